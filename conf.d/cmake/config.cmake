@@ -130,6 +130,33 @@ set(COMPILE_OPTIONS
 # When Present LUA is used by the controller
 # ---------------------------------------------------------------
 set(CONTROL_SUPPORT_LUA 1 CACHE BOOL "Active or not LUA Support")
+
+# Build the benchmarks and the mock HAL plugin (hal-benchmark), not packaged
+# ---------------------------------------------------------------
+set(HAL_GENERIC_BENCHMARK OFF CACHE BOOL "Build the benchmarks and the mock HAL plugin")
+
+# Build the config into the binding as const tables (hal-codegen), for
+# fixed-config images: no config parsing, no cache and no reload at runtime
+# ---------------------------------------------------------------
+set(HAL_GENERIC_STATIC_CONFIG OFF CACHE BOOL "Build the config into the binding")
+set(HAL_GENERIC_STATIC_CONFIG_FILE ${CMAKE_CURRENT_SOURCE_DIR}/conf.d/project/etc/config-4a-hal-generic.json
+    CACHE FILEPATH "Config built into the binding, with its ctls files")
+# hal-generic-codegen runs on the build host: cross builds either use a
+# prebuilt one, or build it with the host compiler (hal-codegen-host)
+set(HAL_GENERIC_CODEGEN_EXECUTABLE "" CACHE FILEPATH "Prebuilt hal-generic-codegen, run on the build host")
+set(HAL_GENERIC_HOST_C_COMPILER cc CACHE STRING "Host compiler of hal-generic-codegen, for cross builds")
+set(HAL_GENERIC_CODEGEN_HOST_DIR ${CMAKE_BINARY_DIR}/hal-codegen-host)
+
+# Build the ALSA tone control plugin (hal-tone-plugin), for cards without a
+# DSP: it filters the stream according to the Bass/Mid/Treble halmap ctls
+# ---------------------------------------------------------------
+set(HAL_GENERIC_TONE_PLUGIN OFF CACHE BOOL "Build the ALSA tone control plugin")
+
+# Build the ALSA zone mixer plugin (hal-mix-plugin), for cards without a
+# DSP: it routes a stream to the card ports as its streammap entry maps it
+# ---------------------------------------------------------------
+set(HAL_GENERIC_MIX_PLUGIN OFF CACHE BOOL "Build the ALSA zone mixer plugin")
+
 add_definitions(-DCONTROL_PLUGIN_PATH="${CMAKE_BINARY_DIR}/package/lib/plugins:${CMAKE_INSTALL_PREFIX}/${PROJECT_NAME}/lib/plugins") 
 add_definitions(-DCONTROL_CONFIG_PATH="${CMAKE_BINARY_DIR}/package/etc:${CMAKE_INSTALL_PREFIX}/${PROJECT_NAME}/etc")
 add_definitions(-DCONTROL_LUA_PATH="${CMAKE_SOURCE_DIR}/conf.d/project/lua.d:${CMAKE_INSTALL_PREFIX}/${PROJECT_NAME}/data")
@@ -50,39 +50,34 @@ local function Apply_Hal_Control(source, label, adjustment)
 
         if (source >= 0) then
 
-            -- get current volume for each HAL
-            local err,result= AFB:servsync(hal["api"],"ctlget", {["label"]=label})
+            -- get current volume and set adjustment in one batch for each HAL
+            local query= {
+                ["ctls"]= {{["label"]=label, ["val"]=adjustment}}
+            }
+            local err,result= AFB:servsync(hal["api"],"ctlbatch", query)
 
-            -- if no error save current volume and set adjustment
+            -- if no error save current volume
             if (err ~= nil) then
                 local response= result["response"]
                 printf ("--- Response %s=%s", hal["api"], Dump_Table(response))
 
-                if (response == nil) then
+                if (response == nil or response["ctls"] == nil) then
                    printf ("--- Fail to Activate '%s'='%s' result=%s", hal["api"], label, Dump_Table(result)) 
                    return 1 -- unhappy
                 end
 
-                -- save response in global space 
-                _CurrentHalVolume [hal["api"]] = response
-
-                -- finally set the new value
-                local query= {
-                    ["tag"]= response["tag"],
-                    ["val"]= adjustment
-                }
-
-                -- best effort to set adjustment value
-                AFB:servsync(hal["api"],"ctlset",query)
+                -- save previous values in global space, as a batch to restore them
+                _CurrentHalVolume [hal["api"]] = {["ctls"]= response["ctls"]}
             end
 
         else  -- when label is release reverse action at preempt time
            
             if (_CurrentHalVolume [hal["api"]] ~= nil) then
 
-                printf("--- Restoring initial volume HAL=%s Control=%s", hal["api"], _CurrentHalVolume [hal["api"]])
+                printf("--- Restoring initial volume HAL=%s Control=%s", hal["api"], Dump_Table(_CurrentHalVolume [hal["api"]]))
 
-                AFB:servsync(hal["api"],"ctlset", _CurrentHalVolume [hal["api"]])
+                AFB:servsync(hal["api"],"ctlbatch", _CurrentHalVolume [hal["api"]])
+                _CurrentHalVolume [hal["api"]] = nil
             end
         end    
 
@@ -91,9 +86,33 @@ local function Apply_Hal_Control(source, label, adjustment)
 end
 
 
+-- Duck lower priority roles through the HAL native ducking engine
+-- (priorities and attenuations come from the HAL 'streams' section)
+local function Apply_Hal_Role(source, role)
+    local verb= "roleacquire"
+    if (source < 0) then verb= "rolerelease" end
+
+    for key,hal in pairs(_Global_Context["registry"]) do
+        AFB:service(hal["api"], verb, {["role"]=role}, "_Apply_Hal_Role_CB", hal["api"])
+    end
+    return 0 -- happy end
+end
+
+function _Apply_Hal_Role_CB(error, result, context)
+    if (error) then
+        AFB:warning ("--* Fail to apply role on HAL=%s", context)
+    end
+end
+
+
 -- Temporally adjust volume
 function _Temporarily_Control(source, control, client)
 
+    -- Role based controls are handled natively by the HAL, without a round trip chain
+    if (control ~= nil and control["role"] ~= nil and _Global_Context["registry"] ~= nil) then
+        return Apply_Hal_Role(source, control["role"])
+    end
+
     printf ("[--> _Temporarily_Control -->] source=%d control=%s client=%s", source, Dump_Table(control), Dump_Table(client))
 
     -- Init should have been properly done
@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Config pipeline benchmark.
+ *
+ * Generates a synthetic config of a given scale, then runs the config
+ * pipeline of the binding on it (parse, index and validate each section,
+ * build the runtime model, generate the 'cardprops', 'streammap' and
+ * halmap of every card) for a
+ * number of iterations. For each phase, it reports the wall time, the
+ * allocations and allocated bytes, and the peak RSS once the phase is
+ * done.
+ *
+ * Usage: hal-generic-bench [-c cards] [-p ports] [-z zones] [-s streams]
+ *                          [-i iterations] [-d] [-v]
+ *   -d : Dump the generated config to stdout, and exit
+ *   -v : Show the binding logs
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-utility.h"
+#include "hal-generic-validate.h"
+#include "hal-generic-index.h"
+#include "hal-generic-model.h"
+#include "hal-generic-tags.h"
+#include "wrap-json.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define BENCH_CARDS 8
+#define BENCH_PORTS 64          // Sink ports per card
+#define BENCH_SOURCES 2         // Source ports per card
+#define BENCH_ZONES 500
+#define BENCH_STREAMS 200
+#define BENCH_ITERATIONS 10
+#define BENCH_CARD_NAME "bench" // Card name prefix
+#define BENCH_ZONE_ROWS_MAX 8   // Stream channels per zone
+
+typedef enum {
+  PHASE_PARSE,
+  PHASE_CARDS,
+  PHASE_ZONES,
+  PHASE_STREAMS,
+  PHASE_CTLS,
+  PHASE_MODEL,
+  PHASE_CARDPROPS,
+  PHASE_STREAMMAP,
+  PHASE_HALMAP,
+  PHASE_RELEASE,
+
+  PHASE_END
+} benchPhaseT;
+
+typedef struct {
+  const char *name;
+  uint64_t minNs;
+  uint64_t maxNs;
+  uint64_t totalNs;
+  uint64_t allocs;
+  uint64_t bytes;
+  long peakRssKb;
+} benchStatsT;
+
+typedef struct {
+  int cards;
+  int ports;
+  int zones;
+  int streams;
+  int iterations;
+  const char *api;      // API of the HAL plugin of every card, if set
+  const char *name;     // Card name prefix
+} benchScaleT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static uint64_t _allocs = 0;        // Allocation calls since start
+static uint64_t _allocBytes = 0;    // Bytes requested since start
+static uint32_t _seed = 1;
+
+static benchStatsT _stats[PHASE_END] = {
+  [PHASE_PARSE] = { .name = "parse" },
+  [PHASE_CARDS] = { .name = "cards" },
+  [PHASE_ZONES] = { .name = "zones" },
+  [PHASE_STREAMS] = { .name = "streams" },
+  [PHASE_CTLS] = { .name = "ctls" },
+  [PHASE_MODEL] = { .name = "model" },
+  [PHASE_CARDPROPS] = { .name = "cardprops" },
+  [PHASE_STREAMMAP] = { .name = "streammap" },
+  [PHASE_HALMAP] = { .name = "halmap" },
+  [PHASE_RELEASE] = { .name = "release" }
+};
+
+// Config key of each ctl type, Switch ctls are not configurable
+static const char *_ctlKeys[EndHalCtlsType] = {
+  [Volume] = "volume",
+  [Ramp] = "volramp",
+  [Bass] = "bass",
+  [Mid] = "mid",
+  [Treble] = "treble",
+  [Fade] = "fade",
+  [Balance] = "balance"
+};
+
+
+/*****************************************************************************
+ * Allocation counting
+ *
+ * The glibc allocator is interposed, so that allocations of json-c are
+ * counted as well as those of the binding.
+ ****************************************************************************/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+  _allocs++;
+  _allocBytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  _allocs++;
+  _allocBytes += nmemb * size;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  _allocs++;
+  _allocBytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Deterministic pseudo-random numbers, so runs are comparable
+ */
+STATIC uint32_t benchRand(uint32_t range)
+{
+  _seed = _seed * 1103515245u + 12345u;
+  return ((_seed >> 16) & 0x7fff) % range;
+}
+
+STATIC uint64_t nowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+STATIC long peakRssKb(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/*
+ * @brief Generate the 'cards' section: sink and source ports per card
+ */
+STATIC json_object *generateCards(const benchScaleT *scale)
+{
+  json_object *cardsJ = json_object_new_array();
+  int cardIdx = 0, portIdx = 0;
+
+  for (cardIdx = 0; cardIdx < scale->cards; cardIdx++)
+  {
+    json_object *cardJ = NULL, *sinksJ = json_object_new_array(),
+                *sourcesJ = json_object_new_array();
+    char name[64], api[64], type[96];
+
+    snprintf(name, sizeof(name), "%s%d", scale->name, cardIdx);
+    if (scale->api)
+      snprintf(api, sizeof(api), "%s", scale->api);
+    else
+      snprintf(api, sizeof(api), "bench-dsp%d", cardIdx);
+
+    for (portIdx = 0; portIdx < scale->ports; portIdx++)
+    {
+      json_object *portJ = NULL;
+
+      snprintf(type, sizeof(type), "%s-sink%d", name, portIdx);
+      wrap_json_pack(&portJ, "{s:s,s:i}", "type", type, "port", portIdx);
+      json_object_array_add(sinksJ, portJ);
+    }
+    for (portIdx = 0; portIdx < BENCH_SOURCES; portIdx++)
+    {
+      json_object *portJ = NULL;
+
+      snprintf(type, sizeof(type), "%s-source%d", name, portIdx);
+      wrap_json_pack(&portJ, "{s:s,s:i}", "type", type, "port", portIdx);
+      json_object_array_add(sourcesJ, portJ);
+    }
+
+    wrap_json_pack(&cardJ, "{s:s,s:s,s:s,s:s,s:{s:o,s:o}}",
+                   "uid", name, "name", name, "api", api,
+                   "info", "Synthetic benchmark card",
+                   "channels", "sink", sinksJ, "source", sourcesJ);
+    json_object_array_add(cardsJ, cardJ);
+  }
+
+  return cardsJ;
+}
+
+/*
+ * @brief Generate the 'zones' section: one in 5 zones is a source, and
+ *        every zone maps to the ports of a single card, with some gains
+ */
+STATIC json_object *generateZones(const benchScaleT *scale)
+{
+  json_object *zonesJ = json_object_new_array();
+  int zoneIdx = 0;
+
+  for (zoneIdx = 0; zoneIdx < scale->zones; zoneIdx++)
+  {
+    bool source = (zoneIdx % 5) == 4;
+    int cardIdx = zoneIdx % scale->cards;
+    int ports = source ? BENCH_SOURCES : scale->ports;
+    int rows = 1 + (int)benchRand(BENCH_ZONE_ROWS_MAX), rowIdx = 0;
+    json_object *zoneJ = NULL, *mappingJ = json_object_new_array();
+    char uid[32];
+
+    for (rowIdx = 0; rowIdx < rows; rowIdx++)
+    {
+      json_object *rowJ = json_object_new_array();
+      int cells = 1 + (int)benchRand(2), cellIdx = 0;
+
+      for (cellIdx = 0; cellIdx < cells; cellIdx++)
+      {
+        char type[64];
+
+        snprintf(type, sizeof(type), "bench%d-%s%d", cardIdx,
+                 source ? "source" : "sink", (int)benchRand((uint32_t)ports));
+        if (cellIdx == 1)
+        {
+          json_object *cellJ = NULL;
+
+          wrap_json_pack(&cellJ, "{s:s,s:f}", "type", type, "gain", 0.5);
+          json_object_array_add(rowJ, cellJ);
+        }
+        else
+          json_object_array_add(rowJ, json_object_new_string(type));
+      }
+      json_object_array_add(mappingJ, rowJ);
+    }
+
+    snprintf(uid, sizeof(uid), "zone%d", zoneIdx);
+    wrap_json_pack(&zoneJ, "{s:s,s:s,s:o}",
+                   "uid", uid, "type", source ? "source" : "sink",
+                   "mapping", mappingJ);
+    json_object_array_add(zonesJ, zoneJ);
+  }
+
+  return zonesJ;
+}
+
+/*
+ * @brief Generate the 'streams' section: the first streams use the HAL
+ *        roles, so that every role has ctls, and every third stream has
+ *        a source
+ */
+STATIC json_object *generateStreams(const benchScaleT *scale)
+{
+  json_object *streamsJ = json_object_new_array();
+  int streamIdx = 0, roleIdx = 0;
+
+  for (streamIdx = 0; streamIdx < scale->streams; streamIdx++)
+  {
+    json_object *streamJ = NULL, *sourceJ = NULL;
+    const char *role = NULL;
+    char uid[32], roleName[32], sinkZone[32], sourceZone[32];
+    int sinkIdx = (int)benchRand((uint32_t)scale->zones);
+
+    // Skip 'Master', it is not a stream
+    while ((role = halCtlsRoleName(roleIdx)) && !strcmp(role, "Master"))
+      roleIdx++;
+    if (role)
+      roleIdx++;
+    else
+    {
+      snprintf(roleName, sizeof(roleName), "BenchRole%d", streamIdx);
+      role = roleName;
+    }
+
+    // Zones: one in 5 is a source
+    if (sinkIdx % 5 == 4)
+      sinkIdx--;
+    snprintf(uid, sizeof(uid), "stream%d", streamIdx);
+    snprintf(sinkZone, sizeof(sinkZone), "zone%d", sinkIdx);
+    if (streamIdx % 3 == 0 && scale->zones >= 5)
+    {
+      snprintf(sourceZone, sizeof(sourceZone), "zone%d",
+               5 * (int)benchRand((uint32_t)(scale->zones / 5)) + 4);
+      wrap_json_pack(&sourceJ, "{s:s}", "zone", sourceZone);
+    }
+
+    wrap_json_pack(&streamJ, "{s:s,s:s,s:i,s:i,s:{s:s},s:o*}",
+                   "uid", uid, "role", role,
+                   "priority", streamIdx % 50, "duck", streamIdx % 100,
+                   "sink", "zone", sinkZone, "source", sourceJ);
+    json_object_array_add(streamsJ, streamJ);
+  }
+
+  return streamsJ;
+}
+
+/*
+ * @brief Generate the 'ctls' section: every HAL role of a stream, and
+ *        'Master', with every ctl type
+ */
+STATIC json_object *generateCtls(json_object *streamsJ)
+{
+  json_object *ctlsJ = json_object_new_array();
+  int roleIdx = 0, typeIdx = 0;
+
+  for (roleIdx = 0; roleIdx < halCtlsRolesCount(); roleIdx++)
+  {
+    json_object *ctlJ = NULL;
+    char uid[64];
+
+    if (halCtlsTagGetByRole(roleIdx, Volume) == EndHalCrlTag)
+      continue;
+    if (strcmp(halCtlsRoleName(roleIdx), "Master") != 0 &&
+        !json_object_array_find(streamsJ, "role", halCtlsRoleName(roleIdx)))
+      continue;
+
+    snprintf(uid, sizeof(uid), "ctls-%s", halCtlsRoleName(roleIdx));
+    wrap_json_pack(&ctlJ, "{s:s,s:s}",
+                   "uid", uid, "stream", halCtlsRoleName(roleIdx));
+
+    for (typeIdx = 0; typeIdx < EndHalCtlsType; typeIdx++)
+    {
+      json_object *typeJ = NULL;
+      char name[96];
+
+      if (!_ctlKeys[typeIdx] ||
+          halCtlsTagGetByRole(roleIdx, (halCtlsTypeT)typeIdx) == EndHalCrlTag)
+        continue;
+
+      snprintf(name, sizeof(name), "%s %s", halCtlsRoleName(roleIdx),
+               halCtlsTypeLabels[typeIdx]);
+      wrap_json_pack(&typeJ, "{s:s,s:i,s:i,s:i}",
+                     "name", name, "value", 50, "minval", 0, "maxval", 100);
+      if (typeIdx == Ramp)
+        json_object_object_add(typeJ, "step", json_object_new_int(2));
+      json_object_object_add(ctlJ, _ctlKeys[typeIdx], typeJ);
+    }
+
+    json_object_array_add(ctlsJ, ctlJ);
+  }
+
+  return ctlsJ;
+}
+
+/*
+ * @brief Generate a complete config, as text
+ */
+STATIC char *generateConfig(const benchScaleT *scale)
+{
+  json_object *configJ = NULL, *streamsJ = generateStreams(scale);
+  char *config = NULL;
+
+  wrap_json_pack(&configJ, "{s:{s:s,s:s,s:s},s:o,s:o,s:o,s:o}",
+                 "metadata", "uid", "hal-generic-bench", "version", "1.0",
+                 "api", "hal-generic-bench",
+                 "cards", generateCards(scale),
+                 "zones", generateZones(scale),
+                 "streams", streamsJ,
+                 "ctls", generateCtls(streamsJ));
+
+  config = strdup(json_object_to_json_string_ext(configJ, JSON_C_TO_STRING_PLAIN));
+  json_object_put(configJ);
+
+  return config;
+}
+
+/*
+ * @brief Record a phase run
+ */
+STATIC void phaseEnd(benchPhaseT phase, uint64_t startNs,
+                     uint64_t startAllocs, uint64_t startBytes)
+{
+  benchStatsT *stats = &_stats[phase];
+  uint64_t ns = nowNs() - startNs;
+
+  if (!stats->minNs || ns < stats->minNs)
+    stats->minNs = ns;
+  if (ns > stats->maxNs)
+    stats->maxNs = ns;
+  stats->totalNs += ns;
+  stats->allocs += _allocs - startAllocs;
+  stats->bytes += _allocBytes - startBytes;
+  stats->peakRssKb = peakRssKb();
+}
+
+#define PHASE(phase, code)                                  \
+  do {                                                      \
+    uint64_t _startNs = nowNs();                            \
+    uint64_t _startAllocs = _allocs, _startBytes = _allocBytes; \
+    code;                                                   \
+    phaseEnd(phase, _startNs, _startAllocs, _startBytes);   \
+  } while (0)
+
+/*
+ * @brief Run the config pipeline once
+ * @return 0 on success, -1 if the config is not valid
+ */
+STATIC int runPipeline(const char *config)
+{
+  json_object *configJ = NULL, *cardsJ = NULL, *zonesJ = NULL,
+              *streamsJ = NULL, *ctlsJ = NULL;
+  halModelT *model = NULL;
+  int err = 0, cardIdx = 0, cardsCount = 0;
+
+  PHASE(PHASE_PARSE,
+        configJ = json_tokener_parse(config);
+        wrap_json_unpack(configJ, "{s:o,s:o,s:o,s:o}",
+                         "cards", &cardsJ, "zones", &zonesJ,
+                         "streams", &streamsJ, "ctls", &ctlsJ));
+
+  validateReportReset();
+  PHASE(PHASE_CARDS,
+        halIndexCards(cardsJ);
+        err |= validateCards(cardsJ));
+  PHASE(PHASE_ZONES,
+        halIndexZones(zonesJ);
+        err |= validateZones(zonesJ));
+  PHASE(PHASE_STREAMS,
+        halIndexStreams(streamsJ);
+        err |= validateStreams(streamsJ));
+  PHASE(PHASE_CTLS,
+        err |= validateCtls(ctlsJ));
+
+  PHASE(PHASE_MODEL,
+        model = halModelNew(cardsJ, zonesJ, streamsJ, ctlsJ));
+  if (!model)
+    err = 1;
+  cardsCount = model ? model->cardsCount : 0;
+
+  PHASE(PHASE_CARDPROPS,
+        for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+          json_object_put(generateCardProperties(&model->cards[cardIdx])));
+  PHASE(PHASE_STREAMMAP,
+        for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+          json_object_put(generateStreamMap(model, cardIdx)));
+  PHASE(PHASE_HALMAP,
+        for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+        {
+          int ctlsCount = 0;
+          halArenaT *arena = halArenaNew(sizeAlsaHalMap(model, cardIdx, &ctlsCount));
+
+          generateAlsaHalMap(arena, model, cardIdx, ctlsCount);
+          halArenaFree(arena);
+        });
+
+  // Once the model is built, the binding holds no more json-c references
+  PHASE(PHASE_RELEASE,
+        halModelFree(model);
+        halIndexClear();
+        json_object_put(configJ));
+
+  return err ? -1 : 0;
+}
+
+STATIC void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-c cards] [-p ports] [-z zones] [-s streams] "
+          "[-i iterations] [-a plugin api] [-n card name] [-d] [-v]\n", name);
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+int main(int argc, char *argv[])
+{
+  benchScaleT scale = {
+    .cards = BENCH_CARDS,
+    .ports = BENCH_PORTS,
+    .zones = BENCH_ZONES,
+    .streams = BENCH_STREAMS,
+    .iterations = BENCH_ITERATIONS,
+    .api = NULL,
+    .name = BENCH_CARD_NAME
+  };
+  bool dump = false;
+  char *config = NULL;
+  int opt = 0, iteration = 0, phase = 0;
+
+  while ((opt = getopt(argc, argv, "c:p:z:s:i:a:n:dv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c': scale.cards = atoi(optarg); break;
+      case 'p': scale.ports = atoi(optarg); break;
+      case 'z': scale.zones = atoi(optarg); break;
+      case 's': scale.streams = atoi(optarg); break;
+      case 'i': scale.iterations = atoi(optarg); break;
+      case 'a': scale.api = optarg; break;
+      case 'n': scale.name = optarg; break;
+      case 'd': dump = true; break;
+      case 'v': afbBindingV2verbosity = AFB_VERBOSITY_LEVEL_DEBUG; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  if (scale.cards <= 0 || scale.ports <= 0 || scale.zones <= 0 ||
+      scale.streams <= 0 || scale.iterations <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  config = generateConfig(&scale);
+  if (dump)
+  {
+    puts(config);
+    free(config);
+    return 0;
+  }
+
+  printf("config: %d cards, %d ports, %d zones, %d streams, %d roles, %zu bytes\n",
+         scale.cards, scale.ports, scale.zones, scale.streams,
+         halCtlsRolesCount(), strlen(config));
+
+  for (iteration = 0; iteration < scale.iterations; iteration++)
+  {
+    if (runPipeline(config) != 0)
+    {
+      json_object *reportJ = validateReportGet();
+
+      fprintf(stderr, "Generated config is not valid: %s\n",
+              json_object_to_json_string_ext(reportJ, JSON_C_TO_STRING_PRETTY));
+      json_object_put(reportJ);
+      free(config);
+      return 1;
+    }
+  }
+
+  printf("%-10s %10s %10s %10s %12s %14s %12s\n", "phase", "mean ms",
+         "min ms", "max ms", "allocs", "bytes", "peak rss kB");
+  for (phase = 0; phase < PHASE_END; phase++)
+  {
+    const benchStatsT *stats = &_stats[phase];
+
+    printf("%-10s %10.3f %10.3f %10.3f %12" PRIu64 " %14" PRIu64 " %12ld\n",
+           stats->name,
+           stats->totalNs / 1e6 / scale.iterations,
+           stats->minNs / 1e6, stats->maxNs / 1e6,
+           stats->allocs / scale.iterations,
+           stats->bytes / scale.iterations,
+           stats->peakRssKb);
+  }
+
+  free(config);
+  return 0;
+}
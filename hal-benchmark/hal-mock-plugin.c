@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Mock HAL plugin.
+ *
+ * Stands in for a DSP HAL plugin (by default 'fd-dsp-hifi2'), so that the
+ * HAL can be brought up on any Linux box. 'initialize_sndcard' and
+ * 'update_sndcard' check the payload sent by the HAL, and reply after a
+ * delay. The behaviour is set with environment variables:
+ *
+ *   HAL_MOCK_API      : API name (default: fd-dsp-hifi2)
+ *   HAL_MOCK_DELAY_MS : Reply delay, in ms (default: 0)
+ *   HAL_MOCK_FAIL     : Number of first calls that fail (default: 0)
+ *   HAL_MOCK_VALIDATE : Check the payload, 0 to disable (default: 1)
+ *
+ * Several cards may share the mock API, each call carries its card props.
+ * A payload sent with the 'shm' option is mapped with the reader library.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic.h"
+#include "hal-generic-shm-reader.h"
+#include "wrap-json.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MOCK_API "fd-dsp-hifi2"
+#define HAL_MOCK_ERRMSG_SZ 256
+#define HAL_MOCK_PORTS_MAX 64
+#define USEC_PER_MSEC 1000ULL
+
+typedef struct {
+  const char *api;
+  int delayMs;
+  int failCount;
+  bool validate;
+} halMockOptionsT;
+
+typedef struct {
+  int calls;
+  int failed;
+  int invalid;
+} halMockStatsT;
+
+// A reply held until the delay expires
+typedef struct {
+  struct afb_req request;
+  sd_event_source *timer;
+  bool success;
+  char message[HAL_MOCK_ERRMSG_SZ];
+} halMockReplyT;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC int hal_mock_preinit();
+STATIC int envInt(const char *name, int defaultValue);
+STATIC int portsCount(json_object *portsJ, char *errmsg);
+STATIC bool checkDirection(json_object *directionJ, int colsCount, char *errmsg);
+STATIC bool checkShmPayload(json_object *shmJ, char *errmsg);
+STATIC bool checkPayload(json_object *argsJ, char *errmsg);
+STATIC void reply(halMockReplyT *pending);
+STATIC int replyTimerCB(sd_event_source *source, uint64_t usec, void *userdata);
+STATIC void sndcardVerb(struct afb_req request, const char *verb);
+STATIC void initializeSndcardVerb(struct afb_req request);
+STATIC void updateSndcardVerb(struct afb_req request);
+STATIC void statsVerb(struct afb_req request);
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halMockOptionsT _options;
+static halMockStatsT _stats;
+
+static const struct afb_verb_v2 halMockApi[] = {
+  { .verb = "initialize_sndcard", .callback = initializeSndcardVerb, .info = "Initialize a card, with its props and streammap" },
+  { .verb = "update_sndcard", .callback = updateSndcardVerb, .info = "Update the props or streammap of a card" },
+  { .verb = "stats", .callback = statsVerb, .info = "Get the number of calls, failed and invalid calls" },
+
+  { .verb = NULL }
+};
+
+const struct afb_binding_v2 afbBindingV2 = {
+  .api = HAL_MOCK_API,
+  .preinit = hal_mock_preinit,
+  .verbs = halMockApi,
+};
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief AFB 'preinit' callback function
+ */
+STATIC int hal_mock_preinit()
+{
+  const char *api = getenv("HAL_MOCK_API");
+
+  _options.api = (api && *api) ? api : HAL_MOCK_API;
+  _options.delayMs = envInt("HAL_MOCK_DELAY_MS", 0);
+  _options.failCount = envInt("HAL_MOCK_FAIL", 0);
+  _options.validate = envInt("HAL_MOCK_VALIDATE", 1) != 0;
+
+  if (strcmp(_options.api, HAL_MOCK_API) != 0 && afb_daemon_rename_api(_options.api))
+  {
+    AFB_ERROR("MOCK: Fail to rename api to: %s", _options.api);
+    return -1;
+  }
+
+  AFB_NOTICE("MOCK: api: %s, delay: %d ms, fail: %d, validate: %d",
+             _options.api, _options.delayMs, _options.failCount,
+             _options.validate);
+  return 0;
+}
+
+/*
+ * @brief Get an integer environment variable
+ */
+STATIC int envInt(const char *name, int defaultValue)
+{
+  const char *value = getenv(name);
+
+  return (value && *value) ? atoi(value) : defaultValue;
+}
+
+/*
+ * @brief Check the ports of a card direction
+ * @return The highest port + 1, or -1 if the ports are not valid
+ */
+STATIC int portsCount(json_object *portsJ, char *errmsg)
+{
+  int idx = 0, len = json_object_array_length(portsJ), count = 0;
+  bool used[HAL_MOCK_PORTS_MAX] = { false };
+
+  for (idx = 0; idx < len; idx++)
+  {
+    const char *type = NULL;
+    int port = -1;
+
+    if (wrap_json_unpack(json_object_array_get_idx(portsJ, idx), "{s:s,s:i}",
+                         "type", &type, "port", &port) ||
+        port < 0 || port >= HAL_MOCK_PORTS_MAX)
+    {
+      snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "cardprops: port %d is not valid", idx);
+      return -1;
+    }
+    if (used[port])
+    {
+      snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "cardprops: port %d is used twice", port);
+      return -1;
+    }
+
+    used[port] = true;
+    if (port >= count)
+      count = port + 1;
+  }
+
+  return count;
+}
+
+/*
+ * @brief Check the sink or source of a streammap entry: the mapping must
+ *        have one row per channel, and the routing matrix one row per
+ *        channel and one column per card port
+ */
+STATIC bool checkDirection(json_object *directionJ, int colsCount, char *errmsg)
+{
+  int channels = 0, rows = 0, cols = 0, rowIdx = 0, cellIdx = 0;
+  const char *format = NULL, *data = NULL;
+  json_object *mappingJ = NULL, *matrixJ = NULL;
+
+  if (wrap_json_unpack(directionJ, "{s:i,s:o,s?o}", "channels", &channels,
+                       "mapping", &mappingJ, "matrix", &matrixJ) ||
+      !json_object_is_type(mappingJ, json_type_array) ||
+      json_object_array_length(mappingJ) != channels)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "'channels' does not match 'mapping'");
+    return false;
+  }
+
+  for (rowIdx = 0; rowIdx < channels; rowIdx++)
+  {
+    json_object *rowJ = json_object_array_get_idx(mappingJ, rowIdx);
+
+    for (cellIdx = 0; cellIdx < json_object_array_length(rowJ); cellIdx++)
+    {
+      const char *type = json_object_get_string(json_object_array_get_idx(rowJ, cellIdx));
+
+      // Channel types may be of other cards, only the names are checked
+      if (!type)
+      {
+        snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "mapping row %d is not valid", rowIdx);
+        return false;
+      }
+    }
+  }
+
+  if (!matrixJ)
+    return true;
+
+  if (wrap_json_unpack(matrixJ, "{s:i,s:i,s:s,s:s}", "rows", &rows,
+                       "cols", &cols, "format", &format, "data", &data) ||
+      strcmp(format, "f32le") != 0)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "matrix is not valid");
+    return false;
+  }
+  if (rows != channels || cols != colsCount)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "matrix is %dx%d, expected %dx%d",
+             rows, cols, channels, colsCount);
+    return false;
+  }
+  if (strlen(data) != (((size_t)rows * cols * 4 + 2) / 3) * 4)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "matrix data is %zu bytes, expected %zu",
+             strlen(data), (((size_t)rows * cols * 4 + 2) / 3) * 4);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * @brief Check a payload sent in a sealed memfd: the layout is checked by
+ *        halShmMap, the ports and matrices as for a JSON payload
+ * @return true if the payload is valid, false and errmsg set otherwise
+ */
+STATIC bool checkShmPayload(json_object *shmJ, char *errmsg)
+{
+  halShmViewT view;
+  const halShmChannelT *channels = NULL;
+  const halShmStreamT *streams = NULL;
+  const char *path = NULL;
+  uint32_t portsCount[2] = { 0, 0 }, count = 0, idx = 0;
+  int dir = 0, err = 0, version = 0;
+  bool valid = true;
+
+  if (wrap_json_unpack(shmJ, "{s:s,s:i}", "path", &path, "version", &version) ||
+      version != HAL_SHM_VERSION)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "shm: expected {path, version: %d}", HAL_SHM_VERSION);
+    return false;
+  }
+
+  err = halShmMap(path, &view);
+  if (err)
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "shm: cannot map %s (%s)", path, strerror(-err));
+    return false;
+  }
+
+  for (dir = HAL_SHM_SINK; dir <= HAL_SHM_SOURCE && valid; dir++)
+  {
+    bool used[HAL_MOCK_PORTS_MAX] = { false };
+
+    channels = halShmChannels(&view, dir, &count);
+    for (idx = 0; idx < count && valid; idx++)
+    {
+      int port = channels[idx].port;
+
+      valid = port >= 0 && port < HAL_MOCK_PORTS_MAX && !used[port];
+      if (!valid)
+        snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "shm: port %d is not valid", port);
+      else
+      {
+        used[port] = true;
+        if ((uint32_t)port >= portsCount[dir])
+          portsCount[dir] = (uint32_t)port + 1;
+      }
+    }
+  }
+
+  streams = halShmStreams(&view, &count);
+  for (idx = 0; idx < count && valid; idx++)
+    for (dir = HAL_SHM_SINK; dir <= HAL_SHM_SOURCE && valid; dir++)
+    {
+      const halShmEndpointT *endpoint = &streams[idx].endpoints[dir];
+
+      valid = !endpoint->cols || endpoint->cols == portsCount[dir];
+      if (!valid)
+        snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "shm: '%.64s' matrix has %u cols, expected %u",
+                 halShmString(&view, streams[idx].role), endpoint->cols, portsCount[dir]);
+    }
+
+  halShmUnmap(&view);
+  return valid;
+}
+
+/*
+ * @brief Check the payload of 'initialize_sndcard' or 'update_sndcard'
+ * @return true if the payload is valid, false and errmsg set otherwise
+ */
+STATIC bool checkPayload(json_object *argsJ, char *errmsg)
+{
+  int idx = 0, sinkCount = 0, sourceCount = 0;
+  json_object *cardpropsJ = NULL, *streammapJ = NULL,
+              *sinksJ = NULL, *sourcesJ = NULL, *shmJ = NULL;
+
+  if (json_object_object_get_ex(argsJ, "shm", &shmJ))
+    return checkShmPayload(shmJ, errmsg);
+
+  if (wrap_json_unpack(argsJ, "{s:o,s:o}", "cardprops", &cardpropsJ,
+                       "streammap", &streammapJ) ||
+      !json_object_is_type(streammapJ, json_type_array))
+  {
+    snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "Expected {cardprops, streammap}");
+    return false;
+  }
+
+  wrap_json_unpack(cardpropsJ, "{s?o,s?o}", "sink", &sinksJ, "source", &sourcesJ);
+  sinkCount = portsCount(sinksJ, errmsg);
+  sourceCount = portsCount(sourcesJ, errmsg);
+  if (sinkCount < 0 || sourceCount < 0)
+    return false;
+
+  for (idx = 0; idx < json_object_array_length(streammapJ); idx++)
+  {
+    const char *stream = NULL;
+    json_object *sinkJ = NULL, *sourceJ = NULL;
+    char dirmsg[HAL_MOCK_ERRMSG_SZ];
+
+    if (wrap_json_unpack(json_object_array_get_idx(streammapJ, idx), "{s:s,s?o,s?o}",
+                         "stream", &stream, "sink", &sinkJ, "source", &sourceJ))
+    {
+      snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "streammap: entry %d is not valid", idx);
+      return false;
+    }
+    if (sinkJ && !checkDirection(sinkJ, sinkCount, dirmsg))
+    {
+      snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "streammap: '%.64s' sink: %.160s", stream, dirmsg);
+      return false;
+    }
+    if (sourceJ && !checkDirection(sourceJ, sourceCount, dirmsg))
+    {
+      snprintf(errmsg, HAL_MOCK_ERRMSG_SZ, "streammap: '%.64s' source: %.160s", stream, dirmsg);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * @brief Send a held reply, in the format expected by the HAL
+ */
+STATIC void reply(halMockReplyT *pending)
+{
+  if (pending->success)
+  {
+    json_object *responseJ = NULL;
+
+    wrap_json_pack(&responseJ, "{s:i,s:s}", "errcode", 0, "message", "OK");
+    afb_req_success(pending->request, responseJ, NULL);
+  }
+  else
+    afb_req_fail_f(pending->request, "failed",
+                   "{\"errcode\":-1,\"message\":\"%s\"}", pending->message);
+
+  afb_req_unref(pending->request);
+  if (pending->timer)
+    sd_event_source_unref(pending->timer);
+  free(pending);
+}
+
+/*
+ * @brief Reply delay timer callback
+ */
+STATIC int replyTimerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  reply((halMockReplyT *)userdata);
+
+  return 0;
+}
+
+/*
+ * @brief Check a sndcard call, then reply now or after the delay
+ */
+STATIC void sndcardVerb(struct afb_req request, const char *verb)
+{
+  halMockReplyT *pending = calloc(1, sizeof(halMockReplyT));
+  struct timespec ts;
+  uint64_t usec = 0;
+
+  if (!pending)
+  {
+    afb_req_fail(request, "failed", "Out of memory");
+    return;
+  }
+
+  _stats.calls++;
+  pending->success = true;
+  if (_options.validate && !checkPayload(afb_req_json(request), pending->message))
+  {
+    _stats.invalid++;
+    pending->success = false;
+    AFB_ERROR("MOCK: %s: invalid payload: %s", verb, pending->message);
+  }
+  else if (_stats.calls <= _options.failCount)
+  {
+    _stats.failed++;
+    pending->success = false;
+    snprintf(pending->message, sizeof(pending->message),
+             "Failing call %d of %d", _stats.calls, _options.failCount);
+  }
+
+  pending->request = request;
+  afb_req_addref(request);
+  if (_options.delayMs <= 0)
+  {
+    reply(pending);
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  usec = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL +
+         (uint64_t)_options.delayMs * USEC_PER_MSEC;
+  if (sd_event_add_time(afb_daemon_get_event_loop(), &pending->timer,
+                        CLOCK_MONOTONIC, usec, USEC_PER_MSEC,
+                        replyTimerCB, pending) < 0)
+  {
+    pending->timer = NULL;
+    AFB_WARNING("MOCK: cannot delay the reply, replying now");
+    reply(pending);
+  }
+}
+
+STATIC void initializeSndcardVerb(struct afb_req request)
+{
+  sndcardVerb(request, "initialize_sndcard");
+}
+
+STATIC void updateSndcardVerb(struct afb_req request)
+{
+  sndcardVerb(request, "update_sndcard");
+}
+
+STATIC void statsVerb(struct afb_req request)
+{
+  json_object *statsJ = NULL;
+
+  wrap_json_pack(&statsJ, "{s:i,s:i,s:i}", "calls", _stats.calls,
+                 "failed", _stats.failed, "invalid", _stats.invalid);
+  afb_req_success(request, statsJ, NULL);
+}
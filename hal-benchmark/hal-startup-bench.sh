@@ -0,0 +1,177 @@
+#!/bin/bash
+###########################################################################
+# Copyright 2018 Fiberdyne Systems
+#
+# author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+###########################################################################
+
+# End to end startup benchmark: boots afb-daemon with hal-generic and the
+# mock HAL plugin on a synthetic config, and times preinit -> init -> ready
+# over several runs, as reported by the 'ready' verb.
+#
+# The bindings of <build>/package/lib are loaded, as with a regular run. The
+# halmap of each card is registered with alsacore, which needs an ALSA card
+# of each card name, e.g. on a box without sound hardware:
+#
+#   sudo modprobe snd-dummy enable=1,1 id=HalMock0,HalMock1
+
+BUILD=build
+CARDS=1
+PORTS=16
+ZONES=20
+STREAMS=10
+DELAY=0
+FAIL=0
+RUNS=5
+NAME=HalMock
+PORT=1234
+WARM=0
+KEEP=0
+TIMEOUT_S=30
+
+API=hal-generic-bench
+MOCK_API=fd-dsp-hifi2
+
+usage() {
+    echo "Usage: $0 [-b build dir] [-c cards] [-p ports] [-z zones] [-s streams]" >&2
+    echo "          [-d mock delay ms] [-f mock failures] [-r runs] [-n card name]" >&2
+    echo "          [-P port] [-w] [-k]" >&2
+    echo "  -w: warm start, keep the config cache between runs" >&2
+    echo "  -k: keep the work directory" >&2
+    exit 1
+}
+
+while getopts "b:c:p:z:s:d:f:r:n:P:wk" opt; do
+    case $opt in
+        b) BUILD=$OPTARG ;;
+        c) CARDS=$OPTARG ;;
+        p) PORTS=$OPTARG ;;
+        z) ZONES=$OPTARG ;;
+        s) STREAMS=$OPTARG ;;
+        d) DELAY=$OPTARG ;;
+        f) FAIL=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        n) NAME=$OPTARG ;;
+        P) PORT=$OPTARG ;;
+        w) WARM=1 ;;
+        k) KEEP=1 ;;
+        *) usage ;;
+    esac
+done
+
+BUILD=$(realpath "$BUILD")
+BENCH=$BUILD/hal-benchmark/hal-generic-bench
+MOCK=$BUILD/hal-benchmark/hal-mock-plugin.so
+LIBDIR=$BUILD/package/lib
+
+for tool in afb-daemon afb-client-demo python3; do
+    command -v $tool >/dev/null || { echo "$tool is required" >&2; exit 1; }
+done
+for file in "$BENCH" "$MOCK" "$LIBDIR/hal-generic.so"; do
+    [ -e "$file" ] || { echo "$file not found, build with -DHAL_GENERIC_BENCHMARK=ON" >&2; exit 1; }
+done
+
+WORK=$(mktemp -d /tmp/hal-startup-bench.XXXXXX)
+RESULTS=$WORK/results.json
+DAEMON=
+
+cleanup() {
+    [ -n "$DAEMON" ] && kill $DAEMON 2>/dev/null && wait $DAEMON 2>/dev/null
+    [ $KEEP = 1 ] && echo "Work directory: $WORK" || rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# All cards share the mock plugin API
+mkdir -p "$WORK/etc"
+"$BENCH" -c "$CARDS" -p "$PORTS" -z "$ZONES" -s "$STREAMS" \
+    -a "$MOCK_API" -n "$NAME" -d > "$WORK/etc/config-4a-hal-generic.json" || exit 1
+
+[ $WARM = 1 ] || export HAL_GENERIC_NO_CACHE=1
+export HAL_MOCK_API=$MOCK_API HAL_MOCK_DELAY_MS=$DELAY HAL_MOCK_FAIL=$FAIL
+
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Print the reply of the 'ready' verb, empty if the daemon is not up yet
+ready() {
+    timeout 2 afb-client-demo "ws://localhost:$PORT/api?token=" $API ready 2>/dev/null |
+        python3 -c '
+import json, sys
+text = sys.stdin.read()
+start = text.find("{")
+if start >= 0:
+    reply = json.loads(text[start:])
+    print(json.dumps(reply.get("response", {})))
+' 2>/dev/null
+}
+
+echo "[]" > "$RESULTS"
+for run in $(seq 1 $RUNS); do
+    start=$(now_ms)
+    afb-daemon --port=$PORT --rootdir="$WORK" --ldpath="$LIBDIR" \
+        --binding="$MOCK" --token= > "$WORK/afb-daemon-$run.log" 2>&1 &
+    DAEMON=$!
+
+    response=
+    while :; do
+        sleep 0.02
+        if ! kill -0 $DAEMON 2>/dev/null; then
+            echo "Run $run: afb-daemon exited, see $WORK/afb-daemon-$run.log" >&2
+            KEEP=1
+            exit 1
+        fi
+        response=$(ready)
+        echo "$response" | grep -q '"complete": true' && break
+        if [ $(( $(now_ms) - start )) -gt $(( TIMEOUT_S * 1000 )) ]; then
+            echo "Run $run: not complete after ${TIMEOUT_S}s" >&2
+            KEEP=1
+            exit 1
+        fi
+    done
+    wall=$(( $(now_ms) - start ))
+
+    kill $DAEMON && wait $DAEMON 2>/dev/null
+    DAEMON=
+
+    python3 - "$RESULTS" "$wall" "$response" <<'EOF'
+import json, sys
+path, wall, response = sys.argv[1], int(sys.argv[2]), json.loads(sys.argv[3])
+results = json.load(open(path))
+timing = response.get("timing", {})
+results.append({"wall": wall, "init": timing.get("init"),
+                "ready": timing.get("ready"), "isready": response.get("ready"),
+                "cards": response.get("cards", [])})
+json.dump(results, open(path, "w"))
+run = results[-1]
+print("run %d: init %s ms, ready %s ms, wall %d ms, ready: %s"
+      % (len(results), run["init"], run["ready"], wall, run["isready"]))
+for card in run["cards"]:
+    if card.get("state") != "ready":
+        print("  card %s: %s (%s)" % (card["name"], card["state"], card.get("error")))
+EOF
+done
+
+python3 - "$RESULTS" <<'EOF'
+import json, sys
+results = json.load(open(sys.argv[1]))
+print("%-16s %10s %10s %10s" % ("phase", "mean ms", "min ms", "max ms"))
+for key, label in (("init", "preinit->init"), ("ready", "init->ready"),
+                   ("wall", "spawn->ready")):
+    values = [run[key] for run in results if run[key] is not None]
+    if values:
+        print("%-16s %10.1f %10.1f %10.1f" % (label, sum(values) / len(values),
+                                              min(values), max(values)))
+EOF
@@ -0,0 +1,614 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Static config generator.
+ *
+ * Loads a config file and its ctls files, validates it with the binding
+ * validation, builds the config model and the halmap of every card, and
+ * writes them as C source: the const halStaticConfig tables of
+ * hal-generic-static.h. The build runs it when the binding is configured
+ * with -DHAL_GENERIC_STATIC_CONFIG=ON. An invalid config fails the build,
+ * with the validation report.
+ *
+ * Usage: hal-generic-codegen [-o output.c] [-v] config.json
+ *   -o : Output file, stdout by default
+ *   -v : Show the binding logs
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-utility.h"
+#include "hal-generic-validate.h"
+#include "hal-generic-index.h"
+#include "hal-generic-model.h"
+#include "hal-generic-options.h"
+#include "hal-generic-tags.h"
+#include "wrap-json.h"
+
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+static const char *_dirLabels[2] = { [SINK] = "sink", [SOURCE] = "source" };
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC json_object *loadSection(json_object *configJ, const char *key,
+                                const char *configDir);
+STATIC HAL_ERRCODE loadSectionFile(json_object *sectionJ, const char *key,
+                                   const char *configDir, const char *name);
+STATIC void emitString(FILE *out, const char *str);
+STATIC void emitCards(FILE *out, const halModelT *model);
+STATIC void emitZones(FILE *out, const halModelT *model);
+STATIC void emitStreams(FILE *out, const halModelT *model);
+STATIC void emitCtls(FILE *out, const halModelT *model);
+STATIC HAL_ERRCODE emitHalMaps(FILE *out, const halModelT *model);
+STATIC HAL_ERRCODE emitConfig(FILE *out, const char *configPath,
+                              const char *api, const halModelT *model);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Load a config section. As with the controller, a section may
+ *        list its entries in other files: { "files": [ "ctls-master" ] }
+ * @return A new reference to the section, or NULL if it is absent
+ */
+STATIC json_object *loadSection(json_object *configJ, const char *key,
+                                const char *configDir)
+{
+  json_object *sectionJ = NULL, *filesJ = NULL, *mergedJ = NULL;
+  int idx = 0, len = 0;
+
+  if (!json_object_object_get_ex(configJ, key, &sectionJ))
+    return NULL;
+
+  if (!json_object_is_type(sectionJ, json_type_object) ||
+      !json_object_object_get_ex(sectionJ, "files", &filesJ))
+    return json_object_get(sectionJ);
+
+  mergedJ = json_object_new_array();
+
+  if (json_object_is_type(filesJ, json_type_string))
+  {
+    if (loadSectionFile(mergedJ, key, configDir, json_object_get_string(filesJ)) != HAL_OK)
+      goto OnErrorExit;
+    return mergedJ;
+  }
+
+  len = json_object_array_length(filesJ);
+  for (idx = 0; idx < len; idx++)
+    if (loadSectionFile(mergedJ, key, configDir,
+                        json_object_get_string(json_object_array_get_idx(filesJ, idx))) != HAL_OK)
+      goto OnErrorExit;
+
+  return mergedJ;
+
+OnErrorExit:
+  json_object_put(mergedJ);
+  return NULL;
+}
+
+/*
+ * @brief Append the entries of a section file to a section
+ */
+STATIC HAL_ERRCODE loadSectionFile(json_object *sectionJ, const char *key,
+                                   const char *configDir, const char *name)
+{
+  char path[PATH_MAX];
+  json_object *fileJ = NULL, *entriesJ = NULL;
+  int idx = 0;
+
+  if (!name)
+    return HAL_FAIL;
+
+  snprintf(path, sizeof(path), "%s/%s%s", configDir, name,
+           strstr(name, ".json") ? "" : ".json");
+  fileJ = json_object_from_file(path);
+  if (!fileJ || !json_object_object_get_ex(fileJ, key, &entriesJ))
+  {
+    fprintf(stderr, "Cannot load the '%s' section from %s\n", key, path);
+    json_object_put(fileJ);
+    return HAL_FAIL;
+  }
+
+  if (json_object_is_type(entriesJ, json_type_array))
+  {
+    for (idx = 0; idx < (int)json_object_array_length(entriesJ); idx++)
+      json_object_array_add(sectionJ, json_object_get(json_object_array_get_idx(entriesJ, idx)));
+  }
+  else
+    json_object_array_add(sectionJ, json_object_get(entriesJ));
+
+  json_object_put(fileJ);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Write a C string literal, or NULL
+ */
+STATIC void emitString(FILE *out, const char *str)
+{
+  if (!str)
+  {
+    fputs("NULL", out);
+    return;
+  }
+
+  fputc('"', out);
+  for (; *str; str++)
+  {
+    unsigned char c = (unsigned char)*str;
+
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(out, "\\%03o", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+/*
+ * @brief Write the cards, and their channels
+ */
+STATIC void emitCards(FILE *out, const halModelT *model)
+{
+  int cardIdx = 0, dir = 0, idx = 0;
+
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+  {
+    const halModelCardT *card = &model->cards[cardIdx];
+
+    for (dir = SINK; dir <= SOURCE; dir++)
+    {
+      // An empty array is kept, a terminator makes it a valid C array
+      if (!card->channels[dir])
+        continue;
+
+      fprintf(out, "static const halModelChannelT card%d_%s[] = {\n", cardIdx, _dirLabels[dir]);
+      for (idx = 0; idx < card->channelsCount[dir]; idx++)
+      {
+        fputs("  { .type = ", out);
+        emitString(out, card->channels[dir][idx].type);
+        fprintf(out, ", .port = %d },\n", card->channels[dir][idx].port);
+      }
+      fputs("  { .type = NULL }\n};\n\n", out);
+    }
+  }
+
+  if (!model->cardsCount)
+    return;
+
+  fputs("static const halModelCardT cards[] = {\n", out);
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+  {
+    const halModelCardT *card = &model->cards[cardIdx];
+
+    fputs("  {\n    .name = ", out);
+    emitString(out, card->name);
+    fputs(",\n    .api = ", out);
+    emitString(out, card->api);
+    fputs(",\n    .info = ", out);
+    emitString(out, card->info);
+    fputs(",\n    .channels = { ", out);
+    for (dir = SINK; dir <= SOURCE; dir++)
+    {
+      if (card->channels[dir])
+        fprintf(out, "card%d_%s", cardIdx, _dirLabels[dir]);
+      else
+        fputs("NULL", out);
+      fputs(dir == SINK ? ", " : " },\n", out);
+    }
+    fprintf(out, "    .channelsCount = { %d, %d },\n",
+            card->channelsCount[SINK], card->channelsCount[SOURCE]);
+    fprintf(out, "    .portsCount = { %d, %d }\n  },\n",
+            card->portsCount[SINK], card->portsCount[SOURCE]);
+  }
+  fputs("};\n\n", out);
+}
+
+/*
+ * @brief Write the zones, their rows and cells
+ */
+STATIC void emitZones(FILE *out, const halModelT *model)
+{
+  int zoneIdx = 0, rowIdx = 0, cellIdx = 0;
+
+  for (zoneIdx = 0; zoneIdx < model->zonesCount; zoneIdx++)
+  {
+    const halModelZoneT *zone = &model->zones[zoneIdx];
+
+    for (rowIdx = 0; rowIdx < zone->rowsCount; rowIdx++)
+    {
+      const halModelRowT *row = &zone->rows[rowIdx];
+
+      if (!row->cellsCount)
+        continue;
+
+      fprintf(out, "static const halModelCellT zone%d_row%d[] = {\n", zoneIdx, rowIdx);
+      for (cellIdx = 0; cellIdx < row->cellsCount; cellIdx++)
+      {
+        const halModelCellT *cell = &row->cells[cellIdx];
+
+        fputs("  { .type = ", out);
+        emitString(out, cell->type);
+        fprintf(out, ", .gain = %.17g, .card = { %d, %d }, .port = { %d, %d } },\n",
+                cell->gain, cell->card[SINK], cell->card[SOURCE],
+                cell->port[SINK], cell->port[SOURCE]);
+      }
+      fputs("};\n\n", out);
+    }
+
+    if (!zone->rowsCount)
+      continue;
+
+    fprintf(out, "static const halModelRowT zone%d_rows[] = {\n", zoneIdx);
+    for (rowIdx = 0; rowIdx < zone->rowsCount; rowIdx++)
+    {
+      if (zone->rows[rowIdx].cellsCount)
+        fprintf(out, "  { .cells = zone%d_row%d, .cellsCount = %d },\n",
+                zoneIdx, rowIdx, zone->rows[rowIdx].cellsCount);
+      else
+        fputs("  { .cells = NULL, .cellsCount = 0 },\n", out);
+    }
+    fputs("};\n\n", out);
+  }
+
+  if (!model->zonesCount)
+    return;
+
+  fputs("static const halModelZoneT zones[] = {\n", out);
+  for (zoneIdx = 0; zoneIdx < model->zonesCount; zoneIdx++)
+  {
+    const halModelZoneT *zone = &model->zones[zoneIdx];
+
+    fputs("  { .uid = ", out);
+    emitString(out, zone->uid);
+    if (zone->rowsCount)
+      fprintf(out, ", .rows = zone%d_rows, .rowsCount = %d },\n", zoneIdx, zone->rowsCount);
+    else
+      fputs(", .rows = NULL, .rowsCount = 0 },\n", out);
+  }
+  fputs("};\n\n", out);
+}
+
+/*
+ * @brief Write the streams, pointing to their zones
+ */
+STATIC void emitStreams(FILE *out, const halModelT *model)
+{
+  int streamIdx = 0, dir = 0;
+
+  if (!model->streamsCount)
+    return;
+
+  fputs("static const halModelStreamT streams[] = {\n", out);
+  for (streamIdx = 0; streamIdx < model->streamsCount; streamIdx++)
+  {
+    const halModelStreamT *stream = &model->streams[streamIdx];
+
+    fputs("  { .role = ", out);
+    emitString(out, stream->role);
+    fputs(", .zones = { ", out);
+    for (dir = SINK; dir <= SOURCE; dir++)
+    {
+      if (stream->zones[dir])
+        fprintf(out, "&zones[%d]", (int)(stream->zones[dir] - model->zones));
+      else
+        fputs("NULL", out);
+      fputs(dir == SINK ? ", " : " }", out);
+    }
+    fprintf(out, ", .priority = %d, .duck = %d },\n", stream->priority, stream->duck);
+  }
+  fputs("};\n\n", out);
+}
+
+/*
+ * @brief Write the ctls, pointing to their streams
+ */
+STATIC void emitCtls(FILE *out, const halModelT *model)
+{
+  int ctlsIdx = 0, ctlType = 0;
+
+  for (ctlsIdx = 0; ctlsIdx < model->ctlsCount; ctlsIdx++)
+  {
+    const halModelCtlsT *ctls = &model->ctls[ctlsIdx];
+
+    for (ctlType = Volume; ctlType < EndHalCtlsType; ctlType++)
+    {
+      const halModelCtlT *ctl = ctls->ctls[ctlType];
+
+      if (!ctl)
+        continue;
+
+      fprintf(out, "static const halModelCtlT ctls%d_%d = {\n  .name = ",
+              ctlsIdx, ctlType);
+      emitString(out, ctl->name);
+      fprintf(out, ",\n  .value = %d, .minval = %d, .maxval = %d, .count = %d, .step = %d,\n"
+              "  .ramp = { .curve = %d, .durationMs = %d }\n};\n\n",
+              ctl->value, ctl->minval, ctl->maxval, ctl->count, ctl->step,
+              (int)ctl->ramp.curve, ctl->ramp.durationMs);
+    }
+  }
+
+  if (!model->ctlsCount)
+    return;
+
+  fputs("static const halModelCtlsT ctls[] = {\n", out);
+  for (ctlsIdx = 0; ctlsIdx < model->ctlsCount; ctlsIdx++)
+  {
+    const halModelCtlsT *ctls = &model->ctls[ctlsIdx];
+
+    fputs("  {\n    .role = ", out);
+    emitString(out, ctls->role);
+    fprintf(out, ",\n    .roleIdx = %d,\n", ctls->roleIdx);
+    if (ctls->stream)
+      fprintf(out, "    .stream = &streams[%d],\n", (int)(ctls->stream - model->streams));
+    else
+      fputs("    .stream = NULL,\n", out);
+    fputs("    .ctls = {\n", out);
+    for (ctlType = Volume; ctlType < EndHalCtlsType; ctlType++)
+      if (ctls->ctls[ctlType])
+        fprintf(out, "      [%d] = &ctls%d_%d,\n", ctlType, ctlsIdx, ctlType);
+    fputs("    }\n  },\n", out);
+  }
+  fputs("};\n\n", out);
+}
+
+/*
+ * @brief Write the halmap of every card, as generated by the binding, and
+ *        the settings of its ramps
+ */
+STATIC HAL_ERRCODE emitHalMaps(FILE *out, const halModelT *model)
+{
+  int cardIdx = 0, idx = 0;
+
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+  {
+    int ctlsCount = 0;
+    halArenaT *arena = halArenaNew(sizeAlsaHalMap(model, cardIdx, &ctlsCount));
+    alsaHalMapT *halmap = arena ? generateAlsaHalMap(arena, model, cardIdx, ctlsCount) : NULL;
+
+    if (!halmap)
+    {
+      fprintf(stderr, "Cannot generate the halmap of card %s\n", model->cards[cardIdx].name);
+      halArenaFree(arena);
+      return HAL_FAIL;
+    }
+
+    fprintf(out, "static const alsaHalMapT halmap%d[] = {\n", cardIdx);
+    for (idx = 0; idx < ctlsCount; idx++)
+    {
+      const alsaHalCtlMapT *ctl = &halmap[idx].ctl;
+
+      fprintf(out, "  { .tag = %d, .label = ", (int)halmap[idx].tag);
+      emitString(out, halmap[idx].label);
+      fprintf(out, ", .ctl = { .numid = %d, .name = ", ctl->numid);
+      emitString(out, ctl->name);
+      fprintf(out, ", .minval = %d, .maxval = %d, .step = %d, .type = %d, "
+              ".count = %d, .value = %d } },\n",
+              ctl->minval, ctl->maxval, ctl->step, (int)ctl->type, ctl->count, ctl->value);
+    }
+    fputs("  { .tag = 0 }\n};\n\n", out);
+
+    // Ramps are set up at startup, as they hold a state
+    fprintf(out, "static const halRampConfigT halmap%d_ramps[] = {\n", cardIdx);
+    for (idx = 0; idx < ctlsCount; idx++)
+    {
+      const halRampConfigT *config = halmap[idx].cb.handle ?
+                                     halRampGetConfig(halmap[idx].cb.handle) : NULL;
+
+      if (config)
+        fprintf(out, "  { .curve = %d, .durationMs = %d },\n",
+                (int)config->curve, config->durationMs);
+      else
+        fputs("  { .curve = 0 },\n", out);
+    }
+    fputs("  { .curve = 0 }\n};\n\n", out);
+
+    halArenaFree(arena);
+  }
+
+  if (!model->cardsCount)
+    return HAL_OK;
+
+  fputs("static const halStaticHalMapT halmaps[] = {\n", out);
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+    fprintf(out, "  { .halmap = halmap%d, .ramps = halmap%d_ramps,\n"
+            "    .ctlsCount = sizeof(halmap%d) / sizeof(halmap%d[0]) - 1 },\n",
+            cardIdx, cardIdx, cardIdx, cardIdx);
+  fputs("};\n\n", out);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Write the static config
+ */
+STATIC HAL_ERRCODE emitConfig(FILE *out, const char *configPath,
+                              const char *api, const halModelT *model)
+{
+  const halOptionsT *options = halOptionsGet();
+  char *path = strdup(configPath);
+
+  if (!path)
+    return HAL_FAIL;
+
+  fputs("/*\n * Generated by hal-generic-codegen, do not edit.\n */\n\n"
+        "#include \"hal-generic-static.h\"\n\n", out);
+
+  emitCards(out, model);
+  emitZones(out, model);
+  emitStreams(out, model);
+  emitCtls(out, model);
+  if (emitHalMaps(out, model) != HAL_OK)
+  {
+    free(path);
+    return HAL_FAIL;
+  }
+
+  fputs("const halStaticConfigT halStaticConfig = {\n  .source = ", out);
+  emitString(out, basename(path));
+  fputs(",\n  .api = ", out);
+  emitString(out, api);
+  // Reloading needs the config files, a static config never changes
+  fprintf(out, ",\n  .options = { .coalesceMs = %d, .reload = 0, .statsMs = %d, .shm = %d },\n",
+          options->coalesceMs, options->statsMs, options->shm);
+  fputs("  .model = {\n    .arena = NULL,\n", out);
+  fprintf(out, "    .cards = %s, .cardsCount = %d,\n",
+          model->cardsCount ? "cards" : "NULL", model->cardsCount);
+  fprintf(out, "    .zones = %s, .zonesCount = %d,\n",
+          model->zonesCount ? "zones" : "NULL", model->zonesCount);
+  fprintf(out, "    .streams = %s, .streamsCount = %d,\n",
+          model->streamsCount ? "streams" : "NULL", model->streamsCount);
+  fprintf(out, "    .ctls = %s, .ctlsCount = %d\n  },\n",
+          model->ctlsCount ? "ctls" : "NULL", model->ctlsCount);
+  fprintf(out, "  .halmaps = %s\n};\n", model->cardsCount ? "halmaps" : "NULL");
+
+  free(path);
+
+  return HAL_OK;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+int main(int argc, char *argv[])
+{
+  const char *output = NULL, *configPath = NULL, *configDir = NULL, *api = NULL;
+  char *configPathCopy = NULL;
+  json_object *configJ = NULL, *metadataJ = NULL, *cardsJ = NULL,
+              *zonesJ = NULL, *streamsJ = NULL, *ctlsJ = NULL, *optionsJ = NULL;
+  halModelT *model = NULL;
+  FILE *out = stdout;
+  int opt = 0, err = 1;
+
+  while ((opt = getopt(argc, argv, "o:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'o': output = optarg; break;
+      case 'v': afbBindingV2verbosity = AFB_VERBOSITY_LEVEL_DEBUG; break;
+      default:
+        fprintf(stderr, "Usage: %s [-o output.c] [-v] config.json\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr, "Usage: %s [-o output.c] [-v] config.json\n", argv[0]);
+    return 1;
+  }
+
+  configPath = argv[optind];
+  configPathCopy = strdup(configPath);
+  configJ = json_object_from_file(configPath);
+  if (!configPathCopy || !configJ)
+  {
+    fprintf(stderr, "Cannot parse %s\n", configPath);
+    goto OnExit;
+  }
+  configDir = dirname(configPathCopy);
+
+  if (json_object_object_get_ex(configJ, "metadata", &metadataJ))
+    wrap_json_unpack(metadataJ, "{s?s}", "api", &api);
+
+  cardsJ = loadSection(configJ, "cards", configDir);
+  zonesJ = loadSection(configJ, "zones", configDir);
+  streamsJ = loadSection(configJ, "streams", configDir);
+  ctlsJ = loadSection(configJ, "ctls", configDir);
+  optionsJ = loadSection(configJ, "options", configDir);
+  if (!cardsJ || !zonesJ || !streamsJ || !ctlsJ)
+  {
+    fprintf(stderr, "%s: 'cards', 'zones', 'streams' and 'ctls' are required\n", configPath);
+    goto OnExit;
+  }
+
+  // Same checks, in the same order, as the binding
+  validateReportReset();
+  halIndexCards(cardsJ);
+  validateCards(cardsJ);
+  halIndexZones(zonesJ);
+  validateZones(zonesJ);
+  halIndexStreams(streamsJ);
+  validateStreams(streamsJ);
+  validateCtls(ctlsJ);
+  if (validateReportCount() || halOptionsLoad(optionsJ) != HAL_OK)
+  {
+    json_object *reportJ = validateReportGet();
+
+    fprintf(stderr, "%s is not valid (%d errors): %s\n", configPath,
+            validateReportCount(),
+            json_object_to_json_string_ext(reportJ, JSON_C_TO_STRING_PRETTY));
+    json_object_put(reportJ);
+    goto OnExit;
+  }
+
+  if (halOptionsGet()->reload)
+    fprintf(stderr, "%s: 'reload' is ignored by a static config\n", configPath);
+
+  model = halModelNew(cardsJ, zonesJ, streamsJ, ctlsJ);
+  if (!model)
+    goto OnExit;
+
+  if (output)
+  {
+    out = fopen(output, "w");
+    if (!out)
+    {
+      perror(output);
+      goto OnExit;
+    }
+  }
+
+  err = (emitConfig(out, configPath, api, model) != HAL_OK);
+
+  if (output)
+  {
+    err |= (fclose(out) != 0);
+    if (err)
+      unlink(output);
+  }
+
+OnExit:
+  halModelFree(model);
+  halIndexClear();
+  json_object_put(cardsJ);
+  json_object_put(zonesJ);
+  json_object_put(streamsJ);
+  json_object_put(ctlsJ);
+  json_object_put(optionsJ);
+  json_object_put(configJ);
+  free(configPathCopy);
+
+  return err;
+}
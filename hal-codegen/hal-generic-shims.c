@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Binder shims for the static config generator, and the benchmark.
+ *
+ * The binding translation units call the binder through the AFB v2
+ * interface tables of 'afbBindingV2data', which afb-daemon fills in when
+ * it loads a binding. The host tools fill them in with stubs instead:
+ * logs go to stderr, there is no event loop, and no other API to call.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC void shimVerbose(void *closure, int level, const char *file, int line,
+                        const char *func, const char *fmt, va_list args);
+STATIC struct sd_event *shimGetEventLoop(void *closure);
+STATIC int shimRequireApi(void *closure, const char *name, int initialized);
+STATIC void shimCall(void *closure, const char *api, const char *verb,
+                     struct json_object *args,
+                     void (*callback)(void *, int, struct json_object *),
+                     void *callbackClosure);
+STATIC int shimCallSync(void *closure, const char *api, const char *verb,
+                        struct json_object *args, struct json_object **result);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+STATIC void shimVerbose(void *closure, int level, const char *file, int line,
+                        const char *func, const char *fmt, va_list args)
+{
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+}
+
+STATIC struct sd_event *shimGetEventLoop(void *closure)
+{
+  return NULL;
+}
+
+STATIC int shimRequireApi(void *closure, const char *name, int initialized)
+{
+  return -1;
+}
+
+STATIC void shimCall(void *closure, const char *api, const char *verb,
+                     struct json_object *args,
+                     void (*callback)(void *, int, struct json_object *),
+                     void *callbackClosure)
+{
+  json_object_put(args);
+  if (callback)
+    callback(callbackClosure, -1, NULL);
+}
+
+STATIC int shimCallSync(void *closure, const char *api, const char *verb,
+                        struct json_object *args, struct json_object **result)
+{
+  json_object_put(args);
+  *result = NULL;
+
+  return -1;
+}
+
+
+/*****************************************************************************
+ * Global Variable Definitions
+ ****************************************************************************/
+static const struct afb_daemon_itf _daemonItf = {
+  .vverbose_v2 = shimVerbose,
+  .get_event_loop = shimGetEventLoop,
+  .require_api = shimRequireApi
+};
+
+static const struct afb_service_itf _serviceItf = {
+  .call = shimCall,
+  .call_sync = shimCallSync
+};
+
+// Quiet unless the tool is run with '-v'
+struct afb_binding_data_v2 afbBindingV2data = {
+  .verbosity = -1,
+  .daemon = { .itf = &_daemonItf, .closure = NULL },
+  .service = { .itf = &_serviceItf, .closure = NULL }
+};
+
+const struct afb_binding_v2 afbBindingV2 = {
+  .api = "hal-generic-bench"
+};
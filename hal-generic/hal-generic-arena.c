@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Arena allocator.
+ *
+ * An arena is a bump allocator over a single block, allocated along with
+ * the arena and sized up front by the caller, e.g. from a counting pass
+ * over the config: allocations are then contiguous, and the arena is freed
+ * at once. Should the size be short,
+ * blocks of HAL_ARENA_BLOCK_SZ or more are chained, so an allocation only
+ * fails when memory is exhausted.
+ *
+ * Objects that hold resources outside the arena, e.g. a running ramp or a
+ * json_object, register a release hook, run in reverse order by
+ * halArenaFree before the blocks are freed.
+ */
+
+#include "hal-generic-arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+typedef struct halArenaBlock {
+  struct halArenaBlock *next;
+  size_t size;
+  size_t used;
+  uint8_t data[];
+} halArenaBlockT;
+
+struct halArena {
+  halArenaBlockT *blocks;             // Current block first
+  halArenaReleaseT *releases;         // Last registered first
+  size_t size;                        // Total size of the blocks
+  size_t used;                        // Total size allocated
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC halArenaBlockT *blockNew(size_t size);
+STATIC void releaseJ(void *ptr);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Allocate a zeroed block
+ */
+STATIC halArenaBlockT *blockNew(size_t size)
+{
+  halArenaBlockT *block = calloc(1, sizeof(halArenaBlockT) + size);
+
+  if (block)
+    block->size = size;
+
+  return block;
+}
+
+/*
+ * @brief Release hook of halArenaOwnJ
+ */
+STATIC void releaseJ(void *ptr)
+{
+  json_object **slotJ = (json_object **)ptr;
+
+  json_object_put(*slotJ);
+  *slotJ = NULL;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Allocate an arena
+ * @param size : The size of the first block, e.g. as counted with
+ *               HAL_ARENA_SZ, HAL_ARENA_STR_SZ and HAL_ARENA_RELEASE_SZ
+ * @return The arena, or NULL on failure
+ */
+PUBLIC halArenaT *halArenaNew(size_t size)
+{
+  halArenaT *arena = NULL;
+
+  size = HAL_ARENA_SZ(size);
+  arena = calloc(1, sizeof(halArenaT) + sizeof(halArenaBlockT) + size);
+  if (!arena)
+  {
+    AFB_ApiError(NULL, "ARENA: Cannot allocate arena (sz: %zu)", size);
+    return NULL;
+  }
+
+  // The first block follows the arena
+  arena->blocks = (halArenaBlockT *)(arena + 1);
+  arena->blocks->size = size;
+  arena->size = size;
+
+  return arena;
+}
+
+/*
+ * @brief Allocate zeroed memory from an arena, aligned on HAL_ARENA_ALIGN
+ * @return The memory, or NULL on failure
+ */
+PUBLIC void *halArenaAlloc(halArenaT *arena, size_t size)
+{
+  halArenaBlockT *block = NULL;
+  void *ptr = NULL;
+
+  if (!arena)
+    return NULL;
+
+  size = HAL_ARENA_SZ(size);
+  block = arena->blocks;
+  if (block->size - block->used < size)
+  {
+    block = blockNew(size > HAL_ARENA_BLOCK_SZ ? size : HAL_ARENA_BLOCK_SZ);
+    if (!block)
+    {
+      AFB_ApiError(NULL, "ARENA: Cannot grow arena (sz: %zu)", size);
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->size += block->size;
+  }
+
+  ptr = block->data + block->used;
+  block->used += size;
+  arena->used += size;
+
+  return ptr;
+}
+
+/*
+ * @brief Copy a string into an arena
+ * @return The copy, or NULL if str is NULL or on failure
+ */
+PUBLIC char *halArenaStrdup(halArenaT *arena, const char *str)
+{
+  char *copy = NULL;
+
+  if (!str)
+    return NULL;
+
+  copy = halArenaAlloc(arena, strlen(str) + 1);
+  if (copy)
+    strcpy(copy, str);
+
+  return copy;
+}
+
+/*
+ * @brief Register a release hook, run when the arena is freed
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halArenaOnFree(halArenaT *arena, void (*release)(void *ptr),
+                                  void *ptr)
+{
+  halArenaReleaseT *hook = halArenaAlloc(arena, sizeof(halArenaReleaseT));
+
+  if (!hook)
+    return HAL_FAIL;
+
+  hook->release = release;
+  hook->ptr = ptr;
+  hook->next = arena->releases;
+  arena->releases = hook;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Hand the reference held in a slot over to the arena. The object
+ *        held by the slot when the arena is freed is released, so the
+ *        slot may be updated in between.
+ * @param slotJ : The slot, e.g. a field of the object owning the arena
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halArenaOwnJ(halArenaT *arena, json_object **slotJ)
+{
+  return halArenaOnFree(arena, releaseJ, slotJ);
+}
+
+/*
+ * @brief Get the size allocated from an arena
+ */
+PUBLIC size_t halArenaUsed(const halArenaT *arena)
+{
+  return arena ? arena->used : 0;
+}
+
+/*
+ * @brief Get the total size of the blocks of an arena
+ */
+PUBLIC size_t halArenaSize(const halArenaT *arena)
+{
+  return arena ? arena->size : 0;
+}
+
+/*
+ * @brief Run the release hooks of an arena, then free it
+ */
+PUBLIC void halArenaFree(halArenaT *arena)
+{
+  halArenaReleaseT *hook = NULL;
+  halArenaBlockT *block = NULL, *next = NULL;
+
+  if (!arena)
+    return;
+
+  for (hook = arena->releases; hook; hook = hook->next)
+    hook->release(hook->ptr);
+
+  for (block = arena->blocks; block; block = next)
+  {
+    next = block->next;
+    if (block != (halArenaBlockT *)(arena + 1))
+      free(block);
+  }
+
+  free(arena);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_ARENA_H
+#define HAL_GENERIC_ARENA_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+#include <stddef.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_ARENA_ALIGN 8                   // Alignment of every allocation
+#define HAL_ARENA_BLOCK_SZ 4096             // Size of the blocks added on overflow
+
+// Size taken in an arena, to size it exactly up front
+#define HAL_ARENA_SZ(sz) \
+  (((size_t)(sz) + HAL_ARENA_ALIGN - 1) & ~((size_t)HAL_ARENA_ALIGN - 1))
+#define HAL_ARENA_STR_SZ(str) ((str) ? HAL_ARENA_SZ(strlen(str) + 1) : 0)
+#define HAL_ARENA_RELEASE_SZ HAL_ARENA_SZ(sizeof(halArenaReleaseT))
+
+// Release hook, run when the arena is freed, e.g. to stop a ramp
+typedef struct halArenaRelease {
+  struct halArenaRelease *next;
+  void (*release)(void *ptr);
+  void *ptr;
+} halArenaReleaseT;
+
+typedef struct halArena halArenaT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC halArenaT *halArenaNew(size_t size);
+PUBLIC void *halArenaAlloc(halArenaT *arena, size_t size);
+PUBLIC char *halArenaStrdup(halArenaT *arena, const char *str);
+PUBLIC HAL_ERRCODE halArenaOnFree(halArenaT *arena, void (*release)(void *ptr),
+                                  void *ptr);
+PUBLIC HAL_ERRCODE halArenaOwnJ(halArenaT *arena, json_object **slotJ);
+PUBLIC size_t halArenaUsed(const halArenaT *arena);
+PUBLIC size_t halArenaSize(const halArenaT *arena);
+PUBLIC void halArenaFree(halArenaT *arena);
+
+#endif /* HAL_GENERIC_ARENA_H */
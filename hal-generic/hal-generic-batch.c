@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Batched HAL control get/set.
+ *
+ * A batch is a list of {tag|label, val}. For each card, all the controls
+ * of the batch are read with a single alsacore 'ctlget', then all the
+ * values to set are written with a single alsacore 'ctlset'. This saves
+ * round trips, but is not atomic: each control is still written on its
+ * own by ALSA. Controls with a halmap callback (e.g. 'volramp') are not
+ * written, their value is handed to the callback, as the HAL does. The
+ * values read before the set are returned, so that a caller can restore
+ * them with one more batch. Values are percentages of the control range,
+ * as with the HAL 'ctlset' and 'ctlget' verbs.
+ *
+ * hal-utilities only registers the controls of the HAL enum tags. The
+ * controls with a dynamic tag are created here, with a single alsacore
+ * 'addcustomctl', and are served by the batches like the others.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-batch.h"
+#include "hal-generic-tags.h"
+#include "hal-generic-stats.h"
+#include "wrap-json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC const alsaHalMapT *halmapGetCtl(const halCardT *card, halCtlsTagT tag);
+STATIC json_object *convertValue(const alsaHalCtlMapT *ctl, json_object *valJ, bool toRaw);
+STATIC json_object *alsacoreCall(const halCardT *card, const char *verb, json_object *ctlsJ);
+STATIC json_object *responseGetVal(json_object *responseJ, int numid);
+STATIC halCtlsTagT batchCtlTag(json_object *ctlJ);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Find a registered control in a card halmap
+ * @return The halmap entry, or NULL if the card does not have the control
+ */
+STATIC const alsaHalMapT *halmapGetCtl(const halCardT *card, halCtlsTagT tag)
+{
+  const alsaHalMapT *ctl = NULL;
+
+  for (ctl = card->halmap; ctl && ctl->ctl.name; ctl++)
+    if (ctl->tag == tag && ctl->ctl.numid > 0)
+      return ctl;
+
+  return NULL;
+}
+
+/*
+ * @brief Convert a value, or an array of per-channel values, between a
+ *        percentage and the raw control range
+ * @return A new json_object with the converted value
+ */
+STATIC json_object *convertValue(const alsaHalCtlMapT *ctl, json_object *valJ, bool toRaw)
+{
+  int range = ctl->maxval - ctl->minval;
+  int val = 0;
+
+  if (json_object_is_type(valJ, json_type_array))
+  {
+    int idx = 0, len = json_object_array_length(valJ);
+    json_object *valsJ = json_object_new_array();
+
+    for (idx = 0; idx < len; idx++)
+      json_object_array_add(valsJ,
+                            convertValue(ctl, json_object_array_get_idx(valJ, idx), toRaw));
+
+    return valsJ;
+  }
+
+  if (json_object_is_type(valJ, json_type_boolean))
+    return json_object_new_int(json_object_get_boolean(valJ) ? (toRaw ? ctl->maxval : 100)
+                                                             : (toRaw ? ctl->minval : 0));
+
+  val = json_object_get_int(valJ);
+  if (range <= 0)
+    return json_object_new_int(toRaw ? ctl->minval : 0);
+
+  if (toRaw)
+  {
+    if (val < 0)
+      val = 0;
+    if (val > 100)
+      val = 100;
+    return json_object_new_int(ctl->minval + (range * val + 50) / 100);
+  }
+
+  return json_object_new_int(((val - ctl->minval) * 100 + range / 2) / range);
+}
+
+/*
+ * @brief Call an alsacore control verb for all the controls of a card
+ * @return The alsacore response, or NULL on failure
+ */
+STATIC json_object *alsacoreCall(const halCardT *card, const char *verb, json_object *ctlsJ)
+{
+  json_object *queryJ = NULL, *resultJ = NULL, *responseJ = NULL;
+  char *devid = NULL;
+  int err = 0;
+
+  if (asprintf(&devid, "hw:%s", card->name) < 0)
+  {
+    json_object_put(ctlsJ);
+    return NULL;
+  }
+
+  wrap_json_pack(&queryJ, "{s:s,s:o}", "devid", devid, "ctl", ctlsJ);
+  free(devid);
+
+  err = halStatsServiceCallSync("alsacore", verb, queryJ, &resultJ);
+  if (err)
+  {
+    AFB_ApiError(NULL, "BATCH: alsacore '%s' failed on card '%s': %s",
+                 verb, card->name, json_object_get_string(resultJ));
+    if (resultJ)
+      json_object_put(resultJ);
+    return NULL;
+  }
+
+  if (json_object_object_get_ex(resultJ, "response", &responseJ))
+    json_object_get(responseJ);
+  else
+    responseJ = json_object_new_object(); // No response to a 'ctlset'
+  json_object_put(resultJ);
+
+  return responseJ;
+}
+
+/*
+ * @brief Get the value of a control in an alsacore 'ctlget' response
+ */
+STATIC json_object *responseGetVal(json_object *responseJ, int numid)
+{
+  int idx = 0, len = 0;
+
+  if (!json_object_is_type(responseJ, json_type_array))
+    return NULL;
+
+  len = json_object_array_length(responseJ);
+  for (idx = 0; idx < len; idx++)
+  {
+    json_object *ctlJ = json_object_array_get_idx(responseJ, idx);
+    json_object *idJ = NULL, *valJ = NULL;
+
+    if (json_object_object_get_ex(ctlJ, "id", &idJ) &&
+        json_object_get_int(idJ) == numid &&
+        json_object_object_get_ex(ctlJ, "val", &valJ))
+      return valJ;
+  }
+
+  return NULL;
+}
+
+/*
+ * @brief Resolve the tag of a batch control, given by 'tag' or 'label'
+ * @return The tag, or EndHalCrlTag if unknown
+ */
+STATIC halCtlsTagT batchCtlTag(json_object *ctlJ)
+{
+  json_object *tagJ = NULL, *labelJ = NULL;
+  int tag = EndHalCrlTag;
+
+  if (json_object_object_get_ex(ctlJ, "tag", &tagJ))
+    tag = json_object_get_int(tagJ);
+  else if (json_object_object_get_ex(ctlJ, "label", &labelJ))
+    tag = halCtlsTagGetByLabel(json_object_get_string(labelJ));
+
+  if (!halCtlsTagIsValid(tag))
+    return EndHalCrlTag;
+
+  return (halCtlsTagT)tag;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Apply a batch of controls to a card: read them all, then set the
+ *        ones with a value, each in a single alsacore call
+ * @param card      : A registered card
+ * @param ctls      : The batch, controls the card does not have are skipped
+ * @param ctlsCount : The number of controls in the batch
+ * @param resultsJ  : Array the values read before the set are added to,
+ *                    or NULL to only set
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halBatchApply(halCardT *card, const halBatchCtlT *ctls,
+                                 int ctlsCount, json_object *resultsJ)
+{
+  const alsaHalMapT *halCtls[HAL_BATCH_CTLS_MAX];
+  json_object *getJ = NULL, *setJ = NULL, *responseJ = NULL;
+  int idx = 0, setCount = 0, getCount = 0;
+
+  if (!card->registered || ctlsCount > HAL_BATCH_CTLS_MAX)
+    return HAL_FAIL;
+
+  getJ = json_object_new_array();
+  setJ = json_object_new_array();
+  for (idx = 0; idx < ctlsCount; idx++)
+  {
+    json_object *ctlJ = NULL;
+
+    halCtls[idx] = NULL;
+    if (ctls[idx].card && strcmp(ctls[idx].card, card->name))
+      continue;
+
+    halCtls[idx] = halmapGetCtl(card, ctls[idx].tag);
+    if (!halCtls[idx])
+      continue;
+
+    if (resultsJ)
+    {
+      wrap_json_pack(&ctlJ, "{s:i}", "id", halCtls[idx]->ctl.numid);
+      json_object_array_add(getJ, ctlJ);
+      getCount++;
+    }
+
+    if (ctls[idx].valJ && halCtls[idx]->cb.callback)
+      continue;
+
+    if (ctls[idx].valJ)
+    {
+      wrap_json_pack(&ctlJ, "{s:i,s:o}", "id", halCtls[idx]->ctl.numid,
+                     "val", convertValue(&halCtls[idx]->ctl, ctls[idx].valJ, true));
+      json_object_array_add(setJ, ctlJ);
+      setCount++;
+    }
+  }
+
+  if (getCount)
+  {
+    // One call to read, and one to write, all the card controls
+    responseJ = alsacoreCall(card, "ctlget", getJ);
+    if (!responseJ)
+    {
+      json_object_put(setJ);
+      return HAL_FAIL;
+    }
+
+    for (idx = 0; idx < ctlsCount; idx++)
+    {
+      json_object *valJ = NULL, *resultJ = NULL;
+
+      if (!halCtls[idx])
+        continue;
+
+      valJ = responseGetVal(responseJ, halCtls[idx]->ctl.numid);
+      wrap_json_pack(&resultJ, "{s:s,s:i,s:s*,s:o*}",
+                     "card", card->name,
+                     "tag", (int)ctls[idx].tag,
+                     "label", halCtlsTagLabel(ctls[idx].tag),
+                     "val", valJ ? convertValue(&halCtls[idx]->ctl, valJ, false) : NULL);
+      json_object_array_add(resultsJ, resultJ);
+    }
+    json_object_put(responseJ);
+  }
+  else
+    json_object_put(getJ);
+
+  // Controls with a callback act on others (e.g. a ramp drives a volume)
+  for (idx = 0; idx < ctlsCount; idx++)
+  {
+    json_object *rawJ = NULL;
+
+    if (!halCtls[idx] || !ctls[idx].valJ || !halCtls[idx]->cb.callback)
+      continue;
+
+    rawJ = convertValue(&halCtls[idx]->ctl, ctls[idx].valJ, true);
+    halCtls[idx]->cb.callback(halCtls[idx]->tag, (alsaHalCtlMapT *)&halCtls[idx]->ctl,
+                              halCtls[idx]->cb.handle, rawJ);
+    json_object_put(rawJ);
+  }
+
+  if (!setCount)
+  {
+    json_object_put(setJ);
+    return HAL_OK;
+  }
+
+  responseJ = alsacoreCall(card, "ctlset", setJ);
+  if (!responseJ)
+    return HAL_FAIL;
+  json_object_put(responseJ);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Create the ALSA controls of the halmap entries with a dynamic tag,
+ *        which hal-utilities cannot register, and set their numids
+ * @param card : The HAL card, registered with hal-utilities
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halBatchAddCtls(halCardT *card)
+{
+  json_object *addJ = json_object_new_array();
+  json_object *responseJ = NULL;
+  alsaHalMapT *ctl = NULL;
+  int idx = 0, addCount = 0;
+
+  for (ctl = card->halmap; ctl && ctl->ctl.name; ctl++)
+  {
+    json_object *ctlJ = NULL;
+
+    if (halCtlsTagIsStatic(ctl->tag))
+      continue;
+
+    wrap_json_pack(&ctlJ, "{s:s,s:i,s:i,s:i,s:i,s:i,s:i}",
+                   "name", ctl->ctl.name,
+                   "type", (int)ctl->ctl.type,
+                   "count", ctl->ctl.count > 0 ? ctl->ctl.count : 1,
+                   "minval", ctl->ctl.minval,
+                   "maxval", ctl->ctl.maxval,
+                   "step", ctl->ctl.step > 0 ? ctl->ctl.step : 1,
+                   "value", ctl->ctl.value);
+    json_object_array_add(addJ, ctlJ);
+    addCount++;
+  }
+
+  if (!addCount)
+  {
+    json_object_put(addJ);
+    return HAL_OK;
+  }
+
+  responseJ = alsacoreCall(card, "addcustomctl", addJ);
+  if (!responseJ)
+    return HAL_FAIL;
+
+  // The created controls are listed in the order of the request
+  if (!json_object_is_type(responseJ, json_type_array) ||
+      json_object_array_length(responseJ) < addCount)
+    goto OnErrorExit;
+
+  for (ctl = card->halmap; ctl->ctl.name; ctl++)
+  {
+    json_object *numidJ = NULL;
+
+    if (halCtlsTagIsStatic(ctl->tag))
+      continue;
+
+    if (!json_object_object_get_ex(json_object_array_get_idx(responseJ, idx++),
+                                   "numid", &numidJ))
+      goto OnErrorExit;
+
+    ctl->ctl.numid = json_object_get_int(numidJ);
+    AFB_ApiNotice(NULL, "BATCH: card %s, ctl '%s' (%s) created, numid: %d",
+                  card->name, ctl->ctl.name, halCtlsTagLabel(ctl->tag), ctl->ctl.numid);
+  }
+
+  json_object_put(responseJ);
+  return HAL_OK;
+
+OnErrorExit:
+  AFB_ApiError(NULL, "BATCH: card %s, unexpected alsacore 'addcustomctl' response: %s",
+               card->name, json_object_get_string(responseJ));
+  json_object_put(responseJ);
+  return HAL_FAIL;
+}
+
+/*
+ * @brief 'ctlbatch' verb: get and set several controls in one call
+ *        args: { "card"?: name, "ctls": [ { "tag"|"label", "val"?, "card"? } ] }
+ *        Without 'card', the batch applies to every card with the controls.
+ *        Returns the values read before the set, as { "ctls": [ ... ] },
+ *        which can be sent back as is to restore them.
+ */
+PUBLIC void halBatchVerb(struct afb_req request)
+{
+  halBatchCtlT ctls[HAL_BATCH_CTLS_MAX];
+  json_object *argsJ = afb_req_json(request);
+  json_object *ctlsJ = NULL, *resultsJ = NULL, *responseJ = NULL;
+  const char *cardName = NULL;
+  int idx = 0, ctlsCount = 0, cardIdx = 0;
+  halCardT *card = NULL;
+
+  if (wrap_json_unpack(argsJ, "{s?s,s:o}", "card", &cardName, "ctls", &ctlsJ) ||
+      !json_object_is_type(ctlsJ, json_type_array))
+  {
+    afb_req_fail(request, "invalid-args", "Expected { \"card\"?: string, \"ctls\": [...] }");
+    return;
+  }
+
+  ctlsCount = json_object_array_length(ctlsJ);
+  if (ctlsCount > HAL_BATCH_CTLS_MAX)
+  {
+    afb_req_fail_f(request, "too-many-ctls", "At most %d ctls per batch", HAL_BATCH_CTLS_MAX);
+    return;
+  }
+
+  // Resolve the whole batch before applying any of it
+  for (idx = 0; idx < ctlsCount; idx++)
+  {
+    json_object *ctlJ = json_object_array_get_idx(ctlsJ, idx);
+
+    ctls[idx].tag = batchCtlTag(ctlJ);
+    ctls[idx].valJ = NULL;
+    ctls[idx].card = NULL;
+    wrap_json_unpack(ctlJ, "{s?o,s?s}", "val", &ctls[idx].valJ, "card", &ctls[idx].card);
+    if (ctls[idx].tag == EndHalCrlTag)
+    {
+      afb_req_fail_f(request, "unknown-ctl", "Unknown ctl: %s",
+                     json_object_get_string(ctlJ));
+      return;
+    }
+  }
+
+  if (cardName && !(card = halCardGetByName(cardName)))
+  {
+    afb_req_fail_f(request, "unknown-card", "Unknown card: %s", cardName);
+    return;
+  }
+
+  if (card && !card->registered)
+  {
+    afb_req_fail_f(request, "card-not-ready", "Card is not ready: %s", cardName);
+    return;
+  }
+
+  resultsJ = json_object_new_array();
+  for (cardIdx = 0; cardIdx < halCardsCount(); cardIdx++)
+  {
+    halCardT *cardCurr = card ? card : halCardGet(cardIdx);
+
+    if (cardCurr->registered &&
+        halBatchApply(cardCurr, ctls, ctlsCount, resultsJ) != HAL_OK)
+    {
+      json_object_put(resultsJ);
+      afb_req_fail_f(request, "batch-failed", "Batch failed on card: %s", cardCurr->name);
+      return;
+    }
+
+    if (card)
+      break;
+  }
+
+  wrap_json_pack(&responseJ, "{s:o}", "ctls", resultsJ);
+  afb_req_success(request, responseJ, NULL);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_BATCH_H
+#define HAL_GENERIC_BATCH_H
+
+#include "hal-generic.h"
+#include "hal-generic-card.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_BATCH_CTLS_MAX 64
+
+typedef struct {
+  halCtlsTagT tag;
+  json_object *valJ;        // Value to set (percent), or NULL to only get
+  const char *card;         // Only apply to this card, or NULL for any
+} halBatchCtlT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halBatchApply(halCardT *card, const halBatchCtlT *ctls,
+                                 int ctlsCount, json_object *resultsJ);
+PUBLIC HAL_ERRCODE halBatchAddCtls(halCardT *card);
+PUBLIC void halBatchVerb(struct afb_req request);
+
+#endif /* HAL_GENERIC_BATCH_H */
@@ -0,0 +1,946 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Warm-start cache of the validated and resolved config.
+ *
+ * The cache file holds a header, one record per card, one record per
+ * halmap control (grouped by card) and a string pool. It is keyed by a FNV-1a hash of every
+ * '*.json' file in the config directory and of the ctls files found in the
+ * other controller config directories (names and contents), so any edit of
+ * the main config or of a ctls file invalidates it. The hash also covers
+ * the binding itself (its build ID, the hal-utilities labels table and the
+ * halmap layout), as the records hold tags and layouts of the build which
+ * wrote them. The file is memory-mapped read-only for the lifetime of
+ * the binding, and the halmap control names point straight into it.
+ *
+ * The 'cardprops' and 'streammap' payloads are stored as compact JSON text,
+ * as they have to be handed to the HAL plugin as a json_object anyway.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-cache.h"
+#include "hal-generic-tags.h"
+#include "hal-generic-utility.h"
+#include "ctl-config.h"
+#include "wrap-json.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_CACHE_MAGIC 0x434c4148 // 'HALC'
+#define HAL_CACHE_VERSION 8
+#define HAL_CACHE_PATH_SZ 512
+
+#define FNV64_OFFSET 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+
+#ifndef CONTROL_CONFIG_PATH
+#define CONTROL_CONFIG_PATH ""
+#endif
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t hash;            // Hash of the config inputs
+  uint32_t size;            // Total file size
+  uint32_t api;             // String offset of the API name (0: none)
+  uint32_t options;         // String offset of the 'options' section (0: none)
+  uint32_t ducking;         // String offset of the role priorities (0: none)
+  uint32_t cardsOffset;
+  uint32_t cardsCount;
+  uint32_t ctlsOffset;
+  uint32_t ctlsCount;
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+} halCacheHeaderT;
+
+typedef struct {
+  uint32_t name;            // String offsets
+  uint32_t api;
+  uint32_t info;
+  uint32_t cardprops;
+  uint32_t streammap;
+  uint32_t ctlsIdx;         // First ctl record of the card halmap
+  uint32_t ctlsCount;
+} halCacheCardRecT;
+
+typedef struct {
+  uint32_t role;            // String offsets, tags are registered again on load
+  int32_t type;
+  uint32_t name;
+  int32_t value;
+  int32_t minval;
+  int32_t maxval;
+  int32_t count;
+  int32_t step;
+  int32_t rampCurve;        // Ramp settings, for 'Ramp' ctls
+  int32_t rampDurationMs;
+} halCacheCtlRecT;
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t alloc;
+  bool failed;
+} halCacheBufT;
+
+// dl_iterate_phdr state, looking for the build ID of the binding
+typedef struct {
+  const void *addr;                   // Any address of the binding
+  uint64_t *hash;
+  bool found;
+} halCacheBuildIdT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static char _cachePath[HAL_CACHE_PATH_SZ];
+static uint64_t _cacheHash = 0;
+static bool _cacheOpened = false;
+
+static const uint8_t *_cacheMap = NULL;
+static const halCacheHeaderT *_cacheHeader = NULL;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint64_t fnv64(uint64_t hash, const void *data, size_t len);
+STATIC int jsonFileFilter(const struct dirent *entry);
+STATIC HAL_ERRCODE hashFile(const char *path, const char *name, uint64_t *hash);
+STATIC HAL_ERRCODE hashConfigDir(const char *configDir, uint64_t *hash);
+STATIC HAL_ERRCODE hashCtlsFiles(const char *configDir, uint64_t *hash);
+STATIC int buildIdCB(struct dl_phdr_info *info, size_t size, void *data);
+STATIC void hashBinding(uint64_t *hash);
+STATIC char *ctlsFileFind(const char *configDir, const char *name);
+STATIC const char *cacheString(uint32_t offset);
+STATIC void bufAppend(halCacheBufT *buf, const void *data, size_t len);
+STATIC uint32_t bufAppendString(halCacheBufT *buf, const char *str);
+STATIC size_t cacheHalMapSize(uint32_t ctlsIdx, uint32_t ctlsCount);
+STATIC alsaHalMapT *cacheHalMap(halArenaT *arena, uint32_t ctlsIdx, uint32_t ctlsCount);
+STATIC HAL_ERRCODE checkRecords(void);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Accumulate a FNV-1a 64 bit hash over a chunk of data
+ */
+STATIC uint64_t fnv64(uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *ptr = (const uint8_t *)data;
+
+  while (len--)
+  {
+    hash ^= *ptr++;
+    hash *= FNV64_PRIME;
+  }
+
+  return hash;
+}
+
+/*
+ * @brief scandir filter for '*.json' files
+ */
+STATIC int jsonFileFilter(const struct dirent *entry)
+{
+  size_t len = strlen(entry->d_name);
+
+  return (len > 5) && !strcmp(entry->d_name + len - 5, ".json");
+}
+
+/*
+ * @brief Hash the name and raw content of a file
+ */
+STATIC HAL_ERRCODE hashFile(const char *path, const char *name, uint64_t *hash)
+{
+  char chunk[4096];
+  ssize_t len = 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    return HAL_FAIL;
+
+  *hash = fnv64(*hash, name, strlen(name) + 1);
+  while ((len = read(fd, chunk, sizeof(chunk))) > 0)
+    *hash = fnv64(*hash, chunk, (size_t)len);
+
+  close(fd);
+  return len < 0 ? HAL_FAIL : HAL_OK;
+}
+
+/*
+ * @brief Hash the name and raw content of every '*.json' in configDir,
+ *        in alphabetical order
+ */
+STATIC HAL_ERRCODE hashConfigDir(const char *configDir, uint64_t *hash)
+{
+  struct dirent **entries = NULL;
+  int entriesCount = 0, idx = 0;
+  HAL_ERRCODE err = HAL_OK;
+
+  entriesCount = scandir(configDir, &entries, jsonFileFilter, alphasort);
+  if (entriesCount < 0)
+  {
+    AFB_ApiError(NULL, "CACHE: Cannot scan config dir '%s' (%s)",
+                 configDir, strerror(errno));
+    return HAL_FAIL;
+  }
+
+  for (idx = 0; idx < entriesCount; idx++)
+  {
+    char path[HAL_CACHE_PATH_SZ];
+
+    snprintf(path, sizeof(path), "%s/%s", configDir, entries[idx]->d_name);
+    if (err == HAL_OK)
+      err = hashFile(path, entries[idx]->d_name, hash);
+
+    free(entries[idx]);
+  }
+  free(entries);
+
+  if (err != HAL_OK)
+    AFB_ApiError(NULL, "CACHE: Cannot read config files in '%s'", configDir);
+
+  return err;
+}
+
+/*
+ * @brief Hash the ctls files of the config which are not in configDir,
+ *        those are already hashed
+ */
+STATIC HAL_ERRCODE hashCtlsFiles(const char *configDir, uint64_t *hash)
+{
+  json_object *filesJ = halCacheCtlsFiles(configDir);
+  char dir[PATH_MAX];
+  int idx = 0, len = 0;
+  HAL_ERRCODE err = HAL_OK;
+
+  if (!filesJ)
+    return HAL_FAIL;
+
+  if (!realpath(configDir, dir))
+    dir[0] = '\0';
+
+  len = (int)json_object_array_length(filesJ);
+  for (idx = 0; idx < len && err == HAL_OK; idx++)
+  {
+    const char *path = json_object_get_string(json_object_array_get_idx(filesJ, idx));
+    const char *name = strrchr(path, '/');
+    char fileDir[PATH_MAX], realDir[PATH_MAX];
+
+    snprintf(fileDir, sizeof(fileDir), "%.*s", name ? (int)(name - path) : 0, path);
+    if (realpath(fileDir, realDir) && !strcmp(realDir, dir))
+      continue;
+
+    err = hashFile(path, path, hash);
+    if (err != HAL_OK)
+      AFB_ApiError(NULL, "CACHE: Cannot read ctls file '%s'", path);
+  }
+
+  json_object_put(filesJ);
+  return err;
+}
+
+/*
+ * @brief dl_iterate_phdr callback: hash the GNU build ID note of the
+ *        object holding the binding
+ */
+STATIC int buildIdCB(struct dl_phdr_info *info, size_t size, void *data)
+{
+  halCacheBuildIdT *ctx = data;
+  bool mine = false;
+  int idx = 0;
+
+  for (idx = 0; idx < info->dlpi_phnum && !mine; idx++)
+  {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[idx];
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+    mine = phdr->p_type == PT_LOAD && (uintptr_t)ctx->addr >= start &&
+           (uintptr_t)ctx->addr < start + phdr->p_memsz;
+  }
+  if (!mine)
+    return 0;
+
+  for (idx = 0; idx < info->dlpi_phnum && !ctx->found; idx++)
+  {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[idx];
+    const uint8_t *note = (const uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+    const uint8_t *end = note + phdr->p_memsz;
+
+    if (phdr->p_type != PT_NOTE)
+      continue;
+
+    while (note + sizeof(ElfW(Nhdr)) <= end)
+    {
+      const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+      const uint8_t *name = note + sizeof(ElfW(Nhdr));
+      const uint8_t *desc = name + ((nhdr->n_namesz + 3) & ~3U);
+
+      if (desc + nhdr->n_descsz > end)
+        break;
+
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          !memcmp(name, "GNU", 4))
+      {
+        *ctx->hash = fnv64(*ctx->hash, desc, nhdr->n_descsz);
+        ctx->found = true;
+        break;
+      }
+
+      note = desc + ((nhdr->n_descsz + 3) & ~3U);
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * @brief Hash what the records depend on in the binding: its build ID (or,
+ *        without one, the size and time of its file), the labels table of
+ *        hal-utilities and the halmap layout
+ */
+STATIC void hashBinding(uint64_t *hash)
+{
+  halCacheBuildIdT ctx = { .addr = (const void *)hashBinding, .hash = hash };
+  uint32_t layout[3] = { EndHalCrlTag, sizeof(alsaHalMapT), sizeof(alsaHalCtlMapT) };
+  int tag = 0;
+
+  dl_iterate_phdr(buildIdCB, &ctx);
+  if (!ctx.found)
+  {
+    Dl_info info;
+    struct stat st;
+
+    if (dladdr((const void *)hashBinding, &info) && info.dli_fname &&
+        stat(info.dli_fname, &st) == 0)
+    {
+      *hash = fnv64(*hash, &st.st_size, sizeof(st.st_size));
+      *hash = fnv64(*hash, &st.st_mtime, sizeof(st.st_mtime));
+    }
+  }
+
+  *hash = fnv64(*hash, layout, sizeof(layout));
+  for (tag = 1; tag < EndHalCrlTag && halCtlsLabels[tag]; tag++)
+    *hash = fnv64(*hash, halCtlsLabels[tag], strlen(halCtlsLabels[tag]) + 1);
+}
+
+/*
+ * @brief Find a ctls file, as the controller does: in the config
+ *        directory, then in the CONTROL_CONFIG_PATH directories
+ * @return The path, to free, or NULL if it is nowhere
+ */
+STATIC char *ctlsFileFind(const char *configDir, const char *name)
+{
+  const char *dirList = getenv("CONTROL_CONFIG_PATH");
+  const char *suffix = strstr(name, ".json") ? "" : ".json";
+  char path[PATH_MAX];
+
+  if (!dirList)
+    dirList = CONTROL_CONFIG_PATH;
+
+  snprintf(path, sizeof(path), "%s/%s%s", configDir, name, suffix);
+  if (access(path, R_OK) == 0)
+    return strdup(path);
+
+  while (*dirList)
+  {
+    size_t len = strcspn(dirList, ":");
+
+    snprintf(path, sizeof(path), "%.*s/%s%s", (int)len, dirList, name, suffix);
+    if (len && access(path, R_OK) == 0)
+      return strdup(path);
+
+    dirList += len;
+    if (*dirList)
+      dirList++;
+  }
+
+  return NULL;
+}
+
+/*
+ * @brief Get a string from the mapped cache string pool
+ * @return The string, or NULL for offset 0 or an out of range offset
+ */
+STATIC const char *cacheString(uint32_t offset)
+{
+  if (!offset || offset >= _cacheHeader->stringsSize)
+    return NULL;
+
+  return (const char *)_cacheMap + _cacheHeader->stringsOffset + offset;
+}
+
+/*
+ * @brief Append data to a growable buffer. On allocation failure the
+ *        buffer is flagged as failed, and further appends are ignored.
+ */
+STATIC void bufAppend(halCacheBufT *buf, const void *data, size_t len)
+{
+  if (buf->failed)
+    return;
+
+  if (buf->len + len > buf->alloc)
+  {
+    size_t alloc = buf->alloc ? buf->alloc : 4096;
+    char *newBuf = NULL;
+
+    while (buf->len + len > alloc)
+      alloc *= 2;
+
+    newBuf = realloc(buf->buf, alloc);
+    if (!newBuf)
+    {
+      buf->failed = true;
+      return;
+    }
+
+    buf->buf = newBuf;
+    buf->alloc = alloc;
+  }
+
+  memcpy(buf->buf + buf->len, data, len);
+  buf->len += len;
+}
+
+/*
+ * @brief Append a string to the string pool buffer
+ * @return The offset of the string in the pool, 0 for NULL
+ */
+STATIC uint32_t bufAppendString(halCacheBufT *buf, const char *str)
+{
+  size_t offset = buf->len;
+
+  if (!str)
+    return 0;
+
+  bufAppend(buf, str, strlen(str) + 1);
+
+  return (uint32_t)offset;
+}
+
+/*
+ * @brief Size the halmap of a range of cached controls, and its ramps
+ * @return The arena size taken by the halmap
+ */
+STATIC size_t cacheHalMapSize(uint32_t ctlsIdx, uint32_t ctlsCount)
+{
+  const halCacheCtlRecT *recs = NULL;
+  size_t size = HAL_ARENA_SZ(sizeof(alsaHalMapT) * (ctlsCount + 1));
+  uint32_t idx = 0;
+
+  recs = (const halCacheCtlRecT *)(_cacheMap + _cacheHeader->ctlsOffset) + ctlsIdx;
+  for (idx = 0; idx < ctlsCount; idx++)
+    if (recs[idx].type == Ramp)
+      size += halRampArenaSize();
+
+  return size;
+}
+
+/*
+ * @brief Rebuild a halmap from a range of cached controls, in the card
+ *        arena. Control names point into the mapped cache.
+ * @return A halmap array, terminated by a zeroed entry, or NULL on failure
+ */
+STATIC alsaHalMapT *cacheHalMap(halArenaT *arena, uint32_t ctlsIdx, uint32_t ctlsCount)
+{
+  const halCacheCtlRecT *recs = NULL;
+  alsaHalMapT *alsaHalMap = NULL;
+  uint32_t idx = 0;
+
+  alsaHalMap = halArenaAlloc(arena, sizeof(alsaHalMapT) * (ctlsCount + 1));
+  if (!alsaHalMap)
+  {
+    AFB_ApiError(NULL, "CACHE: Cannot allocate halmap");
+    return NULL;
+  }
+
+  recs = (const halCacheCtlRecT *)(_cacheMap + _cacheHeader->ctlsOffset) + ctlsIdx;
+  for (idx = 0; idx < ctlsCount; idx++)
+  {
+    halCtlsTypeT type = (halCtlsTypeT)recs[idx].type;
+    halCtlsTagT tag = EndHalCrlTag;
+    halRampConfigT rampConfig = {
+      .curve = (halRampCurveT)recs[idx].rampCurve,
+      .durationMs = recs[idx].rampDurationMs
+    };
+
+    // Checked on load, a record which slips through is an error, not the
+    // end of the halmap
+    if (recs[idx].type < 0 || recs[idx].type >= EndHalCtlsType ||
+        !cacheString(recs[idx].name) || !cacheString(recs[idx].role))
+    {
+      AFB_ApiError(NULL, "CACHE: Invalid ctl record %u", ctlsIdx + idx);
+      return NULL;
+    }
+
+    tag = halCtlsTagRegister(halCtlsRoleRegister(cacheString(recs[idx].role)), type);
+    if (tag == EndHalCrlTag)
+    {
+      AFB_ApiError(NULL, "CACHE: Cannot register tag of ctl '%s'", cacheString(recs[idx].name));
+      return NULL;
+    }
+
+    setupAlsaHalMapCtl(arena, &alsaHalMap[idx], tag, type,
+                       cacheString(recs[idx].name), recs[idx].value,
+                       recs[idx].minval, recs[idx].maxval,
+                       recs[idx].count, recs[idx].step, &rampConfig);
+  }
+
+  return alsaHalMap;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief List the ctls files of the config in configDir: the 'files' of
+ *        its 'ctls' section, found as the controller finds them
+ * @return A new array of paths, empty if the ctls are inline or if none
+ *         is found, or NULL if there is no config
+ */
+PUBLIC json_object *halCacheCtlsFiles(const char *configDir)
+{
+  const char *configPath = CtlConfigSearch(NULL, configDir, "config");
+  json_object *configJ = NULL, *ctlsJ = NULL, *namesJ = NULL, *filesJ = NULL;
+  int idx = 0, len = 0;
+
+  if (!configPath)
+    return NULL;
+
+  configJ = json_object_from_file(configPath);
+  if (!configJ)
+    return NULL;
+
+  filesJ = json_object_new_array();
+  if (!json_object_object_get_ex(configJ, "ctls", &ctlsJ) ||
+      !json_object_is_type(ctlsJ, json_type_object) ||
+      !json_object_object_get_ex(ctlsJ, "files", &namesJ))
+  {
+    json_object_put(configJ);
+    return filesJ;
+  }
+
+  len = json_object_is_type(namesJ, json_type_array) ? (int)json_object_array_length(namesJ) : 1;
+  for (idx = 0; idx < len; idx++)
+  {
+    json_object *nameJ = json_object_is_type(namesJ, json_type_array) ?
+                         json_object_array_get_idx(namesJ, idx) : namesJ;
+    char *path = NULL;
+
+    if (!json_object_is_type(nameJ, json_type_string))
+      continue;
+
+    path = ctlsFileFind(configDir, json_object_get_string(nameJ));
+    if (!path)
+    {
+      AFB_ApiWarning(NULL, "CACHE: ctls file '%s' not found", json_object_get_string(nameJ));
+      continue;
+    }
+
+    json_object_array_add(filesJ, json_object_new_string(path));
+    free(path);
+  }
+
+  json_object_put(configJ);
+  return filesJ;
+}
+
+/*
+ * @brief Check every card and ctl record of the mapped cache, so that a
+ *        corrupt cache is a miss rather than a partial halmap
+ * @return HAL_OK if all records are usable, HAL_FAIL otherwise
+ */
+STATIC HAL_ERRCODE checkRecords(void)
+{
+  const halCacheCardRecT *cards = (const halCacheCardRecT *)(_cacheMap + _cacheHeader->cardsOffset);
+  const halCacheCtlRecT *ctls = (const halCacheCtlRecT *)(_cacheMap + _cacheHeader->ctlsOffset);
+  uint32_t idx = 0;
+
+  for (idx = 0; idx < _cacheHeader->cardsCount; idx++)
+    if (!cacheString(cards[idx].name) || !cacheString(cards[idx].api) ||
+        (uint64_t)cards[idx].ctlsIdx + cards[idx].ctlsCount > _cacheHeader->ctlsCount)
+      return HAL_FAIL;
+
+  for (idx = 0; idx < _cacheHeader->ctlsCount; idx++)
+    if (!cacheString(ctls[idx].name) || !cacheString(ctls[idx].role) ||
+        ctls[idx].type < 0 || ctls[idx].type >= EndHalCtlsType ||
+        ctls[idx].rampCurve < 0 || ctls[idx].rampCurve >= HAL_RAMP_CURVE_END)
+      return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Hash the config inputs, and locate the cache file
+ * @param configDir : The directory holding the config and ctls files
+ * @return HAL_OK if the cache can be used, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCacheOpen(const char *configDir)
+{
+  const char *cacheDir = getenv(HAL_CACHE_DIR_ENV);
+  uint32_t version = HAL_CACHE_VERSION;
+
+  _cacheOpened = false;
+
+  if (getenv(HAL_CACHE_DISABLE_ENV))
+  {
+    AFB_ApiNotice(NULL, "CACHE: Disabled by environment");
+    return HAL_FAIL;
+  }
+
+  if (!cacheDir || !*cacheDir)
+    cacheDir = configDir;
+
+  _cacheHash = fnv64(FNV64_OFFSET, &version, sizeof(version));
+  hashBinding(&_cacheHash);
+  if (hashConfigDir(configDir, &_cacheHash) != HAL_OK ||
+      hashCtlsFiles(configDir, &_cacheHash) != HAL_OK)
+    return HAL_FAIL;
+
+  snprintf(_cachePath, sizeof(_cachePath), "%s/%s", cacheDir, HAL_CACHE_FILENAME);
+  _cacheOpened = true;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Map the cache file, and check it matches the current config
+ * @return HAL_OK if the cache is valid and loaded, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCacheLoad(void)
+{
+  const halCacheHeaderT *header = NULL;
+  struct stat st;
+  void *map = NULL;
+  int fd = -1;
+
+  if (!_cacheOpened)
+    return HAL_FAIL;
+
+  fd = open(_cachePath, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    AFB_ApiNotice(NULL, "CACHE: No cache at '%s'", _cachePath);
+    return HAL_FAIL;
+  }
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(halCacheHeaderT))
+  {
+    close(fd);
+    return HAL_FAIL;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    AFB_ApiError(NULL, "CACHE: Cannot map '%s' (%s)", _cachePath, strerror(errno));
+    return HAL_FAIL;
+  }
+
+  // Check the header, and that every section lies within the file
+  header = (const halCacheHeaderT *)map;
+  if (header->magic != HAL_CACHE_MAGIC ||
+      header->version != HAL_CACHE_VERSION ||
+      header->size != (uint64_t)st.st_size ||
+      header->hash != _cacheHash ||
+      header->cardsOffset + (uint64_t)header->cardsCount * sizeof(halCacheCardRecT) > header->size ||
+      header->ctlsOffset + (uint64_t)header->ctlsCount * sizeof(halCacheCtlRecT) > header->size ||
+      header->stringsOffset + (uint64_t)header->stringsSize > header->size ||
+      header->stringsSize == 0 ||
+      ((const char *)map)[header->stringsOffset + header->stringsSize - 1] != '\0')
+  {
+    AFB_ApiNotice(NULL, "CACHE: '%s' is stale or invalid", _cachePath);
+    munmap(map, (size_t)st.st_size);
+    return HAL_FAIL;
+  }
+
+  // The mapping is kept for the lifetime of the binding
+  _cacheMap = (const uint8_t *)map;
+  _cacheHeader = header;
+
+  if (checkRecords() != HAL_OK)
+  {
+    AFB_ApiNotice(NULL, "CACHE: '%s' has invalid records", _cachePath);
+    _cacheMap = NULL;
+    _cacheHeader = NULL;
+    munmap(map, (size_t)st.st_size);
+    return HAL_FAIL;
+  }
+
+  AFB_ApiNotice(NULL, "CACHE: Loaded '%s' (cards: %u, ctls: %u)",
+                _cachePath, header->cardsCount, header->ctlsCount);
+  return HAL_OK;
+}
+
+/*
+ * @brief Check whether a valid cache has been loaded
+ */
+PUBLIC bool halCacheIsLoaded(void)
+{
+  return _cacheHeader != NULL;
+}
+
+/*
+ * @brief Get the cached API name
+ * @return The API name, or NULL if the config did not rename the API
+ */
+PUBLIC const char *halCacheGetApi(void)
+{
+  if (!_cacheHeader)
+    return NULL;
+
+  return cacheString(_cacheHeader->api);
+}
+
+/*
+ * @brief Get the cached 'options' section
+ * @return A new 'options' object, or NULL if the config has none
+ */
+PUBLIC json_object *halCacheGetOptions(void)
+{
+  const char *options = NULL;
+
+  if (!_cacheHeader)
+    return NULL;
+
+  options = cacheString(_cacheHeader->options);
+  if (!options)
+    return NULL;
+
+  return json_tokener_parse(options);
+}
+
+/*
+ * @brief Get the cached role priorities and attenuations
+ * @return A new array, as returned by halDuckGetJ, or NULL if none
+ */
+PUBLIC json_object *halCacheGetDucking(void)
+{
+  const char *ducking = NULL;
+
+  if (!_cacheHeader)
+    return NULL;
+
+  ducking = cacheString(_cacheHeader->ducking);
+  if (!ducking)
+    return NULL;
+
+  return json_tokener_parse(ducking);
+}
+
+/*
+ * @brief Get the number of cached cards
+ */
+PUBLIC int halCacheGetCardCount(void)
+{
+  if (!_cacheHeader)
+    return 0;
+
+  return (int)_cacheHeader->cardsCount;
+}
+
+/*
+ * @brief Get a cached card, and rebuild its halmap. The cardprops and
+ *        streammap objects are new references, owned by the card.
+ * @param bindingApi : The binding API, see halCardInit
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCacheGetCard(int cardIdx, halCardT *card,
+                                   const char *bindingApi)
+{
+  const halCacheCardRecT *rec = NULL;
+
+  if (!_cacheHeader || cardIdx < 0 || cardIdx >= (int)_cacheHeader->cardsCount)
+    return HAL_FAIL;
+
+  rec = (const halCacheCardRecT *)(_cacheMap + _cacheHeader->cardsOffset) + cardIdx;
+  if ((uint64_t)rec->ctlsIdx + rec->ctlsCount > _cacheHeader->ctlsCount ||
+      !cacheString(rec->name) || !cacheString(rec->api))
+  {
+    AFB_ApiError(NULL, "CACHE: Card %d is invalid", cardIdx);
+    return HAL_FAIL;
+  }
+
+  if (halCardInit(card, bindingApi, cacheString(rec->name), cacheString(rec->api),
+                  cacheString(rec->info),
+                  cacheHalMapSize(rec->ctlsIdx, rec->ctlsCount)) != HAL_OK)
+    return HAL_FAIL;
+
+  card->cardpropsJ = json_tokener_parse(cacheString(rec->cardprops));
+  card->streammapJ = json_tokener_parse(cacheString(rec->streammap));
+  card->halmap = cacheHalMap(card->arena, rec->ctlsIdx, rec->ctlsCount);
+
+  if (!card->cardpropsJ || !card->streammapJ || !card->halmap)
+  {
+    AFB_ApiError(NULL, "CACHE: Card %d is invalid", cardIdx);
+    return HAL_FAIL;
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Write the resolved HAL cards to the cache file
+ * @param api      : The API name set by the config, or NULL
+ * @param optionsJ : The 'options' section, or NULL
+ * @param duckingJ : The role priorities, as returned by halDuckGetJ, or NULL
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCacheStore(const char *api, json_object *optionsJ,
+                                 json_object *duckingJ)
+{
+  halCacheHeaderT header;
+  halCacheBufT cardRecs = { NULL, 0, 0, false }, ctlRecs = { NULL, 0, 0, false },
+               strings = { NULL, 0, 0, false };
+  char tmpPath[HAL_CACHE_PATH_SZ + 8];
+  HAL_ERRCODE err = HAL_OK;
+  int cardIdx = 0, cardsCount = halCardsCount(), fd = -1;
+  uint32_t ctlsCount = 0;
+
+  if (!_cacheOpened)
+    return HAL_FAIL;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = HAL_CACHE_MAGIC;
+  header.version = HAL_CACHE_VERSION;
+  header.hash = _cacheHash;
+
+  // Offset 0 of the string pool stands for NULL
+  bufAppend(&strings, "", 1);
+  header.api = bufAppendString(&strings, api);
+  if (optionsJ)
+    header.options = bufAppendString(&strings,
+                       json_object_to_json_string_ext(optionsJ,
+                                                      JSON_C_TO_STRING_PLAIN));
+  if (duckingJ)
+    header.ducking = bufAppendString(&strings,
+                       json_object_to_json_string_ext(duckingJ,
+                                                      JSON_C_TO_STRING_PLAIN));
+
+  for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+  {
+    const halCardT *card = halCardGet(cardIdx);
+    halCacheCardRecT rec;
+
+    rec.name = bufAppendString(&strings, card->name);
+    rec.api = bufAppendString(&strings, card->api);
+    rec.info = bufAppendString(&strings, card->info);
+    rec.cardprops = bufAppendString(&strings,
+                      json_object_to_json_string_ext(card->cardpropsJ,
+                                                     JSON_C_TO_STRING_PLAIN));
+    rec.streammap = bufAppendString(&strings,
+                      json_object_to_json_string_ext(card->streammapJ,
+                                                     JSON_C_TO_STRING_PLAIN));
+    rec.ctlsIdx = ctlsCount;
+
+    for (rec.ctlsCount = 0; card->halmap && card->halmap[rec.ctlsCount].ctl.name; rec.ctlsCount++)
+    {
+      const alsaHalMapT *ctl = &card->halmap[rec.ctlsCount];
+      halCacheCtlRecT ctlRec;
+
+      ctlRec.role = bufAppendString(&strings, halCtlsRoleName(halCtlsTagRole(ctl->tag)));
+      ctlRec.type = (int32_t)halCtlsTypeGet(ctl->tag);
+      ctlRec.name = bufAppendString(&strings, ctl->ctl.name);
+      ctlRec.value = ctl->ctl.value;
+      ctlRec.minval = ctl->ctl.minval;
+      ctlRec.maxval = ctl->ctl.maxval;
+      ctlRec.count = ctl->ctl.count;
+      ctlRec.step = ctl->ctl.step;
+      ctlRec.rampCurve = HAL_RAMP_LINEAR;
+      ctlRec.rampDurationMs = HAL_RAMP_DURATION_MS;
+      if (ctl->cb.callback == halRampCB && ctl->cb.handle)
+      {
+        ctlRec.rampCurve = (int32_t)halRampGetConfig(ctl->cb.handle)->curve;
+        ctlRec.rampDurationMs = halRampGetConfig(ctl->cb.handle)->durationMs;
+      }
+      bufAppend(&ctlRecs, &ctlRec, sizeof(ctlRec));
+    }
+
+    ctlsCount += rec.ctlsCount;
+    bufAppend(&cardRecs, &rec, sizeof(rec));
+  }
+
+  header.cardsOffset = sizeof(header);
+  header.cardsCount = (uint32_t)cardsCount;
+  header.ctlsOffset = header.cardsOffset + (uint32_t)cardRecs.len;
+  header.ctlsCount = ctlsCount;
+  header.stringsOffset = header.ctlsOffset + (uint32_t)ctlRecs.len;
+  header.stringsSize = (uint32_t)strings.len;
+  header.size = header.stringsOffset + header.stringsSize;
+  if (cardRecs.failed || ctlRecs.failed || strings.failed)
+    err = HAL_FAIL;
+
+  // Write to a temporary file, then atomically replace the cache
+  snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", _cachePath);
+  if (err == HAL_OK)
+    fd = mkostemp(tmpPath, O_CLOEXEC);
+  if (fd < 0)
+    err = HAL_FAIL;
+
+  if (err == HAL_OK &&
+      (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+       write(fd, cardRecs.buf, cardRecs.len) != (ssize_t)cardRecs.len ||
+       write(fd, ctlRecs.buf, ctlRecs.len) != (ssize_t)ctlRecs.len ||
+       write(fd, strings.buf, strings.len) != (ssize_t)strings.len))
+    err = HAL_FAIL;
+
+  if (fd >= 0)
+  {
+    if (close(fd) < 0)
+      err = HAL_FAIL;
+    if (err == HAL_OK && rename(tmpPath, _cachePath) < 0)
+      err = HAL_FAIL;
+    if (err != HAL_OK)
+      unlink(tmpPath);
+  }
+
+  free(cardRecs.buf);
+  free(ctlRecs.buf);
+  free(strings.buf);
+
+  if (err != HAL_OK)
+  {
+    AFB_ApiWarning(NULL, "CACHE: Cannot write '%s'", _cachePath);
+    return HAL_FAIL;
+  }
+
+  AFB_ApiNotice(NULL, "CACHE: Stored '%s' (cards: %d, ctls: %u)",
+                _cachePath, cardsCount, ctlsCount);
+  return HAL_OK;
+}
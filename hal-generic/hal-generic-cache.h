@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_CACHE_H
+#define HAL_GENERIC_CACHE_H
+
+#include "hal-generic.h"
+#include "hal-generic-card.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_CACHE_FILENAME "hal-generic.cache"
+#define HAL_CACHE_DIR_ENV "HAL_GENERIC_CACHE_DIR"
+#define HAL_CACHE_DISABLE_ENV "HAL_GENERIC_NO_CACHE"
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC json_object *halCacheCtlsFiles(const char *configDir);
+PUBLIC HAL_ERRCODE halCacheOpen(const char *configDir);
+PUBLIC HAL_ERRCODE halCacheLoad(void);
+PUBLIC bool halCacheIsLoaded(void);
+
+PUBLIC const char *halCacheGetApi(void);
+PUBLIC json_object *halCacheGetOptions(void);
+PUBLIC json_object *halCacheGetDucking(void);
+PUBLIC int halCacheGetCardCount(void);
+PUBLIC HAL_ERRCODE halCacheGetCard(int cardIdx, halCardT *card,
+                                   const char *bindingApi);
+
+PUBLIC HAL_ERRCODE halCacheStore(const char *api, json_object *optionsJ,
+                                 json_object *duckingJ);
+
+#endif /* HAL_GENERIC_CACHE_H */
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-card.h"
+#include "hal-generic-utility.h"
+#include "hal-generic-ramp.h"
+#include "hal-generic-batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halCardT *_cards = NULL;
+static int _cardsCount = 0;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC void closeShm(void *ptr);
+STATIC alsaHalMapT *halCtlsMap(halCardT *card);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the halmap to register with hal-utilities, which indexes
+ *        halCtlsLabels by tag: the entries with a HAL enum tag. Without
+ *        dynamic tags, this is the card halmap itself, else a copy.
+ * @return A halmap array, terminated by a zeroed entry, or NULL on failure
+ */
+STATIC alsaHalMapT *halCtlsMap(halCardT *card)
+{
+  alsaHalMapT *halCtls = NULL;
+  int idx = 0, ctlsCount = 0, staticCount = 0;
+
+  if (!card->halmap)
+    return NULL;
+
+  for (idx = 0; card->halmap[idx].ctl.name; idx++)
+    if (halCtlsTagIsStatic(card->halmap[idx].tag))
+      staticCount++;
+  ctlsCount = idx;
+
+  if (staticCount == ctlsCount)
+    return card->halmap;
+
+  halCtls = halArenaAlloc(card->arena, sizeof(alsaHalMapT) * (staticCount + 1));
+  if (!halCtls)
+    return NULL;
+
+  for (idx = 0, staticCount = 0; idx < ctlsCount; idx++)
+    if (halCtlsTagIsStatic(card->halmap[idx].tag))
+      halCtls[staticCount++] = card->halmap[idx];
+  memset(&halCtls[staticCount], 0, sizeof(alsaHalMapT));
+
+  return halCtls;
+}
+
+/*
+ * @brief Arena release hook: close the payload memfd of a card
+ */
+STATIC void closeShm(void *ptr)
+{
+  halCardT *card = (halCardT *)ptr;
+
+  if (card->shmFd >= 0)
+    close(card->shmFd);
+  card->shmFd = -1;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Allocate the HAL card instances
+ * @param cardsCount : The number of cards
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCardsAlloc(int cardsCount)
+{
+  _cards = calloc((size_t)cardsCount + 1, sizeof(halCardT));
+  if (!_cards)
+  {
+    AFB_ApiError(NULL, "CARD: Cannot allocate %d cards", cardsCount);
+    return HAL_FAIL;
+  }
+
+  _cardsCount = cardsCount;
+  return HAL_OK;
+}
+
+/*
+ * @brief Get the number of HAL card instances
+ */
+PUBLIC int halCardsCount(void)
+{
+  return _cardsCount;
+}
+
+/*
+ * @brief Get a HAL card instance by index
+ * @return The card, or NULL if out of range
+ */
+PUBLIC halCardT *halCardGet(int cardIdx)
+{
+  if (cardIdx < 0 || cardIdx >= _cardsCount)
+    return NULL;
+
+  return &_cards[cardIdx];
+}
+
+/*
+ * @brief Get a HAL card instance by card name
+ * @return The card, or NULL if not found
+ */
+PUBLIC halCardT *halCardGetByName(const char *name)
+{
+  int cardIdx = 0;
+
+  for (cardIdx = 0; name && cardIdx < _cardsCount; cardIdx++)
+    if (_cards[cardIdx].name && !strcmp(_cards[cardIdx].name, name))
+      return &_cards[cardIdx];
+
+  return NULL;
+}
+
+/*
+ * @brief Set up a card and its arena, which owns its strings, its halmap
+ *        and its 'cardprops' and 'streammap' references. A v2 binding
+ *        exports a single API, the binding API serves the HAL ctls.
+ * @param bindingApi : The binding API
+ * @param name       : The card name, copied
+ * @param api        : The HAL plugin API, copied
+ * @param info       : The card info, copied, or NULL
+ * @param halmapSize : The size of the halmap, as counted by sizeAlsaHalMap
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCardInit(halCardT *card,
+                               const char *bindingApi,
+                               const char *name,
+                               const char *api,
+                               const char *info,
+                               size_t halmapSize)
+{
+  size_t prefixSize = strlen(bindingApi) + 1;
+  size_t size = halmapSize + HAL_ARENA_STR_SZ(name) + HAL_ARENA_STR_SZ(api) +
+                HAL_ARENA_STR_SZ(info) + HAL_ARENA_SZ(prefixSize) +
+                3 * HAL_ARENA_RELEASE_SZ;
+
+  card->shmFd = -1;
+  card->arena = halArenaNew(size);
+  if (!card->arena)
+    return HAL_FAIL;
+
+  card->name = halArenaStrdup(card->arena, name);
+  card->api = halArenaStrdup(card->arena, api);
+  card->info = halArenaStrdup(card->arena, info);
+  card->prefix = halArenaAlloc(card->arena, prefixSize);
+
+  if (!card->name || !card->api || (info && !card->info) || !card->prefix ||
+      halArenaOwnJ(card->arena, &card->cardpropsJ) != HAL_OK ||
+      halArenaOwnJ(card->arena, &card->streammapJ) != HAL_OK ||
+      halArenaOnFree(card->arena, closeShm, card) != HAL_OK)
+  {
+    AFB_ApiError(NULL, "CARD: Cannot allocate '%s'", name);
+    halCardRelease(card);
+    return HAL_FAIL;
+  }
+
+  strcpy(card->prefix, bindingApi);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Tear down a card: its arena, and all it owns, is freed at once
+ */
+PUBLIC void halCardRelease(halCardT *card)
+{
+  halArenaFree(card->arena);
+  memset(card, 0, sizeof(halCardT));
+}
+
+/*
+ * @brief Register the halmap of a HAL card, once its HAL plugin has been
+ *        initialized. hal-utilities holds a single sound card, which is
+ *        the first card: it carries the ctls of every role. The other
+ *        cards have an empty halmap, there is nothing to register.
+ *        hal-utilities only knows the tags of the HAL enum: the ctls with
+ *        a dynamic tag are created by the binding, see halBatchAddCtls.
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCardRegister(halCardT *card)
+{
+  alsaHalMapT *halCtls = NULL;
+  int err = 0, idx = 0, staticIdx = 0;
+
+  if (card != &_cards[HAL_CARD_HAL_IDX])
+  {
+    card->registered = true;
+    AFB_ApiNotice(NULL, "CARD: '%s' ready, its ctls are served by '%s'",
+                  card->name, _cards[HAL_CARD_HAL_IDX].name);
+    return HAL_OK;
+  }
+
+  halCtls = halCtlsMap(card);
+  if (!halCtls)
+  {
+    AFB_ApiError(NULL, "CARD: '%s' cannot allocate its HAL ctls", card->name);
+    return HAL_FAIL;
+  }
+
+  // HAL sound card mapping info
+  card->sndcard.name = card->name;
+  card->sndcard.info = card->info;
+  card->sndcard.ctls = halCtls;
+  card->sndcard.volumeCB = NULL; // Use default volume normalization function
+
+  // Register the HAL with the loaded sound card halmap
+  err = halServiceInit(card->prefix, &card->sndcard);
+  if (err)
+  {
+    AFB_ApiError(NULL, "Cannot initialize ALSA soundcard: %s", card->name);
+    return HAL_FAIL;
+  }
+
+  // Get back the numids resolved by hal-utilities in the copy, if any
+  for (idx = 0; halCtls != card->halmap && card->halmap[idx].ctl.name; idx++)
+    if (halCtlsTagIsStatic(card->halmap[idx].tag))
+      card->halmap[idx].ctl.numid = halCtls[staticIdx++].ctl.numid;
+
+  if (halBatchAddCtls(card) != HAL_OK)
+  {
+    AFB_ApiError(NULL, "CARD: '%s' cannot create the ctls of its dynamic tags", card->name);
+    return HAL_FAIL;
+  }
+
+  halRampBind(card);
+  card->hal = true;
+  card->registered = true;
+  AFB_ApiNotice(NULL, "CARD: '%s' registered (prefix: '%s')", card->name, card->prefix);
+  return HAL_OK;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_CARD_H
+#define HAL_GENERIC_CARD_H
+
+#include "hal-generic.h"
+#include "hal-generic-arena.h"
+#include "hal-interface.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+/*
+ * One instance per sound card, each with its own HAL plugin, payloads and
+ * halmap. hal-utilities keeps a single alsaHalSndCard for the binding API,
+ * so the first card is the HAL card: its halmap carries the ctls of every
+ * role, and its streammap every stream. The other cards have their plugin
+ * initialized with the streams routed to them, but no HAL ctls. Everything
+ * a card derives from the config lives in its arena.
+ */
+#define HAL_CARD_HAL_IDX 0    // Card registered with hal-utilities
+
+typedef struct {
+  const char *name;           // ALSA card name, MUST match with 'aplay -l'
+  const char *api;            // HAL plugin AFB API
+  const char *info;
+  char *prefix;               // API serving the HAL ctls, the binding API
+  json_object *cardpropsJ;    // 'cardprops' sent to the HAL plugin
+  json_object *streammapJ;    // 'streammap' sent to the HAL plugin
+  alsaHalMapT *halmap;        // Ctls of every role on the HAL card, else empty
+  alsaHalSndCardT sndcard;    // alsaHalSndCard for alsacore
+  bool registered;            // Card ready, its HAL plugin initialized
+  bool hal;                   // halmap registered with hal-utilities
+  int shmFd;                  // Payload memfd sent to the HAL plugin, -1 if none
+  halArenaT *arena;           // Owns the card strings, halmap and payloads
+} halCardT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halCardsAlloc(int cardsCount);
+PUBLIC int halCardsCount(void);
+PUBLIC halCardT *halCardGet(int cardIdx);
+PUBLIC halCardT *halCardGetByName(const char *name);
+
+PUBLIC HAL_ERRCODE halCardInit(halCardT *card,
+                               const char *bindingApi,
+                               const char *name,
+                               const char *api,
+                               const char *info,
+                               size_t halmapSize);
+PUBLIC void halCardRelease(halCardT *card);
+PUBLIC HAL_ERRCODE halCardRegister(halCardT *card);
+
+#endif /* HAL_GENERIC_CARD_H */
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Coalescing of control change events.
+ *
+ * Events are keyed by event name and control numid ('id'). The first event
+ * of an idle control is delivered at once, and the control becomes hot
+ * for one window. Further events of a hot control only replace its
+ * pending value. At the end of each window, pending values are delivered
+ * and their control stays hot for another window; controls with nothing
+ * pending go idle, and the timer stops once no control is hot.
+ *
+ * A control is thus delivered at most once per window, and its latest
+ * value is always delivered within one window of the last change.
+ */
+
+#include "hal-generic-coalesce.h"
+#include "wrap-json.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_COALESCE_MAX 256
+#define HAL_COALESCE_HASH_SZ 512 // Power of 2, > HAL_COALESCE_MAX
+#define USEC_PER_MSEC 1000ULL
+
+typedef struct {
+  char *evtname;            // NULL if the slot is free
+  int numid;
+  uint32_t hash;
+  bool hot;                 // Delivered during the current window
+  json_object *pendingJ;    // Latest undelivered event, if any
+} halCoalesceEntryT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static uint64_t _windowUsec = 0;
+static halEventCbT _deliver = NULL;
+static void *_deliverClosure = NULL;
+
+static halCoalesceEntryT _entries[HAL_COALESCE_HASH_SZ];
+static int _entriesCount = 0;
+static halCoalesceEntryT *_hot[HAL_COALESCE_MAX];    // Hot entries
+static int _hotCount = 0;
+static sd_event_source *_timer = NULL;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint32_t keyHash(const char *evtname, int numid);
+STATIC halCoalesceEntryT *entryGet(const char *evtname, int numid);
+STATIC HAL_ERRCODE armTimer(void);
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief FNV-1a hash of an event name and control numid
+ */
+STATIC uint32_t keyHash(const char *evtname, int numid)
+{
+  uint32_t hash = 2166136261u;
+  size_t idx = 0;
+
+  while (*evtname)
+  {
+    hash ^= (uint8_t)*evtname++;
+    hash *= 16777619u;
+  }
+
+  for (idx = 0; idx < sizeof(numid); idx++)
+  {
+    hash ^= (uint8_t)((unsigned)numid >> (idx * 8));
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * @brief Find or add the entry of a control
+ * @return The entry, or NULL if the table is full
+ */
+STATIC halCoalesceEntryT *entryGet(const char *evtname, int numid)
+{
+  uint32_t hash = keyHash(evtname, numid);
+  uint32_t slot = hash & (HAL_COALESCE_HASH_SZ - 1);
+
+  while (_entries[slot].evtname)
+  {
+    if (_entries[slot].hash == hash && _entries[slot].numid == numid &&
+        !strcmp(_entries[slot].evtname, evtname))
+      return &_entries[slot];
+
+    slot = (slot + 1) & (HAL_COALESCE_HASH_SZ - 1);
+  }
+
+  if (_entriesCount >= HAL_COALESCE_MAX)
+    return NULL;
+
+  _entries[slot].evtname = strdup(evtname);
+  if (!_entries[slot].evtname)
+    return NULL;
+  _entries[slot].numid = numid;
+  _entries[slot].hash = hash;
+  _entriesCount++;
+
+  return &_entries[slot];
+}
+
+/*
+ * @brief Arm the window timer
+ */
+STATIC HAL_ERRCODE armTimer(void)
+{
+  struct timespec ts;
+  uint64_t usec = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  usec = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL + _windowUsec;
+
+  if (!_timer)
+  {
+    if (sd_event_add_time(afb_daemon_get_event_loop(), &_timer, CLOCK_MONOTONIC,
+                          usec, USEC_PER_MSEC, timerCB, NULL) < 0)
+    {
+      _timer = NULL;
+      return HAL_FAIL;
+    }
+    return HAL_OK;
+  }
+
+  if (sd_event_source_set_time(_timer, usec) < 0 ||
+      sd_event_source_set_enabled(_timer, SD_EVENT_ONESHOT) < 0)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief End of window: deliver pending values, and cool down idle controls
+ */
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  int idx = 0, hotCount = 0;
+
+  for (idx = 0; idx < _hotCount; idx++)
+  {
+    halCoalesceEntryT *entry = _hot[idx];
+
+    if (!entry->pendingJ)
+    {
+      entry->hot = false;
+      continue;
+    }
+
+    _deliver(_deliverClosure, entry->evtname, entry->pendingJ);
+    json_object_put(entry->pendingJ);
+    entry->pendingJ = NULL;
+    _hot[hotCount++] = entry;
+  }
+  _hotCount = hotCount;
+
+  if (_hotCount > 0 && armTimer() != HAL_OK)
+    halCoalesceFlush();
+
+  return 0;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Set up event coalescing
+ * @param windowMs : The coalescing window, 0 delivers every event at once
+ * @param deliver  : Called with the events to deliver
+ * @param closure  : Passed to deliver
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halCoalesceInit(int windowMs, halEventCbT deliver, void *closure)
+{
+  if (!deliver || windowMs < 0)
+    return HAL_FAIL;
+
+  halCoalesceFlush();
+
+  _windowUsec = (uint64_t)windowMs * USEC_PER_MSEC;
+  _deliver = deliver;
+  _deliverClosure = closure;
+
+  AFB_ApiNotice(NULL, "COALESCE: window %d ms", windowMs);
+  return HAL_OK;
+}
+
+/*
+ * @brief Deliver a control change event, or hold it until the end of the
+ *        current window if its control is hot. Events without a control
+ *        numid are delivered at once.
+ */
+PUBLIC void halCoalescePush(const char *evtname, json_object *eventJ)
+{
+  halCoalesceEntryT *entry = NULL;
+  json_object *numidJ = NULL;
+
+  if (!_deliver)
+    return;
+
+  if (!_windowUsec ||
+      !json_object_object_get_ex(eventJ, "id", &numidJ) ||
+      !(entry = entryGet(evtname, json_object_get_int(numidJ))))
+  {
+    _deliver(_deliverClosure, evtname, eventJ);
+    return;
+  }
+
+  if (entry->hot)
+  {
+    // Only the latest value of the window is delivered
+    if (entry->pendingJ)
+      json_object_put(entry->pendingJ);
+    entry->pendingJ = json_object_get(eventJ);
+    return;
+  }
+
+  _deliver(_deliverClosure, evtname, eventJ);
+
+  if (_hotCount == 0 && armTimer() != HAL_OK)
+    return; // No timer, stay uncoalesced
+
+  entry->hot = true;
+  _hot[_hotCount++] = entry;
+}
+
+/*
+ * @brief Change the coalescing window, pending events are flushed
+ */
+PUBLIC void halCoalesceSetWindow(int windowMs)
+{
+  if (windowMs < 0 || (uint64_t)windowMs * USEC_PER_MSEC == _windowUsec)
+    return;
+
+  halCoalesceFlush();
+  _windowUsec = (uint64_t)windowMs * USEC_PER_MSEC;
+
+  AFB_ApiNotice(NULL, "COALESCE: window %d ms", windowMs);
+}
+
+/*
+ * @brief Deliver all pending events now, and cool down all controls
+ */
+PUBLIC void halCoalesceFlush(void)
+{
+  int idx = 0;
+
+  for (idx = 0; idx < _hotCount; idx++)
+  {
+    halCoalesceEntryT *entry = _hot[idx];
+
+    if (entry->pendingJ && _deliver)
+    {
+      _deliver(_deliverClosure, entry->evtname, entry->pendingJ);
+      json_object_put(entry->pendingJ);
+      entry->pendingJ = NULL;
+    }
+    entry->hot = false;
+  }
+  _hotCount = 0;
+
+  if (_timer)
+    sd_event_source_set_enabled(_timer, SD_EVENT_OFF);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_COALESCE_H
+#define HAL_GENERIC_COALESCE_H
+
+#include "hal-generic.h"
+#include "hal-generic-events.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halCoalesceInit(int windowMs, halEventCbT deliver, void *closure);
+PUBLIC void halCoalescePush(const char *evtname, json_object *eventJ);
+PUBLIC void halCoalesceFlush(void);
+PUBLIC void halCoalesceSetWindow(int windowMs);
+
+#endif /* HAL_GENERIC_COALESCE_H */
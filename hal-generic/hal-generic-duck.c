@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Role priority and ducking engine.
+ *
+ * Each stream declares a 'priority' and a 'duck' attenuation (in %). While
+ * a role is acquired, every role of lower priority is attenuated by its
+ * 'duck'; when several acquired roles duck the same role, the strongest
+ * attenuation applies. The roles are kept sorted by priority, so the gains
+ * are recomputed in a single pass on each acquire or release, and only the
+ * roles whose gain changed are applied: one 'ctlget' batch per card to
+ * save the volume of newly ducked roles, and one 'ctlset' batch per card
+ * for all the new volumes. The saved volume is restored when a role is no
+ * longer ducked.
+ */
+
+#include "hal-generic-duck.h"
+#include "hal-generic-batch.h"
+#include "hal-generic-tags.h"
+#include "wrap-json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_DUCK_VOLUME_UNKNOWN (-1)
+
+typedef struct {
+  const char *role;
+  halCtlsTagT volumeTag;
+  int priority;
+  int duck;                 // Attenuation of lower priority roles, in %
+  int acquired;             // Acquire count
+  int gain;                 // Applied gain, in %
+  int newGain;
+  int *volumes;             // Saved volume of each card, in %
+} halDuckRoleT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halDuckRoleT _roles[HAL_DUCK_ROLES_MAX]; // Sorted by priority, highest first
+static int _rolesCount = 0;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC int roleCompare(const void *a, const void *b);
+STATIC halDuckRoleT *roleGet(const char *role);
+STATIC HAL_ERRCODE addRole(halDuckRoleT *roles, int *rolesCount,
+                           const char *roleName, int priority, int duck);
+STATIC void releaseRoles(halDuckRoleT *roles, int rolesCount);
+STATIC void commitRoles(halDuckRoleT *roles, int rolesCount);
+STATIC int computeGains(void);
+STATIC void applyCard(halCardT *card, int cardIdx);
+STATIC json_object *gainsJ(void);
+STATIC void duckVerb(struct afb_req request, bool acquire);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief qsort comparator, by decreasing priority
+ */
+STATIC int roleCompare(const void *a, const void *b)
+{
+  return ((const halDuckRoleT *)b)->priority - ((const halDuckRoleT *)a)->priority;
+}
+
+/*
+ * @brief Find a role
+ */
+STATIC halDuckRoleT *roleGet(const char *role)
+{
+  int idx = 0;
+
+  for (idx = 0; role && idx < _rolesCount; idx++)
+    if (!strcmp(_roles[idx].role, role))
+      return &_roles[idx];
+
+  return NULL;
+}
+
+/*
+ * @brief Add a role to a new set of roles, copying the state of a role
+ *        which already exists: the running roles stay intact until the
+ *        new set is committed. The first stream of a role wins.
+ * @return HAL_OK on success, or if the role is skipped, HAL_FAIL otherwise
+ */
+STATIC HAL_ERRCODE addRole(halDuckRoleT *roles, int *rolesCount,
+                           const char *roleName, int priority, int duck)
+{
+  halDuckRoleT *role = &roles[*rolesCount], *prevRole = NULL;
+  int roleIdx = 0;
+
+  if (!roleName)
+    return HAL_OK;
+  for (roleIdx = 0; roleIdx < *rolesCount; roleIdx++)
+    if (!strcmp(roles[roleIdx].role, roleName))
+      return HAL_OK;
+
+  if (*rolesCount >= HAL_DUCK_ROLES_MAX)
+  {
+    AFB_ApiError(NULL, "DUCK: Too many roles, cannot add '%s'", roleName);
+    return HAL_FAIL;
+  }
+
+  prevRole = roleGet(roleName);
+  if (prevRole)
+  {
+    *role = *prevRole;
+    role->volumes = NULL;
+  }
+  else
+  {
+    memset(role, 0, sizeof(halDuckRoleT));
+    role->gain = 100;
+  }
+
+  role->role = strdup(roleName);
+  if (!role->role)
+    return HAL_FAIL;
+
+  // The cards cannot change at runtime, nor the size of the volumes
+  if (prevRole && prevRole->volumes)
+  {
+    size_t size = sizeof(int) * (size_t)(halCardsCount() > 0 ? halCardsCount() : 1);
+
+    role->volumes = malloc(size);
+    if (!role->volumes)
+    {
+      free((char *)role->role);
+      return HAL_FAIL;
+    }
+    memcpy(role->volumes, prevRole->volumes, size);
+  }
+
+  role->volumeTag = halCtlsTagGet(roleName, Volume);
+  role->priority = priority;
+  role->duck = duck;
+  (*rolesCount)++;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Release a set of roles
+ */
+STATIC void releaseRoles(halDuckRoleT *roles, int rolesCount)
+{
+  int idx = 0;
+
+  for (idx = 0; idx < rolesCount; idx++)
+  {
+    free((char *)roles[idx].role);
+    free(roles[idx].volumes);
+  }
+}
+
+/*
+ * @brief Replace the roles with a new set, releasing the running ones
+ */
+STATIC void commitRoles(halDuckRoleT *roles, int rolesCount)
+{
+  releaseRoles(_roles, _rolesCount);
+
+  memcpy(_roles, roles, sizeof(halDuckRoleT) * (size_t)rolesCount);
+  _rolesCount = rolesCount;
+  qsort(_roles, (size_t)_rolesCount, sizeof(halDuckRoleT), roleCompare);
+}
+
+/*
+ * @brief Compute the gain of every role, in a single pass over the roles
+ *        sorted by priority
+ * @return The number of roles whose gain changed
+ */
+STATIC int computeGains(void)
+{
+  int idx = 0, changed = 0;
+  int duck = 0;             // Strongest duck of the acquired higher priority roles
+  int levelDuck = 0;        // Strongest duck of the acquired roles of this priority
+
+  for (idx = 0; idx < _rolesCount; idx++)
+  {
+    if (idx > 0 && _roles[idx].priority != _roles[idx - 1].priority)
+    {
+      if (levelDuck > duck)
+        duck = levelDuck;
+      levelDuck = 0;
+    }
+
+    _roles[idx].newGain = 100 - duck;
+    if (_roles[idx].newGain != _roles[idx].gain)
+      changed++;
+
+    if (_roles[idx].acquired > 0 && _roles[idx].duck > levelDuck)
+      levelDuck = _roles[idx].duck;
+  }
+
+  return changed;
+}
+
+/*
+ * @brief Apply the changed gains to a card
+ */
+STATIC void applyCard(halCardT *card, int cardIdx)
+{
+  halBatchCtlT ctls[HAL_BATCH_CTLS_MAX];
+  json_object *resultsJ = NULL;
+  int idx = 0, ctlsCount = 0;
+
+  if (!card->registered)
+    return;
+
+  // Save the volume of the roles being ducked
+  for (idx = 0; idx < _rolesCount && ctlsCount < HAL_BATCH_CTLS_MAX; idx++)
+  {
+    halDuckRoleT *role = &_roles[idx];
+
+    if (role->volumes && role->newGain < 100 &&
+        role->volumes[cardIdx] == HAL_DUCK_VOLUME_UNKNOWN)
+    {
+      ctls[ctlsCount].tag = role->volumeTag;
+      ctls[ctlsCount].valJ = NULL;
+      ctls[ctlsCount].card = NULL;
+      ctlsCount++;
+    }
+  }
+
+  if (ctlsCount)
+  {
+    int resultsIdx = 0;
+
+    resultsJ = json_object_new_array();
+    halBatchApply(card, ctls, ctlsCount, resultsJ);
+
+    for (resultsIdx = 0; resultsIdx < (int)json_object_array_length(resultsJ); resultsIdx++)
+    {
+      int tag = EndHalCrlTag, volume = HAL_DUCK_VOLUME_UNKNOWN;
+      json_object *valJ = NULL;
+
+      wrap_json_unpack(json_object_array_get_idx(resultsJ, resultsIdx),
+                       "{s:i,s?o}", "tag", &tag, "val", &valJ);
+      if (json_object_is_type(valJ, json_type_array))
+        valJ = json_object_array_get_idx(valJ, 0);
+      if (valJ)
+        volume = json_object_get_int(valJ);
+
+      for (idx = 0; idx < _rolesCount; idx++)
+        if (_roles[idx].volumes && (int)_roles[idx].volumeTag == tag)
+          _roles[idx].volumes[cardIdx] = volume;
+    }
+    json_object_put(resultsJ);
+  }
+
+  // Set the new volumes
+  ctlsCount = 0;
+  for (idx = 0; idx < _rolesCount && ctlsCount < HAL_BATCH_CTLS_MAX; idx++)
+  {
+    halDuckRoleT *role = &_roles[idx];
+    int volume = role->volumes ? role->volumes[cardIdx] : HAL_DUCK_VOLUME_UNKNOWN;
+
+    if (role->newGain == role->gain || volume == HAL_DUCK_VOLUME_UNKNOWN)
+      continue;
+
+    ctls[ctlsCount].tag = role->volumeTag;
+    ctls[ctlsCount].valJ = json_object_new_int(volume * role->newGain / 100);
+    ctls[ctlsCount].card = NULL;
+    ctlsCount++;
+
+    // Not ducked anymore, the saved volume is restored
+    if (role->newGain == 100)
+      role->volumes[cardIdx] = HAL_DUCK_VOLUME_UNKNOWN;
+  }
+
+  if (ctlsCount && halBatchApply(card, ctls, ctlsCount, NULL) != HAL_OK)
+    AFB_ApiWarning(NULL, "DUCK: Cannot apply gains to card '%s'", card->name);
+
+  for (idx = 0; idx < ctlsCount; idx++)
+    json_object_put(ctls[idx].valJ);
+}
+
+/*
+ * @brief Describe the state of every role
+ */
+STATIC json_object *gainsJ(void)
+{
+  json_object *rolesJ = json_object_new_array();
+  int idx = 0;
+
+  for (idx = 0; idx < _rolesCount; idx++)
+  {
+    json_object *roleJ = NULL;
+
+    wrap_json_pack(&roleJ, "{s:s,s:i,s:b,s:i}",
+                   "role", _roles[idx].role,
+                   "priority", _roles[idx].priority,
+                   "acquired", _roles[idx].acquired > 0,
+                   "gain", _roles[idx].gain);
+    json_object_array_add(rolesJ, roleJ);
+  }
+
+  return rolesJ;
+}
+
+/*
+ * @brief Common part of the 'roleacquire' and 'rolerelease' verbs
+ */
+STATIC void duckVerb(struct afb_req request, bool acquire)
+{
+  const char *role = afb_req_value(request, "role");
+
+  if (!role)
+  {
+    afb_req_fail(request, "invalid-args", "Expected { \"role\": string }");
+    return;
+  }
+
+  if (halDuckAcquire(role, acquire) != HAL_OK)
+  {
+    afb_req_fail_f(request, "unknown-role", "Unknown or unreleased role: %s", role);
+    return;
+  }
+
+  afb_req_success(request, gainsJ(), NULL);
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Load the role priorities and attenuations. On a reload, the roles
+ *        which still exist keep their acquire count and saved volumes.
+ * @param streamsJ : The 'streams' section, or a cached halDuckGetJ array
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halDuckLoad(json_object *streamsJ)
+{
+  halDuckRoleT roles[HAL_DUCK_ROLES_MAX];
+  int idx = 0, len = 0, rolesCount = 0;
+
+  if (json_object_is_type(streamsJ, json_type_array))
+    len = json_object_array_length(streamsJ);
+
+  for (idx = 0; idx < len; idx++)
+  {
+    char *roleName = NULL;
+    int priority = HAL_DUCK_PRIORITY, duck = HAL_DUCK_ATTENUATION;
+
+    wrap_json_unpack(json_object_array_get_idx(streamsJ, idx), "{s:s,s?i,s?i}",
+                     "role", &roleName, "priority", &priority, "duck", &duck);
+    if (addRole(roles, &rolesCount, roleName, priority, duck) != HAL_OK)
+    {
+      releaseRoles(roles, rolesCount);
+      return HAL_FAIL;
+    }
+  }
+
+  commitRoles(roles, rolesCount);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Load the role priorities and attenuations from the streams of a
+ *        config model
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halDuckLoadModel(const halModelT *model)
+{
+  halDuckRoleT roles[HAL_DUCK_ROLES_MAX];
+  int idx = 0, rolesCount = 0;
+
+  for (idx = 0; idx < model->streamsCount; idx++)
+  {
+    const halModelStreamT *stream = &model->streams[idx];
+
+    if (addRole(roles, &rolesCount, stream->role, stream->priority,
+                stream->duck) != HAL_OK)
+    {
+      releaseRoles(roles, rolesCount);
+      return HAL_FAIL;
+    }
+  }
+
+  commitRoles(roles, rolesCount);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Get the role priorities and attenuations, to store in the cache
+ */
+PUBLIC json_object *halDuckGetJ(void)
+{
+  json_object *rolesJ = json_object_new_array();
+  int idx = 0;
+
+  for (idx = 0; idx < _rolesCount; idx++)
+  {
+    json_object *roleJ = NULL;
+
+    wrap_json_pack(&roleJ, "{s:s,s:i,s:i}",
+                   "role", _roles[idx].role,
+                   "priority", _roles[idx].priority,
+                   "duck", _roles[idx].duck);
+    json_object_array_add(rolesJ, roleJ);
+  }
+
+  return rolesJ;
+}
+
+/*
+ * @brief Acquire or release a role, and apply the resulting gains
+ * @return HAL_OK on success, HAL_FAIL if the role is unknown, or released
+ *         more than acquired
+ */
+PUBLIC HAL_ERRCODE halDuckAcquire(const char *role, bool acquire)
+{
+  halDuckRoleT *duckRole = roleGet(role);
+  int idx = 0, cardIdx = 0, cardsCount = halCardsCount();
+
+  if (!duckRole || (!acquire && duckRole->acquired == 0))
+    return HAL_FAIL;
+
+  duckRole->acquired += acquire ? 1 : -1;
+
+  // Only roles which duck others change gains
+  if (duckRole->duck == 0 || computeGains() == 0)
+    return HAL_OK;
+
+  for (idx = 0; idx < _rolesCount; idx++)
+  {
+    // The volume tag of a role is registered with its ctls, after the roles
+    if (_roles[idx].volumeTag == EndHalCrlTag)
+      _roles[idx].volumeTag = halCtlsTagGet(_roles[idx].role, Volume);
+    if (_roles[idx].volumes || _roles[idx].volumeTag == EndHalCrlTag)
+      continue;
+
+    _roles[idx].volumes = malloc(sizeof(int) * (size_t)(cardsCount > 0 ? cardsCount : 1));
+    if (!_roles[idx].volumes)
+      return HAL_FAIL;
+    for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+      _roles[idx].volumes[cardIdx] = HAL_DUCK_VOLUME_UNKNOWN;
+  }
+
+  for (cardIdx = 0; cardIdx < cardsCount; cardIdx++)
+    applyCard(halCardGet(cardIdx), cardIdx);
+
+  for (idx = 0; idx < _rolesCount; idx++)
+    _roles[idx].gain = _roles[idx].newGain;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief 'roleacquire' verb: acquire a role, ducking lower priority roles
+ */
+PUBLIC void halDuckAcquireVerb(struct afb_req request)
+{
+  duckVerb(request, true);
+}
+
+/*
+ * @brief 'rolerelease' verb: release a role, restoring the roles it ducked
+ */
+PUBLIC void halDuckReleaseVerb(struct afb_req request)
+{
+  duckVerb(request, false);
+}
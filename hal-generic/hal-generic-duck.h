@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_DUCK_H
+#define HAL_GENERIC_DUCK_H
+
+#include "hal-generic.h"
+#include "hal-generic-model.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_DUCK_ROLES_MAX 32
+#define HAL_DUCK_PRIORITY 0       // Default stream priority
+#define HAL_DUCK_ATTENUATION 0    // Default attenuation of lower priority streams, in %
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halDuckLoad(json_object *streamsJ);
+PUBLIC HAL_ERRCODE halDuckLoadModel(const halModelT *model);
+PUBLIC json_object *halDuckGetJ(void);
+PUBLIC HAL_ERRCODE halDuckAcquire(const char *role, bool acquire);
+
+PUBLIC void halDuckAcquireVerb(struct afb_req request);
+PUBLIC void halDuckReleaseVerb(struct afb_req request);
+
+#endif /* HAL_GENERIC_DUCK_H */
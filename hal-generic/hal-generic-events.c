@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Event dispatch table.
+ *
+ * Events are named '<api>/<event>'. Handlers are registered per API, in an
+ * open addressing hash keyed by the API name. Dispatching an event hashes
+ * its API prefix in place (no copy, no allocation) and probes the table
+ * once, so the cost does not depend on the number of APIs. An API may have
+ * several handlers (e.g. cards sharing a HAL plugin API), chained in their
+ * registration order, and all called. Events with no registered API go to
+ * the default handler.
+ */
+
+#include "hal-generic-events.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_EVENTS_MAX 32
+#define HAL_EVENTS_HASH_SZ 64 // Power of 2, > HAL_EVENTS_MAX
+#define HAL_EVENTS_HANDLERS_MAX 128
+
+typedef struct halEventChain {
+  halEventCbT callback;
+  void *closure;
+  struct halEventChain *next;
+} halEventChainT;
+
+typedef struct {
+  char *api;            // NULL if the slot is free
+  size_t apiLen;
+  uint32_t hash;
+  halEventChainT *first;
+  halEventChainT *last;
+} halEventHandlerT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halEventHandlerT _handlers[HAL_EVENTS_HASH_SZ];
+static int _handlersCount = 0;
+static halEventChainT _chains[HAL_EVENTS_HANDLERS_MAX];
+static int _chainsCount = 0;
+static halEventChainT _defaultHandler = { .callback = NULL };
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint32_t apiHash(const char *evtname, size_t *apiLen);
+STATIC halEventHandlerT *handlerLookup(const char *api, size_t apiLen, uint32_t hash);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief FNV-1a hash of the API prefix of an event name, up to the first
+ *        '/' (or the whole name if there is none)
+ */
+STATIC uint32_t apiHash(const char *evtname, size_t *apiLen)
+{
+  uint32_t hash = 2166136261u;
+  const char *c = evtname;
+
+  while (*c && *c != '/')
+  {
+    hash ^= (uint8_t)*c++;
+    hash *= 16777619u;
+  }
+
+  *apiLen = (size_t)(c - evtname);
+  return hash;
+}
+
+/*
+ * @brief Find the slot of an API, or the free slot it would be stored in
+ */
+STATIC halEventHandlerT *handlerLookup(const char *api, size_t apiLen, uint32_t hash)
+{
+  uint32_t slot = hash & (HAL_EVENTS_HASH_SZ - 1);
+
+  while (_handlers[slot].api)
+  {
+    if (_handlers[slot].hash == hash && _handlers[slot].apiLen == apiLen &&
+        !memcmp(_handlers[slot].api, api, apiLen))
+      return &_handlers[slot];
+
+    slot = (slot + 1) & (HAL_EVENTS_HASH_SZ - 1);
+  }
+
+  return &_handlers[slot];
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Register a handler of all events of an API. Registering an API
+ *        again adds a handler, called after the previous ones.
+ * @param api      : The API name, without the trailing '/'
+ * @param callback : The handler
+ * @param closure  : Passed to the handler
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halEventsRegister(const char *api, halEventCbT callback, void *closure)
+{
+  size_t apiLen = 0;
+  uint32_t hash = 0;
+  halEventHandlerT *handler = NULL;
+  halEventChainT *chain = NULL;
+
+  if (!api || !callback)
+    return HAL_FAIL;
+
+  if (_chainsCount >= HAL_EVENTS_HANDLERS_MAX)
+  {
+    AFB_ApiError(NULL, "EVENTS: Too many handlers, cannot add one for '%s'", api);
+    return HAL_FAIL;
+  }
+
+  hash = apiHash(api, &apiLen);
+  handler = handlerLookup(api, apiLen, hash);
+  if (!handler->api)
+  {
+    if (_handlersCount >= HAL_EVENTS_MAX)
+    {
+      AFB_ApiError(NULL, "EVENTS: Too many APIs, cannot add '%s'", api);
+      return HAL_FAIL;
+    }
+
+    handler->api = strndup(api, apiLen);
+    if (!handler->api)
+      return HAL_FAIL;
+    handler->apiLen = apiLen;
+    handler->hash = hash;
+    _handlersCount++;
+  }
+
+  chain = &_chains[_chainsCount++];
+  chain->callback = callback;
+  chain->closure = closure;
+  chain->next = NULL;
+  if (handler->last)
+    handler->last->next = chain;
+  else
+    handler->first = chain;
+  handler->last = chain;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Set the handler of events with no registered API
+ */
+PUBLIC void halEventsSetDefault(halEventCbT callback, void *closure)
+{
+  _defaultHandler.callback = callback;
+  _defaultHandler.closure = closure;
+}
+
+/*
+ * @brief Dispatch an event to the handler of its API
+ */
+PUBLIC void halEventsDispatch(const char *evtname, json_object *eventJ)
+{
+  size_t apiLen = 0;
+  uint32_t hash = apiHash(evtname, &apiLen);
+  halEventHandlerT *handler = handlerLookup(evtname, apiLen, hash);
+  halEventChainT *chain = handler->api ? handler->first : &_defaultHandler;
+
+  for (; chain; chain = chain->next)
+    if (chain->callback)
+      chain->callback(chain->closure, evtname, eventJ);
+}
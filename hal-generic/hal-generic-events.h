@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_EVENTS_H
+#define HAL_GENERIC_EVENTS_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+typedef void (*halEventCbT)(void *closure, const char *evtname, json_object *eventJ);
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halEventsRegister(const char *api, halEventCbT callback, void *closure);
+PUBLIC void halEventsSetDefault(halEventCbT callback, void *closure);
+PUBLIC void halEventsDispatch(const char *evtname, json_object *eventJ);
+
+#endif /* HAL_GENERIC_EVENTS_H */
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Lookup index over the loaded config sections.
+ *
+ * Each section is indexed once, right before it is validated, into
+ * json-c objects used as hash tables (json-c objects are backed by a
+ * linkhash). The indexed values are references to the section's own
+ * objects, so a lookup is a single hash probe with no 'wrap_json_unpack'.
+ * When a key appears more than once, the first occurrence wins, which
+ * matches the previous linear 'json_object_array_find' behaviour.
+ *
+ * Sections are indexed before validation so that the validator can check
+ * references with the index. Malformed entries are skipped, and a section
+ * that is not an array leaves its index empty.
+ */
+
+#include "hal-generic-index.h"
+#include "wrap-json.h"
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static json_object *_cardsByNameJ = NULL;       // card name -> card
+static json_object *_zonesByUidJ = NULL;        // zone uid -> zone
+static json_object *_streamsByRoleJ = NULL;     // stream role -> stream
+static json_object *_channelsByTypeJ[2] = {     // channel type -> channel
+  [SINK] = NULL,
+  [SOURCE] = NULL
+};
+static json_object *_cardNamesByTypeJ[2] = {    // channel type -> card name
+  [SINK] = NULL,
+  [SOURCE] = NULL
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC void indexReset(json_object **indexJ);
+STATIC void indexAdd(json_object *indexJ, const char *key, json_object *valueJ);
+STATIC json_object *indexGet(json_object *indexJ, const char *key);
+STATIC void indexCardChannels(json_object *channelsArrayJ,
+                              json_object *cardNameJ,
+                              SinkSourceT sinkSourceType);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Drop an index (if any), and replace it with an empty one
+ */
+STATIC void indexReset(json_object **indexJ)
+{
+  if (*indexJ)
+    json_object_put(*indexJ);
+
+  *indexJ = json_object_new_object();
+}
+
+/*
+ * @brief Add a reference to valueJ under key, unless the key is already set
+ */
+STATIC void indexAdd(json_object *indexJ, const char *key, json_object *valueJ)
+{
+  if (!key || !valueJ)
+    return;
+
+  if (json_object_object_get_ex(indexJ, key, NULL))
+    return; // First occurrence wins
+
+  json_object_object_add(indexJ, key, json_object_get(valueJ));
+}
+
+/*
+ * @brief Lookup a key in an index
+ */
+STATIC json_object *indexGet(json_object *indexJ, const char *key)
+{
+  json_object *valueJ = NULL;
+
+  if (!indexJ || !key)
+    return NULL;
+
+  if (!json_object_object_get_ex(indexJ, key, &valueJ))
+    return NULL;
+
+  return valueJ;
+}
+
+/*
+ * @brief Index all of a card's channel sinks or sources by 'type'
+ */
+STATIC void indexCardChannels(json_object *channelsArrayJ,
+                              json_object *cardNameJ,
+                              SinkSourceT sinkSourceType)
+{
+  int idx = 0;
+  int len = 0;
+
+  if (!json_object_is_type(channelsArrayJ, json_type_array))
+    return;
+
+  len = json_object_array_length(channelsArrayJ);
+
+  for (idx = 0; idx < len; idx++)
+  {
+    char *type = NULL;
+    json_object *channelCurrJ = json_object_array_get_idx(channelsArrayJ, idx);
+
+    wrap_json_unpack(channelCurrJ, "{s?s}", "type", &type);
+    indexAdd(_channelsByTypeJ[sinkSourceType], type, channelCurrJ);
+    indexAdd(_cardNamesByTypeJ[sinkSourceType], type, cardNameJ);
+  }
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Index a 'cards' section by card name and channel type
+ * @param cardsJ : A json_object containing an array of card objects
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halIndexCards(json_object *cardsJ)
+{
+  int cardsIdx = 0, cardsLength = 0;
+
+  indexReset(&_cardsByNameJ);
+  indexReset(&_channelsByTypeJ[SINK]);
+  indexReset(&_channelsByTypeJ[SOURCE]);
+  indexReset(&_cardNamesByTypeJ[SINK]);
+  indexReset(&_cardNamesByTypeJ[SOURCE]);
+  if (!_cardsByNameJ || !_channelsByTypeJ[SINK] || !_channelsByTypeJ[SOURCE] ||
+      !_cardNamesByTypeJ[SINK] || !_cardNamesByTypeJ[SOURCE])
+  {
+    AFB_ApiError(NULL, "INDEX: Cannot allocate card index");
+    return HAL_FAIL;
+  }
+
+  if (!json_object_is_type(cardsJ, json_type_array))
+    return HAL_FAIL;
+
+  cardsLength = json_object_array_length(cardsJ);
+  for (cardsIdx = 0; cardsIdx < cardsLength; cardsIdx++)
+  {
+    char *cardName = NULL;
+    json_object *cardCurrJ = NULL, *cardChannelsJ = NULL, *cardNameJ = NULL,
+                *cardSinksJ = NULL, *cardSourcesJ = NULL;
+
+    cardCurrJ = json_object_array_get_idx(cardsJ, cardsIdx);
+    wrap_json_unpack(cardCurrJ, "{s?s,s?o}",
+                     "name", &cardName, "channels", &cardChannelsJ);
+    json_object_object_get_ex(cardCurrJ, "name", &cardNameJ);
+    wrap_json_unpack(cardChannelsJ, "{s?o,s?o}",
+                     "sink", &cardSinksJ, "source", &cardSourcesJ);
+
+    indexAdd(_cardsByNameJ, cardName, cardCurrJ);
+    if (cardSinksJ)
+      indexCardChannels(cardSinksJ, cardNameJ, SINK);
+    if (cardSourcesJ)
+      indexCardChannels(cardSourcesJ, cardNameJ, SOURCE);
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Index a 'zones' section by zone uid
+ * @param zonesJ : A json_object containing an array of zone objects
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halIndexZones(json_object *zonesJ)
+{
+  int zonesIdx = 0, zonesLength = 0;
+
+  indexReset(&_zonesByUidJ);
+  if (!_zonesByUidJ)
+  {
+    AFB_ApiError(NULL, "INDEX: Cannot allocate zone index");
+    return HAL_FAIL;
+  }
+
+  if (!json_object_is_type(zonesJ, json_type_array))
+    return HAL_FAIL;
+
+  zonesLength = json_object_array_length(zonesJ);
+  for (zonesIdx = 0; zonesIdx < zonesLength; zonesIdx++)
+  {
+    char *zoneUid = NULL;
+    json_object *zoneCurrJ = json_object_array_get_idx(zonesJ, zonesIdx);
+
+    wrap_json_unpack(zoneCurrJ, "{s?s}", "uid", &zoneUid);
+    indexAdd(_zonesByUidJ, zoneUid, zoneCurrJ);
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Index a 'streams' section by stream role
+ * @param streamsJ : A json_object containing an array of stream objects
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halIndexStreams(json_object *streamsJ)
+{
+  int streamsIdx = 0, streamsLength = 0;
+
+  indexReset(&_streamsByRoleJ);
+  if (!_streamsByRoleJ)
+  {
+    AFB_ApiError(NULL, "INDEX: Cannot allocate stream index");
+    return HAL_FAIL;
+  }
+
+  if (!json_object_is_type(streamsJ, json_type_array))
+    return HAL_FAIL;
+
+  streamsLength = json_object_array_length(streamsJ);
+  for (streamsIdx = 0; streamsIdx < streamsLength; streamsIdx++)
+  {
+    char *streamRole = NULL;
+    json_object *streamCurrJ = json_object_array_get_idx(streamsJ, streamsIdx);
+
+    wrap_json_unpack(streamCurrJ, "{s?s}", "role", &streamRole);
+    indexAdd(_streamsByRoleJ, streamRole, streamCurrJ);
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Release all indexes
+ */
+PUBLIC void halIndexClear(void)
+{
+  json_object **indexes[] = {
+    &_cardsByNameJ, &_zonesByUidJ, &_streamsByRoleJ,
+    &_channelsByTypeJ[SINK], &_channelsByTypeJ[SOURCE],
+    &_cardNamesByTypeJ[SINK], &_cardNamesByTypeJ[SOURCE]
+  };
+  size_t idx = 0;
+
+  for (idx = 0; idx < sizeof(indexes) / sizeof(indexes[0]); idx++)
+  {
+    if (*indexes[idx])
+      json_object_put(*indexes[idx]);
+    *indexes[idx] = NULL;
+  }
+}
+
+/*
+ * @brief Get a card object by name
+ * @return The card json_object, or NULL if not found
+ */
+PUBLIC json_object *halIndexGetCard(const char *name)
+{
+  return indexGet(_cardsByNameJ, name);
+}
+
+/*
+ * @brief Get a zone object by uid
+ * @return The zone json_object, or NULL if not found
+ */
+PUBLIC json_object *halIndexGetZone(const char *uid)
+{
+  return indexGet(_zonesByUidJ, uid);
+}
+
+/*
+ * @brief Get a stream object by role
+ * @return The stream json_object, or NULL if not found
+ */
+PUBLIC json_object *halIndexGetStream(const char *role)
+{
+  return indexGet(_streamsByRoleJ, role);
+}
+
+/*
+ * @brief Get a card channel sink/source object by type, across all cards
+ * @return The channel json_object, or NULL if not found
+ */
+PUBLIC json_object *halIndexGetChannel(const char *type,
+                                       SinkSourceT sinkSourceType)
+{
+  return indexGet(_channelsByTypeJ[sinkSourceType], type);
+}
+
+/*
+ * @brief Get the name of the card declaring a channel sink/source type
+ * @return The card name, or NULL if not found
+ */
+PUBLIC const char *halIndexGetChannelCard(const char *type,
+                                          SinkSourceT sinkSourceType)
+{
+  json_object *cardNameJ = indexGet(_cardNamesByTypeJ[sinkSourceType], type);
+
+  if (!cardNameJ)
+    return NULL;
+
+  return json_object_get_string(cardNameJ);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_INDEX_H
+#define HAL_GENERIC_INDEX_H
+
+#include "hal-generic.h"
+#include "hal-generic-utility.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halIndexCards(json_object *cardsJ);
+PUBLIC HAL_ERRCODE halIndexZones(json_object *zonesJ);
+PUBLIC HAL_ERRCODE halIndexStreams(json_object *streamsJ);
+PUBLIC void halIndexClear(void);
+
+PUBLIC json_object *halIndexGetCard(const char *name);
+PUBLIC json_object *halIndexGetZone(const char *uid);
+PUBLIC json_object *halIndexGetStream(const char *role);
+PUBLIC json_object *halIndexGetChannel(const char *type,
+                                       SinkSourceT sinkSourceType);
+PUBLIC const char *halIndexGetChannelCard(const char *type,
+                                          SinkSourceT sinkSourceType);
+
+#endif /* HAL_GENERIC_INDEX_H */
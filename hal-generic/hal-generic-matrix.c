@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Routing matrices.
+ *
+ * A zone 'mapping' lists, for each stream channel, the card channels it is
+ * routed to, by type name. Each cell is either a channel type, or an
+ * object with a 'type' and a linear 'gain'. For a given card, the mapping
+ * is resolved into a dense matrix of gains, with one row per stream
+ * channel and one column per card port, so that the HAL plugin can set up
+ * and remix a stream without any name lookup. Cells that are not routed
+ * have a gain of 0.
+ *
+ * The matrix is sent as { "rows", "cols", "format", "data" }, where data
+ * is the base64 encoding of rows x cols float32 gains, row major, little
+ * endian.
+ */
+
+#include "hal-generic-matrix.h"
+#include "wrap-json.h"
+
+#include <endian.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static const char _base64[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC char *base64Encode(const uint8_t *data, size_t len);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Encode a buffer in base64
+ * @return A new nul terminated string, or NULL on allocation failure
+ */
+STATIC char *base64Encode(const uint8_t *data, size_t len)
+{
+  char *out = malloc(((len + 2) / 3) * 4 + 1), *ptr = out;
+  size_t idx = 0;
+
+  if (!out)
+    return NULL;
+
+  for (idx = 0; idx + 2 < len; idx += 3)
+  {
+    uint32_t triple = (data[idx] << 16) | (data[idx + 1] << 8) | data[idx + 2];
+
+    *ptr++ = _base64[(triple >> 18) & 0x3f];
+    *ptr++ = _base64[(triple >> 12) & 0x3f];
+    *ptr++ = _base64[(triple >> 6) & 0x3f];
+    *ptr++ = _base64[triple & 0x3f];
+  }
+
+  if (idx < len)
+  {
+    uint32_t triple = data[idx] << 16;
+
+    if (idx + 1 < len)
+      triple |= data[idx + 1] << 8;
+
+    *ptr++ = _base64[(triple >> 18) & 0x3f];
+    *ptr++ = _base64[(triple >> 12) & 0x3f];
+    *ptr++ = (idx + 1 < len) ? _base64[(triple >> 6) & 0x3f] : '=';
+    *ptr++ = '=';
+  }
+
+  *ptr = '\0';
+
+  return out;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Read a zone mapping cell, either a channel type or
+ *        { "type": <channel type>, "gain": <linear gain> }
+ * @param type : Set to the channel type
+ * @param gain : Set to the cell gain, HAL_MATRIX_GAIN by default
+ * @return true if the cell is well formed, false otherwise
+ */
+PUBLIC bool halMatrixCellGet(json_object *cellJ, const char **type, double *gain)
+{
+  *type = NULL;
+  *gain = HAL_MATRIX_GAIN;
+
+  if (json_object_is_type(cellJ, json_type_string))
+    *type = json_object_get_string(cellJ);
+  else if (json_object_is_type(cellJ, json_type_object))
+    wrap_json_unpack(cellJ, "{s:s,s?F}", "type", type, "gain", gain);
+
+  return *type && *gain >= 0.0;
+}
+
+/*
+ * @brief Get a zone mapping with channel types only, without the gains
+ * @return A new json_object, in the 'mapping' format of the HAL plugin
+ */
+PUBLIC json_object *halMatrixNames(const halModelZoneT *zone)
+{
+  int rowIdx = 0;
+  json_object *namesJ = json_object_new_array();
+
+  for (rowIdx = 0; rowIdx < zone->rowsCount; rowIdx++)
+  {
+    const halModelRowT *row = &zone->rows[rowIdx];
+    json_object *rowNamesJ = json_object_new_array();
+    int cellIdx = 0;
+
+    for (cellIdx = 0; cellIdx < row->cellsCount; cellIdx++)
+      json_object_array_add(rowNamesJ, json_object_new_string(row->cells[cellIdx].type));
+
+    json_object_array_add(namesJ, rowNamesJ);
+  }
+
+  return namesJ;
+}
+
+/*
+ * @brief Resolve a zone mapping into a routing matrix for a card
+ * @param model          : The config model
+ * @param zone           : The zone
+ * @param sinkSourceType : The zone type (SINK or SOURCE)
+ * @param cardIdx        : The card the matrix columns are the ports of
+ * @return A new matrix json_object, or NULL on failure
+ */
+PUBLIC json_object *halMatrixGenerate(const halModelT *model,
+                                      const halModelZoneT *zone,
+                                      SinkSourceT sinkSourceType,
+                                      int cardIdx)
+{
+  const halModelCardT *card = &model->cards[cardIdx];
+  int rowsCount = zone->rowsCount;
+  int colsCount = card->portsCount[sinkSourceType];
+  int rowIdx = 0;
+  uint32_t *cells = NULL;
+  char *data = NULL;
+  json_object *matrixJ = NULL;
+
+  if (rowsCount <= 0 || colsCount <= 0 || colsCount > HAL_MATRIX_PORTS_MAX)
+  {
+    AFB_ApiError(NULL, "MATRIX: card %s, cannot route %d channels to %d ports",
+                 card->name, rowsCount, colsCount);
+    return NULL;
+  }
+
+  cells = calloc(rowsCount * colsCount, sizeof(*cells));
+  if (!cells)
+    return NULL;
+
+  for (rowIdx = 0; rowIdx < rowsCount; rowIdx++)
+  {
+    const halModelRowT *row = &zone->rows[rowIdx];
+    int cellIdx = 0;
+
+    for (cellIdx = 0; cellIdx < row->cellsCount; cellIdx++)
+    {
+      const halModelCellT *modelCell = &row->cells[cellIdx];
+      int port = modelCell->port[sinkSourceType];
+      float cell = 0.0f;
+      uint32_t bits = 0;
+
+      // Channels of other cards are not routed by this card
+      if (modelCell->card[sinkSourceType] != cardIdx || port < 0 || port >= colsCount)
+        continue;
+
+      cell = (float)modelCell->gain;
+      memcpy(&bits, &cell, sizeof(bits));
+      cells[rowIdx * colsCount + port] = htole32(bits);
+    }
+  }
+
+  data = base64Encode((const uint8_t *)cells, rowsCount * colsCount * sizeof(*cells));
+  free(cells);
+  if (!data)
+    return NULL;
+
+  wrap_json_pack(&matrixJ, "{s:i,s:i,s:s,s:s}",
+                 "rows", rowsCount, "cols", colsCount,
+                 "format", HAL_MATRIX_FORMAT, "data", data);
+  free(data);
+
+  return matrixJ;
+}
+
+/*
+ * @brief Decode the 'data' of a matrix into gains, in host order
+ * @param data  : The base64 encoded f32le gains
+ * @param gains : Set to the gains
+ * @param count : The number of gains, rows x cols
+ * @return true on success, false if data is not of count gains
+ */
+PUBLIC bool halMatrixDecode(const char *data, float *gains, size_t count)
+{
+  uint32_t acc = 0, bits = 0;
+  uint8_t cell[4];
+  size_t cellLen = 0, cellIdx = 0;
+
+  if (strlen(data) != ((count * sizeof(float) + 2) / 3) * 4)
+    return false;
+
+  for (; *data && *data != '='; data++)
+  {
+    const char *value = strchr(_base64, *data);
+
+    if (!value)
+      return false;
+
+    acc = (acc << 6) | (uint32_t)(value - _base64);
+    bits += 6;
+    if (bits < 8)
+      continue;
+
+    bits -= 8;
+    cell[cellLen++] = (uint8_t)(acc >> bits);
+    if (cellLen == sizeof(cell) && cellIdx < count)
+    {
+      uint32_t le = 0;
+
+      memcpy(&le, cell, sizeof(le));
+      le = le32toh(le);
+      memcpy(&gains[cellIdx++], &le, sizeof(le));
+      cellLen = 0;
+    }
+  }
+
+  return cellIdx == count;
+}
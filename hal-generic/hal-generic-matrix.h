@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_MATRIX_H
+#define HAL_GENERIC_MATRIX_H
+
+#include "hal-generic.h"
+#include "hal-generic-model.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MATRIX_FORMAT "f32le"     // Gains, row major, little endian
+#define HAL_MATRIX_GAIN 1.0           // Gain of a cell with no 'gain'
+#define HAL_MATRIX_PORTS_MAX 64       // Card ports, i.e. matrix columns
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC bool halMatrixCellGet(json_object *cellJ, const char **type, double *gain);
+PUBLIC json_object *halMatrixNames(const halModelZoneT *zone);
+PUBLIC json_object *halMatrixGenerate(const halModelT *model,
+                                      const halModelZoneT *zone,
+                                      SinkSourceT sinkSourceType,
+                                      int cardIdx);
+PUBLIC bool halMatrixDecode(const char *data, float *gains, size_t count);
+
+#endif /* HAL_GENERIC_MATRIX_H */
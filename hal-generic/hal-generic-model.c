@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runtime config model.
+ *
+ * Once the config sections are validated, they are converted in one pass
+ * into plain C structs, allocated in a single arena. Names are copied,
+ * and references are resolved: streams point to their zones, zone cells
+ * to the card and port of their channel, ctls to their stream. The cards
+ * are resolved from the model, after which the json-c config tree, its
+ * index and the model itself can be released.
+ *
+ * Lookups while building the model use temporary json-c objects as hash
+ * tables, as the index does, holding array positions. When a key appears
+ * more than once, the first occurrence wins, as with the index.
+ */
+
+#include "hal-generic-model.h"
+#include "hal-generic-matrix.h"
+#include "hal-generic-duck.h"
+#include "wrap-json.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+// Temporary lookup tables, name -> array position
+typedef struct {
+  json_object *cardsJ;                // card name -> card index
+  json_object *channelsJ[2];          // channel type -> card index << 32 | channel index
+  json_object *zonesJ;                // zone uid -> zone index
+  json_object *streamsJ;              // stream role -> stream index
+} halModelTablesT;
+
+// Config key of each ctl type, Switch ctls are not configurable
+static const char *_ctlKeys[EndHalCtlsType] = {
+  [Volume] = "volume",
+  [Ramp] = "volramp",
+  [Bass] = "bass",
+  [Mid] = "mid",
+  [Treble] = "treble",
+  [Fade] = "fade",
+  [Balance] = "balance"
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC void tableAdd(json_object *tableJ, const char *key, int64_t value);
+STATIC int64_t tableGet(json_object *tableJ, const char *key);
+STATIC HAL_ERRCODE modelCards(halModelT *model, halModelTablesT *tables,
+                              json_object *cardsJ);
+STATIC HAL_ERRCODE modelChannels(halModelT *model, halModelTablesT *tables,
+                                 halModelCardT *card, int cardIdx,
+                                 json_object *channelsJ,
+                                 SinkSourceT sinkSourceType);
+STATIC HAL_ERRCODE modelZones(halModelT *model, halModelTablesT *tables,
+                              json_object *zonesJ);
+STATIC HAL_ERRCODE modelCell(halModelT *model, halModelTablesT *tables,
+                             json_object *cellJ, halModelCellT *cell);
+STATIC HAL_ERRCODE modelStreams(halModelT *model, halModelTablesT *tables,
+                                json_object *streamsJ);
+STATIC HAL_ERRCODE modelCtls(halModelT *model, halModelTablesT *tables,
+                             json_object *ctlsJ);
+STATIC halModelCtlT *modelCtl(halModelT *model, json_object *ctlJ,
+                              halCtlsTypeT ctlType);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Add a key to a lookup table, unless the key is already set
+ */
+STATIC void tableAdd(json_object *tableJ, const char *key, int64_t value)
+{
+  if (!key || json_object_object_get_ex(tableJ, key, NULL))
+    return; // First occurrence wins
+
+  json_object_object_add(tableJ, key, json_object_new_int64(value));
+}
+
+/*
+ * @brief Lookup a key in a lookup table
+ * @return The value, or -1 if not found
+ */
+STATIC int64_t tableGet(json_object *tableJ, const char *key)
+{
+  json_object *valueJ = NULL;
+
+  if (!key || !json_object_object_get_ex(tableJ, key, &valueJ))
+    return -1;
+
+  return json_object_get_int64(valueJ);
+}
+
+/*
+ * @brief Convert the 'cards' section
+ */
+STATIC HAL_ERRCODE modelCards(halModelT *model, halModelTablesT *tables,
+                              json_object *cardsJ)
+{
+  int cardIdx = 0;
+  halModelCardT *cards = NULL;
+
+  model->cardsCount = json_object_array_length(cardsJ);
+  cards = halArenaAlloc(model->arena, sizeof(halModelCardT) * model->cardsCount);
+  model->cards = cards;
+  if (model->cardsCount && !cards)
+    return HAL_FAIL;
+
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+  {
+    halModelCardT *card = &cards[cardIdx];
+    char *name = NULL, *api = NULL, *info = NULL;
+    json_object *channelsJ = NULL, *sinksJ = NULL, *sourcesJ = NULL;
+
+    wrap_json_unpack(json_object_array_get_idx(cardsJ, cardIdx),
+                     "{s?s,s?s,s?s,s?o}", "name", &name, "api", &api,
+                     "info", &info, "channels", &channelsJ);
+    wrap_json_unpack(channelsJ, "{s?o,s?o}", "sink", &sinksJ, "source", &sourcesJ);
+
+    card->name = halArenaStrdup(model->arena, name);
+    card->api = halArenaStrdup(model->arena, api);
+    card->info = halArenaStrdup(model->arena, info);
+    if ((name && !card->name) || (api && !card->api) || (info && !card->info))
+      return HAL_FAIL;
+
+    tableAdd(tables->cardsJ, name, cardIdx);
+    if (modelChannels(model, tables, card, cardIdx, sinksJ, SINK) != HAL_OK ||
+        modelChannels(model, tables, card, cardIdx, sourcesJ, SOURCE) != HAL_OK)
+      return HAL_FAIL;
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Convert the sink or source channels of a card
+ */
+STATIC HAL_ERRCODE modelChannels(halModelT *model, halModelTablesT *tables,
+                                 halModelCardT *card, int cardIdx,
+                                 json_object *channelsJ,
+                                 SinkSourceT sinkSourceType)
+{
+  int channelIdx = 0, channelsCount = 0;
+  halModelChannelT *channels = NULL;
+
+  if (!json_object_is_type(channelsJ, json_type_array))
+    return HAL_OK;
+
+  // An empty array is kept, so that 'cardprops' is generated as declared
+  channelsCount = json_object_array_length(channelsJ);
+  channels = halArenaAlloc(model->arena, sizeof(halModelChannelT) * (channelsCount + 1));
+  if (!channels)
+    return HAL_FAIL;
+
+  for (channelIdx = 0; channelIdx < channelsCount; channelIdx++)
+  {
+    char *type = NULL;
+    int port = -1;
+
+    wrap_json_unpack(json_object_array_get_idx(channelsJ, channelIdx),
+                     "{s?s,s?i}", "type", &type, "port", &port);
+    channels[channelIdx].type = halArenaStrdup(model->arena, type);
+    channels[channelIdx].port = port;
+    if (type && !channels[channelIdx].type)
+      return HAL_FAIL;
+
+    if (port >= card->portsCount[sinkSourceType])
+      card->portsCount[sinkSourceType] = port + 1;
+    tableAdd(tables->channelsJ[sinkSourceType], type,
+             ((int64_t)cardIdx << 32) | channelIdx);
+  }
+
+  card->channels[sinkSourceType] = channels;
+  card->channelsCount[sinkSourceType] = channelsCount;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Convert the 'zones' section
+ */
+STATIC HAL_ERRCODE modelZones(halModelT *model, halModelTablesT *tables,
+                              json_object *zonesJ)
+{
+  int zoneIdx = 0;
+  halModelZoneT *zones = NULL;
+
+  model->zonesCount = json_object_array_length(zonesJ);
+  zones = halArenaAlloc(model->arena, sizeof(halModelZoneT) * model->zonesCount);
+  model->zones = zones;
+  if (model->zonesCount && !zones)
+    return HAL_FAIL;
+
+  for (zoneIdx = 0; zoneIdx < model->zonesCount; zoneIdx++)
+  {
+    halModelZoneT *zone = &zones[zoneIdx];
+    halModelRowT *rows = NULL;
+    char *uid = NULL;
+    json_object *mappingJ = NULL;
+    int rowIdx = 0;
+
+    wrap_json_unpack(json_object_array_get_idx(zonesJ, zoneIdx),
+                     "{s?s,s?o}", "uid", &uid, "mapping", &mappingJ);
+
+    zone->uid = halArenaStrdup(model->arena, uid);
+    zone->rowsCount = json_object_array_length(mappingJ);
+    rows = halArenaAlloc(model->arena, sizeof(halModelRowT) * zone->rowsCount);
+    zone->rows = rows;
+    if ((uid && !zone->uid) || (zone->rowsCount && !rows))
+      return HAL_FAIL;
+
+    tableAdd(tables->zonesJ, uid, zoneIdx);
+
+    for (rowIdx = 0; rowIdx < zone->rowsCount; rowIdx++)
+    {
+      halModelRowT *row = &rows[rowIdx];
+      json_object *rowJ = json_object_array_get_idx(mappingJ, rowIdx);
+      int cellIdx = 0, cellsCount = json_object_array_length(rowJ);
+      halModelCellT *cells = halArenaAlloc(model->arena, sizeof(halModelCellT) * cellsCount);
+
+      row->cells = cells;
+      if (cellsCount && !cells)
+        return HAL_FAIL;
+
+      // Malformed cells are skipped, as they are not routed
+      for (cellIdx = 0; cellIdx < cellsCount; cellIdx++)
+        if (modelCell(model, tables, json_object_array_get_idx(rowJ, cellIdx),
+                      &cells[row->cellsCount]) == HAL_OK)
+          row->cellsCount++;
+    }
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Convert a zone mapping cell, and resolve its channel
+ * @return HAL_OK if the cell is well formed, HAL_FAIL otherwise
+ */
+STATIC HAL_ERRCODE modelCell(halModelT *model, halModelTablesT *tables,
+                             json_object *cellJ, halModelCellT *cell)
+{
+  const char *type = NULL;
+  int dir = 0;
+
+  if (!halMatrixCellGet(cellJ, &type, &cell->gain))
+    return HAL_FAIL;
+
+  cell->type = NULL;
+  for (dir = SINK; dir <= SOURCE; dir++)
+  {
+    int64_t found = tableGet(tables->channelsJ[dir], type);
+    const halModelChannelT *channel = NULL;
+
+    cell->card[dir] = -1;
+    cell->port[dir] = -1;
+    if (found < 0)
+      continue;
+
+    // Resolved cells share the name of their channel
+    channel = &model->cards[found >> 32].channels[dir][found & 0xffffffff];
+    cell->card[dir] = (int)(found >> 32);
+    cell->port[dir] = channel->port;
+    if (!cell->type)
+      cell->type = channel->type;
+  }
+
+  if (!cell->type)
+    cell->type = halArenaStrdup(model->arena, type);
+
+  return cell->type ? HAL_OK : HAL_FAIL;
+}
+
+/*
+ * @brief Convert the 'streams' section
+ */
+STATIC HAL_ERRCODE modelStreams(halModelT *model, halModelTablesT *tables,
+                                json_object *streamsJ)
+{
+  static const char *endpoints[2] = { [SINK] = "sink", [SOURCE] = "source" };
+  int streamIdx = 0;
+  halModelStreamT *streams = NULL;
+
+  model->streamsCount = json_object_array_length(streamsJ);
+  streams = halArenaAlloc(model->arena, sizeof(halModelStreamT) * model->streamsCount);
+  model->streams = streams;
+  if (model->streamsCount && !streams)
+    return HAL_FAIL;
+
+  for (streamIdx = 0; streamIdx < model->streamsCount; streamIdx++)
+  {
+    halModelStreamT *stream = &streams[streamIdx];
+    json_object *streamJ = json_object_array_get_idx(streamsJ, streamIdx);
+    char *role = NULL;
+    int dir = 0;
+
+    stream->priority = HAL_DUCK_PRIORITY;
+    stream->duck = HAL_DUCK_ATTENUATION;
+    wrap_json_unpack(streamJ, "{s?s,s?i,s?i}", "role", &role,
+                     "priority", &stream->priority, "duck", &stream->duck);
+    stream->role = halArenaStrdup(model->arena, role);
+    if (role && !stream->role)
+      return HAL_FAIL;
+
+    tableAdd(tables->streamsJ, role, streamIdx);
+
+    for (dir = SINK; dir <= SOURCE; dir++)
+    {
+      json_object *endpointJ = NULL;
+      char *zoneUid = NULL;
+      int64_t zoneIdx = -1;
+
+      wrap_json_unpack(streamJ, "{s?o}", endpoints[dir], &endpointJ);
+      wrap_json_unpack(endpointJ, "{s?s}", "zone", &zoneUid);
+      if (!zoneUid)
+        continue;
+
+      zoneIdx = tableGet(tables->zonesJ, zoneUid);
+      if (zoneIdx < 0)
+      {
+        AFB_ApiError(NULL, "STREAM: Zone '%s' is not defined!", zoneUid);
+        continue;
+      }
+      stream->zones[dir] = &model->zones[zoneIdx];
+    }
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Convert the 'ctls' section. Entries of an unknown stream are
+ *        never routed, and are dropped.
+ */
+STATIC HAL_ERRCODE modelCtls(halModelT *model, halModelTablesT *tables,
+                             json_object *ctlsJ)
+{
+  int ctlsIdx = 0, ctlsLength = json_object_array_length(ctlsJ);
+  halModelCtlsT *ctlsArray = halArenaAlloc(model->arena, sizeof(halModelCtlsT) * ctlsLength);
+
+  model->ctls = ctlsArray;
+  if (ctlsLength && !ctlsArray)
+    return HAL_FAIL;
+
+  for (ctlsIdx = 0; ctlsIdx < ctlsLength; ctlsIdx++)
+  {
+    halModelCtlsT *ctls = &ctlsArray[model->ctlsCount];
+    json_object *ctlsCurrJ = json_object_array_get_idx(ctlsJ, ctlsIdx);
+    char *role = NULL;
+    int ctlType = 0;
+    int64_t streamIdx = -1;
+
+    wrap_json_unpack(ctlsCurrJ, "{s?s}", "stream", &role);
+    if (!role)
+      continue;
+
+    if (strcmp(role, "Master") != 0)
+    {
+      streamIdx = tableGet(tables->streamsJ, role);
+      if (streamIdx < 0)
+        continue;
+      ctls->stream = &model->streams[streamIdx];
+    }
+
+    ctls->role = halArenaStrdup(model->arena, role);
+    if (!ctls->role)
+      return HAL_FAIL;
+
+    // Resolve the role once, every ctl type is then a table lookup. Roles
+    // and ctl types the HAL does not know are registered.
+    ctls->roleIdx = halCtlsRoleRegister(role);
+
+    for (ctlType = Volume; ctlType < EndHalCtlsType; ctlType++)
+    {
+      json_object *ctlJ = NULL;
+
+      if (!_ctlKeys[ctlType] ||
+          !json_object_object_get_ex(ctlsCurrJ, _ctlKeys[ctlType], &ctlJ))
+        continue;
+
+      ctls->ctls[ctlType] = modelCtl(model, ctlJ, (halCtlsTypeT)ctlType);
+      halCtlsTagRegister(ctls->roleIdx, (halCtlsTypeT)ctlType);
+    }
+
+    model->ctlsCount++;
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Convert a ctl, with the defaults of the unset values
+ * @return The ctl, or NULL if it has no name or on failure
+ */
+STATIC halModelCtlT *modelCtl(halModelT *model, json_object *ctlJ,
+                              halCtlsTypeT ctlType)
+{
+  char *name = NULL, *curve = NULL;
+  halModelCtlT *ctl = NULL;
+  halModelCtlT defaults = {
+    .value = 50,
+    .minval = 0,
+    .maxval = 100,
+    .count = 1,
+    .step = 1,
+    .ramp = {
+      .curve = HAL_RAMP_LINEAR,
+      .durationMs = HAL_RAMP_DURATION_MS
+    }
+  };
+
+  if (wrap_json_unpack(ctlJ, "{s:s,s?i,s?i,s?i,s?i,s?i,s?s,s?i}",
+                       "name", &name, "value", &defaults.value,
+                       "minval", &defaults.minval, "maxval", &defaults.maxval,
+                       "count", &defaults.count, "step", &defaults.step,
+                       "curve", &curve, "duration", &defaults.ramp.durationMs))
+    return NULL;
+
+  if (curve)
+    defaults.ramp.curve = halRampCurveGet(curve);
+
+  ctl = halArenaAlloc(model->arena, sizeof(halModelCtlT));
+  if (!ctl)
+    return NULL;
+
+  *ctl = defaults;
+  ctl->name = halArenaStrdup(model->arena, name);
+
+  return ctl->name ? ctl : NULL;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Convert the validated config sections into a model
+ * @return The model, or NULL on failure
+ */
+PUBLIC halModelT *halModelNew(json_object *cardsJ, json_object *zonesJ,
+                              json_object *streamsJ, json_object *ctlsJ)
+{
+  halArenaT *arena = halArenaNew(HAL_MODEL_ARENA_SZ);
+  halModelT *model = halArenaAlloc(arena, sizeof(halModelT));
+  halModelTablesT tables = {
+    .cardsJ = json_object_new_object(),
+    .channelsJ = { json_object_new_object(), json_object_new_object() },
+    .zonesJ = json_object_new_object(),
+    .streamsJ = json_object_new_object()
+  };
+  HAL_ERRCODE err = HAL_FAIL;
+
+  if (model)
+  {
+    model->arena = arena;
+    if (tables.cardsJ && tables.channelsJ[SINK] && tables.channelsJ[SOURCE] &&
+        tables.zonesJ && tables.streamsJ)
+      err = modelCards(model, &tables, cardsJ);
+    if (err == HAL_OK)
+      err = modelZones(model, &tables, zonesJ);
+    if (err == HAL_OK)
+      err = modelStreams(model, &tables, streamsJ);
+    if (err == HAL_OK)
+      err = modelCtls(model, &tables, ctlsJ);
+  }
+
+  json_object_put(tables.cardsJ);
+  json_object_put(tables.channelsJ[SINK]);
+  json_object_put(tables.channelsJ[SOURCE]);
+  json_object_put(tables.zonesJ);
+  json_object_put(tables.streamsJ);
+
+  if (err != HAL_OK)
+  {
+    AFB_ApiError(NULL, "MODEL: Cannot convert the config");
+    halArenaFree(arena);
+    return NULL;
+  }
+
+  AFB_ApiNotice(NULL, "MODEL: cards: %d, zones: %d, streams: %d, ctls: %d (%zu bytes)",
+                model->cardsCount, model->zonesCount, model->streamsCount,
+                model->ctlsCount, halArenaUsed(arena));
+
+  return model;
+}
+
+/*
+ * @brief Free a model
+ */
+PUBLIC void halModelFree(halModelT *model)
+{
+  if (model)
+    halArenaFree(model->arena);
+}
+
+/*
+ * @brief Get a card of a model by name
+ * @return The card index, or -1 if not found
+ */
+PUBLIC int halModelGetCard(const halModelT *model, const char *name)
+{
+  int cardIdx = 0;
+
+  for (cardIdx = 0; name && cardIdx < model->cardsCount; cardIdx++)
+    if (model->cards[cardIdx].name && !strcmp(model->cards[cardIdx].name, name))
+      return cardIdx;
+
+  return -1;
+}
+
+/*
+ * @brief Check whether any channel mapped by a zone belongs to a card
+ */
+PUBLIC bool halModelZoneUsesCard(const halModelZoneT *zone,
+                                 SinkSourceT sinkSourceType, int cardIdx)
+{
+  int rowIdx = 0, cellIdx = 0;
+
+  for (rowIdx = 0; zone && rowIdx < zone->rowsCount; rowIdx++)
+    for (cellIdx = 0; cellIdx < zone->rows[rowIdx].cellsCount; cellIdx++)
+      if (zone->rows[rowIdx].cells[cellIdx].card[sinkSourceType] == cardIdx)
+        return true;
+
+  return false;
+}
+
+/*
+ * @brief Check whether a stream is routed to a card
+ * @return true if the stream sink or source zone maps a channel of the card
+ */
+PUBLIC bool halModelStreamUsesCard(const halModelStreamT *stream, int cardIdx)
+{
+  return stream &&
+         (halModelZoneUsesCard(stream->zones[SINK], SINK, cardIdx) ||
+          halModelZoneUsesCard(stream->zones[SOURCE], SOURCE, cardIdx));
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_MODEL_H
+#define HAL_GENERIC_MODEL_H
+
+#include "hal-generic.h"
+#include "hal-generic-arena.h"
+#include "hal-generic-tags.h"
+#include "hal-generic-ramp.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MODEL_ARENA_SZ 16384      // First block of the model arena
+
+typedef enum {
+  SINK,
+  SOURCE
+} SinkSourceT;
+
+// A card channel, i.e. an entry of 'channels.sink' or 'channels.source'
+typedef struct {
+  const char *type;
+  int port;
+} halModelChannelT;
+
+typedef struct {
+  const char *name;
+  const char *api;
+  const char *info;                   // NULL if none
+  const halModelChannelT *channels[2]; // By SinkSourceT, NULL if not declared
+  int channelsCount[2];
+  int portsCount[2];                  // Highest port + 1
+} halModelCardT;
+
+// A zone mapping cell, resolved for either direction
+typedef struct {
+  const char *type;                   // Card channel type
+  double gain;
+  int card[2];                        // By SinkSourceT, -1 if unresolved
+  int port[2];
+} halModelCellT;
+
+// The card channels a stream channel is routed to
+typedef struct {
+  const halModelCellT *cells;
+  int cellsCount;
+} halModelRowT;
+
+typedef struct {
+  const char *uid;
+  const halModelRowT *rows;           // 'mapping', one row per stream channel
+  int rowsCount;
+} halModelZoneT;
+
+typedef struct {
+  const char *role;
+  const halModelZoneT *zones[2];      // By SinkSourceT, NULL if none
+  int priority;                       // Ducking, see halDuckLoad
+  int duck;
+} halModelStreamT;
+
+typedef struct {
+  const char *name;
+  int value;
+  int minval;
+  int maxval;
+  int count;
+  int step;
+  halRampConfigT ramp;                // 'volramp' ctls only
+} halModelCtlT;
+
+// A 'ctls' entry, with the ctls of a role
+typedef struct {
+  const char *role;                   // Stream role, or 'Master'
+  int roleIdx;                        // See halCtlsRoleGet
+  const halModelStreamT *stream;      // NULL for the 'Master' role
+  const halModelCtlT *ctls[EndHalCtlsType]; // By type, NULL if absent
+} halModelCtlsT;
+
+/*
+ * The validated config, as plain C structs: references between sections
+ * are resolved into pointers and indexes. Everything is allocated in the
+ * model arena, and nothing points into the json-c config. A model built
+ * into the binding (see hal-generic-static) has no arena, and is const.
+ */
+typedef struct {
+  halArenaT *arena;
+  const halModelCardT *cards;
+  int cardsCount;
+  const halModelZoneT *zones;
+  int zonesCount;
+  const halModelStreamT *streams;
+  int streamsCount;
+  const halModelCtlsT *ctls;
+  int ctlsCount;
+} halModelT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC halModelT *halModelNew(json_object *cardsJ, json_object *zonesJ,
+                              json_object *streamsJ, json_object *ctlsJ);
+PUBLIC void halModelFree(halModelT *model);
+PUBLIC int halModelGetCard(const halModelT *model, const char *name);
+PUBLIC bool halModelZoneUsesCard(const halModelZoneT *zone,
+                                 SinkSourceT sinkSourceType, int cardIdx);
+PUBLIC bool halModelStreamUsesCard(const halModelStreamT *stream, int cardIdx);
+
+#endif /* HAL_GENERIC_MODEL_H */
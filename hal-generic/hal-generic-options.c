@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hal-generic-options.h"
+#include "wrap-json.h"
+
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halOptionsT _options = {
+  .coalesceMs = HAL_OPTIONS_COALESCE_MS,
+  .reload = 0,
+  .statsMs = 0,
+  .shm = 0
+};
+static bool _loaded = false;            // An 'options' section was loaded
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Load the 'options' section, from the config or the cache
+ * @param optionsJ : The 'options' object, or NULL for the defaults
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halOptionsLoad(json_object *optionsJ)
+{
+  halOptionsT options = {
+    .coalesceMs = HAL_OPTIONS_COALESCE_MS,
+    .reload = 0,
+    .statsMs = 0,
+    .shm = 0
+  };
+
+  if (!optionsJ)
+  {
+    _loaded = false;
+    _options = options;
+    return HAL_OK;
+  }
+
+  if (wrap_json_unpack(optionsJ, "{s?i,s?b,s?i,s?b}",
+                       "coalesce", &options.coalesceMs, "reload", &options.reload,
+                       "stats", &options.statsMs, "shm", &options.shm))
+  {
+    AFB_ApiError(NULL, "OPTIONS: Invalid options: %s",
+                 json_object_get_string(optionsJ));
+    return HAL_FAIL;
+  }
+
+  if (options.coalesceMs < 0 || options.coalesceMs > HAL_OPTIONS_COALESCE_MS_MAX)
+  {
+    AFB_ApiError(NULL, "OPTIONS: 'coalesce' must be in [0, %d]: %d",
+                 HAL_OPTIONS_COALESCE_MS_MAX, options.coalesceMs);
+    return HAL_FAIL;
+  }
+
+  if (options.statsMs < 0 || options.statsMs > HAL_OPTIONS_STATS_MS_MAX)
+  {
+    AFB_ApiError(NULL, "OPTIONS: 'stats' must be in [0, %d]: %d",
+                 HAL_OPTIONS_STATS_MS_MAX, options.statsMs);
+    return HAL_FAIL;
+  }
+
+  // Only the settings are kept, not the config object
+  _loaded = true;
+  _options = options;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Set the options, already validated, e.g. built into the binding
+ */
+PUBLIC void halOptionsSet(const halOptionsT *options)
+{
+  _loaded = true;
+  _options = *options;
+}
+
+/*
+ * @brief Get the current options
+ */
+PUBLIC const halOptionsT *halOptionsGet(void)
+{
+  return &_options;
+}
+
+/*
+ * @brief Get the loaded options as an 'options' object, to store in the cache
+ * @return A new 'options' object, or NULL if the config has none
+ */
+PUBLIC json_object *halOptionsGetJ(void)
+{
+  json_object *optionsJ = NULL;
+
+  if (!_loaded)
+    return NULL;
+
+  wrap_json_pack(&optionsJ, "{s:i,s:b,s:i,s:b}",
+                 "coalesce", _options.coalesceMs,
+                 "reload", _options.reload,
+                 "stats", _options.statsMs,
+                 "shm", _options.shm);
+
+  return optionsJ;
+}
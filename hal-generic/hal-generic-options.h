@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_OPTIONS_H
+#define HAL_GENERIC_OPTIONS_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_OPTIONS_COALESCE_MS 10      // Default alsacore event coalescing window
+#define HAL_OPTIONS_COALESCE_MS_MAX 1000
+#define HAL_OPTIONS_STATS_MS_MAX 3600000 // Max period of the 'stats' event
+
+/*
+ * Settings of the optional 'options' config section. Unset options keep
+ * their default value.
+ */
+typedef struct {
+  int coalesceMs;           // alsacore event coalescing window, 0 disables
+  int reload;               // Reload the config when its files change
+  int statsMs;              // Period of the 'stats' event, 0 disables
+  int shm;                  // Send the plugin payload in a sealed memfd
+} halOptionsT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halOptionsLoad(json_object *optionsJ);
+PUBLIC void halOptionsSet(const halOptionsT *options);
+PUBLIC const halOptionsT *halOptionsGet(void);
+PUBLIC json_object *halOptionsGetJ(void);
+
+#endif /* HAL_GENERIC_OPTIONS_H */
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Volume ramp engine.
+ *
+ * Setting a 'volramp' ctl ramps the volume ctl of the same role (its
+ * slave) to the requested value, over a duration proportional to the
+ * distance, along a curve. Every ramp is allocated in the arena of the
+ * halmap of its ctl, and stopped when the arena is freed. All active ramps
+ * are driven by a single hashed timer wheel: one timer ticking every
+ * HAL_RAMP_TICK_MS while any ramp is active. Each ramp sits in the slot
+ * of its next update, and the updates due on a tick are sent with one
+ * 'ctlset' batch per card.
+ */
+
+#include "hal-generic-ramp.h"
+#include "hal-generic-batch.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define USEC_PER_MSEC 1000ULL
+#define HAL_RAMP_UPDATES_MAX 128      // Updates sent per tick
+#define HAL_RAMP_DB_FLOOR (-60.0)     // dB value of a 0% volume
+
+const char *halRampCurveLabels[] = {
+  [HAL_RAMP_LINEAR] = "linear",
+  [HAL_RAMP_DB] = "db",
+  [HAL_RAMP_SCURVE] = "s-curve",
+
+  [HAL_RAMP_CURVE_END] = NULL
+};
+
+struct halRamp {
+  halRampConfigT config;
+  halCtlsTagT slave;          // Volume ctl driven by the ramp
+  int step;                   // Minimum change per update, in %
+  halCardT *card;
+
+  // Running ramp
+  bool active;
+  int from, to, current;      // Slave volume, in %
+  uint64_t startTick;
+  uint64_t durationTicks;
+  uint32_t intervalTicks;     // Ticks between updates
+  uint32_t rounds;            // Wheel turns left before the next update
+  halRampT *next;             // Next ramp in the wheel slot
+};
+
+typedef struct {
+  halRampT *ramp;
+  int value;
+} halRampUpdateT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halRampT *_wheel[HAL_RAMP_WHEEL_SZ];
+static uint64_t _tick = 0;          // Current tick
+static uint64_t _tickUsec = 0;      // Time of the current tick
+static int _activeCount = 0;
+static sd_event_source *_timer = NULL;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint64_t nowUsec(void);
+STATIC double curveValue(const halRampT *ramp, double progress);
+STATIC void schedule(halRampT *ramp, uint32_t ticks);
+STATIC void unschedule(halRampT *ramp);
+STATIC HAL_ERRCODE startTimer(void);
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata);
+STATIC void processTick(void);
+STATIC void applyUpdates(halRampUpdateT *updates, int updatesCount);
+STATIC int readSlave(halRampT *ramp, int fallback);
+STATIC void releaseRamp(void *ptr);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the monotonic time, in usec
+ */
+STATIC uint64_t nowUsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/*
+ * @brief Get the ramp value at a progress in [0, 1], along its curve
+ */
+STATIC double curveValue(const halRampT *ramp, double progress)
+{
+  double from = ramp->from, to = ramp->to;
+
+  switch (ramp->config.curve)
+  {
+    case HAL_RAMP_DB:
+    {
+      double fromDb = from > 0 ? 20.0 * log10(from / 100.0) : HAL_RAMP_DB_FLOOR;
+      double toDb = to > 0 ? 20.0 * log10(to / 100.0) : HAL_RAMP_DB_FLOOR;
+      double db = 0;
+
+      if (fromDb < HAL_RAMP_DB_FLOOR)
+        fromDb = HAL_RAMP_DB_FLOOR;
+      if (toDb < HAL_RAMP_DB_FLOOR)
+        toDb = HAL_RAMP_DB_FLOOR;
+
+      db = fromDb + (toDb - fromDb) * progress;
+      if (db <= HAL_RAMP_DB_FLOOR)
+        return 0;
+      return 100.0 * pow(10.0, db / 20.0);
+    }
+
+    case HAL_RAMP_SCURVE:
+      progress = progress * progress * (3.0 - 2.0 * progress);
+      return from + (to - from) * progress;
+
+    case HAL_RAMP_LINEAR:
+    default:
+      return from + (to - from) * progress;
+  }
+}
+
+/*
+ * @brief Put a ramp in the wheel slot of its next update, in 'ticks' ticks
+ */
+STATIC void schedule(halRampT *ramp, uint32_t ticks)
+{
+  uint32_t slot = 0;
+
+  if (ticks < 1)
+    ticks = 1;
+
+  slot = (uint32_t)((_tick + ticks) & (HAL_RAMP_WHEEL_SZ - 1));
+  ramp->rounds = (ticks - 1) / HAL_RAMP_WHEEL_SZ;
+  ramp->next = _wheel[slot];
+  _wheel[slot] = ramp;
+}
+
+/*
+ * @brief Remove a ramp from the wheel
+ */
+STATIC void unschedule(halRampT *ramp)
+{
+  int slot = 0;
+
+  for (slot = 0; slot < HAL_RAMP_WHEEL_SZ; slot++)
+  {
+    halRampT **curr = &_wheel[slot];
+
+    for (; *curr; curr = &(*curr)->next)
+    {
+      if (*curr == ramp)
+      {
+        *curr = ramp->next;
+        ramp->next = NULL;
+        return;
+      }
+    }
+  }
+}
+
+/*
+ * @brief Start the wheel timer, if it is not running
+ */
+STATIC HAL_ERRCODE startTimer(void)
+{
+  uint64_t usec = 0;
+
+  if (_activeCount > 0)
+    return HAL_OK; // Already running
+
+  _tickUsec = nowUsec();
+  usec = _tickUsec + HAL_RAMP_TICK_MS * USEC_PER_MSEC;
+
+  if (!_timer)
+  {
+    if (sd_event_add_time(afb_daemon_get_event_loop(), &_timer, CLOCK_MONOTONIC,
+                          usec, USEC_PER_MSEC, timerCB, NULL) < 0)
+    {
+      _timer = NULL;
+      return HAL_FAIL;
+    }
+    sd_event_source_set_enabled(_timer, SD_EVENT_ON);
+    return HAL_OK;
+  }
+
+  if (sd_event_source_set_time(_timer, usec) < 0 ||
+      sd_event_source_set_enabled(_timer, SD_EVENT_ON) < 0)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Wheel timer callback: process every tick elapsed since the last
+ *        one, so a late wakeup catches up instead of slowing ramps down
+ */
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  uint64_t now = nowUsec();
+
+  while (_activeCount > 0 && _tickUsec + HAL_RAMP_TICK_MS * USEC_PER_MSEC <= now)
+  {
+    _tickUsec += HAL_RAMP_TICK_MS * USEC_PER_MSEC;
+    _tick++;
+    processTick();
+  }
+
+  if (_activeCount > 0)
+    sd_event_source_set_time(source, _tickUsec + HAL_RAMP_TICK_MS * USEC_PER_MSEC);
+  else
+    sd_event_source_set_enabled(source, SD_EVENT_OFF);
+
+  return 0;
+}
+
+/*
+ * @brief Update the ramps of the current wheel slot
+ */
+STATIC void processTick(void)
+{
+  halRampUpdateT updates[HAL_RAMP_UPDATES_MAX];
+  uint32_t slot = (uint32_t)(_tick & (HAL_RAMP_WHEEL_SZ - 1));
+  halRampT *ramp = _wheel[slot], *next = NULL;
+  int updatesCount = 0;
+
+  _wheel[slot] = NULL;
+  for (; ramp; ramp = next)
+  {
+    double progress = 0;
+    int value = 0;
+
+    next = ramp->next;
+    ramp->next = NULL;
+
+    if (ramp->rounds > 0)
+    {
+      ramp->rounds--;
+      ramp->next = _wheel[slot];
+      _wheel[slot] = ramp;
+      continue;
+    }
+
+    progress = (double)(_tick - ramp->startTick) / (double)ramp->durationTicks;
+    if (progress >= 1.0)
+      value = ramp->to;
+    else
+      value = (int)lround(curveValue(ramp, progress));
+
+    // No room left on this tick: retry on the next one, the ramp catches up
+    // along its curve, and ends only once its final value is sent
+    if (value != ramp->current && updatesCount >= HAL_RAMP_UPDATES_MAX)
+    {
+      schedule(ramp, 1);
+      continue;
+    }
+
+    if (value != ramp->current)
+    {
+      updates[updatesCount].ramp = ramp;
+      updates[updatesCount].value = value;
+      updatesCount++;
+      ramp->current = value;
+    }
+
+    if (progress >= 1.0)
+    {
+      ramp->active = false;
+      _activeCount--;
+    }
+    else
+      schedule(ramp, ramp->intervalTicks);
+  }
+
+  applyUpdates(updates, updatesCount);
+}
+
+/*
+ * @brief Send the updates of a tick, with one batch per card
+ */
+STATIC void applyUpdates(halRampUpdateT *updates, int updatesCount)
+{
+  halBatchCtlT ctls[HAL_BATCH_CTLS_MAX];
+  int idx = 0, batchIdx = 0, ctlsCount = 0;
+
+  for (idx = 0; idx < updatesCount; idx++)
+  {
+    halCardT *card = updates[idx].ramp ? updates[idx].ramp->card : NULL;
+
+    if (!card)
+      continue;
+
+    // Gather the updates of this card, marking them as sent
+    ctlsCount = 0;
+    for (batchIdx = idx; batchIdx < updatesCount && ctlsCount < HAL_BATCH_CTLS_MAX; batchIdx++)
+    {
+      halRampT *ramp = updates[batchIdx].ramp;
+
+      if (!ramp || ramp->card != card)
+        continue;
+
+      ctls[ctlsCount].tag = ramp->slave;
+      ctls[ctlsCount].valJ = json_object_new_int(updates[batchIdx].value);
+      ctls[ctlsCount].card = NULL;
+      ctlsCount++;
+      updates[batchIdx].ramp = NULL;
+    }
+
+    if (halBatchApply(card, ctls, ctlsCount, NULL) != HAL_OK)
+      AFB_ApiWarning(NULL, "RAMP: Cannot update card '%s'", card->name);
+
+    for (batchIdx = 0; batchIdx < ctlsCount; batchIdx++)
+      json_object_put(ctls[batchIdx].valJ);
+  }
+}
+
+/*
+ * @brief Read the current slave volume, in %
+ */
+STATIC int readSlave(halRampT *ramp, int fallback)
+{
+  halBatchCtlT ctl = { .tag = ramp->slave, .valJ = NULL, .card = NULL };
+  json_object *resultsJ = json_object_new_array();
+  json_object *valJ = NULL;
+  int value = fallback;
+
+  if (halBatchApply(ramp->card, &ctl, 1, resultsJ) == HAL_OK &&
+      json_object_array_length(resultsJ) > 0 &&
+      json_object_object_get_ex(json_object_array_get_idx(resultsJ, 0), "val", &valJ))
+  {
+    if (json_object_is_type(valJ, json_type_array))
+      valJ = json_object_array_get_idx(valJ, 0);
+    value = json_object_get_int(valJ);
+  }
+
+  json_object_put(resultsJ);
+  return value;
+}
+
+/*
+ * @brief Release hook of a ramp, stopping it if it is running
+ */
+STATIC void releaseRamp(void *ptr)
+{
+  halRampT *ramp = (halRampT *)ptr;
+
+  if (ramp->active)
+  {
+    unschedule(ramp);
+    _activeCount--;
+  }
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get a ramp curve from its label
+ * @return The curve, or HAL_RAMP_CURVE_END if unknown
+ */
+PUBLIC halRampCurveT halRampCurveGet(const char *label)
+{
+  int curve = 0;
+
+  for (curve = 0; label && curve < HAL_RAMP_CURVE_END; curve++)
+    if (!strcmp(halRampCurveLabels[curve], label))
+      return (halRampCurveT)curve;
+
+  return HAL_RAMP_CURVE_END;
+}
+
+/*
+ * @brief Get the size taken by a ramp in an arena
+ */
+PUBLIC size_t halRampArenaSize(void)
+{
+  return HAL_ARENA_SZ(sizeof(halRampT)) + HAL_ARENA_RELEASE_SZ;
+}
+
+/*
+ * @brief Allocate the ramp of a 'volramp' ctl
+ * @param arena  : The arena of the halmap, that stops the ramp when freed
+ * @param slave  : The volume ctl driven by the ramp
+ * @param step   : The minimum change per update, in %
+ * @param config : The ramp settings
+ * @return The ramp, or NULL on failure
+ */
+PUBLIC halRampT *halRampNew(halArenaT *arena, halCtlsTagT slave, int step,
+                            const halRampConfigT *config)
+{
+  halRampT *ramp = halArenaAlloc(arena, sizeof(halRampT));
+
+  if (!ramp || halArenaOnFree(arena, releaseRamp, ramp) != HAL_OK)
+  {
+    AFB_ApiError(NULL, "RAMP: Cannot allocate ramp");
+    return NULL;
+  }
+
+  ramp->slave = slave;
+  ramp->step = step > 0 ? step : 1;
+  ramp->config = *config;
+  if (ramp->config.curve >= HAL_RAMP_CURVE_END)
+    ramp->config.curve = HAL_RAMP_LINEAR;
+  if (ramp->config.durationMs < 0)
+    ramp->config.durationMs = HAL_RAMP_DURATION_MS;
+
+  return ramp;
+}
+
+/*
+ * @brief Get the settings of a ramp
+ */
+PUBLIC const halRampConfigT *halRampGetConfig(const halRampT *ramp)
+{
+  return &ramp->config;
+}
+
+/*
+ * @brief Change the settings of a ramp, from its next start
+ */
+PUBLIC void halRampSetConfig(halRampT *ramp, int step, const halRampConfigT *config)
+{
+  ramp->step = step > 0 ? step : 1;
+  ramp->config = *config;
+  if (ramp->config.curve >= HAL_RAMP_CURVE_END)
+    ramp->config.curve = HAL_RAMP_LINEAR;
+  if (ramp->config.durationMs < 0)
+    ramp->config.durationMs = HAL_RAMP_DURATION_MS;
+}
+
+/*
+ * @brief Bind the ramps of a card halmap to the card
+ */
+PUBLIC void halRampBind(halCardT *card)
+{
+  alsaHalMapT *ctl = NULL;
+
+  for (ctl = card->halmap; ctl && ctl->ctl.name; ctl++)
+    if (ctl->cb.callback == halRampCB && ctl->cb.handle)
+      ((halRampT *)ctl->cb.handle)->card = card;
+}
+
+/*
+ * @brief 'volramp' ctl callback: ramp the slave volume to the new value
+ */
+PUBLIC void halRampCB(halCtlsTagT tag, alsaHalCtlMapT *control, void *handle, json_object *valJ)
+{
+  halRampT *ramp = (halRampT *)handle;
+  int range = control->maxval - control->minval;
+  int target = 0, delta = 0, updates = 0;
+
+  if (!ramp || !ramp->card)
+    return;
+
+  if (json_object_is_type(valJ, json_type_array))
+    valJ = json_object_array_get_idx(valJ, 0);
+
+  // Target, in % of the slave range
+  target = json_object_get_int(valJ);
+  target = range > 0 ? ((target - control->minval) * 100 + range / 2) / range : 0;
+  if (target < 0)
+    target = 0;
+  if (target > 100)
+    target = 100;
+
+  // A running ramp is retargeted from where it is
+  if (ramp->active)
+    unschedule(ramp);
+  else
+    ramp->current = readSlave(ramp, target);
+
+  ramp->from = ramp->current;
+  ramp->to = target;
+  delta = abs(ramp->to - ramp->from);
+  if (delta == 0)
+  {
+    if (ramp->active)
+    {
+      ramp->active = false;
+      _activeCount--;
+    }
+    return;
+  }
+
+  // Full scale takes durationMs, updates are at least 'step' % apart
+  ramp->startTick = _tick;
+  ramp->durationTicks = (uint64_t)ramp->config.durationMs * (uint64_t)delta /
+                        (100ULL * HAL_RAMP_TICK_MS);
+  if (ramp->durationTicks < 1)
+    ramp->durationTicks = 1;
+  updates = delta / ramp->step;
+  if (updates < 1)
+    updates = 1;
+  ramp->intervalTicks = (uint32_t)(ramp->durationTicks / (uint64_t)updates);
+  if (ramp->intervalTicks < 1)
+    ramp->intervalTicks = 1;
+
+  if (!ramp->active)
+  {
+    if (startTimer() != HAL_OK)
+    {
+      AFB_ApiError(NULL, "RAMP: Cannot start timer, ramp skipped");
+      return;
+    }
+    ramp->active = true;
+    _activeCount++;
+  }
+
+  schedule(ramp, ramp->intervalTicks);
+}
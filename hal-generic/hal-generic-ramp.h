@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_RAMP_H
+#define HAL_GENERIC_RAMP_H
+
+#include "hal-generic.h"
+#include "hal-generic-arena.h"
+#include "hal-generic-card.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_RAMP_TICK_MS 10           // Timer wheel resolution
+#define HAL_RAMP_WHEEL_SZ 64          // Timer wheel slots, power of 2
+#define HAL_RAMP_DURATION_MS 500      // Default duration of a full scale ramp
+
+typedef enum {
+  HAL_RAMP_LINEAR,
+  HAL_RAMP_DB,                        // Linear in dB
+  HAL_RAMP_SCURVE,                    // Smoothstep
+
+  HAL_RAMP_CURVE_END
+} halRampCurveT;
+
+// Ramp settings of a 'volramp' ctl
+typedef struct {
+  halRampCurveT curve;
+  int durationMs;                     // Duration of a 0 to 100% ramp
+} halRampConfigT;
+
+typedef struct halRamp halRampT;
+
+extern const char *halRampCurveLabels[];
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC halRampCurveT halRampCurveGet(const char *label);
+PUBLIC size_t halRampArenaSize(void);
+PUBLIC halRampT *halRampNew(halArenaT *arena, halCtlsTagT slave, int step,
+                            const halRampConfigT *config);
+PUBLIC const halRampConfigT *halRampGetConfig(const halRampT *ramp);
+PUBLIC void halRampSetConfig(halRampT *ramp, int step, const halRampConfigT *config);
+PUBLIC void halRampBind(halCardT *card);
+PUBLIC void halRampCB(halCtlsTagT tag, alsaHalCtlMapT *control, void *handle, json_object *valJ);
+
+#endif /* HAL_GENERIC_RAMP_H */
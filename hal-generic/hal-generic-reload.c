@@ -0,0 +1,866 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hot reload of the config.
+ *
+ * The config directory is watched with inotify, and a change of any json
+ * file (the config, or a ctls file it references) reloads the config once
+ * the files have been quiet for HAL_RELOAD_DEBOUNCE_MS. The ctls files
+ * found in other controller config directories are watched too, through
+ * their directory as editors replace files rather than write them. Each section is
+ * compared with the running one, and only the first changed section of
+ * the cards -> zones -> streams -> ctls chain, and the sections after it,
+ * are indexed and validated again. A failed validation keeps the running
+ * config, and its errors are in the validation report.
+ *
+ * The cards themselves cannot change at runtime. For each card, the new
+ * 'cardprops', 'streammap' and halmap are compared with the running ones:
+ * changed streams are sent to the HAL plugin with 'update_sndcard' (the
+ * plugin is fully initialized again if it does not support it), and the
+ * halmap ctls are updated in place. Adding, removing or renaming a ctl,
+ * or changing its range, needs a restart as the ALSA controls already
+ * exist.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-reload.h"
+#include "hal-generic-utility.h"
+#include "hal-generic-validate.h"
+#include "hal-generic-index.h"
+#include "hal-generic-model.h"
+#include "hal-generic-cache.h"
+#include "hal-generic-card.h"
+#include "hal-generic-options.h"
+#include "hal-generic-stats.h"
+#include "hal-generic-coalesce.h"
+#include "hal-generic-batch.h"
+#include "hal-generic-ramp.h"
+#include "hal-generic-duck.h"
+#include "ctl-config.h"
+#include "wrap-json.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define USEC_PER_MSEC 1000ULL
+
+#define HAL_RELOAD_EVENTS_BUF_SZ (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+#define HAL_RELOAD_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+// A ctls file outside the config directory, watched through its directory
+typedef struct {
+  int wd;
+  char *name;
+} halReloadWatchT;
+
+// Sections in dependency order, a change invalidates all the next ones
+typedef enum {
+  RELOAD_CARDS,
+  RELOAD_ZONES,
+  RELOAD_STREAMS,
+  RELOAD_CTLS,
+  RELOAD_CHAIN_END,
+  RELOAD_OPTIONS = RELOAD_CHAIN_END,
+
+  RELOAD_SECTIONS_END
+} halReloadSectionT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static char *_configDir = NULL;
+static const char *_api = NULL;
+static int _fd = -1;
+static int _configWd = -1;
+static halReloadWatchT *_watches = NULL;
+static int _watchesCount = 0;
+static sd_event_source *_io = NULL;
+static sd_event_source *_timer = NULL;
+
+static json_object *_currentJ[RELOAD_SECTIONS_END];  // Running sections
+static json_object *_nextJ[RELOAD_SECTIONS_END];     // Sections being loaded
+
+static HAL_ERRCODE (*const _validate[RELOAD_CHAIN_END])(json_object *) = {
+  [RELOAD_CARDS] = validateCards,
+  [RELOAD_ZONES] = validateZones,
+  [RELOAD_STREAMS] = validateStreams,
+  [RELOAD_CTLS] = validateCtls
+};
+
+static HAL_ERRCODE (*const _index[RELOAD_CHAIN_END])(json_object *) = {
+  [RELOAD_CARDS] = halIndexCards,
+  [RELOAD_ZONES] = halIndexZones,
+  [RELOAD_STREAMS] = halIndexStreams,
+  [RELOAD_CTLS] = NULL
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC int stashSection(AFB_ApiT apiHandle, CtlSectionT *section, json_object *sectionJ);
+STATIC HAL_ERRCODE loadSections(void);
+STATIC void releaseSections(json_object **sectionsJ);
+STATIC HAL_ERRCODE validateChain(int firstDirty);
+STATIC void restoreIndexes(int firstDirty);
+STATIC bool cardsUnchanged(const halModelT *model);
+STATIC json_object *streamMapGet(json_object *streammapJ, const char *stream);
+STATIC json_object *streamMapDelta(json_object *oldJ, json_object *newJ,
+                                   json_object **removedJ);
+STATIC void halmapDelta(halCardT *card, alsaHalMapT *halmap);
+STATIC void reloadCard(halCardT *card, const halModelT *model, int firstDirty);
+STATIC void updatePluginCB(void *closure, int result, json_object *responseJ);
+STATIC void reinitPluginCB(void *closure, int result, json_object *responseJ);
+STATIC HAL_ERRCODE reloadConfig(void);
+STATIC HAL_ERRCODE armTimer(void);
+STATIC void releaseWatches(void);
+STATIC void watchCtlsFiles(void);
+STATIC bool watchedFile(int wd, const char *name);
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata);
+STATIC int inotifyCB(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+
+
+// Stash the sections, validation is done once they are all loaded
+static CtlSectionT _reloadSections[] = {
+  {.key="cards"  , .loadCB= stashSection, .handle= &_nextJ[RELOAD_CARDS]},
+  {.key="zones"  , .loadCB= stashSection, .handle= &_nextJ[RELOAD_ZONES]},
+  {.key="streams", .loadCB= stashSection, .handle= &_nextJ[RELOAD_STREAMS]},
+  {.key="ctls"   , .loadCB= stashSection, .handle= &_nextJ[RELOAD_CTLS]},
+  {.key="options", .loadCB= stashSection, .handle= &_nextJ[RELOAD_OPTIONS]},
+
+  {.key=NULL}
+};
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Section callback, keep a reference to the section
+ */
+STATIC int stashSection(AFB_ApiT apiHandle, CtlSectionT *section, json_object *sectionJ)
+{
+  json_object **slotJ = (json_object **)section->handle;
+
+  *slotJ = json_object_get(sectionJ);
+
+  return 0;
+}
+
+/*
+ * @brief Load the sections of the config into _nextJ
+ */
+STATIC HAL_ERRCODE loadSections(void)
+{
+  const char *configPath = NULL;
+  CtlConfigT *ctrlConfig = NULL;
+  int err = 0;
+
+  releaseSections(_nextJ);
+
+  configPath = CtlConfigSearch(NULL, _configDir, "config");
+  if (!configPath)
+  {
+    AFB_ApiError(NULL, "RELOAD: No config found in %s", _configDir);
+    return HAL_FAIL;
+  }
+
+  ctrlConfig = CtlLoadMetaData(NULL, configPath);
+  if (!ctrlConfig)
+  {
+    AFB_ApiError(NULL, "RELOAD: Cannot parse %s", configPath);
+    return HAL_FAIL;
+  }
+
+  if (ctrlConfig->api && _api && strcmp(ctrlConfig->api, _api) != 0)
+    AFB_ApiWarning(NULL, "RELOAD: Changing the api (%s) needs a restart",
+                   ctrlConfig->api);
+
+  err = CtlLoadSections(NULL, ctrlConfig, _reloadSections);
+
+  // The sections hold their own references
+  json_object_put(ctrlConfig->configJ);
+  free(ctrlConfig);
+
+  if (err)
+  {
+    releaseSections(_nextJ);
+    return HAL_FAIL;
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Drop a set of section references
+ */
+STATIC void releaseSections(json_object **sectionsJ)
+{
+  int idx = 0;
+
+  for (idx = 0; idx < RELOAD_SECTIONS_END; idx++)
+  {
+    if (sectionsJ[idx])
+      json_object_put(sectionsJ[idx]);
+    sectionsJ[idx] = NULL;
+  }
+}
+
+/*
+ * @brief Index and validate the changed sections of the chain, in order.
+ *        All the errors are added to the validation report.
+ * @param firstDirty : The first changed section of the chain
+ * @return HAL_OK if all the changed sections are valid
+ */
+STATIC HAL_ERRCODE validateChain(int firstDirty)
+{
+  HAL_ERRCODE err = HAL_OK;
+  int idx = 0;
+
+  validateReportReset();
+
+  for (idx = firstDirty; idx < RELOAD_CHAIN_END; idx++)
+  {
+    if (!_nextJ[idx])
+    {
+      AFB_ApiError(NULL, "RELOAD: Missing '%s' section", _reloadSections[idx].key);
+      err = HAL_FAIL;
+      continue;
+    }
+    if (_index[idx])
+      _index[idx](_nextJ[idx]);
+    if (_validate[idx](_nextJ[idx]) != HAL_OK)
+      err = HAL_FAIL;
+  }
+
+  if (err != HAL_OK)
+    AFB_ApiError(NULL, "RELOAD: Config is not valid (%d errors)", validateReportCount());
+
+  return err;
+}
+
+/*
+ * @brief Index the running sections again, after a failed reload
+ */
+STATIC void restoreIndexes(int firstDirty)
+{
+  int idx = 0;
+
+  for (idx = firstDirty; idx < RELOAD_CHAIN_END; idx++)
+  {
+    if (!_index[idx])
+      continue;
+    if (!_currentJ[idx])
+    {
+      // Loaded from the cache, nothing was indexed before the reload
+      halIndexClear();
+      return;
+    }
+    _index[idx](_currentJ[idx]);
+  }
+}
+
+/*
+ * @brief Check the new 'cards' section declares the running cards
+ */
+STATIC bool cardsUnchanged(const halModelT *model)
+{
+  int cardIdx = 0;
+  bool unchanged = (model->cardsCount == halCardsCount());
+
+  for (cardIdx = 0; unchanged && cardIdx < model->cardsCount; cardIdx++)
+  {
+    const halModelCardT *modelCard = &model->cards[cardIdx];
+    halCardT *card = halCardGet(cardIdx);
+
+    unchanged = !strcmp(modelCard->name, card->name) &&
+                !strcmp(modelCard->api, card->api);
+  }
+
+  return unchanged;
+}
+
+/*
+ * @brief Find a stream in a 'streammap'
+ */
+STATIC json_object *streamMapGet(json_object *streammapJ, const char *stream)
+{
+  int idx = 0, len = json_object_array_length(streammapJ);
+
+  for (idx = 0; idx < len; idx++)
+  {
+    char *name = NULL;
+    json_object *streamJ = json_object_array_get_idx(streammapJ, idx);
+
+    wrap_json_unpack(streamJ, "{s:s}", "stream", &name);
+    if (name && !strcmp(name, stream))
+      return streamJ;
+  }
+
+  return NULL;
+}
+
+/*
+ * @brief Get the new or changed streams of a 'streammap'
+ * @param removedJ : Set to the names of the removed streams, or NULL
+ * @return The new or changed streams, or NULL if there are none
+ */
+STATIC json_object *streamMapDelta(json_object *oldJ, json_object *newJ,
+                                   json_object **removedJ)
+{
+  int idx = 0, len = 0;
+  json_object *changedJ = NULL;
+
+  *removedJ = NULL;
+
+  len = json_object_array_length(newJ);
+  for (idx = 0; idx < len; idx++)
+  {
+    char *name = NULL;
+    json_object *streamJ = json_object_array_get_idx(newJ, idx);
+
+    wrap_json_unpack(streamJ, "{s:s}", "stream", &name);
+    if (json_object_equal(streamMapGet(oldJ, name), streamJ))
+      continue;
+    if (!changedJ)
+      changedJ = json_object_new_array();
+    json_object_array_add(changedJ, json_object_get(streamJ));
+  }
+
+  len = json_object_array_length(oldJ);
+  for (idx = 0; idx < len; idx++)
+  {
+    char *name = NULL;
+
+    wrap_json_unpack(json_object_array_get_idx(oldJ, idx), "{s:s}", "stream", &name);
+    if (streamMapGet(newJ, name))
+      continue;
+    if (!*removedJ)
+      *removedJ = json_object_new_array();
+    json_object_array_add(*removedJ, json_object_new_string(name));
+  }
+
+  return changedJ;
+}
+
+/*
+ * @brief Apply a new halmap to the running halmap of a card
+ */
+STATIC void halmapDelta(halCardT *card, alsaHalMapT *halmap)
+{
+  halBatchCtlT ctls[HAL_BATCH_CTLS_MAX];
+  int ctlsCount = 0, runningCount = 0, newCount = 0;
+  alsaHalMapT *ctl = NULL;
+
+  for (ctl = card->halmap; ctl->ctl.name; ctl++)
+    runningCount++;
+
+  for (ctl = halmap; ctl->ctl.name; ctl++)
+  {
+    alsaHalMapT *running = NULL;
+    alsaHalCtlMapT *runningCtl = NULL;
+
+    newCount++;
+    for (running = card->halmap; running->ctl.name; running++)
+      if (running->tag == ctl->tag)
+        break;
+    runningCtl = &running->ctl;
+
+    if (!runningCtl->name || strcmp(runningCtl->name, ctl->ctl.name) != 0)
+    {
+      AFB_ApiWarning(NULL, "RELOAD: card %s, ctl '%s' was added or renamed, "
+                     "restart needed", card->name, ctl->ctl.name);
+      continue;
+    }
+    if (runningCtl->minval != ctl->ctl.minval ||
+        runningCtl->maxval != ctl->ctl.maxval ||
+        runningCtl->count != ctl->ctl.count)
+      AFB_ApiWarning(NULL, "RELOAD: card %s, ctl '%s' range changed, "
+                     "restart needed", card->name, ctl->ctl.name);
+
+    if (running->cb.callback == halRampCB && ctl->cb.callback == halRampCB)
+    {
+      runningCtl->step = ctl->ctl.step;
+      halRampSetConfig(running->cb.handle, ctl->ctl.step,
+                       halRampGetConfig(ctl->cb.handle));
+    }
+
+    if (runningCtl->value == ctl->ctl.value)
+      continue;
+    runningCtl->value = ctl->ctl.value;
+
+    // The new default value is applied as a percentage of the running range
+    if (card->registered && ctlsCount < HAL_BATCH_CTLS_MAX)
+    {
+      int range = runningCtl->maxval - runningCtl->minval;
+      int percent = range > 0 ? ((ctl->ctl.value - runningCtl->minval) * 100) / range : 0;
+
+      ctls[ctlsCount].tag = ctl->tag;
+      ctls[ctlsCount].valJ = json_object_new_int(percent);
+      ctls[ctlsCount].card = card->name;
+      ctlsCount++;
+    }
+  }
+
+  if (newCount != runningCount)
+    AFB_ApiWarning(NULL, "RELOAD: card %s, ctls were added or removed "
+                   "(%d -> %d), restart needed", card->name, runningCount, newCount);
+
+  if (ctlsCount && halBatchApply(card, ctls, ctlsCount, NULL) != HAL_OK)
+    AFB_ApiError(NULL, "RELOAD: card %s, cannot apply the new ctl values",
+                 card->name);
+
+  while (ctlsCount--)
+    json_object_put(ctls[ctlsCount].valJ);
+}
+
+/*
+ * @brief Apply the changed sections to a card
+ */
+STATIC void reloadCard(halCardT *card, const halModelT *model, int firstDirty)
+{
+  json_object *cardpropsJ = NULL, *changedJ = NULL, *removedJ = NULL,
+              *argsJ = NULL;
+  int cardIdx = halModelGetCard(model, card->name);
+
+  if (cardIdx < 0)
+    return;
+
+  if (firstDirty <= RELOAD_CARDS)
+  {
+    cardpropsJ = generateCardProperties(&model->cards[cardIdx]);
+    if (json_object_equal(cardpropsJ, card->cardpropsJ))
+    {
+      json_object_put(cardpropsJ);
+      cardpropsJ = NULL;
+    }
+  }
+
+  if (firstDirty <= RELOAD_STREAMS)
+  {
+    json_object *streammapJ = generateStreamMap(model, cardIdx);
+
+    changedJ = streamMapDelta(card->streammapJ, streammapJ, &removedJ);
+    json_object_put(card->streammapJ);
+    card->streammapJ = streammapJ;
+  }
+
+  if (firstDirty <= RELOAD_CTLS)
+  {
+    // The new halmap only lives for the delta, in an arena of its own
+    int ctlsCount = 0;
+    size_t size = sizeAlsaHalMap(model, cardIdx, &ctlsCount);
+    halArenaT *arena = halArenaNew(size);
+    alsaHalMapT *halmap = generateAlsaHalMap(arena, model, cardIdx, ctlsCount);
+
+    if (halmap)
+      halmapDelta(card, halmap);
+    halArenaFree(arena);
+  }
+
+  // The card takes the new 'cardprops', released by its arena
+  if (cardpropsJ)
+  {
+    json_object_put(card->cardpropsJ);
+    card->cardpropsJ = cardpropsJ;
+  }
+
+  // A card still starting up is initialized with the new config
+  if (card->registered && (cardpropsJ || changedJ || removedJ))
+  {
+    AFB_ApiNotice(NULL, "RELOAD: card %s, updating HAL plugin", card->name);
+    wrap_json_pack(&argsJ, "{s:O*,s:o*,s:o*}",
+                   "cardprops", cardpropsJ,
+                   "streammap", changedJ,
+                   "removed", removedJ);
+    halStatsServiceCall(card->api, HAL_RELOAD_PLUGIN_VERB, argsJ, updatePluginCB, card);
+  }
+  else
+  {
+    if (changedJ)
+      json_object_put(changedJ);
+    if (removedJ)
+      json_object_put(removedJ);
+  }
+}
+
+/*
+ * @brief 'update_sndcard' reply, fall back on a full plugin initialization
+ */
+STATIC void updatePluginCB(void *closure, int result, json_object *responseJ)
+{
+  halCardT *card = (halCardT *)closure;
+
+  if (!result)
+    return;
+
+  AFB_ApiNotice(NULL, "RELOAD: '%s' failed on %s, initializing the plugin again",
+                HAL_RELOAD_PLUGIN_VERB, card->api);
+  initHalPluginAsync(card, reinitPluginCB, card);
+}
+
+/*
+ * @brief 'initialize_sndcard' reply after a reload
+ */
+STATIC void reinitPluginCB(void *closure, int result, json_object *responseJ)
+{
+  halCardT *card = (halCardT *)closure;
+
+  if (initHalPluginResult(result, responseJ) != HAL_OK)
+    AFB_ApiError(NULL, "RELOAD: Cannot initialize HAL plugin (name: '%s', api: '%s')",
+                 card->name, card->api);
+}
+
+/*
+ * @brief Reload the config, and apply the changes to the running cards
+ * @return HAL_OK if the config was reloaded (or did not change)
+ */
+STATIC HAL_ERRCODE reloadConfig(void)
+{
+  int idx = 0, firstDirty = RELOAD_CHAIN_END, cardIdx = 0;
+  bool optionsDirty = false;
+  json_object *duckingJ = NULL, *optionsJ = NULL;
+  halModelT *model = NULL;
+
+  if (loadSections() != HAL_OK)
+    return HAL_FAIL;
+
+  for (idx = 0; idx < RELOAD_CHAIN_END; idx++)
+  {
+    if (!json_object_equal(_currentJ[idx], _nextJ[idx]))
+    {
+      firstDirty = idx;
+      break;
+    }
+  }
+  optionsDirty = !json_object_equal(_currentJ[RELOAD_OPTIONS], _nextJ[RELOAD_OPTIONS]);
+
+  if (firstDirty == RELOAD_CHAIN_END && !optionsDirty)
+  {
+    AFB_ApiNotice(NULL, "RELOAD: No change");
+    releaseSections(_nextJ);
+    return HAL_OK;
+  }
+
+  AFB_ApiNotice(NULL, "RELOAD: Changed from '%s'%s",
+                firstDirty < RELOAD_CHAIN_END ? _reloadSections[firstDirty].key : "-",
+                optionsDirty ? ", 'options'" : "");
+
+  if (validateChain(firstDirty) == HAL_OK && firstDirty < RELOAD_CHAIN_END)
+    model = halModelNew(_nextJ[RELOAD_CARDS], _nextJ[RELOAD_ZONES],
+                        _nextJ[RELOAD_STREAMS], _nextJ[RELOAD_CTLS]);
+
+  if ((firstDirty < RELOAD_CHAIN_END && !model) ||
+      (firstDirty <= RELOAD_CARDS && !cardsUnchanged(model)) ||
+      (optionsDirty && halOptionsLoad(_nextJ[RELOAD_OPTIONS]) != HAL_OK))
+  {
+    if (firstDirty <= RELOAD_CARDS)
+      AFB_ApiError(NULL, "RELOAD: Adding, removing or changing cards needs a restart");
+    AFB_ApiError(NULL, "RELOAD: Keeping the running config");
+    halModelFree(model);
+    restoreIndexes(firstDirty);
+    releaseSections(_nextJ);
+    return HAL_FAIL;
+  }
+
+  if (optionsDirty)
+  {
+    halCoalesceSetWindow(halOptionsGet()->coalesceMs);
+    halStatsSetPeriod(halOptionsGet()->statsMs);
+    if (!halOptionsGet()->reload)
+      AFB_ApiNotice(NULL, "RELOAD: Disabled by the new options");
+  }
+
+  if (firstDirty <= RELOAD_STREAMS)
+    halDuckLoad(_nextJ[RELOAD_STREAMS]);
+
+  for (cardIdx = 0; firstDirty < RELOAD_CHAIN_END && cardIdx < halCardsCount(); cardIdx++)
+    reloadCard(halCardGet(cardIdx), model, firstDirty);
+  halModelFree(model);
+
+  // The new sections are now running
+  releaseSections(_currentJ);
+  memcpy(_currentJ, _nextJ, sizeof(_currentJ));
+  memset(_nextJ, 0, sizeof(_nextJ));
+
+  // Keep the cache in step, for the next start
+  if (halCacheOpen(_configDir) == HAL_OK)
+  {
+    duckingJ = halDuckGetJ();
+    optionsJ = halOptionsGetJ();
+    halCacheStore(_api, optionsJ, duckingJ);
+    json_object_put(optionsJ);
+    json_object_put(duckingJ);
+  }
+
+  if (!halOptionsGet()->reload)
+    halReloadStop();
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Arm the debounce timer
+ */
+STATIC HAL_ERRCODE armTimer(void)
+{
+  struct timespec ts;
+  uint64_t usec = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  usec = (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL +
+         HAL_RELOAD_DEBOUNCE_MS * USEC_PER_MSEC;
+
+  if (!_timer)
+  {
+    if (sd_event_add_time(afb_daemon_get_event_loop(), &_timer, CLOCK_MONOTONIC,
+                          usec, 10 * USEC_PER_MSEC, timerCB, NULL) < 0)
+    {
+      _timer = NULL;
+      return HAL_FAIL;
+    }
+    return HAL_OK;
+  }
+
+  if (sd_event_source_set_time(_timer, usec) < 0 ||
+      sd_event_source_set_enabled(_timer, SD_EVENT_ONESHOT) < 0)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Forget the ctls files watched outside the config directory
+ */
+STATIC void releaseWatches(void)
+{
+  int idx = 0;
+
+  for (idx = 0; idx < _watchesCount; idx++)
+  {
+    if (_watches[idx].wd != _configWd)
+      inotify_rm_watch(_fd, _watches[idx].wd);
+    free(_watches[idx].name);
+  }
+
+  free(_watches);
+  _watches = NULL;
+  _watchesCount = 0;
+}
+
+/*
+ * @brief Watch the directories of the ctls files which are not in the
+ *        config directory, the list may change with each reload
+ */
+STATIC void watchCtlsFiles(void)
+{
+  json_object *filesJ = halCacheCtlsFiles(_configDir);
+  int idx = 0, len = 0;
+
+  releaseWatches();
+  if (!filesJ)
+    return;
+
+  len = (int)json_object_array_length(filesJ);
+  _watches = calloc((size_t)len, sizeof(halReloadWatchT));
+  for (idx = 0; _watches && idx < len; idx++)
+  {
+    const char *path = json_object_get_string(json_object_array_get_idx(filesJ, idx));
+    const char *name = strrchr(path, '/');
+    char dir[PATH_MAX];
+    int wd = -1;
+
+    if (!name)
+      continue;
+
+    snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+    wd = inotify_add_watch(_fd, dir, HAL_RELOAD_WATCH_MASK);
+    if (wd < 0)
+    {
+      AFB_ApiWarning(NULL, "RELOAD: Cannot watch %s (%s)", dir, strerror(errno));
+      continue;
+    }
+
+    // Same directory inode as the config one, already watched
+    if (wd == _configWd)
+      continue;
+
+    _watches[_watchesCount].wd = wd;
+    _watches[_watchesCount].name = strdup(name + 1);
+    if (_watches[_watchesCount].name)
+      _watchesCount++;
+  }
+
+  json_object_put(filesJ);
+}
+
+/*
+ * @brief Tell if an event of a ctls file directory is about a ctls file
+ */
+STATIC bool watchedFile(int wd, const char *name)
+{
+  int idx = 0;
+
+  for (idx = 0; idx < _watchesCount; idx++)
+    if (_watches[idx].wd == wd && !strcmp(_watches[idx].name, name))
+      return true;
+
+  return false;
+}
+
+/*
+ * @brief The config files have been quiet long enough, reload
+ */
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  reloadConfig();
+
+  // The reload may have stopped the watcher (reload disabled by the options)
+  if (_fd < 0)
+    return 0;
+
+  // The config may reference other ctls files now
+  watchCtlsFiles();
+
+  return 0;
+}
+
+/*
+ * @brief Config directory change, (re)start the debounce timer
+ */
+STATIC int inotifyCB(sd_event_source *source, int fd, uint32_t revents, void *userdata)
+{
+  char buf[HAL_RELOAD_EVENTS_BUF_SZ * 16]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t len = 0;
+
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+  {
+    char *ptr = buf;
+
+    while (ptr < buf + len)
+    {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+      size_t nameLen = event->len ? strlen(event->name) : 0;
+
+      // Only the json files make the config, the cache lives here too
+      if (event->wd == _configWd)
+      {
+        if (nameLen > 5 && !strcmp(event->name + nameLen - 5, ".json"))
+          changed = true;
+      }
+      else if (nameLen && watchedFile(event->wd, event->name))
+        changed = true;
+
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  if (changed && armTimer() != HAL_OK)
+    AFB_ApiError(NULL, "RELOAD: Cannot arm the debounce timer");
+
+  return 0;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Watch the config directory, and reload the config on changes
+ * @param configDir : The directory holding the config and ctls files
+ * @param api       : The api set by the config
+ * @param sections  : The running sections, all NULL if loaded from the cache
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halReloadStart(const char *configDir, const char *api,
+                                  const halReloadSectionsT *sections)
+{
+  if (_fd >= 0)
+    return HAL_OK;
+
+  _configDir = strdup(configDir);
+  if (!_configDir)
+    return HAL_FAIL;
+  _api = api;
+
+  _currentJ[RELOAD_CARDS] = json_object_get(sections->cardsJ);
+  _currentJ[RELOAD_ZONES] = json_object_get(sections->zonesJ);
+  _currentJ[RELOAD_STREAMS] = json_object_get(sections->streamsJ);
+  _currentJ[RELOAD_CTLS] = json_object_get(sections->ctlsJ);
+  _currentJ[RELOAD_OPTIONS] = json_object_get(sections->optionsJ);
+
+  _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (_fd >= 0)
+    _configWd = inotify_add_watch(_fd, _configDir, HAL_RELOAD_WATCH_MASK);
+  if (_fd < 0 || _configWd < 0 ||
+      sd_event_add_io(afb_daemon_get_event_loop(), &_io, _fd, EPOLLIN,
+                      inotifyCB, NULL) < 0)
+  {
+    AFB_ApiError(NULL, "RELOAD: Cannot watch %s (%s)", _configDir, strerror(errno));
+    halReloadStop();
+    return HAL_FAIL;
+  }
+
+  watchCtlsFiles();
+  AFB_ApiNotice(NULL, "RELOAD: Watching %s and %d ctls file(s) outside of it",
+                _configDir, _watchesCount);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Stop watching the config directory
+ */
+PUBLIC void halReloadStop(void)
+{
+  if (_io)
+    sd_event_source_unref(_io);
+  _io = NULL;
+  if (_timer)
+    sd_event_source_unref(_timer);
+  _timer = NULL;
+  releaseWatches();
+  if (_fd >= 0)
+    close(_fd);
+  _fd = -1;
+  _configWd = -1;
+
+  free(_configDir);
+  _configDir = NULL;
+
+  // Nothing is reloaded anymore, the running config can go
+  releaseSections(_currentJ);
+  halIndexClear();
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_RELOAD_H
+#define HAL_GENERIC_RELOAD_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_RELOAD_DEBOUNCE_MS 200    // Quiet time after the last file change
+#define HAL_RELOAD_PLUGIN_VERB "update_sndcard"
+
+typedef struct {
+  json_object *cardsJ;
+  json_object *zonesJ;
+  json_object *streamsJ;
+  json_object *ctlsJ;
+  json_object *optionsJ;
+} halReloadSectionsT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halReloadStart(const char *configDir, const char *api,
+                                  const halReloadSectionsT *sections);
+PUBLIC void halReloadStop(void);
+
+#endif /* HAL_GENERIC_RELOAD_H */
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Zero-copy handoff of the plugin payload.
+ *
+ * With the 'shm' option, the 'cardprops' and 'streammap' of a card are
+ * written into a memfd, in the binary layout of hal-generic-shm-layout.h,
+ * which is then sealed. 'initialize_sndcard' only carries its path, under
+ * /proc/<pid>/fd, which the plugin maps read-only with the
+ * hal-generic-shm-reader library: the payload is neither serialized to
+ * text nor parsed again.
+ *
+ * The segment is sized with a counting pass, then filled in place. The
+ * memfd of a card is kept open until the plugin is initialized again, or
+ * the card is released.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-shm.h"
+#include "hal-generic-matrix.h"
+#include "hal-generic-model.h"
+#include "wrap-json.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_SHM_PATH_SZ 64
+#define HAL_SHM_LINK_SZ 256
+#define HAL_SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+// Section sizes on the counting pass, fill cursors on the second pass
+typedef struct {
+  uint8_t *base;                      // NULL on the counting pass
+  const halShmHeaderT *header;
+  uint32_t channels[2];
+  uint32_t streams;
+  uint32_t rows;
+  uint32_t cells;
+  uint32_t gains;
+  uint32_t strings;
+} halShmWriterT;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint32_t shmSection(uint32_t prevOffset, uint64_t prevSize);
+STATIC uint32_t shmString(halShmWriterT *writer, const char *str);
+STATIC bool shmChannels(halShmWriterT *writer, json_object *channelsJ,
+                        SinkSourceT sinkSourceType);
+STATIC bool shmEndpoint(halShmWriterT *writer, json_object *endpointJ,
+                        halShmEndpointT *endpoint);
+STATIC bool shmWrite(halShmWriterT *writer, json_object *cardpropsJ,
+                     json_object *streammapJ);
+STATIC void shmLink(const char *name, const char *path);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Lay out a section after the previous one, aligned
+ * @return The section offset, or 0 if it is past the 32 bit offsets
+ */
+STATIC uint32_t shmSection(uint32_t prevOffset, uint64_t prevSize)
+{
+  uint64_t offset = ((uint64_t)prevOffset + prevSize + HAL_SHM_ALIGN - 1) &
+                    ~((uint64_t)HAL_SHM_ALIGN - 1);
+
+  return offset > UINT32_MAX ? 0 : (uint32_t)offset;
+}
+
+/*
+ * @brief Add a string to the pool
+ * @return The string offset, 0 for NULL
+ */
+STATIC uint32_t shmString(halShmWriterT *writer, const char *str)
+{
+  uint32_t offset = writer->strings;
+  size_t len = 0;
+
+  if (!str)
+    return 0;
+
+  len = strlen(str) + 1;
+  if (writer->base)
+    memcpy(writer->base + writer->header->stringsOffset + offset, str, len);
+  writer->strings += (uint32_t)len;
+
+  return offset;
+}
+
+/*
+ * @brief Add the sink or source channels of 'cardprops'
+ * @return true on success, false if a channel is not valid
+ */
+STATIC bool shmChannels(halShmWriterT *writer, json_object *channelsJ,
+                        SinkSourceT sinkSourceType)
+{
+  int idx = 0;
+
+  for (idx = 0; channelsJ && idx < (int)json_object_array_length(channelsJ); idx++)
+  {
+    halShmChannelT channel = { 0, 0 };
+    const char *type = NULL;
+    uint32_t channelIdx = writer->channels[sinkSourceType]++;
+
+    if (wrap_json_unpack(json_object_array_get_idx(channelsJ, idx), "{s?s,s:i}",
+                         "type", &type, "port", &channel.port))
+      return false;
+
+    channel.type = shmString(writer, type);
+    if (!writer->base)
+      continue;
+
+    // Sources follow the sinks
+    if (sinkSourceType == SOURCE)
+      channelIdx += writer->header->channelsCount[SINK];
+    ((halShmChannelT *)(writer->base + writer->header->channelsOffset))[channelIdx] = channel;
+  }
+
+  return true;
+}
+
+/*
+ * @brief Add the 'mapping' rows and the matrix of a stream 'sink' or
+ *        'source'
+ * @return true on success, false if the endpoint is not valid
+ */
+STATIC bool shmEndpoint(halShmWriterT *writer, json_object *endpointJ,
+                        halShmEndpointT *endpoint)
+{
+  json_object *mappingJ = NULL, *matrixJ = NULL;
+  const char *format = NULL, *data = NULL;
+  int channels = 0, rows = 0, cols = 0, rowIdx = 0, cellIdx = 0;
+
+  memset(endpoint, 0, sizeof(halShmEndpointT));
+  if (!endpointJ)
+    return true;
+
+  if (wrap_json_unpack(endpointJ, "{s:i,s:o,s?o}", "channels", &channels,
+                       "mapping", &mappingJ, "matrix", &matrixJ) ||
+      channels <= 0 || !json_object_is_type(mappingJ, json_type_array) ||
+      (int)json_object_array_length(mappingJ) != channels)
+    return false;
+
+  endpoint->channels = (uint32_t)channels;
+  endpoint->rowsIdx = writer->rows;
+  writer->rows += (uint32_t)channels;
+
+  for (rowIdx = 0; rowIdx < channels; rowIdx++)
+  {
+    json_object *rowJ = json_object_array_get_idx(mappingJ, rowIdx);
+    halShmRowT row = { writer->cells, (uint32_t)json_object_array_length(rowJ) };
+
+    writer->cells += row.cellsCount;
+    for (cellIdx = 0; cellIdx < (int)row.cellsCount; cellIdx++)
+    {
+      uint32_t cell = shmString(writer, json_object_get_string(json_object_array_get_idx(rowJ, cellIdx)));
+
+      if (writer->base)
+        ((uint32_t *)(writer->base + writer->header->cellsOffset))[row.cellsIdx + cellIdx] = cell;
+    }
+
+    if (writer->base)
+      ((halShmRowT *)(writer->base + writer->header->rowsOffset))[endpoint->rowsIdx + rowIdx] = row;
+  }
+
+  if (!matrixJ)
+    return true;
+
+  if (wrap_json_unpack(matrixJ, "{s:i,s:i,s:s,s:s}", "rows", &rows, "cols", &cols,
+                       "format", &format, "data", &data) ||
+      strcmp(format, HAL_MATRIX_FORMAT) != 0 || rows != channels ||
+      cols <= 0 || cols > HAL_MATRIX_PORTS_MAX)
+    return false;
+
+  endpoint->cols = (uint32_t)cols;
+  endpoint->gainsIdx = writer->gains;
+  writer->gains += (uint32_t)(rows * cols);
+
+  // Decoded straight into the segment
+  if (writer->base &&
+      !halMatrixDecode(data, (float *)(writer->base + writer->header->gainsOffset) + endpoint->gainsIdx,
+                       (size_t)rows * cols))
+    return false;
+
+  return true;
+}
+
+/*
+ * @brief Write the payload, or only size its sections if writer->base is
+ *        NULL
+ * @return true on success, false if the payload is not valid
+ */
+STATIC bool shmWrite(halShmWriterT *writer, json_object *cardpropsJ,
+                     json_object *streammapJ)
+{
+  json_object *sinksJ = NULL, *sourcesJ = NULL;
+  int idx = 0;
+
+  // Offset 0 of the string pool stands for NULL
+  writer->strings = 0;
+  shmString(writer, "");
+
+  wrap_json_unpack(cardpropsJ, "{s?o,s?o}", "sink", &sinksJ, "source", &sourcesJ);
+  if (!shmChannels(writer, sinksJ, SINK) || !shmChannels(writer, sourcesJ, SOURCE))
+    return false;
+
+  for (idx = 0; idx < (int)json_object_array_length(streammapJ); idx++)
+  {
+    halShmStreamT stream;
+    const char *role = NULL;
+    json_object *sinkJ = NULL, *sourceJ = NULL;
+
+    if (wrap_json_unpack(json_object_array_get_idx(streammapJ, idx), "{s:s,s?o,s?o}",
+                         "stream", &role, "sink", &sinkJ, "source", &sourceJ))
+      return false;
+
+    stream.role = shmString(writer, role);
+    if (!shmEndpoint(writer, sinkJ, &stream.endpoints[SINK]) ||
+        !shmEndpoint(writer, sourceJ, &stream.endpoints[SOURCE]))
+      return false;
+
+    if (writer->base)
+      ((halShmStreamT *)(writer->base + writer->header->streamsOffset))[writer->streams] = stream;
+    writer->streams++;
+  }
+
+  return true;
+}
+
+
+/*
+ * @brief Link the segment of a card at <runtime dir>/4a-hal/<card>.shm, for
+ *        the ALSA plugins. The link is replaced atomically. Failures are
+ *        logged only, as HAL plugins are sent the path.
+ * @param name : The card name
+ * @param path : The /proc path of the memfd
+ */
+STATIC void shmLink(const char *name, const char *path)
+{
+  const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+  char dir[HAL_SHM_LINK_SZ], link[HAL_SHM_LINK_SZ], tmp[HAL_SHM_LINK_SZ];
+  struct stat dirStat;
+
+  if (!runtimeDir || !*runtimeDir)
+    runtimeDir = HAL_SHM_LINK_RUNTIME;
+  if (strchr(name, '/'))
+    return;
+
+  link[0] = '\0';
+  if (snprintf(dir, sizeof(dir), "%s/%s", runtimeDir, HAL_SHM_LINK_DIR) >= (int)sizeof(dir) ||
+      snprintf(link, sizeof(link), "%s/%s%s", dir, name, HAL_SHM_LINK_SUFFIX) >= (int)sizeof(link) ||
+      snprintf(tmp, sizeof(tmp), "%s.%d", link, (int)getpid()) >= (int)sizeof(tmp))
+  {
+    errno = ENAMETOOLONG;
+    goto OnErrorExit;
+  }
+
+  // The dir may be shared, as /tmp: only link into a dir of ours
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+    goto OnErrorExit;
+  if (lstat(dir, &dirStat) < 0 || !S_ISDIR(dirStat.st_mode) ||
+      dirStat.st_uid != geteuid())
+  {
+    errno = EPERM;
+    goto OnErrorExit;
+  }
+
+  unlink(tmp);
+  if (symlink(path, tmp) < 0)
+    goto OnErrorExit;
+  if (rename(tmp, link) < 0)
+  {
+    unlink(tmp);
+    goto OnErrorExit;
+  }
+
+  return;
+
+OnErrorExit:
+  AFB_ApiWarning(NULL, "SHM: card %s, cannot link %s: %s", name, link, strerror(errno));
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Write the payload of a card into a new sealed memfd
+ * @param name : The memfd name, e.g. the card name
+ * @param size : Set to the segment size
+ * @return The memfd, or -1 on failure
+ */
+PUBLIC int halShmCreate(const char *name, json_object *cardpropsJ,
+                        json_object *streammapJ, size_t *size)
+{
+  halShmWriterT writer;
+  halShmHeaderT header;
+  uint8_t *base = NULL;
+  int fd = -1;
+
+  if (!json_object_is_type(streammapJ, json_type_array))
+    return -1;
+
+  // Counting pass, then lay out the sections
+  memset(&writer, 0, sizeof(writer));
+  if (!shmWrite(&writer, cardpropsJ, streammapJ))
+  {
+    AFB_ApiError(NULL, "SHM: card %s, the payload is not valid", name);
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = HAL_SHM_MAGIC;
+  header.version = HAL_SHM_VERSION;
+  header.channelsCount[SINK] = writer.channels[SINK];
+  header.channelsCount[SOURCE] = writer.channels[SOURCE];
+  header.streamsCount = writer.streams;
+  header.rowsCount = writer.rows;
+  header.cellsCount = writer.cells;
+  header.gainsCount = writer.gains;
+  header.stringsSize = writer.strings;
+  header.channelsOffset = shmSection(0, sizeof(header));
+  header.streamsOffset = shmSection(header.channelsOffset,
+                                    ((uint64_t)writer.channels[SINK] + writer.channels[SOURCE]) *
+                                    sizeof(halShmChannelT));
+  header.rowsOffset = shmSection(header.streamsOffset, (uint64_t)writer.streams * sizeof(halShmStreamT));
+  header.cellsOffset = shmSection(header.rowsOffset, (uint64_t)writer.rows * sizeof(halShmRowT));
+  header.gainsOffset = shmSection(header.cellsOffset, (uint64_t)writer.cells * sizeof(uint32_t));
+  header.stringsOffset = shmSection(header.gainsOffset, (uint64_t)writer.gains * sizeof(float));
+  if (!header.streamsOffset || !header.rowsOffset || !header.cellsOffset ||
+      !header.gainsOffset || !header.stringsOffset ||
+      (uint64_t)header.stringsOffset + writer.strings > UINT32_MAX)
+  {
+    AFB_ApiError(NULL, "SHM: card %s, the payload does not fit in 4 GiB", name);
+    return -1;
+  }
+  header.size = header.stringsOffset + writer.strings;
+
+  fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0 || ftruncate(fd, header.size) < 0)
+    goto OnErrorExit;
+
+  base = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    goto OnErrorExit;
+
+  // Fill pass, in place
+  memcpy(base, &header, sizeof(header));
+  memset(&writer, 0, sizeof(writer));
+  writer.base = base;
+  writer.header = &header;
+  if (!shmWrite(&writer, cardpropsJ, streammapJ))
+  {
+    munmap(base, header.size);
+    goto OnErrorExit;
+  }
+
+  // No writable mapping may be left to seal the memfd
+  munmap(base, header.size);
+  if (fcntl(fd, F_ADD_SEALS, HAL_SHM_SEALS) < 0)
+    goto OnErrorExit;
+
+  *size = header.size;
+  return fd;
+
+OnErrorExit:
+  AFB_ApiError(NULL, "SHM: card %s, cannot create the payload segment (%s)",
+               name, strerror(errno));
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+/*
+ * @brief Get the 'initialize_sndcard' arguments of a card, as a new sealed
+ *        segment, which replaces the previous one of the card
+ * @param shmFd : The memfd of the card, -1 if none, set to the new memfd
+ * @return { "shm": { "path", "size", "version" } }, or NULL on failure
+ */
+PUBLIC json_object *halShmArgs(int *shmFd, const char *name,
+                               json_object *cardpropsJ, json_object *streammapJ)
+{
+  json_object *argsJ = NULL;
+  char path[HAL_SHM_PATH_SZ];
+  size_t size = 0;
+  int fd = halShmCreate(name, cardpropsJ, streammapJ, &size);
+
+  if (fd < 0)
+    return NULL;
+
+  if (*shmFd >= 0)
+    close(*shmFd);
+  *shmFd = fd;
+
+  // The plugin opens the memfd of this process, at any time until replaced
+  snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)getpid(), fd);
+  shmLink(name, path);
+  wrap_json_pack(&argsJ, "{s:{s:s,s:I,s:i}}",
+                 "shm", "path", path, "size", (int64_t)size,
+                 "version", HAL_SHM_VERSION);
+
+  AFB_ApiNotice(NULL, "SHM: card %s, payload of %zu bytes in %s", name, size, path);
+  return argsJ;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_SHM_H
+#define HAL_GENERIC_SHM_H
+
+#include "hal-generic.h"
+#include "hal-generic-shm-layout.h"
+
+#include <json-c/json.h>
+#include <stddef.h>
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC int halShmCreate(const char *name, json_object *cardpropsJ,
+                        json_object *streammapJ, size_t *size);
+PUBLIC json_object *halShmArgs(int *shmFd, const char *name,
+                               json_object *cardpropsJ, json_object *streammapJ);
+
+#endif /* HAL_GENERIC_SHM_H */
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Asynchronous HAL card bring-up.
+ *
+ * Every card runs its own pipeline on the binder event loop:
+ *
+ *   WAIT_API -> INIT_PLUGIN -> READY
+ *       \            \
+ *        `-----------`-> FAILED
+ *
+ * WAIT_API polls for the HAL plugin API until its deadline. INIT_PLUGIN
+ * sends 'initialize_sndcard' with an asynchronous service call, and retries
+ * it on error or timeout. When the plugin replies, the card halmap is
+ * registered with the HAL and the card is READY. All cards progress
+ * concurrently, so the HAL comes up as soon as the slowest plugin is ready.
+ * Once every card has completed, the 'ready' event is pushed.
+ *
+ * The time of the preinit, init and ready milestones, and the bring-up
+ * time of each card, are reported with the readiness. Each step of a card
+ * is traced on the lane of that card, and the trace is dumped once every
+ * card has completed.
+ */
+
+#include "hal-generic-startup.h"
+#include "hal-generic-card.h"
+#include "hal-generic-utility.h"
+#include "hal-generic-trace.h"
+#include "wrap-json.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define USEC_PER_MSEC 1000ULL
+
+typedef enum {
+  STARTUP_WAIT_API,
+  STARTUP_INIT_PLUGIN,
+  STARTUP_READY,
+  STARTUP_FAILED
+} halStartupStateT;
+
+static const char *halStartupStateLabels[] = {
+  [STARTUP_WAIT_API] = "wait-api",
+  [STARTUP_INIT_PLUGIN] = "init-plugin",
+  [STARTUP_READY] = "ready",
+  [STARTUP_FAILED] = "failed"
+};
+
+typedef struct {
+  halCardT *card;
+  halStartupStateT state;
+  int attempt;              // 'initialize_sndcard' attempts so far
+  unsigned serial;          // Serial of the outstanding call
+  bool pending;             // A call is outstanding
+  uint64_t deadline;        // WAIT_API deadline
+  uint64_t started;          // Pipeline start time
+  uint64_t completed;        // Pipeline completion time, 0 until completed
+  sd_event_source *timer;
+  halTraceSpanT span;        // Trace span of the current step
+  const char *error;
+} halStartupCardT;
+
+typedef struct {
+  halStartupCardT *sc;
+  unsigned serial;
+} halStartupCallT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halStartupCardT *_startupCards = NULL;
+static int _startupCardsCount = 0;
+static int _startupPending = 0;
+static struct afb_event _readyEvent;
+static uint64_t _marks[HAL_STARTUP_MARK_END];  // Milestone times, 0 if not reached
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint64_t nowUsec(void);
+STATIC void traceStep(halStartupCardT *sc, const char *name);
+STATIC HAL_ERRCODE armTimer(halStartupCardT *sc, uint64_t delayMs);
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata);
+STATIC void stepWaitApi(halStartupCardT *sc);
+STATIC void stepInitPlugin(halStartupCardT *sc);
+STATIC void initPluginCB(void *closure, int result, json_object *cfgResultJ);
+STATIC void retryInitPlugin(halStartupCardT *sc, const char *error);
+STATIC void complete(halStartupCardT *sc, halStartupStateT state, const char *error);
+STATIC json_object *elapsedMsJ(uint64_t fromUsec, uint64_t toUsec);
+STATIC json_object *readinessJ(void);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the monotonic time, in usec
+ */
+STATIC uint64_t nowUsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/*
+ * @brief End the trace span of the current step of a card pipeline, and
+ *        begin the span of the next step, if any
+ */
+STATIC void traceStep(halStartupCardT *sc, const char *name)
+{
+  halTraceEnd(sc->span);
+  sc->span = name ? halTraceBegin("card", name, HAL_TRACE_CARD(sc - _startupCards),
+                                  sc->card->name)
+                  : -1;
+}
+
+/*
+ * @brief (Re)arm the one-shot timer of a card pipeline
+ */
+STATIC HAL_ERRCODE armTimer(halStartupCardT *sc, uint64_t delayMs)
+{
+  uint64_t usec = nowUsec() + delayMs * USEC_PER_MSEC;
+
+  if (!sc->timer)
+  {
+    if (sd_event_add_time(afb_daemon_get_event_loop(), &sc->timer,
+                          CLOCK_MONOTONIC, usec, USEC_PER_MSEC,
+                          timerCB, sc) < 0)
+    {
+      sc->timer = NULL;
+      return HAL_FAIL;
+    }
+    return HAL_OK;
+  }
+
+  if (sd_event_source_set_time(sc->timer, usec) < 0 ||
+      sd_event_source_set_enabled(sc->timer, SD_EVENT_ONESHOT) < 0)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Timer callback: poll, retry, or time out the current step
+ */
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  halStartupCardT *sc = (halStartupCardT *)userdata;
+
+  switch (sc->state)
+  {
+    case STARTUP_WAIT_API:
+      stepWaitApi(sc);
+      break;
+
+    case STARTUP_INIT_PLUGIN:
+      if (sc->pending)
+      {
+        // Forget the outstanding call, a late reply will be dropped
+        sc->pending = false;
+        sc->serial++;
+        traceStep(sc, NULL);
+        retryInitPlugin(sc, "'initialize_sndcard' timed out");
+      }
+      else
+        stepInitPlugin(sc);
+      break;
+
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/*
+ * @brief Wait for the HAL plugin API to be available
+ */
+STATIC void stepWaitApi(halStartupCardT *sc)
+{
+  if (afb_daemon_require_api(sc->card->api, 0) == 0)
+  {
+    sc->state = STARTUP_INIT_PLUGIN;
+    stepInitPlugin(sc);
+    return;
+  }
+
+  if (nowUsec() >= sc->deadline)
+  {
+    AFB_ApiError(NULL, "AFB API '%s' is not availble!", sc->card->api);
+    complete(sc, STARTUP_FAILED, "HAL plugin API is not available");
+    return;
+  }
+
+  if (armTimer(sc, HAL_STARTUP_API_POLL_MS) != HAL_OK)
+    complete(sc, STARTUP_FAILED, "Cannot arm startup timer");
+}
+
+/*
+ * @brief Send 'initialize_sndcard' to the HAL plugin, with a deadline
+ */
+STATIC void stepInitPlugin(halStartupCardT *sc)
+{
+  halStartupCallT *call = malloc(sizeof(halStartupCallT));
+
+  if (!call || armTimer(sc, HAL_STARTUP_INIT_TIMEOUT_MS) != HAL_OK)
+  {
+    free(call);
+    complete(sc, STARTUP_FAILED, "Cannot start 'initialize_sndcard'");
+    return;
+  }
+
+  sc->attempt++;
+  sc->serial++;
+  sc->pending = true;
+  traceStep(sc, "initialize_sndcard");
+  call->sc = sc;
+  call->serial = sc->serial;
+
+  // Attempt to initialize the HAL plugin by it's AFB API
+  AFB_ApiNotice(NULL, "Initialize HAL plugin (name: '%s', api: '%s', attempt: %d)",
+                sc->card->name, sc->card->api, sc->attempt);
+  initHalPluginAsync(sc->card, initPluginCB, call);
+}
+
+/*
+ * @brief 'initialize_sndcard' reply callback
+ */
+STATIC void initPluginCB(void *closure, int result, json_object *cfgResultJ)
+{
+  halStartupCallT *call = (halStartupCallT *)closure;
+  halStartupCardT *sc = call->sc;
+  bool stale = (call->serial != sc->serial) || !sc->pending;
+
+  free(call);
+  if (stale)
+  {
+    AFB_ApiNotice(NULL, "Dropping late 'initialize_sndcard' reply from '%s'",
+                  sc->card->api);
+    return;
+  }
+
+  sc->pending = false;
+  sd_event_source_set_enabled(sc->timer, SD_EVENT_OFF);
+  traceStep(sc, NULL);
+
+  if (initHalPluginResult(result, cfgResultJ) != HAL_OK)
+  {
+    AFB_ApiError(NULL, "Initialize HAL plugin failed! (name: '%s', api: '%s')",
+                 sc->card->name, sc->card->api);
+    retryInitPlugin(sc, "'initialize_sndcard' failed");
+    return;
+  }
+
+  traceStep(sc, "halServiceInit");
+  if (halCardRegister(sc->card) != HAL_OK)
+  {
+    complete(sc, STARTUP_FAILED, "Cannot register the card halmap");
+    return;
+  }
+
+  complete(sc, STARTUP_READY, NULL);
+}
+
+/*
+ * @brief Schedule another 'initialize_sndcard' attempt, or give up
+ */
+STATIC void retryInitPlugin(halStartupCardT *sc, const char *error)
+{
+  if (sc->attempt >= HAL_STARTUP_INIT_RETRIES)
+  {
+    complete(sc, STARTUP_FAILED, error);
+    return;
+  }
+
+  AFB_ApiWarning(NULL, "CARD: '%s': %s, retrying", sc->card->name, error);
+  if (armTimer(sc, HAL_STARTUP_RETRY_DELAY_MS) != HAL_OK)
+    complete(sc, STARTUP_FAILED, error);
+}
+
+/*
+ * @brief Complete a card pipeline, and push the 'ready' event once all
+ *        card pipelines have completed
+ */
+STATIC void complete(halStartupCardT *sc, halStartupStateT state, const char *error)
+{
+  sc->state = state;
+  sc->error = error;
+  sc->completed = nowUsec();
+  traceStep(sc, NULL);
+  halTraceInstant("card", halStartupStateLabels[state], HAL_TRACE_CARD(sc - _startupCards));
+  if (sc->timer)
+    sd_event_source_set_enabled(sc->timer, SD_EVENT_OFF);
+
+  if (state == STARTUP_FAILED)
+    AFB_ApiError(NULL, "CARD: '%s' failed to start: %s", sc->card->name, error);
+
+  if (--_startupPending > 0)
+    return;
+
+  halStartupMark(HAL_STARTUP_MARK_READY);
+  halTraceInstant("binding", HAL_STARTUP_EVENT, HAL_TRACE_MAIN);
+  halTraceDump();
+  AFB_ApiNotice(NULL, ".. Initializing Complete! (ready: %d)", halStartupIsReady());
+  if (afb_event_is_valid(_readyEvent))
+    afb_event_push(_readyEvent, readinessJ());
+}
+
+/*
+ * @brief Get the time between two milestones in ms, null if either one
+ *        has not been reached
+ */
+STATIC json_object *elapsedMsJ(uint64_t fromUsec, uint64_t toUsec)
+{
+  if (!fromUsec || !toUsec)
+    return NULL;
+
+  return json_object_new_double((double)(toUsec - fromUsec) / USEC_PER_MSEC);
+}
+
+/*
+ * @brief Describe the startup state of the HAL, and of each card
+ */
+STATIC json_object *readinessJ(void)
+{
+  json_object *cardsJ = json_object_new_array();
+  json_object *readyJ = NULL;
+  bool degraded = false;
+  int idx = 0;
+
+  for (idx = 0; idx < _startupCardsCount; idx++)
+  {
+    halStartupCardT *sc = &_startupCards[idx];
+    json_object *cardJ = NULL;
+
+    // A failed card, the others still serve their streams
+    if (sc->state == STARTUP_FAILED)
+      degraded = true;
+
+    wrap_json_pack(&cardJ, "{s:s,s:s,s:b,s:s,s:i,s:o*,s:s*}",
+                   "name", sc->card->name,
+                   "prefix", sc->card->prefix,
+                   "hal", sc->card->hal,
+                   "state", halStartupStateLabels[sc->state],
+                   "attempts", sc->attempt,
+                   "ms", elapsedMsJ(sc->started, sc->completed),
+                   "error", sc->error);
+    json_object_array_add(cardsJ, cardJ);
+  }
+
+  // Milestones, in ms since the previous one
+  wrap_json_pack(&readyJ, "{s:b,s:b,s:b,s:b,s:{s:o*,s:o*},s:o}",
+                 "ready", halStartupIsReady(),
+                 "hal", halStartupHalIsReady(),
+                 "degraded", degraded,
+                 "complete", _startupPending == 0,
+                 "timing",
+                   "init", elapsedMsJ(_marks[HAL_STARTUP_MARK_PREINIT],
+                                      _marks[HAL_STARTUP_MARK_INIT]),
+                   "ready", elapsedMsJ(_marks[HAL_STARTUP_MARK_INIT],
+                                       _marks[HAL_STARTUP_MARK_READY]),
+                 "cards", cardsJ);
+
+  return readyJ;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Record the time a startup milestone is reached
+ */
+PUBLIC void halStartupMark(halStartupMarkT mark)
+{
+  if (mark < HAL_STARTUP_MARK_END)
+    _marks[mark] = nowUsec();
+}
+
+/*
+ * @brief Start the bring-up pipeline of every resolved HAL card. Returns
+ *        once every pipeline is started; completion is signalled by the
+ *        'ready' event.
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halStartupRun(void)
+{
+  int idx = 0;
+
+  _readyEvent = afb_daemon_make_event(HAL_STARTUP_EVENT);
+  if (!afb_event_is_valid(_readyEvent))
+    AFB_ApiWarning(NULL, "Cannot create '%s' event", HAL_STARTUP_EVENT);
+
+  _startupCardsCount = halCardsCount();
+  _startupCards = calloc((size_t)_startupCardsCount + 1, sizeof(halStartupCardT));
+  if (!_startupCards)
+  {
+    AFB_ApiError(NULL, "Cannot allocate startup pipelines");
+    return HAL_FAIL;
+  }
+
+  // Count every pipeline as pending before starting any of them, so that
+  // a pipeline completing synchronously does not complete the startup
+  _startupPending = _startupCardsCount;
+  for (idx = 0; idx < _startupCardsCount; idx++)
+  {
+    _startupCards[idx].card = halCardGet(idx);
+    _startupCards[idx].state = STARTUP_WAIT_API;
+    _startupCards[idx].started = nowUsec();
+    _startupCards[idx].span = -1;
+    _startupCards[idx].deadline = nowUsec() + HAL_STARTUP_API_DEADLINE_MS * USEC_PER_MSEC;
+  }
+
+  for (idx = 0; idx < _startupCardsCount; idx++)
+  {
+    halTraceLaneName(HAL_TRACE_CARD(idx), _startupCards[idx].card->name);
+    traceStep(&_startupCards[idx], "afb_daemon_require_api");
+    stepWaitApi(&_startupCards[idx]);
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Check whether every HAL card is ready
+ */
+PUBLIC bool halStartupIsReady(void)
+{
+  int idx = 0;
+
+  if (!_startupCards || _startupPending > 0)
+    return false;
+
+  for (idx = 0; idx < _startupCardsCount; idx++)
+    if (_startupCards[idx].state != STARTUP_READY)
+      return false;
+
+  return true;
+}
+
+/*
+ * @brief Check whether the HAL card, which serves the HAL service verbs,
+ *        is registered and ready, whatever the state of the other cards
+ */
+PUBLIC bool halStartupHalIsReady(void)
+{
+  const halCardT *card = halCardGet(HAL_CARD_HAL_IDX);
+  int idx = 0;
+
+  if (!_startupCards || !card)
+    return false;
+
+  for (idx = 0; idx < _startupCardsCount; idx++)
+    if (_startupCards[idx].card == card)
+      return _startupCards[idx].state == STARTUP_READY && card->hal;
+
+  return false;
+}
+
+/*
+ * @brief 'ready' verb: get the HAL readiness, and subscribe to the
+ *        'ready' event
+ */
+PUBLIC void halStartupReadyVerb(struct afb_req request)
+{
+  if (afb_event_is_valid(_readyEvent))
+    afb_req_subscribe(request, _readyEvent);
+
+  afb_req_success(request, readinessJ(), NULL);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_STARTUP_H
+#define HAL_GENERIC_STARTUP_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_STARTUP_EVENT "ready"
+
+#define HAL_STARTUP_API_DEADLINE_MS 10000 // Wait for a HAL plugin API
+#define HAL_STARTUP_API_POLL_MS 50        // Poll period for a HAL plugin API
+#define HAL_STARTUP_INIT_TIMEOUT_MS 3000  // Wait for 'initialize_sndcard'
+#define HAL_STARTUP_INIT_RETRIES 3        // 'initialize_sndcard' attempts
+#define HAL_STARTUP_RETRY_DELAY_MS 200    // Delay between attempts
+
+// Startup milestones, reported by the 'ready' verb
+typedef enum {
+  HAL_STARTUP_MARK_PREINIT,
+  HAL_STARTUP_MARK_INIT,
+  HAL_STARTUP_MARK_READY,
+
+  HAL_STARTUP_MARK_END
+} halStartupMarkT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC void halStartupMark(halStartupMarkT mark);
+PUBLIC HAL_ERRCODE halStartupRun(void);
+PUBLIC bool halStartupIsReady(void);
+PUBLIC bool halStartupHalIsReady(void);
+PUBLIC void halStartupReadyVerb(struct afb_req request);
+
+#endif /* HAL_GENERIC_STARTUP_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Static config, for fixed-config images.
+ *
+ * Built with -DHAL_GENERIC_STATIC_CONFIG=ON, the config is validated at
+ * build time by hal-generic-codegen, and compiled into the binding as
+ * const tables: the config model, the options, and the halmap of every
+ * card. Nothing is parsed at startup, and the config files, the cache and
+ * the reload are not used.
+ *
+ * Tags the HAL does not know are registered by the codegen as the model is
+ * built, and registered again at startup, in the same order, so that they
+ * get the same values as in the tables.
+ *
+ * The halmap of a card is still copied into the card arena, as alsacore
+ * resolves its numids and the 'Ramp' entries get a ramp of their own. The
+ * 'cardprops' and 'streammap' payloads are generated from the model, as
+ * they have to be handed to the HAL plugin as json_objects anyway.
+ */
+
+#include "hal-generic-static.h"
+#include "hal-generic-utility.h"
+#include "hal-generic-duck.h"
+#include "hal-generic-tags.h"
+
+#include <string.h>
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC HAL_ERRCODE staticRegisterTags(void);
+STATIC size_t staticHalMapSize(const halStaticHalMapT *staticHalMap);
+STATIC alsaHalMapT *staticHalMap(halArenaT *arena,
+                                 const halStaticHalMapT *staticHalMap);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Register the roles and ctl tags of the model, as the codegen did,
+ *        and check them against the halmaps
+ * @return HAL_OK on success, HAL_FAIL if a tag differs from the tables
+ */
+STATIC HAL_ERRCODE staticRegisterTags(void)
+{
+  const halModelT *model = &halStaticConfig.model;
+  int ctlsIdx = 0, cardIdx = 0, idx = 0, ctlType = 0;
+
+  for (ctlsIdx = 0; ctlsIdx < model->ctlsCount; ctlsIdx++)
+  {
+    const halModelCtlsT *ctls = &model->ctls[ctlsIdx];
+
+    if (halCtlsRoleRegister(ctls->role) != ctls->roleIdx)
+    {
+      AFB_ApiError(NULL, "STATIC: Role '%s' differs from the config tables", ctls->role);
+      return HAL_FAIL;
+    }
+
+    for (ctlType = Volume; ctlType < EndHalCtlsType; ctlType++)
+      if (ctls->ctls[ctlType])
+        halCtlsTagRegister(ctls->roleIdx, (halCtlsTypeT)ctlType);
+  }
+
+  for (cardIdx = 0; cardIdx < model->cardsCount; cardIdx++)
+  {
+    const halStaticHalMapT *halmap = &halStaticConfig.halmaps[cardIdx];
+
+    for (idx = 0; idx < halmap->ctlsCount; idx++)
+      if (halCtlsTagGetByLabel(halmap->halmap[idx].label) != halmap->halmap[idx].tag)
+      {
+        AFB_ApiError(NULL, "STATIC: Tag of '%s' differs from the config tables",
+                     halmap->halmap[idx].label);
+        return HAL_FAIL;
+      }
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Size the halmap of a card, and its ramps
+ * @return The arena size taken by the halmap
+ */
+STATIC size_t staticHalMapSize(const halStaticHalMapT *staticHalMap)
+{
+  size_t size = HAL_ARENA_SZ(sizeof(alsaHalMapT) * (staticHalMap->ctlsCount + 1));
+  int idx = 0;
+
+  for (idx = 0; idx < staticHalMap->ctlsCount; idx++)
+    if (halCtlsTypeGet(staticHalMap->halmap[idx].tag) == Ramp)
+      size += halRampArenaSize();
+
+  return size;
+}
+
+/*
+ * @brief Copy the halmap of a card into its arena, and set up its ramps.
+ *        Control names point into the static tables.
+ * @return A halmap array, terminated by a zeroed entry, or NULL on failure
+ */
+STATIC alsaHalMapT *staticHalMap(halArenaT *arena,
+                                 const halStaticHalMapT *staticHalMap)
+{
+  alsaHalMapT *alsaHalMap = NULL;
+  int idx = 0;
+
+  alsaHalMap = halArenaAlloc(arena, sizeof(alsaHalMapT) * (staticHalMap->ctlsCount + 1));
+  if (!alsaHalMap)
+  {
+    AFB_ApiError(NULL, "STATIC: Cannot allocate halmap");
+    return NULL;
+  }
+
+  memcpy(alsaHalMap, staticHalMap->halmap,
+         sizeof(alsaHalMapT) * (staticHalMap->ctlsCount + 1));
+
+  for (idx = 0; idx < staticHalMap->ctlsCount; idx++)
+  {
+    alsaHalMapT *entry = &alsaHalMap[idx];
+
+    if (halCtlsTypeGet(entry->tag) != Ramp)
+      continue;
+
+    // The ramp drives the volume ctl of the same role
+    entry->cb.handle = halRampNew(arena,
+                                  halCtlsTagGetByRole(halCtlsTagRole(entry->tag), Volume),
+                                  entry->ctl.step, &staticHalMap->ramps[idx]);
+    if (entry->cb.handle)
+      entry->cb.callback = halRampCB;
+  }
+
+  return alsaHalMap;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Load the settings of the static config: API name, options and
+ *        role priorities
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halStaticLoad(void)
+{
+  if (halStaticConfig.api && afb_daemon_rename_api(halStaticConfig.api))
+  {
+    AFB_ApiError(NULL, "STATIC: Fail to rename api to:%s", halStaticConfig.api);
+    return HAL_FAIL;
+  }
+
+  halOptionsSet(&halStaticConfig.options);
+  if (staticRegisterTags() != HAL_OK)
+    return HAL_FAIL;
+  if (halDuckLoadModel(&halStaticConfig.model) != HAL_OK)
+    return HAL_FAIL;
+
+  AFB_ApiNotice(NULL, "STATIC: Config built into the binding, from %s (cards: %d)",
+                halStaticConfig.source, halStaticConfig.model.cardsCount);
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Get the API name set by the static config
+ * @return The API name, or NULL if the config did not rename the API
+ */
+PUBLIC const char *halStaticGetApi(void)
+{
+  return halStaticConfig.api;
+}
+
+/*
+ * @brief Get the number of cards of the static config
+ */
+PUBLIC int halStaticGetCardCount(void)
+{
+  return halStaticConfig.model.cardsCount;
+}
+
+/*
+ * @brief Get a card of the static config, and copy its halmap. The
+ *        cardprops and streammap objects are new references, owned by
+ *        the card.
+ * @param bindingApi : The binding API, see halCardInit
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halStaticGetCard(int cardIdx, halCardT *card,
+                                    const char *bindingApi)
+{
+  const halModelT *model = &halStaticConfig.model;
+  const halModelCardT *modelCard = NULL;
+  const halStaticHalMapT *halmap = NULL;
+
+  if (cardIdx < 0 || cardIdx >= model->cardsCount)
+    return HAL_FAIL;
+
+  modelCard = &model->cards[cardIdx];
+  halmap = &halStaticConfig.halmaps[cardIdx];
+
+  if (halCardInit(card, bindingApi, modelCard->name, modelCard->api,
+                  modelCard->info, staticHalMapSize(halmap)) != HAL_OK)
+    return HAL_FAIL;
+
+  card->cardpropsJ = generateCardProperties(modelCard);
+  card->streammapJ = generateStreamMap(model, cardIdx);
+  card->halmap = staticHalMap(card->arena, halmap);
+
+  if (!card->cardpropsJ || !card->streammapJ || !card->halmap)
+  {
+    AFB_ApiError(NULL, "STATIC: Card %d cannot be resolved", cardIdx);
+    return HAL_FAIL;
+  }
+
+  return HAL_OK;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_STATIC_H
+#define HAL_GENERIC_STATIC_H
+
+#include "hal-generic.h"
+#include "hal-generic-card.h"
+#include "hal-generic-model.h"
+#include "hal-generic-options.h"
+#include "hal-generic-ramp.h"
+#include "hal-interface.h"
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+// The pre-resolved halmap of a card
+typedef struct {
+  const alsaHalMapT *halmap;          // Terminated by a zeroed entry, no callbacks
+  const halRampConfigT *ramps;        // By halmap entry, for the 'Ramp' entries
+  int ctlsCount;
+} halStaticHalMapT;
+
+/*
+ * A validated config, built into the binding by hal-generic-codegen. It
+ * is const, and lives in read-only pages shared by every process.
+ */
+typedef struct {
+  const char *source;                 // Config file the tables were generated from
+  const char *api;                    // NULL if the config does not rename the API
+  halOptionsT options;
+  halModelT model;
+  const halStaticHalMapT *halmaps;    // By card
+} halStaticConfigT;
+
+extern const halStaticConfigT halStaticConfig;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC HAL_ERRCODE halStaticLoad(void);
+PUBLIC const char *halStaticGetApi(void);
+PUBLIC int halStaticGetCardCount(void);
+PUBLIC HAL_ERRCODE halStaticGetCard(int cardIdx, halCardT *card,
+                                    const char *bindingApi);
+
+#endif /* HAL_GENERIC_STATIC_H */
@@ -0,0 +1,628 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency statistics.
+ *
+ * A series records the latency of a binding verb, of the dispatch of the
+ * events of an API (event name prefix), or of the calls to a downstream
+ * API verb. Each series is a log-linear histogram: every power of two
+ * of nanoseconds is split into 8 linear buckets, so a percentile is read
+ * within 12.5%.
+ *
+ * Recording is lock-free: every series has one shard per CPU slot, each
+ * on its own cache lines, updated with relaxed atomics. Shards are only
+ * merged when the stats are read. Series are found by name in an open
+ * addressing table; they are added under a lock and never removed, so
+ * lookups need no lock either.
+ *
+ * Verbs are timed by swapping their callback for a trampoline that knows
+ * the verb index; only the synchronous part of a verb is timed. Calls are
+ * timed up to their reply.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-stats.h"
+#include "wrap-json.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <systemd/sd-event.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_STATS_SUB_BITS 3              // 8 linear buckets per power of 2
+#define HAL_STATS_SUB (1 << HAL_STATS_SUB_BITS)
+#define HAL_STATS_EXP_MAX 36              // Up to 2^36 ns (~68 s)
+#define HAL_STATS_BUCKETS ((HAL_STATS_EXP_MAX - HAL_STATS_SUB_BITS + 2) * HAL_STATS_SUB)
+#define HAL_STATS_SHARDS 8                // Power of 2, CPU slots
+#define HAL_STATS_SERIES_MAX 128
+#define HAL_STATS_HASH_SZ 256             // Power of 2, > HAL_STATS_SERIES_MAX
+#define HAL_STATS_NAME_SZ 96
+#define USEC_PER_MSEC 1000ULL
+
+typedef enum {
+  STATS_VERB,
+  STATS_EVENT,
+  STATS_CALL,
+
+  STATS_KIND_END
+} halStatsKindT;
+
+static const char *halStatsKindLabels[STATS_KIND_END] = {
+  [STATS_VERB] = "verbs",
+  [STATS_EVENT] = "events",
+  [STATS_CALL] = "calls"
+};
+
+typedef struct {
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+  uint32_t buckets[HAL_STATS_BUCKETS];
+} __attribute__((aligned(64))) halStatsShardT;
+
+typedef struct {
+  halStatsKindT kind;
+  char *name;
+  size_t nameLen;
+  uint32_t hash;
+  halStatsShardT shards[HAL_STATS_SHARDS];
+} halStatsSeriesT;
+
+// Outstanding downstream call
+typedef struct {
+  halStatsSeriesT *series;
+  uint64_t startNs;
+  void (*callback)(void *closure, int result, json_object *resultJ);
+  void *closure;
+} halStatsCallT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halStatsSeriesT *_table[HAL_STATS_HASH_SZ];
+static halStatsSeriesT *_series[HAL_STATS_SERIES_MAX];   // In creation order
+static int _seriesCount = 0;
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void (*_verbCallbacks[HAL_STATS_VERBS_MAX])(struct afb_req request);
+static halStatsSeriesT *_verbSeries[HAL_STATS_VERBS_MAX];
+
+static uint64_t _resetNs = 0;
+static uint64_t _periodUsec = 0;
+static sd_event_source *_timer = NULL;
+static struct afb_event _statsEvent;
+static bool _statsEventMade = false;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint32_t seriesHash(halStatsKindT kind, const char *name, size_t nameLen);
+STATIC halStatsSeriesT *seriesGet(halStatsKindT kind, const char *name, size_t nameLen);
+STATIC int bucketIndex(uint64_t ns);
+STATIC uint64_t bucketUpperNs(int bucket);
+STATIC void record(halStatsSeriesT *series, uint64_t ns);
+STATIC json_object *seriesJ(const halStatsSeriesT *series);
+STATIC void verbCall(int idx, struct afb_req request);
+STATIC void serviceCallCB(void *closure, int result, json_object *resultJ);
+STATIC HAL_ERRCODE armTimer(void);
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata);
+
+
+/*****************************************************************************
+ * Verb Trampolines
+ ****************************************************************************/
+// One trampoline per verb slot, since v2 verbs have no closure
+#define HAL_STATS_TRAMPOLINE(a, b) \
+  STATIC void verbTrampoline##a##b(struct afb_req request) { verbCall(8 * a + b, request); }
+#define HAL_STATS_TRAMPOLINES(a) \
+  HAL_STATS_TRAMPOLINE(a, 0) HAL_STATS_TRAMPOLINE(a, 1) \
+  HAL_STATS_TRAMPOLINE(a, 2) HAL_STATS_TRAMPOLINE(a, 3) \
+  HAL_STATS_TRAMPOLINE(a, 4) HAL_STATS_TRAMPOLINE(a, 5) \
+  HAL_STATS_TRAMPOLINE(a, 6) HAL_STATS_TRAMPOLINE(a, 7)
+#define HAL_STATS_TRAMPOLINE_REFS(a) \
+  verbTrampoline##a##0, verbTrampoline##a##1, verbTrampoline##a##2, \
+  verbTrampoline##a##3, verbTrampoline##a##4, verbTrampoline##a##5, \
+  verbTrampoline##a##6, verbTrampoline##a##7
+
+HAL_STATS_TRAMPOLINES(0)
+HAL_STATS_TRAMPOLINES(1)
+HAL_STATS_TRAMPOLINES(2)
+HAL_STATS_TRAMPOLINES(3)
+HAL_STATS_TRAMPOLINES(4)
+HAL_STATS_TRAMPOLINES(5)
+HAL_STATS_TRAMPOLINES(6)
+HAL_STATS_TRAMPOLINES(7)
+
+static void (*const _trampolines[HAL_STATS_VERBS_MAX])(struct afb_req request) = {
+  HAL_STATS_TRAMPOLINE_REFS(0), HAL_STATS_TRAMPOLINE_REFS(1),
+  HAL_STATS_TRAMPOLINE_REFS(2), HAL_STATS_TRAMPOLINE_REFS(3),
+  HAL_STATS_TRAMPOLINE_REFS(4), HAL_STATS_TRAMPOLINE_REFS(5),
+  HAL_STATS_TRAMPOLINE_REFS(6), HAL_STATS_TRAMPOLINE_REFS(7)
+};
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief FNV-1a hash of a series kind and name
+ */
+STATIC uint32_t seriesHash(halStatsKindT kind, const char *name, size_t nameLen)
+{
+  uint32_t hash = 2166136261u;
+  size_t idx = 0;
+
+  hash ^= (uint8_t)kind;
+  hash *= 16777619u;
+  for (idx = 0; idx < nameLen; idx++)
+  {
+    hash ^= (uint8_t)name[idx];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * @brief Find or add a series
+ * @return The series, or NULL if there are too many series
+ */
+STATIC halStatsSeriesT *seriesGet(halStatsKindT kind, const char *name, size_t nameLen)
+{
+  uint32_t hash = seriesHash(kind, name, nameLen);
+  uint32_t slot = hash & (HAL_STATS_HASH_SZ - 1);
+  halStatsSeriesT *series = NULL;
+
+  // Lock-free lookup, slots are only ever filled
+  while ((series = __atomic_load_n(&_table[slot], __ATOMIC_ACQUIRE)))
+  {
+    if (series->hash == hash && series->kind == kind &&
+        series->nameLen == nameLen && !memcmp(series->name, name, nameLen))
+      return series;
+
+    slot = (slot + 1) & (HAL_STATS_HASH_SZ - 1);
+  }
+
+  pthread_mutex_lock(&_lock);
+
+  // Another thread may have added it meanwhile
+  while ((series = _table[slot]))
+  {
+    if (series->hash == hash && series->kind == kind &&
+        series->nameLen == nameLen && !memcmp(series->name, name, nameLen))
+      break;
+
+    slot = (slot + 1) & (HAL_STATS_HASH_SZ - 1);
+  }
+
+  if (!series && _seriesCount < HAL_STATS_SERIES_MAX &&
+      (series = calloc(1, sizeof(halStatsSeriesT))))
+  {
+    series->kind = kind;
+    series->name = strndup(name, nameLen);
+    series->nameLen = nameLen;
+    series->hash = hash;
+    if (!series->name)
+    {
+      free(series);
+      series = NULL;
+    }
+    else
+    {
+      _series[_seriesCount] = series;
+      __atomic_store_n(&_seriesCount, _seriesCount + 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&_table[slot], series, __ATOMIC_RELEASE);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return series;
+}
+
+/*
+ * @brief Get the histogram bucket of a latency
+ */
+STATIC int bucketIndex(uint64_t ns)
+{
+  int exp = 0;
+
+  if (ns < HAL_STATS_SUB)
+    return (int)ns;
+
+  exp = 63 - __builtin_clzll(ns);
+  if (exp > HAL_STATS_EXP_MAX)
+    return HAL_STATS_BUCKETS - 1;
+
+  return (exp - HAL_STATS_SUB_BITS + 1) * HAL_STATS_SUB +
+         (int)((ns >> (exp - HAL_STATS_SUB_BITS)) & (HAL_STATS_SUB - 1));
+}
+
+/*
+ * @brief Get the highest latency of a histogram bucket
+ */
+STATIC uint64_t bucketUpperNs(int bucket)
+{
+  int exp = bucket / HAL_STATS_SUB + HAL_STATS_SUB_BITS - 1;
+  uint64_t sub = (uint64_t)(bucket % HAL_STATS_SUB);
+
+  if (bucket < HAL_STATS_SUB)
+    return (uint64_t)bucket;
+
+  return ((HAL_STATS_SUB + sub + 1) << (exp - HAL_STATS_SUB_BITS)) - 1;
+}
+
+/*
+ * @brief Record a latency, in the shard of the current CPU
+ */
+STATIC void record(halStatsSeriesT *series, uint64_t ns)
+{
+  int cpu = sched_getcpu();
+  halStatsShardT *shard = NULL;
+  uint64_t max = 0;
+
+  if (!series)
+    return;
+
+  shard = &series->shards[(cpu < 0 ? 0 : cpu) & (HAL_STATS_SHARDS - 1)];
+  __atomic_fetch_add(&shard->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shard->sumNs, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shard->buckets[bucketIndex(ns)], 1, __ATOMIC_RELAXED);
+
+  max = __atomic_load_n(&shard->maxNs, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&shard->maxNs, &max, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/*
+ * @brief Merge the shards of a series, and describe it
+ * @return { count, mean, p50, p90, p99, p999, max }, in us
+ */
+STATIC json_object *seriesJ(const halStatsSeriesT *series)
+{
+  static const double percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+  static const char *percentileKeys[] = { "p50", "p90", "p99", "p999" };
+  uint64_t buckets[HAL_STATS_BUCKETS] = { 0 };
+  uint64_t count = 0, sumNs = 0, maxNs = 0, seen = 0;
+  int shardIdx = 0, bucket = 0, pctIdx = 0;
+  json_object *statsJ = json_object_new_object();
+
+  for (shardIdx = 0; shardIdx < HAL_STATS_SHARDS; shardIdx++)
+  {
+    const halStatsShardT *shard = &series->shards[shardIdx];
+    uint64_t shardMax = __atomic_load_n(&shard->maxNs, __ATOMIC_RELAXED);
+
+    count += __atomic_load_n(&shard->count, __ATOMIC_RELAXED);
+    sumNs += __atomic_load_n(&shard->sumNs, __ATOMIC_RELAXED);
+    if (shardMax > maxNs)
+      maxNs = shardMax;
+    for (bucket = 0; bucket < HAL_STATS_BUCKETS; bucket++)
+      buckets[bucket] += __atomic_load_n(&shard->buckets[bucket], __ATOMIC_RELAXED);
+  }
+
+  json_object_object_add(statsJ, "count", json_object_new_int64((int64_t)count));
+  json_object_object_add(statsJ, "mean",
+                         json_object_new_double(count ? (double)sumNs / 1e3 / (double)count : 0.0));
+
+  // Percentiles are the upper bound of their bucket, capped by the max
+  for (bucket = 0; bucket < HAL_STATS_BUCKETS && pctIdx < 4; bucket++)
+  {
+    seen += buckets[bucket];
+    while (pctIdx < 4 && count && seen >= (uint64_t)(percentiles[pctIdx] * (double)count + 0.5))
+    {
+      uint64_t ns = bucketUpperNs(bucket);
+
+      json_object_object_add(statsJ, percentileKeys[pctIdx],
+                             json_object_new_double((double)(ns < maxNs ? ns : maxNs) / 1e3));
+      pctIdx++;
+    }
+  }
+  for (; pctIdx < 4; pctIdx++)
+    json_object_object_add(statsJ, percentileKeys[pctIdx], json_object_new_double(0.0));
+
+  json_object_object_add(statsJ, "max", json_object_new_double((double)maxNs / 1e3));
+
+  return statsJ;
+}
+
+/*
+ * @brief Call a wrapped verb, and record its latency
+ */
+STATIC void verbCall(int idx, struct afb_req request)
+{
+  uint64_t startNs = halStatsNow();
+
+  _verbCallbacks[idx](request);
+  record(_verbSeries[idx], halStatsNow() - startNs);
+}
+
+/*
+ * @brief Downstream call reply: record its latency, then pass it on
+ */
+STATIC void serviceCallCB(void *closure, int result, json_object *resultJ)
+{
+  halStatsCallT *call = (halStatsCallT *)closure;
+
+  record(call->series, halStatsNow() - call->startNs);
+  if (call->callback)
+    call->callback(call->closure, result, resultJ);
+  free(call);
+}
+
+/*
+ * @brief Arm the 'stats' event timer
+ */
+STATIC HAL_ERRCODE armTimer(void)
+{
+  uint64_t usec = halStatsNow() / 1000ULL + _periodUsec;
+
+  if (!_timer)
+  {
+    if (sd_event_add_time(afb_daemon_get_event_loop(), &_timer, CLOCK_MONOTONIC,
+                          usec, USEC_PER_MSEC, timerCB, NULL) < 0)
+    {
+      _timer = NULL;
+      return HAL_FAIL;
+    }
+    return HAL_OK;
+  }
+
+  if (sd_event_source_set_time(_timer, usec) < 0 ||
+      sd_event_source_set_enabled(_timer, SD_EVENT_ONESHOT) < 0)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Push the 'stats' event, every period
+ */
+STATIC int timerCB(sd_event_source *source, uint64_t usec, void *userdata)
+{
+  if (_statsEventMade && afb_event_is_valid(_statsEvent))
+    afb_event_push(_statsEvent, halStatsGetJ());
+
+  if (_periodUsec && armTimer() != HAL_OK)
+    AFB_ApiWarning(NULL, "STATS: Cannot arm the '%s' event timer", HAL_STATS_EVENT);
+
+  return 0;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the monotonic time, in ns
+ */
+PUBLIC uint64_t halStatsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * @brief Time every verb of a binding verbs table, by swapping the verb
+ *        callbacks for trampolines. Must be called once the table is
+ *        complete, before the verbs can be called.
+ * @return HAL_OK on success, HAL_FAIL if there are too many verbs
+ */
+PUBLIC HAL_ERRCODE halStatsWrapVerbs(struct afb_verb_v2 *verbs)
+{
+  int idx = 0;
+
+  if (!_resetNs)
+    _resetNs = halStatsNow();
+
+  for (idx = 0; verbs[idx].verb; idx++)
+  {
+    if (idx >= HAL_STATS_VERBS_MAX)
+    {
+      AFB_ApiError(NULL, "STATS: Too many verbs, increase HAL_STATS_VERBS_MAX");
+      return HAL_FAIL;
+    }
+
+    _verbCallbacks[idx] = verbs[idx].callback;
+    _verbSeries[idx] = seriesGet(STATS_VERB, verbs[idx].verb, strlen(verbs[idx].verb));
+    verbs[idx].callback = _trampolines[idx];
+  }
+
+  return HAL_OK;
+}
+
+/*
+ * @brief Record the dispatch latency of an event, by event API
+ *        (name prefix, up to the first '/')
+ * @param startNs : halStatsNow() when the event was received
+ */
+PUBLIC void halStatsEvent(const char *evtname, uint64_t startNs)
+{
+  const char *slash = NULL;
+
+  if (!evtname)
+    return;
+
+  slash = strchr(evtname, '/');
+  record(seriesGet(STATS_EVENT, evtname, slash ? (size_t)(slash - evtname) : strlen(evtname)),
+         halStatsNow() - startNs);
+}
+
+/*
+ * @brief afb_service_call, recording the latency of the call up to its reply
+ */
+PUBLIC void halStatsServiceCall(const char *api, const char *verb,
+                                json_object *argsJ,
+                                void (*callback)(void *closure, int result,
+                                                 json_object *resultJ),
+                                void *closure)
+{
+  char name[HAL_STATS_NAME_SZ];
+  int len = snprintf(name, sizeof(name), "%s/%s", api, verb);
+  halStatsCallT *call = malloc(sizeof(halStatsCallT));
+
+  if (!call)
+  {
+    afb_service_call(api, verb, argsJ, callback, closure);
+    return;
+  }
+
+  call->series = seriesGet(STATS_CALL, name, len < (int)sizeof(name) ? (size_t)len : sizeof(name) - 1);
+  call->callback = callback;
+  call->closure = closure;
+  call->startNs = halStatsNow();
+  afb_service_call(api, verb, argsJ, serviceCallCB, call);
+}
+
+/*
+ * @brief afb_service_call_sync, recording the latency of the call
+ */
+PUBLIC int halStatsServiceCallSync(const char *api, const char *verb,
+                                   json_object *argsJ, json_object **resultJ)
+{
+  char name[HAL_STATS_NAME_SZ];
+  int len = snprintf(name, sizeof(name), "%s/%s", api, verb);
+  halStatsSeriesT *series = seriesGet(STATS_CALL, name, len < (int)sizeof(name) ? (size_t)len : sizeof(name) - 1);
+  uint64_t startNs = halStatsNow();
+  int result = afb_service_call_sync(api, verb, argsJ, resultJ);
+
+  record(series, halStatsNow() - startNs);
+
+  return result;
+}
+
+/*
+ * @brief Set the period of the 'stats' event
+ * @param periodMs : The period, 0 stops the event
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halStatsSetPeriod(int periodMs)
+{
+  if (periodMs < 0 || periodMs > HAL_STATS_PERIOD_MS_MAX)
+    return HAL_FAIL;
+
+  _periodUsec = (uint64_t)periodMs * USEC_PER_MSEC;
+  if (!_periodUsec)
+  {
+    if (_timer)
+      sd_event_source_set_enabled(_timer, SD_EVENT_OFF);
+    return HAL_OK;
+  }
+
+  if (!_statsEventMade)
+  {
+    _statsEvent = afb_daemon_make_event(HAL_STATS_EVENT);
+    _statsEventMade = true;
+    if (!afb_event_is_valid(_statsEvent))
+      AFB_ApiWarning(NULL, "STATS: Cannot create '%s' event", HAL_STATS_EVENT);
+  }
+
+  return armTimer();
+}
+
+/*
+ * @brief Describe every series
+ * @return { "since": <s>, "verbs": {...}, "events": {...}, "calls": {...} },
+ *         each series keyed by name
+ */
+PUBLIC json_object *halStatsGetJ(void)
+{
+  json_object *statsJ = json_object_new_object();
+  json_object *kindsJ[STATS_KIND_END];
+  int idx = 0, count = __atomic_load_n(&_seriesCount, __ATOMIC_ACQUIRE);
+
+  json_object_object_add(statsJ, "since",
+                         json_object_new_double((double)(halStatsNow() - _resetNs) / 1e9));
+  for (idx = 0; idx < STATS_KIND_END; idx++)
+  {
+    kindsJ[idx] = json_object_new_object();
+    json_object_object_add(statsJ, halStatsKindLabels[idx], kindsJ[idx]);
+  }
+
+  for (idx = 0; idx < count; idx++)
+  {
+    const halStatsSeriesT *series = _series[idx];
+
+    // Verbs are listed even when never called, other series once used
+    json_object_object_add(kindsJ[series->kind], series->name, seriesJ(series));
+  }
+
+  return statsJ;
+}
+
+/*
+ * @brief Reset every series. Latencies recorded meanwhile may be lost.
+ */
+PUBLIC void halStatsReset(void)
+{
+  int idx = 0, count = __atomic_load_n(&_seriesCount, __ATOMIC_ACQUIRE);
+
+  for (idx = 0; idx < count; idx++)
+  {
+    halStatsSeriesT *series = _series[idx];
+    int shardIdx = 0, bucket = 0;
+
+    for (shardIdx = 0; shardIdx < HAL_STATS_SHARDS; shardIdx++)
+    {
+      halStatsShardT *shard = &series->shards[shardIdx];
+
+      __atomic_store_n(&shard->count, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&shard->sumNs, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&shard->maxNs, 0, __ATOMIC_RELAXED);
+      for (bucket = 0; bucket < HAL_STATS_BUCKETS; bucket++)
+        __atomic_store_n(&shard->buckets[bucket], 0, __ATOMIC_RELAXED);
+    }
+  }
+
+  _resetNs = halStatsNow();
+}
+
+/*
+ * @brief 'stats' verb: get the latency stats, then reset them with
+ *        { "reset": true }. Subscribes to the 'stats' event, if enabled.
+ */
+PUBLIC void halStatsVerb(struct afb_req request)
+{
+  int reset = 0;
+
+  if (wrap_json_unpack(afb_req_json(request), "{s?b}", "reset", &reset))
+  {
+    afb_req_fail(request, "invalid-args", "Expected { \"reset\": <bool> }");
+    return;
+  }
+
+  if (_statsEventMade && afb_event_is_valid(_statsEvent))
+    afb_req_subscribe(request, _statsEvent);
+
+  afb_req_success(request, halStatsGetJ(), NULL);
+  if (reset)
+    halStatsReset();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_STATS_H
+#define HAL_GENERIC_STATS_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_STATS_EVENT "stats"
+#define HAL_STATS_VERBS_MAX 64            // Wrapped verbs, >= HAL_GENERIC_VERBS_MAX
+#define HAL_STATS_PERIOD_MS_MAX 3600000   // Period of the 'stats' event
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC uint64_t halStatsNow(void);
+PUBLIC HAL_ERRCODE halStatsWrapVerbs(struct afb_verb_v2 *verbs);
+PUBLIC void halStatsEvent(const char *evtname, uint64_t startNs);
+PUBLIC void halStatsServiceCall(const char *api, const char *verb,
+                                json_object *argsJ,
+                                void (*callback)(void *closure, int result,
+                                                 json_object *resultJ),
+                                void *closure);
+PUBLIC int halStatsServiceCallSync(const char *api, const char *verb,
+                                   json_object *argsJ, json_object **resultJ);
+PUBLIC HAL_ERRCODE halStatsSetPeriod(int periodMs);
+PUBLIC json_object *halStatsGetJ(void);
+PUBLIC void halStatsReset(void);
+PUBLIC void halStatsVerb(struct afb_req request);
+
+#endif /* HAL_GENERIC_STATS_H */
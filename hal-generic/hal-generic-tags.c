@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Registry of the role x ctl type -> halCtlsTagT tags.
+ *
+ * 'halCtlsLabels' is split exactly once (under pthread_once) into a 2-D
+ * table indexed by role index and halCtlsTypeT. Role names are resolved to
+ * a role index with an open addressing hash.
+ *
+ * Roles and ctl types which the HAL does not know at compile time are
+ * registered at runtime, as the ctls are loaded: a dynamic tag is allocated
+ * past EndHalCrlTag, which still stands for 'no tag', and is labelled
+ * '<Role>_<Type>'. Tags are dense, so every table is indexed by tag.
+ * hal-utilities indexes 'halCtlsLabels' by tag: dynamic tags never go into
+ * a halmap registered with it, their ctls are created by the binding.
+ *
+ * Registration is serialized by a mutex, and an entry is published with a
+ * release store once it is complete. Lookups take no lock, and may be used
+ * from any thread.
+ */
+
+#include "hal-generic-tags.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_CTLS_ROLES_HASH_SZ 128 // Power of 2, > HAL_CTLS_ROLES_MAX
+#define HAL_CTLS_LABEL_SZ 255
+#define HAL_CTLS_LABELS_HASH_SZ 1024 // Power of 2, > HAL_CTLS_TAGS_MAX
+
+const char *halCtlsTypeLabels[] = {
+  [Volume] = "Volume",
+  [Ramp] = "Ramp",
+  [Switch] = "Switch",
+  [Bass] = "Bass",
+  [Mid] = "Mid",
+  [Treble] = "Treble",
+  [Fade] = "Fade",
+  [Balance] = "Balance",
+
+  [EndHalCtlsType] = NULL
+};
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static pthread_once_t _tagsOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _tagsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char _roleNames[HAL_CTLS_ROLES_MAX][HAL_CTLS_LABEL_SZ];
+static int _rolesCount = 0;
+static int _roleHash[HAL_CTLS_ROLES_HASH_SZ];   // slot -> role index
+static halCtlsTagT _tagTable[HAL_CTLS_ROLES_MAX][EndHalCtlsType];
+static int _tagsCount = HAL_CTLS_TAG_DYNAMIC;   // Next dynamic tag
+static halCtlsTypeT _typeTable[HAL_CTLS_TAGS_MAX]; // tag -> ctl type
+static int _roleTable[HAL_CTLS_TAGS_MAX];       // tag -> role index
+static const char *_labelTable[HAL_CTLS_TAGS_MAX]; // tag -> label
+static int _labelHash[HAL_CTLS_LABELS_HASH_SZ]; // slot -> tag
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint32_t roleHash(const char *role);
+STATIC int roleLookup(const char *role);
+STATIC int roleInsert(const char *role);
+STATIC halCtlsTypeT typeLookup(const char *type);
+STATIC void labelInsert(halCtlsTagT tag);
+STATIC void tagsInit(void);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief FNV-1a hash of a role name
+ */
+STATIC uint32_t roleHash(const char *role)
+{
+  uint32_t hash = 2166136261u;
+
+  while (*role)
+  {
+    hash ^= (uint8_t)*role++;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * @brief Find the role index for a role name
+ * @return The role index, or HAL_CTLS_ROLE_NONE if unknown
+ */
+STATIC int roleLookup(const char *role)
+{
+  uint32_t slot = roleHash(role) & (HAL_CTLS_ROLES_HASH_SZ - 1);
+  int roleIdx;
+
+  while ((roleIdx = __atomic_load_n(&_roleHash[slot], __ATOMIC_ACQUIRE)) != HAL_CTLS_ROLE_NONE)
+  {
+    if (!strcmp(_roleNames[roleIdx], role))
+      return roleIdx;
+
+    slot = (slot + 1) & (HAL_CTLS_ROLES_HASH_SZ - 1);
+  }
+
+  return HAL_CTLS_ROLE_NONE;
+}
+
+/*
+ * @brief Find or allocate the role index for a role name (init, or with
+ *        the registry locked)
+ * @return The role index, or HAL_CTLS_ROLE_NONE if the table is full
+ */
+STATIC int roleInsert(const char *role)
+{
+  int roleIdx = roleLookup(role);
+  uint32_t slot;
+
+  if (roleIdx != HAL_CTLS_ROLE_NONE)
+    return roleIdx;
+
+  if (_rolesCount >= HAL_CTLS_ROLES_MAX)
+  {
+    AFB_ApiError(NULL, "TAGS: Too many roles, cannot add '%s'", role);
+    return HAL_CTLS_ROLE_NONE;
+  }
+
+  roleIdx = _rolesCount;
+  strncpy(_roleNames[roleIdx], role, HAL_CTLS_LABEL_SZ - 1);
+
+  slot = roleHash(role) & (HAL_CTLS_ROLES_HASH_SZ - 1);
+  while (_roleHash[slot] != HAL_CTLS_ROLE_NONE)
+    slot = (slot + 1) & (HAL_CTLS_ROLES_HASH_SZ - 1);
+
+  __atomic_store_n(&_rolesCount, roleIdx + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&_roleHash[slot], roleIdx, __ATOMIC_RELEASE);
+
+  return roleIdx;
+}
+
+/*
+ * @brief Get the halCtlsTypeT for a ctl type label (init only)
+ * @return The type, or EndHalCtlsType if unknown
+ */
+STATIC halCtlsTypeT typeLookup(const char *type)
+{
+  int typeIdx = 0;
+
+  for (typeIdx = 0; typeIdx < EndHalCtlsType; typeIdx++)
+    if (!strcmp(halCtlsTypeLabels[typeIdx], type))
+      return (halCtlsTypeT)typeIdx;
+
+  return EndHalCtlsType;
+}
+
+/*
+ * @brief Add a tag to the label hash (init, or with the registry locked)
+ */
+STATIC void labelInsert(halCtlsTagT tag)
+{
+  uint32_t slot = roleHash(_labelTable[tag]) & (HAL_CTLS_LABELS_HASH_SZ - 1);
+  uint32_t probes = 0;
+
+  while (_labelHash[slot] != EndHalCrlTag)
+  {
+    if (!strcmp(_labelTable[_labelHash[slot]], _labelTable[tag]))
+      return; // First label wins
+    if (++probes >= HAL_CTLS_LABELS_HASH_SZ - 1)
+      return; // Keep a free slot to end lookups
+
+    slot = (slot + 1) & (HAL_CTLS_LABELS_HASH_SZ - 1);
+  }
+
+  __atomic_store_n(&_labelHash[slot], (int)tag, __ATOMIC_RELEASE);
+}
+
+/*
+ * @brief Split 'halCtlsLabels' once into the role x type tag table.
+ *        Labels are '<Role>_<Type>', or '<Role>_<Any>_<Type>' for Master.
+ */
+STATIC void tagsInit(void)
+{
+  int i = 0, roleIdx = 0, typeIdx = 0;
+
+  for (i = 0; i < HAL_CTLS_ROLES_HASH_SZ; i++)
+    _roleHash[i] = HAL_CTLS_ROLE_NONE;
+
+  for (roleIdx = 0; roleIdx < HAL_CTLS_ROLES_MAX; roleIdx++)
+    for (typeIdx = 0; typeIdx < EndHalCtlsType; typeIdx++)
+      _tagTable[roleIdx][typeIdx] = EndHalCrlTag;
+
+  for (i = 0; i < HAL_CTLS_TAGS_MAX; i++)
+  {
+    _typeTable[i] = EndHalCtlsType;
+    _roleTable[i] = HAL_CTLS_ROLE_NONE;
+  }
+
+  for (i = 0; i < HAL_CTLS_LABELS_HASH_SZ; i++)
+    _labelHash[i] = EndHalCrlTag;
+
+  for (i = 1; i < EndHalCrlTag && halCtlsLabels[i] != NULL; i++)
+  {
+    _labelTable[i] = halCtlsLabels[i];
+    labelInsert((halCtlsTagT)i);
+  }
+
+  for (i = 1; i < EndHalCrlTag && halCtlsLabels[i] != NULL; i++)
+  {
+    char ctlLabel[HAL_CTLS_LABEL_SZ];
+    char *savePtr = NULL;
+    const char *ctlRole = NULL, *ctlType = NULL;
+    halCtlsTypeT type;
+
+    strncpy(ctlLabel, halCtlsLabels[i], HAL_CTLS_LABEL_SZ - 1);
+    ctlLabel[HAL_CTLS_LABEL_SZ - 1] = '\0';
+
+    ctlRole = strtok_r(ctlLabel, "_", &savePtr);
+    ctlType = strtok_r(NULL, "_", &savePtr);
+    if (ctlRole && !strcmp(ctlRole, "Master"))
+      ctlType = strtok_r(NULL, "_", &savePtr);
+    if (!ctlRole || !ctlType)
+      continue;
+
+    type = typeLookup(ctlType);
+    if (type == EndHalCtlsType)
+      continue;
+    _typeTable[i] = type;
+
+    roleIdx = roleInsert(ctlRole);
+    if (roleIdx == HAL_CTLS_ROLE_NONE)
+      continue;
+    _roleTable[i] = roleIdx;
+
+    // First label wins, as with the previous linear search
+    if (_tagTable[roleIdx][type] == EndHalCrlTag)
+      _tagTable[roleIdx][type] = (halCtlsTagT)i;
+  }
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the role index of an audio role, for use with halCtlsTagGetByRole
+ * @param role : The audio role name (eg. 'Multimedia')
+ * @return The role index, or HAL_CTLS_ROLE_NONE if the role has no ctls
+ */
+PUBLIC int halCtlsRoleGet(const char *role)
+{
+  pthread_once(&_tagsOnce, tagsInit);
+
+  if (!role)
+    return HAL_CTLS_ROLE_NONE;
+
+  return roleLookup(role);
+}
+
+/*
+ * @brief Get the role index of an audio role, registering the role if the
+ *        HAL does not know it
+ * @return The role index, or HAL_CTLS_ROLE_NONE if the registry is full
+ */
+PUBLIC int halCtlsRoleRegister(const char *role)
+{
+  int roleIdx = halCtlsRoleGet(role);
+
+  if (!role || roleIdx != HAL_CTLS_ROLE_NONE)
+    return roleIdx;
+
+  if (strlen(role) >= HAL_CTLS_LABEL_SZ)
+  {
+    AFB_ApiError(NULL, "TAGS: Role name too long: '%s'", role);
+    return HAL_CTLS_ROLE_NONE;
+  }
+
+  pthread_mutex_lock(&_tagsLock);
+  roleIdx = roleInsert(role);
+  pthread_mutex_unlock(&_tagsLock);
+
+  return roleIdx;
+}
+
+/*
+ * @brief Get the number of roles with ctls
+ */
+PUBLIC int halCtlsRolesCount(void)
+{
+  pthread_once(&_tagsOnce, tagsInit);
+
+  return __atomic_load_n(&_rolesCount, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief Get the name of a role index
+ * @return The role name, or NULL if the index is out of range
+ */
+PUBLIC const char *halCtlsRoleName(int roleIdx)
+{
+  if (roleIdx < 0 || roleIdx >= halCtlsRolesCount())
+    return NULL;
+
+  return _roleNames[roleIdx];
+}
+
+/*
+ * @brief Get the halCtlsTagT for a role index, and ctl type
+ * @return The tag, or EndHalCrlTag if there is none
+ */
+PUBLIC halCtlsTagT halCtlsTagGetByRole(int roleIdx, halCtlsTypeT type)
+{
+  if (roleIdx < 0 || roleIdx >= halCtlsRolesCount() || type >= EndHalCtlsType)
+    return EndHalCrlTag;
+
+  return __atomic_load_n(&_tagTable[roleIdx][type], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief Get the halCtlsTagT for a role index and ctl type, allocating a
+ *        dynamic tag if the HAL has none
+ * @return The tag, or EndHalCrlTag if the role index is invalid
+ */
+PUBLIC halCtlsTagT halCtlsTagRegister(int roleIdx, halCtlsTypeT type)
+{
+  halCtlsTagT tag = halCtlsTagGetByRole(roleIdx, type);
+  char label[HAL_CTLS_LABEL_SZ + 16];
+
+  if (tag != EndHalCrlTag || roleIdx < 0 || roleIdx >= halCtlsRolesCount() ||
+      type >= EndHalCtlsType)
+    return tag;
+
+  pthread_mutex_lock(&_tagsLock);
+
+  // Registered by another thread meanwhile
+  tag = _tagTable[roleIdx][type];
+  if (tag != EndHalCrlTag)
+    goto OnExit;
+
+  // The table has room for every role x type, this cannot fail but on ENOMEM
+  snprintf(label, sizeof(label), "%s_%s", _roleNames[roleIdx], halCtlsTypeLabels[type]);
+  _labelTable[_tagsCount] = strdup(label);
+  if (!_labelTable[_tagsCount])
+  {
+    AFB_ApiError(NULL, "TAGS: Cannot register tag '%s'", label);
+    goto OnExit;
+  }
+
+  tag = (halCtlsTagT)_tagsCount;
+  _typeTable[tag] = type;
+  _roleTable[tag] = roleIdx;
+  labelInsert(tag);
+
+  __atomic_store_n(&_tagsCount, _tagsCount + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&_tagTable[roleIdx][type], tag, __ATOMIC_RELEASE);
+
+  AFB_ApiNotice(NULL, "TAGS: Registered tag %d for '%s'", (int)tag, label);
+
+OnExit:
+  pthread_mutex_unlock(&_tagsLock);
+  return tag;
+}
+
+/*
+ * @brief Get the halCtlsTagT for a given audio role, and ctl type
+ * @return The tag, or EndHalCrlTag if there is none
+ */
+PUBLIC halCtlsTagT halCtlsTagGet(const char *role, halCtlsTypeT type)
+{
+  return halCtlsTagGetByRole(halCtlsRoleGet(role), type);
+}
+
+/*
+ * @brief Check that a tag is known to the registry
+ */
+PUBLIC bool halCtlsTagIsValid(int tag)
+{
+  pthread_once(&_tagsOnce, tagsInit);
+
+  if (tag > StartHalCrlTag && tag < EndHalCrlTag)
+    return true;
+
+  return tag >= HAL_CTLS_TAG_DYNAMIC &&
+         tag < __atomic_load_n(&_tagsCount, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * @brief Check that a tag is one of the HAL enum, which hal-utilities can
+ *        label: dynamic tags are only known to the registry
+ */
+PUBLIC bool halCtlsTagIsStatic(int tag)
+{
+  return tag > StartHalCrlTag && tag < EndHalCrlTag;
+}
+
+/*
+ * @brief Get the ctl type of a halCtlsTagT
+ * @return The ctl type, or EndHalCtlsType if the tag has none
+ */
+PUBLIC halCtlsTypeT halCtlsTypeGet(halCtlsTagT tag)
+{
+  if (!halCtlsTagIsValid(tag))
+    return EndHalCtlsType;
+
+  return _typeTable[tag];
+}
+
+/*
+ * @brief Get the role index of a halCtlsTagT
+ * @return The role index, or HAL_CTLS_ROLE_NONE if the tag has none
+ */
+PUBLIC int halCtlsTagRole(halCtlsTagT tag)
+{
+  if (!halCtlsTagIsValid(tag))
+    return HAL_CTLS_ROLE_NONE;
+
+  return _roleTable[tag];
+}
+
+/*
+ * @brief Get the label of a halCtlsTagT, from 'halCtlsLabels' or registered
+ * @return The label, or NULL if the tag is unknown
+ */
+PUBLIC const char *halCtlsTagLabel(halCtlsTagT tag)
+{
+  if (!halCtlsTagIsValid(tag))
+    return NULL;
+
+  return _labelTable[tag];
+}
+
+/*
+ * @brief Get the halCtlsTagT of a label (eg. 'Multimedia_Playback_Volume')
+ * @return The tag, or EndHalCrlTag if unknown
+ */
+PUBLIC halCtlsTagT halCtlsTagGetByLabel(const char *label)
+{
+  uint32_t slot;
+  int tag;
+
+  pthread_once(&_tagsOnce, tagsInit);
+
+  if (!label)
+    return EndHalCrlTag;
+
+  slot = roleHash(label) & (HAL_CTLS_LABELS_HASH_SZ - 1);
+  while ((tag = __atomic_load_n(&_labelHash[slot], __ATOMIC_ACQUIRE)) != EndHalCrlTag)
+  {
+    if (!strcmp(_labelTable[tag], label))
+      return (halCtlsTagT)tag;
+
+    slot = (slot + 1) & (HAL_CTLS_LABELS_HASH_SZ - 1);
+  }
+
+  return EndHalCrlTag;
+}
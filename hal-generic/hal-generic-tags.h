@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_TAGS_H
+#define HAL_GENERIC_TAGS_H
+
+#include "hal-generic.h"
+#include "hal-interface.h"
+
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+typedef enum  {
+  Volume,
+  Ramp,
+  Switch,
+  Bass,
+  Mid,
+  Treble,
+  Fade,
+  Balance,
+
+  EndHalCtlsType
+} halCtlsTypeT;
+
+#define HAL_CTLS_ROLE_NONE (-1)
+#define HAL_CTLS_ROLES_MAX 64
+
+// Tags registered at runtime follow EndHalCrlTag, which stands for 'no tag'
+#define HAL_CTLS_TAG_DYNAMIC (EndHalCrlTag + 1)
+#define HAL_CTLS_TAGS_MAX (HAL_CTLS_TAG_DYNAMIC + HAL_CTLS_ROLES_MAX * EndHalCtlsType)
+
+extern const char *halCtlsTypeLabels[];
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC int halCtlsRoleGet(const char *role);
+PUBLIC int halCtlsRoleRegister(const char *role);
+PUBLIC int halCtlsRolesCount(void);
+PUBLIC const char *halCtlsRoleName(int roleIdx);
+PUBLIC halCtlsTagT halCtlsTagGetByRole(int roleIdx, halCtlsTypeT type);
+PUBLIC halCtlsTagT halCtlsTagRegister(int roleIdx, halCtlsTypeT type);
+PUBLIC halCtlsTagT halCtlsTagGet(const char *role, halCtlsTypeT type);
+PUBLIC bool halCtlsTagIsValid(int tag);
+PUBLIC bool halCtlsTagIsStatic(int tag);
+PUBLIC halCtlsTypeT halCtlsTypeGet(halCtlsTagT tag);
+PUBLIC int halCtlsTagRole(halCtlsTagT tag);
+PUBLIC const char *halCtlsTagLabel(halCtlsTagT tag);
+PUBLIC halCtlsTagT halCtlsTagGetByLabel(const char *label);
+
+#endif /* HAL_GENERIC_TAGS_H */
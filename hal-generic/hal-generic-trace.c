@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Startup tracing.
+ *
+ * Every startup phase is recorded as a span, with monotonic begin and end
+ * times, in a fixed buffer: spans past HAL_TRACE_SPANS_MAX are dropped.
+ * Spans are laid out in lanes: the binding callbacks on the main lane,
+ * and the bring-up of each card, which overlap, on a lane of their own.
+ *
+ * The trace is exported in the Trace Event format, as complete ('X')
+ * events, loadable in chrome://tracing or Perfetto. It is returned by the
+ * 'trace' verb, and written to $HAL_GENERIC_TRACE, if set, once every card
+ * has completed its bring-up.
+ */
+
+#include "hal-generic-trace.h"
+#include "wrap-json.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_TRACE_NAME_SZ 48
+#define HAL_TRACE_CAT_SZ 16
+#define HAL_TRACE_DETAIL_SZ 64
+#define HAL_TRACE_LANES_MAX 64
+
+typedef struct {
+  char cat[HAL_TRACE_CAT_SZ];
+  char name[HAL_TRACE_NAME_SZ];
+  char detail[HAL_TRACE_DETAIL_SZ];   // Empty if none
+  int lane;
+  char phase;                         // 'X' for spans, 'i' for instants
+  uint64_t beginUsec;
+  uint64_t endUsec;                   // 0 while the span is open
+} halTraceSpanEntryT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halTraceSpanEntryT _spans[HAL_TRACE_SPANS_MAX];
+static int _spansCount = 0;
+static int _dropped = 0;
+static char *_laneNames[HAL_TRACE_LANES_MAX];
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+STATIC uint64_t nowUsec(void);
+STATIC halTraceSpanT record(const char *cat, const char *name, int lane,
+                            const char *detail, char phase);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the monotonic time, in usec
+ */
+STATIC uint64_t nowUsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/*
+ * @brief Record a span or an instant, starting now
+ */
+STATIC halTraceSpanT record(const char *cat, const char *name, int lane,
+                            const char *detail, char phase)
+{
+  halTraceSpanEntryT *entry = NULL;
+  halTraceSpanT span = -1;
+
+  pthread_mutex_lock(&_lock);
+  if (_spansCount < HAL_TRACE_SPANS_MAX)
+  {
+    span = _spansCount++;
+    entry = &_spans[span];
+    snprintf(entry->cat, sizeof(entry->cat), "%s", cat);
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    snprintf(entry->detail, sizeof(entry->detail), "%s", detail ? detail : "");
+    entry->lane = lane;
+    entry->phase = phase;
+    entry->beginUsec = nowUsec();
+    entry->endUsec = (phase == 'X') ? 0 : entry->beginUsec;
+  }
+  else
+    _dropped++;
+  pthread_mutex_unlock(&_lock);
+
+  return span;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Begin a span
+ * @param cat    : The span category, e.g. "config" or "card"
+ * @param name   : The span name, usually the traced function
+ * @param lane   : HAL_TRACE_MAIN, or HAL_TRACE_CARD(card index)
+ * @param detail : Optional detail, e.g. the card name
+ * @return The span, to end with halTraceEnd
+ */
+PUBLIC halTraceSpanT halTraceBegin(const char *cat, const char *name,
+                                   int lane, const char *detail)
+{
+  return record(cat, name, lane, detail, 'X');
+}
+
+/*
+ * @brief End a span
+ */
+PUBLIC void halTraceEnd(halTraceSpanT span)
+{
+  if (span < 0 || span >= HAL_TRACE_SPANS_MAX)
+    return;
+
+  pthread_mutex_lock(&_lock);
+  _spans[span].endUsec = nowUsec();
+  pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * @brief Record an instant event, e.g. a milestone
+ */
+PUBLIC void halTraceInstant(const char *cat, const char *name, int lane)
+{
+  record(cat, name, lane, NULL, 'i');
+}
+
+/*
+ * @brief Name a lane, e.g. after its card
+ */
+PUBLIC void halTraceLaneName(int lane, const char *name)
+{
+  if (lane < 0 || lane >= HAL_TRACE_LANES_MAX || !name)
+    return;
+
+  pthread_mutex_lock(&_lock);
+  free(_laneNames[lane]);
+  _laneNames[lane] = strdup(name);
+  pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * @brief Get the trace, in the Trace Event format. Open spans end now.
+ * @return { "traceEvents": [...], "displayTimeUnit": "ms" }
+ */
+PUBLIC json_object *halTraceGetJ(void)
+{
+  json_object *traceJ = NULL, *eventsJ = json_object_new_array();
+  int idx = 0, pid = (int)getpid();
+  uint64_t now = nowUsec();
+
+  pthread_mutex_lock(&_lock);
+
+  for (idx = 0; idx < HAL_TRACE_LANES_MAX; idx++)
+  {
+    json_object *metaJ = NULL;
+
+    if (!_laneNames[idx])
+      continue;
+
+    wrap_json_pack(&metaJ, "{s:s,s:s,s:i,s:i,s:{s:s}}",
+                   "name", "thread_name", "ph", "M", "pid", pid, "tid", idx,
+                   "args", "name", _laneNames[idx]);
+    json_object_array_add(eventsJ, metaJ);
+  }
+
+  for (idx = 0; idx < _spansCount; idx++)
+  {
+    const halTraceSpanEntryT *entry = &_spans[idx];
+    json_object *eventJ = NULL, *argsJ = NULL;
+
+    if (entry->detail[0])
+      wrap_json_pack(&argsJ, "{s:s}", "detail", entry->detail);
+
+    wrap_json_pack(&eventJ, "{s:s,s:s,s:s,s:I,s:i,s:i,s:o*}",
+                   "name", entry->name,
+                   "cat", entry->cat,
+                   "ph", entry->phase == 'X' ? "X" : "i",
+                   "ts", (int64_t)entry->beginUsec,
+                   "pid", pid,
+                   "tid", entry->lane,
+                   "args", argsJ);
+    if (entry->phase == 'X')
+    {
+      uint64_t endUsec = entry->endUsec ? entry->endUsec : now;
+
+      json_object_object_add(eventJ, "dur",
+                             json_object_new_int64((int64_t)(endUsec - entry->beginUsec)));
+    }
+    else
+      json_object_object_add(eventJ, "s", json_object_new_string("t"));
+    json_object_array_add(eventsJ, eventJ);
+  }
+
+  wrap_json_pack(&traceJ, "{s:o,s:s,s:{s:i}}",
+                 "traceEvents", eventsJ,
+                 "displayTimeUnit", "ms",
+                 "otherData", "dropped", _dropped);
+
+  pthread_mutex_unlock(&_lock);
+
+  return traceJ;
+}
+
+/*
+ * @brief Write the trace to $HAL_GENERIC_TRACE, if set
+ * @return HAL_OK on success or if not set, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE halTraceDump(void)
+{
+  const char *path = getenv(HAL_TRACE_ENV);
+  json_object *traceJ = NULL;
+  int err = 0;
+
+  if (!path || !*path)
+    return HAL_OK;
+
+  traceJ = halTraceGetJ();
+  err = json_object_to_file_ext(path, traceJ, JSON_C_TO_STRING_PLAIN);
+  json_object_put(traceJ);
+
+  if (err)
+  {
+    AFB_ApiError(NULL, "TRACE: Cannot write the trace to %s", path);
+    return HAL_FAIL;
+  }
+
+  AFB_ApiNotice(NULL, "TRACE: Startup trace written to %s", path);
+  return HAL_OK;
+}
+
+/*
+ * @brief 'trace' verb: get the startup trace, in the Trace Event format
+ */
+PUBLIC void halTraceVerb(struct afb_req request)
+{
+  afb_req_success(request, halTraceGetJ(), NULL);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_TRACE_H
+#define HAL_GENERIC_TRACE_H
+
+#include "hal-generic.h"
+
+#include <json-c/json.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_TRACE_ENV "HAL_GENERIC_TRACE"   // File the trace is written to
+#define HAL_TRACE_SPANS_MAX 1024
+#define HAL_TRACE_MAIN 0                    // Lane of the binding callbacks
+#define HAL_TRACE_CARD(idx) ((int)(idx) + 1) // Lane of a card bring-up
+
+typedef int halTraceSpanT;                  // -1 if the span is not recorded
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+PUBLIC halTraceSpanT halTraceBegin(const char *cat, const char *name,
+                                   int lane, const char *detail);
+PUBLIC void halTraceEnd(halTraceSpanT span);
+PUBLIC void halTraceInstant(const char *cat, const char *name, int lane);
+PUBLIC void halTraceLaneName(int lane, const char *name);
+PUBLIC json_object *halTraceGetJ(void);
+PUBLIC HAL_ERRCODE halTraceDump(void);
+PUBLIC void halTraceVerb(struct afb_req request);
+
+#endif /* HAL_GENERIC_TRACE_H */
@@ -18,97 +18,85 @@
 
 
 #include "hal-generic-utility.h"
+#include "hal-generic-index.h"
+#include "hal-generic-matrix.h"
+#include "hal-generic-tags.h"
+#include "hal-generic-stats.h"
+#include "hal-generic-options.h"
+#include "hal-generic-shm.h"
 #include "wrap-json.h"
 
 #include <stdbool.h>
-
-
-/*****************************************************************************
- * Definitions
- ****************************************************************************/
-typedef enum  {
-  Volume,
-  Ramp,
-  Switch,
-  Bass,
-  Mid,
-  Treble,
-  Fade,
-  Balance
-} halCtlsTypeT;
-
-const char *halCtlsTypeLabels[] = {
-  [Volume] = "Volume",
-  [Ramp] = "Ramp",
-  [Switch] = "Switch",
-  [Bass] = "Bass",
-  [Mid] = "Mid",
-  [Treble] = "Treble",
-  [Fade] = "Fade",
-  [Balance] = "Balance"
-};
+#include <string.h>
 
 
 /*****************************************************************************
  * Local Function Declarations
  ****************************************************************************/
-PUBLIC STATIC json_object *getZoneMap(json_object *zonesJ, const char *zoneName);
-PUBLIC STATIC halCtlsTagT getHalCtlsTag(const char *role, halCtlsTypeT ctlsType);
-PUBLIC STATIC bool generateAlsaHalMapCtl(json_object *ctlJ,
-                                         const char *ctlStream,
+PUBLIC STATIC bool generateAlsaHalMapCtl(halArenaT *arena,
+                                         const halModelCtlsT *ctls,
                                          halCtlsTypeT ctlType,
                                          alsaHalMapT *alsaHalMap);
-
+PUBLIC STATIC json_object *generateChannels(const halModelCardT *card,
+                                            SinkSourceT sinkSourceType);
+PUBLIC STATIC json_object *generateEndpoint(const halModelT *model,
+                                            const halModelZoneT *zone,
+                                            SinkSourceT sinkSourceType,
+                                            int cardIdx);
 
 
 /*****************************************************************************
  * Local Function Definitions
  ****************************************************************************/
 /*
- * @brief Get the stream mapping according to the zone it belongs to
+ * @brief Generate the sink or source channels of a 'cardprops' object
+ * @return A new json_object, or NULL if the card declares none
  */
-PUBLIC STATIC json_object *getZoneMap(json_object *zonesJ, const char *zoneName)
+PUBLIC STATIC json_object *generateChannels(const halModelCardT *card,
+                                            SinkSourceT sinkSourceType)
 {
-  json_object *resultJ = NULL, *zoneMappingJ = NULL;
-  
-  resultJ = json_object_array_find(zonesJ, "uid", zoneName);
-  if (resultJ)
+  json_object *channelsJ = NULL;
+  int channelIdx = 0;
+
+  if (!card->channels[sinkSourceType])
+    return NULL;
+
+  channelsJ = json_object_new_array();
+  for (channelIdx = 0; channelIdx < card->channelsCount[sinkSourceType]; channelIdx++)
   {
-    wrap_json_unpack(resultJ, "{s?o}",
-                     "mapping", &zoneMappingJ);
-    return zoneMappingJ;
+    const halModelChannelT *channel = &card->channels[sinkSourceType][channelIdx];
+    json_object *channelJ = NULL;
+
+    wrap_json_pack(&channelJ, "{s:s*,s:i}",
+                   "type", channel->type, "port", channel->port);
+    json_object_array_add(channelsJ, channelJ);
   }
 
-  AFB_ApiError(NULL, "STREAM: Zone '%s' is not defined!", zoneName);
-  return NULL;
+  return channelsJ;
 }
 
 /*
- * @brief Get the halCtlsTagT for a given audio role, and ctl type
+ * @brief Generate the 'sink' or 'source' of a 'streammap' entry, with the
+ *        zone mapping both by channel names and as a routing matrix of
+ *        the card ports
+ * @return A new json_object, or NULL if the stream has no such zone
  */
-PUBLIC STATIC halCtlsTagT getHalCtlsTag(const char *role, halCtlsTypeT type)
+PUBLIC STATIC json_object *generateEndpoint(const halModelT *model,
+                                            const halModelZoneT *zone,
+                                            SinkSourceT sinkSourceType,
+                                            int cardIdx)
 {
-  int i = 1;
-  char ctlLabel[255];
+  json_object *endpointJ = NULL;
 
-  while (halCtlsLabels[i] != NULL)
-  {
-    strcpy(ctlLabel, halCtlsLabels[i]);
-    const char *ctlRole = strtok(ctlLabel, "_");
-    const char *ctlType = strtok(NULL, "_");
-    if (!strcmp(ctlRole, "Master"))
-      ctlType = strtok(NULL, "_");
-
-    if (!strcmp(ctlRole, role))
-    {
-      if (!strcmp(ctlType, halCtlsTypeLabels[type]))
-        return (halCtlsTagT)i;
-    }
+  if (!zone)
+    return NULL;
 
-    i++;
-  }
+  wrap_json_pack(&endpointJ, "{s:i,s:o,s:o*}",
+                 "channels", zone->rowsCount,
+                 "mapping", halMatrixNames(zone),
+                 "matrix", halMatrixGenerate(model, zone, sinkSourceType, cardIdx));
 
-  return EndHalCrlTag;
+  return endpointJ;
 }
 
 
@@ -142,40 +130,65 @@ json_object *json_object_array_find(json_object *arrayJ,
   return NULL;
 }
 
-HAL_ERRCODE initHalPlugin(const char *halPluginName,
-                          json_object *cardpropsJ,
-                          json_object *streammapJ)
+/*
+ * @brief Build the 'initialize_sndcard' arguments for a HAL plugin. The
+ *        arguments hold their own references to cardpropsJ and streammapJ.
+ */
+PUBLIC json_object *initHalPluginArgs(halCardT *card)
 {
   json_object *cfgJ = NULL;
-  json_object *cfgResultJ = NULL;
-  json_object *resultJ = NULL;
-  int result = -1;
-  const char *message;
 
   AFB_ApiNotice(NULL, "Configuration OK, sending to HAL plugin");
-  wrap_json_pack(&cfgJ, "{s:o,s:o}",
-                 "cardprops", cardpropsJ,
-                 "streammap", streammapJ);
+
+  // With the 'shm' option, only the path of a sealed copy is sent
+  if (halOptionsGet()->shm)
+  {
+    cfgJ = halShmArgs(&card->shmFd, card->name, card->cardpropsJ, card->streammapJ);
+    if (cfgJ)
+      return cfgJ;
+
+    AFB_ApiWarning(NULL, "SHM: card %s, sending the payload as JSON", card->name);
+  }
+
+  wrap_json_pack(&cfgJ, "{s:O,s:O}",
+                 "cardprops", card->cardpropsJ,
+                 "streammap", card->streammapJ);
 
   // printf("jobj from str:\n---\n%s\n---\n", json_object_to_json_string_ext(cfgJ, JSON_C_TO_STRING_SPACED | JSON_C_TO_STRING_PRETTY));
 
-  result = afb_service_call_sync(halPluginName, "initialize_sndcard", cfgJ, &cfgResultJ);
+  return cfgJ;
+}
+
+/*
+ * @brief Check the reply of a HAL plugin to 'initialize_sndcard'
+ * @param result     : The call status, 0 on success
+ * @param cfgResultJ : The call reply
+ * @return HAL_OK if the plugin was initialized, HAL_FAIL otherwise
+ */
+PUBLIC HAL_ERRCODE initHalPluginResult(int result, json_object *cfgResultJ)
+{
+  const char *message = NULL;
+
   AFB_NOTICE("Result Code: %d, result: %s", result, json_object_get_string(cfgResultJ));
 
   if (result)
   {
     // Error code was returned, return fail to afb init
-    const char *strResult;
-    const char *strStatus;
+    const char *strResult = NULL;
+    const char *strStatus = NULL;
+    json_object *resultJ = NULL;
     int errCode = -1;
 
-    wrap_json_unpack(cfgResultJ, "{s:{s:s,s:s}}",
+    wrap_json_unpack(cfgResultJ, "{s:{s:s,s?s}}",
                      "request", "status", &strStatus, "info", &strResult);
-    resultJ = json_tokener_parse(strResult);
+    if (strResult)
+      resultJ = json_tokener_parse(strResult);
     wrap_json_unpack(resultJ, "{s:i,s:s}", "errcode",
                      &errCode, "message", &message);
 
     AFB_NOTICE("Status: %s, Message: %s, ErrCode: %d", strStatus, message, errCode);
+    if (resultJ)
+      json_object_put(resultJ);
 
     return HAL_FAIL;
   }
@@ -190,88 +203,161 @@ HAL_ERRCODE initHalPlugin(const char *halPluginName,
   return HAL_OK;
 }
 
-PUBLIC alsaHalMapT *generateAlsaHalMap(json_object *ctlsJ)
+/*
+ * @brief Initialize a HAL plugin, waiting for its reply
+ */
+PUBLIC HAL_ERRCODE initHalPlugin(halCardT *card)
 {
-  int ctlsLength = json_object_array_length(ctlsJ);
-  size_t ctlsAlloc = sizeof(alsaHalMapT) * ctlsLength * 8;
-  int ctlsIdx = 0, halMapIdx = 0;
-  alsaHalMapT *alsaHalMap = (alsaHalMapT *)malloc(ctlsAlloc);
-  memset(alsaHalMap, 0, ctlsAlloc);
+  json_object *cfgResultJ = NULL;
+  int result = -1;
+
+  result = halStatsServiceCallSync(card->api, "initialize_sndcard",
+                                   initHalPluginArgs(card),
+                                   &cfgResultJ);
+
+  return initHalPluginResult(result, cfgResultJ);
+}
+
+/*
+ * @brief Initialize a HAL plugin, without waiting for its reply.
+ *        The callback is given the reply, see initHalPluginResult.
+ */
+PUBLIC void initHalPluginAsync(halCardT *card,
+                               void (*callback)(void *closure, int result,
+                                                json_object *cfgResultJ),
+                               void *closure)
+{
+  halStatsServiceCall(card->api, "initialize_sndcard",
+                      initHalPluginArgs(card),
+                      callback, closure);
+}
+
+/*
+ * @brief Size the halmap of a card, with a counting pass over the ctls.
+ *        The HAL card carries the ctls of every role, the others none.
+ * @param model     : The config model
+ * @param cardIdx   : The card index in the model
+ * @param ctlsCount : Set to the number of halmap entries
+ * @return The arena size taken by the halmap, its names and its ramps
+ */
+PUBLIC size_t sizeAlsaHalMap(const halModelT *model,
+                             int cardIdx,
+                             int *ctlsCount)
+{
+  int ctlsIdx = 0, halMapCount = 0, ctlType = 0;
+  size_t size = 0;
+
+  for (ctlsIdx = 0; cardIdx == HAL_CARD_HAL_IDX && ctlsIdx < model->ctlsCount; ctlsIdx++)
+  {
+    const halModelCtlsT *ctls = &model->ctls[ctlsIdx];
+
+    for (ctlType = Volume; ctlType < EndHalCtlsType; ctlType++)
+    {
+      if (!ctls->ctls[ctlType])
+        continue;
+
+      halMapCount++;
+      size += HAL_ARENA_STR_SZ(ctls->ctls[ctlType]->name);
+      if (ctlType == Ramp)
+        size += halRampArenaSize();
+    }
+  }
+
+  *ctlsCount = halMapCount;
+  return size + HAL_ARENA_SZ(sizeof(alsaHalMapT) * (halMapCount + 1));
+}
+
+/*
+ * @brief Generate the halmap of a card: the ctls of every role for the HAL
+ *        card, none for the others, as only the HAL card is registered with
+ *        hal-utilities. The halmap, its names and its ramps are allocated
+ *        in an arena, sized with sizeAlsaHalMap.
+ * @param arena     : The arena owning the halmap
+ * @param model     : The config model
+ * @param cardIdx   : The card index in the model
+ * @param ctlsCount : The number of halmap entries, as set by sizeAlsaHalMap
+ * @return A halmap array, terminated by a zeroed entry, or NULL on failure
+ */
+PUBLIC alsaHalMapT *generateAlsaHalMap(halArenaT *arena,
+                                       const halModelT *model,
+                                       int cardIdx,
+                                       int ctlsCount)
+{
+  int ctlsIdx = 0, halMapIdx = 0, ctlType = 0;
+  alsaHalMapT *alsaHalMap = halArenaAlloc(arena, sizeof(alsaHalMapT) * (ctlsCount + 1));
 
   if (!alsaHalMap)
   {
-    AFB_ApiError(NULL, "HALMAP: Cannot allocate memory (sz: %ld)", ctlsAlloc);
+    AFB_ApiError(NULL, "HALMAP: Cannot allocate memory (ctls: %d)", ctlsCount);
     return NULL;
   }
 
-  for (ctlsIdx = 0; ctlsIdx < ctlsLength; ctlsIdx++)
+  for (ctlsIdx = 0; cardIdx == HAL_CARD_HAL_IDX && ctlsIdx < model->ctlsCount; ctlsIdx++)
   {
-    char *ctlUid = NULL, *ctlStream = NULL;
-    json_object *ctlCurrJ = NULL, *ctlVolumeJ = NULL, *ctlVolrampJ = NULL,
-                *ctlBassJ = NULL, *ctlMidJ = NULL, *ctlTrebleJ = NULL,
-                *ctlFadeJ = NULL, *ctlBalanceJ = NULL;
-
-    ctlCurrJ = json_object_array_get_idx(ctlsJ, ctlsIdx);
-    wrap_json_unpack(ctlCurrJ, "{s:s,s:s,s:o,s?o,s?o,s?o,s?o,s?o,s?o}",
-                     "uid", &ctlUid, "stream", &ctlStream,
-                     "volume", &ctlVolumeJ, "volramp", &ctlVolrampJ,
-                     "bass", &ctlBassJ, "mid", &ctlMidJ, "treble", &ctlTrebleJ,
-                     "fade", &ctlFadeJ, "balance", &ctlBalanceJ);
-
-    if (generateAlsaHalMapCtl(ctlVolumeJ, ctlStream, Volume, &alsaHalMap[halMapIdx]))
-      halMapIdx++;
-    if (ctlVolrampJ)
-      if (generateAlsaHalMapCtl(ctlVolrampJ, ctlStream, Ramp, &alsaHalMap[halMapIdx]))
-        halMapIdx++;
-    if (ctlBassJ)
-      if (generateAlsaHalMapCtl(ctlBassJ, ctlStream, Bass, &alsaHalMap[halMapIdx]))
-        halMapIdx++;
-    if (ctlMidJ)
-      if (generateAlsaHalMapCtl(ctlMidJ, ctlStream, Mid, &alsaHalMap[halMapIdx]))
-        halMapIdx++;
-    if (ctlTrebleJ)
-      if (generateAlsaHalMapCtl(ctlTrebleJ, ctlStream, Treble, &alsaHalMap[halMapIdx]))
-        halMapIdx++;
-    if (ctlFadeJ)
-      if (generateAlsaHalMapCtl(ctlFadeJ, ctlStream, Fade, &alsaHalMap[halMapIdx]))
-        halMapIdx++;
-    if (ctlBalanceJ)
-      if (generateAlsaHalMapCtl(ctlBalanceJ, ctlStream, Balance, &alsaHalMap[halMapIdx]))
+    const halModelCtlsT *ctls = &model->ctls[ctlsIdx];
+
+    for (ctlType = Volume; ctlType < EndHalCtlsType && halMapIdx < ctlsCount; ctlType++)
+      if (ctls->ctls[ctlType] &&
+          generateAlsaHalMapCtl(arena, ctls, (halCtlsTypeT)ctlType,
+                                &alsaHalMap[halMapIdx]))
         halMapIdx++;
   }
 
-  AFB_ApiNotice(NULL, "ctlsIdx: %d, halMapIdx: %d:", ctlsIdx, halMapIdx);
+  AFB_ApiNotice(NULL, "HALMAP: card: %s, ctlsIdx: %d, halMapIdx: %d",
+                model->cards[cardIdx].name, ctlsIdx, halMapIdx);
 
   return alsaHalMap;
 }
 
-PUBLIC STATIC bool generateAlsaHalMapCtl(json_object *ctlJ,
-                                         const char *ctlStream,
+PUBLIC STATIC bool generateAlsaHalMapCtl(halArenaT *arena,
+                                         const halModelCtlsT *ctls,
                                          halCtlsTypeT ctlType,
                                          alsaHalMapT *alsaHalMap)
 {
+  const halModelCtlT *ctl = ctls->ctls[ctlType];
+
   // Get halCtlsTagT for ctlType
-  halCtlsTagT tag = getHalCtlsTag(ctlStream, ctlType);
+  halCtlsTagT tag = halCtlsTagGetByRole(ctls->roleIdx, ctlType);
   if (tag == EndHalCrlTag)
   {
     AFB_ApiError(NULL, "HALMAP: Cannot get HAL ctl tag for role: %s, type: %s",
-                 ctlStream, halCtlsTypeLabels[ctlType]);
+                 ctls->role, halCtlsTypeLabels[ctlType]);
     return false;
   }
 
-  // Set to defaults
-  char *ctlName = NULL, *ctlCb = NULL;
-  int ctlValue = 50, ctlMinval = 0, ctlMaxval = 100,
-      ctlCount = 1, ctlStep = 1;
+  // The halmap outlives the model, the name is copied into the arena
+  setupAlsaHalMapCtl(arena, alsaHalMap, tag, ctlType,
+                     halArenaStrdup(arena, ctl->name), ctl->value,
+                     ctl->minval, ctl->maxval, ctl->count, ctl->step,
+                     ctlType == Ramp ? &ctl->ramp : NULL);
 
-  // Unpack the control
-  wrap_json_unpack(ctlJ, "{s:s,s?s,s?i,s?i,s?i}",
-                   "name", &ctlName, "cb", &ctlCb, "value", &ctlValue,
-                   "minval", &ctlMinval, "maxval", &ctlMaxval,
-                   "count", &ctlStep, "step", &ctlStep);
+  return true;
+}
 
+/*
+ * @brief Set up a halmap entry from a resolved ctl definition
+ * @param arena      : The arena owning the halmap, and the ramp of the entry
+ * @param alsaHalMap : The (zeroed) halmap entry to set up
+ * @param tag        : The resolved halCtlsTagT of the control
+ * @param ctlType    : The type of the control
+ * @param rampConfig : The ramp settings of a 'Ramp' control
+ * @return None
+ */
+PUBLIC void setupAlsaHalMapCtl(halArenaT *arena,
+                               alsaHalMapT *alsaHalMap,
+                               halCtlsTagT tag,
+                               halCtlsTypeT ctlType,
+                               const char *ctlName,
+                               int ctlValue,
+                               int ctlMinval,
+                               int ctlMaxval,
+                               int ctlCount,
+                               int ctlStep,
+                               const halRampConfigT *rampConfig)
+{
   // Set up the halmap
   alsaHalMap->tag = tag;
+  alsaHalMap->label = halCtlsTagLabel(tag);
   alsaHalMap->ctl.name = ctlName;
   alsaHalMap->ctl.numid = CTL_AUTO;
   alsaHalMap->ctl.type = SND_CTL_ELEM_TYPE_INTEGER;
@@ -282,187 +368,79 @@ PUBLIC STATIC bool generateAlsaHalMapCtl(json_object *ctlJ,
   if (ctlType == Volume)
     alsaHalMap->ctl.count = ctlCount;
 
-  if (ctlType == Ramp)
+  if (ctlType == Ramp && rampConfig)
   {
+    // The ramp drives the volume ctl of the same role
     alsaHalMap->ctl.step = ctlStep;
-    alsaHalMap->cb.callback = volumeRamp;
-    halVolRampT halVolRamp = {
-      .mode = RAMP_VOL_SMOOTH,
-      .slave = (halCtlsTagT)(tag - 1),
-      .delay = 100 * 1000,
-      .stepDown = 1,
-      .stepUp = 1,
-    };
-    alsaHalMap->cb.handle = &halVolRamp;
+    alsaHalMap->cb.handle = halRampNew(arena, halCtlsTagGetByRole(halCtlsTagRole(tag), Volume),
+                                       ctlStep, rampConfig);
+    if (alsaHalMap->cb.handle)
+      alsaHalMap->cb.callback = halRampCB;
   }
 
   alsaHalMap->ctl.enums = NULL;
-
-  return true;
-}
-
-/*
- * @brief Get the ALSA card info (name, api) from JSON config
- * @param cardsJ : A json_object containing an array of card objects
- * @return A json_object containing an array of card info objects
- */
-PUBLIC json_object *getCardInfo(json_object *cardsJ)
-{
-  int cardsIdx = 0;
-  int cardsLength = json_object_array_length(cardsJ);
-  json_object *cardInfoArrayJ = NULL, *cardInfoJ = NULL;
-  
-  wrap_json_pack(&cardInfoArrayJ, "[]");
-
-  for (cardsIdx = 0; cardsIdx < cardsLength; cardsIdx++)
-  {
-    char *name = NULL, *api = NULL, *info = NULL;
-    json_object *cardCurrJ = NULL;
-
-    cardCurrJ = json_object_array_get_idx(cardsJ, cardsIdx);
-    
-    wrap_json_unpack(cardCurrJ, "{s?s,s?s,s?s}",
-                     "name", &name, "api", &api, "info", &info);
-                     
-    wrap_json_pack(&cardInfoJ, "{s:s,s:s,s?s}",
-                   "name", name, "api", api, "info", info);
-
-    json_object_array_add(cardInfoArrayJ, cardInfoJ);
-  }
-
-  return cardInfoArrayJ;
 }
 
 /*
  * @brief Get a card's sink/source map by string
  * @param map            : The map to search for
- * @param cardsJ         : A json_object containing an array of card objects
  * @param sinkSourceType : An enum indicating the zone type (SINK or SOURCE)
  * @return A json_object containing the sink/source map object, or NULL if unsuccessful
  */
 PUBLIC json_object *getCardSinkSource(const char *map,
-                                      json_object *cardsJ,
                                       SinkSourceT sinkSourceType)
 {
-  int cardIdx = 0, cardLength = 0;
-  char *type = NULL;
-
-  if (sinkSourceType == SINK)
-    type = "sink";
-  else
-    type = "source";
-
-  // Loop card array
-  cardLength = json_object_array_length(cardsJ);
-  for (cardIdx = 0; cardIdx < cardLength; cardIdx++)
-  {
-    int sinkSourceIdx = 0, sinkSourceLength = 0;
-    json_object *cardCurrJ = NULL, *sinkSourceArrayJ = NULL,
-                *cardChannelsJ = NULL;
-    
-    cardCurrJ = json_object_array_get_idx(cardsJ, cardIdx);
-    wrap_json_unpack(cardCurrJ, "{s?o}",
-                     "channels", &cardChannelsJ);
-    wrap_json_unpack(cardChannelsJ, "{s?o}",
-                     type, &sinkSourceArrayJ);
-    
-    // Loop sink/source array
-    sinkSourceLength = json_object_array_length(sinkSourceArrayJ);
-    for (sinkSourceIdx = 0; sinkSourceIdx < sinkSourceLength; sinkSourceIdx++)
-    {
-      char *thisMap = NULL;
-      json_object *sinkSourceCurrJ = json_object_array_get_idx(sinkSourceArrayJ, 
-                                                               sinkSourceIdx);
-      wrap_json_unpack(sinkSourceCurrJ, "{s?s}",
-                       "type", &thisMap);
-      if (strcmp(thisMap, map) == 0)
-        return sinkSourceCurrJ;
-    }
-  }
-
-  return NULL;
+  return halIndexGetChannel(map, sinkSourceType);
 }
 
 /*
- * @brief Generate a 'cardprops' object from a 'card' config
- * @param cardsJ : A json_object containing an a card object
- * @return A json_object containing a 'cardprops' object
+ * @brief Generate a 'cardprops' object, i.e. the card channels
+ * @param card : A card of the config model
+ * @return A new json_object containing a 'cardprops' object
  */
-PUBLIC json_object *generateCardProperties(json_object *cardJ,
-                                           const char *cardname)
+PUBLIC json_object *generateCardProperties(const halModelCardT *card)
 {
-  AFB_ApiNotice(NULL, "CARD: Generating 'cardprops' for card: %s", cardname);
+  json_object *cardpropsJ = NULL;
+
+  AFB_ApiNotice(NULL, "CARD: Generating 'cardprops' for card: %s", card->name);
 
-  json_object *cardChannelsJ = NULL;
+  wrap_json_pack(&cardpropsJ, "{s:o*,s:o*}",
+                 "sink", generateChannels(card, SINK),
+                 "source", generateChannels(card, SOURCE));
 
-  wrap_json_unpack(cardJ, "{s:o}", "channels", &cardChannelsJ);
-    
-  return cardChannelsJ;
+  return cardpropsJ;
 }
 
 /*
- * @brief Generate a 'streammap' object from an array of streams and zones
- * @param streamsJ : A json_object containing an array of streams
- * @param zonesJ   : A json_object containing an array of zones
- * @return A json_object containing a 'steammap' object
+ * @brief Generate a 'streammap' object: every stream for the HAL card, which
+ *        serves all the ctls, the streams routed to the card for the others
+ * @param model   : The config model
+ * @param cardIdx : The card index in the model
+ * @return A new json_object containing a 'streammap' object
  */
-PUBLIC json_object *generateStreamMap(json_object *streamsJ,
-                                      json_object *zonesJ,
-                                      const char *cardname)
+PUBLIC json_object *generateStreamMap(const halModelT *model, int cardIdx)
 {
-  int streamsIdx = 0;
-  int streamsLength = json_object_array_length(streamsJ);
+  int streamIdx = 0;
   json_object *streamMapArrayJ = NULL;
 
-  AFB_ApiNotice(NULL, "STREAM: Generating 'streammap' for card: %s:", cardname);
+  AFB_ApiNotice(NULL, "STREAM: Generating 'streammap' for card: %s:",
+                model->cards[cardIdx].name);
 
   wrap_json_pack(&streamMapArrayJ, "[]");
 
-  for (streamsIdx = 0; streamsIdx < streamsLength; streamsIdx++)
+  for (streamIdx = 0; streamIdx < model->streamsCount; streamIdx++)
   {
-    json_object *streamMapJ = NULL, *sourceJ = NULL, *sinkJ = NULL,
-                *sourceZoneMapJ = NULL, *sinkZoneMapJ = NULL,
-                *streamSourceJ = NULL, *streamSinkJ = NULL, *currStreamJ = NULL;
-    const char *streamName = NULL, *sourceProfile = NULL, *sinkProfile = NULL,
-               *sourceZone = NULL, *sinkZone = NULL;
-    int sinkChannels = 0, sourceChannels = 0;
-
-    // Begin unpacking
-    currStreamJ = json_object_array_get_idx(streamsJ, streamsIdx);
-    wrap_json_unpack(currStreamJ, "{s:s,s?o,s?o}",
-                     "role", &streamName, "source", &streamSourceJ,
-                     "sink", &streamSinkJ);
-    if (streamSourceJ)
-      wrap_json_unpack(streamSourceJ, "{s?s,s:s}",
-                       "profile", &sourceProfile, "zone", &sourceZone);
-    if (streamSinkJ)
-      wrap_json_unpack(streamSinkJ, "{s?s,s:s}",
-                       "profile", &sinkProfile, "zone", &sinkZone);
-
-    // Validate that the mapped zone exists, and get the zone's mapping
-    if (sourceZone)
-    {
-      sourceZoneMapJ = getZoneMap(zonesJ, sourceZone);
-      if (sourceZoneMapJ)
-      {
-        sourceChannels = json_object_array_length(sourceZoneMapJ);
-        wrap_json_pack(&sourceJ, "{s:i,s:o}",
-                       "channels", sourceChannels, "mapping", sourceZoneMapJ);
-      }
-    }
-    if (sinkZone)
-    {
-      sinkZoneMapJ = getZoneMap(zonesJ, sinkZone);
-      if (sinkZoneMapJ)
-      {
-        sinkChannels = json_object_array_length(sinkZoneMapJ);
-        wrap_json_pack(&sinkJ, "{s:i,s:o}",
-                       "channels", sinkChannels, "mapping", sinkZoneMapJ);
-      }
-    }
-    
+    const halModelStreamT *stream = &model->streams[streamIdx];
+    json_object *streamMapJ = NULL;
+
+    // Skip the streams that are not routed to this card, but on the HAL card
+    if (cardIdx != HAL_CARD_HAL_IDX && !halModelStreamUsesCard(stream, cardIdx))
+      continue;
+
     wrap_json_pack(&streamMapJ, "{s:s,s:o*,s:o*}",
-                   "stream", streamName, "source", sourceJ, "sink", sinkJ);
+                   "stream", stream->role,
+                   "source", generateEndpoint(model, stream->zones[SOURCE], SOURCE, cardIdx),
+                   "sink", generateEndpoint(model, stream->zones[SINK], SINK, cardIdx));
 
     json_object_array_add(streamMapArrayJ, streamMapJ);
   }
@@ -20,18 +20,15 @@
 #define HAL_GENERIC_UTILITY_H
 
 #include "hal-generic.h"
+#include "hal-generic-arena.h"
+#include "hal-generic-card.h"
+#include "hal-generic-model.h"
+#include "hal-generic-tags.h"
+#include "hal-generic-ramp.h"
 #include "hal-interface.h"
 
 #include <json-c/json.h>
-
-/*****************************************************************************
- * Definitions
- ****************************************************************************/
-typedef enum {
-  SINK,
-  SOURCE
-} SinkSourceT;
-
+#include <stdbool.h>
 
 /*****************************************************************************
  * Global Function Declarations
@@ -40,19 +37,35 @@ PUBLIC json_object *json_object_array_find(json_object *arrayJ,
                                            const char *key,
                                            const char *value);
 
-PUBLIC json_object *getCardInfo(json_object *cardsJ);
 PUBLIC json_object *getCardSinkSource(const char *map,
-                                      json_object *cardsJ,
                                       SinkSourceT sinkSourceType);
-                                      
-PUBLIC alsaHalMapT *generateAlsaHalMap(json_object *ctlsJ);
-PUBLIC json_object *generateCardProperties(json_object *cardJ,
-                                           const char *cardname);
-PUBLIC json_object *generateStreamMap(json_object *streamsJ,
-                                      json_object *zonesJ,
-                                      const char *cardname);
-PUBLIC HAL_ERRCODE initHalPlugin(const char *halPluginName,
-                                 json_object *cardpropsJ,
-                                 json_object *streammapJ);
+
+PUBLIC size_t sizeAlsaHalMap(const halModelT *model,
+                             int cardIdx,
+                             int *ctlsCount);
+PUBLIC alsaHalMapT *generateAlsaHalMap(halArenaT *arena,
+                                       const halModelT *model,
+                                       int cardIdx,
+                                       int ctlsCount);
+PUBLIC void setupAlsaHalMapCtl(halArenaT *arena,
+                               alsaHalMapT *alsaHalMap,
+                               halCtlsTagT tag,
+                               halCtlsTypeT ctlType,
+                               const char *ctlName,
+                               int ctlValue,
+                               int ctlMinval,
+                               int ctlMaxval,
+                               int ctlCount,
+                               int ctlStep,
+                               const halRampConfigT *rampConfig);
+PUBLIC json_object *generateCardProperties(const halModelCardT *card);
+PUBLIC json_object *generateStreamMap(const halModelT *model, int cardIdx);
+PUBLIC json_object *initHalPluginArgs(halCardT *card);
+PUBLIC HAL_ERRCODE initHalPluginResult(int result, json_object *cfgResultJ);
+PUBLIC HAL_ERRCODE initHalPlugin(halCardT *card);
+PUBLIC void initHalPluginAsync(halCardT *card,
+                               void (*callback)(void *closure, int result,
+                                                json_object *cfgResultJ),
+                               void *closure);
 
 #endif /* HAL_GENERIC_UTILITY_H */
\ No newline at end of file
@@ -1,6 +1,6 @@
 /*
  * Copyright (C) 2018 Fiberdyne Systems
- * 
+ *
  * Author: Mark Farrugia <mark.farrugia@fiberdyne.com.au>
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
@@ -16,122 +16,204 @@
  * limitations under the License.
  */
 
+/*
+ * Config validation.
+ *
+ * Each section is indexed before it is validated (see hal-generic-index),
+ * so that every reference (channel type, zone uid, stream role) is checked
+ * with a single hash probe, and declarations shadowed by an earlier one
+ * are found by checking the index holds the object itself. Each section is
+ * thus validated in a single pass.
+ *
+ * Validation does not stop at the first error: all errors are added to
+ * the validation report, with the section, the index and uid of the
+ * faulty entry, and a message. The report covers the last config load
+ * (or reload), and is returned by the 'validation' verb.
+ */
+
 
 /*****************************************************************************
  * Included Files
  ****************************************************************************/
 #include "hal-generic-validate.h"
 #include "hal-generic-utility.h"
+#include "hal-generic-index.h"
+#include "hal-generic-matrix.h"
 #include "wrap-json.h"
 
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 
 
 /*****************************************************************************
- * Local Function Definitions
+ * Definitions
  ****************************************************************************/
-static char assert_j_errbuf[255];
-#define ASSERT_J(j, errmsg, type, ...)                       \
-  {                                                          \
-    if (!json_object_is_type(j, type))                       \
-    {                                                        \
-      snprintf(assert_j_errbuf, 255, errmsg, ##__VA_ARGS__); \
-      AFB_ApiError(NULL, assert_j_errbuf);                   \
-      return HAL_FAIL;                                       \
-    }                                                        \
-  }
+#define HAL_VALIDATE_MSG_SZ 256
+
+// The entry being validated, for error reporting
+typedef struct {
+  const char *section;
+  int index;
+  const char *uid;
+  int errors;
+} halValidateCtxT;
 
-#define ASSERT_JARRAY(jarray, errmsg, ...)                   \
-  ASSERT_J(jarray, errmsg, json_type_array, ##__VA_ARGS__)
 
-#define ASSERT_JOBJECT(jobject, errmsg, ...)                 \
-  ASSERT_J(jobject, errmsg, json_type_object, ##__VA_ARGS__)
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static json_object *_reportJ = NULL;    // Errors of the last load
 
 
 /*****************************************************************************
  * Local Function Declarations
  ****************************************************************************/
-PUBLIC STATIC HAL_ERRCODE validateCardSinkSource(json_object *arrayJ);
-PUBLIC STATIC HAL_ERRCODE validateZoneIsSinkSource(json_object *zoneJ,
-                                                   const char *zoneId,
-                                                   SinkSourceT matchType);
-PUBLIC STATIC HAL_ERRCODE validateZoneMapping(json_object *zoneMappingJ,
-                                              json_object *cardsJ,
-                                              SinkSourceT sinkSourceType);
-PUBLIC STATIC HAL_ERRCODE validateCtl(json_object *ctlJ, const char *ctlType);
+PUBLIC STATIC void reportError(halValidateCtxT *ctx, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+PUBLIC STATIC bool checkType(halValidateCtxT *ctx, json_object *j,
+                             json_type type, const char *what);
+PUBLIC STATIC void validateCardSinkSource(halValidateCtxT *ctx,
+                                          json_object *arrayJ,
+                                          SinkSourceT sinkSourceType);
+PUBLIC STATIC void validateStreamZone(halValidateCtxT *ctx,
+                                      json_object *endpointJ,
+                                      SinkSourceT matchType);
+PUBLIC STATIC void validateZoneMapping(halValidateCtxT *ctx,
+                                       json_object *zoneMappingJ,
+                                       SinkSourceT sinkSourceType);
+PUBLIC STATIC void validateCtl(halValidateCtxT *ctx, json_object *ctlJ,
+                               const char *ctlType);
 
 
 /*****************************************************************************
  * Local Function Definitions
  ****************************************************************************/
+/*
+ * @brief Add an error to the report
+ */
+STATIC void reportError(halValidateCtxT *ctx, const char *fmt, ...)
+{
+  char message[HAL_VALIDATE_MSG_SZ];
+  json_object *errorJ = NULL;
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+
+  ctx->errors++;
+  AFB_ApiError(NULL, "%s[%d]%s%s: %s", ctx->section, ctx->index,
+               ctx->uid ? " " : "", ctx->uid ? ctx->uid : "", message);
+
+  if (!_reportJ)
+    _reportJ = json_object_new_array();
+
+  wrap_json_pack(&errorJ, "{s:s,s:i,s:s*,s:s}",
+                 "section", ctx->section, "index", ctx->index,
+                 "uid", ctx->uid, "message", message);
+  json_object_array_add(_reportJ, errorJ);
+}
+
+/*
+ * @brief Check the type of a json_object, reporting an error otherwise
+ */
+STATIC bool checkType(halValidateCtxT *ctx, json_object *j,
+                      json_type type, const char *what)
+{
+  if (json_object_is_type(j, type))
+    return true;
+
+  reportError(ctx, "%s must be a JSON %s!", what,
+              type == json_type_array ? "array" : "object");
+  return false;
+}
+
 /*
  * @brief Parse and validate a CTL definition
  * @params ctlJ    : The ctl json_object
  *         ctlType : The ctl type for error reporting
- * @return HAL_OK if ctl is valid, HAL_FAIL otherwise 
  */
-STATIC HAL_ERRCODE validateCtl(json_object *ctlJ, const char *ctlType)
+STATIC void validateCtl(halValidateCtxT *ctx, json_object *ctlJ, const char *ctlType)
 {
   // Set to defaults
-  int ctlValue = 50, ctlMinval = 0, ctlMaxval = 100;
+  int ctlValue = 50, ctlMinval = 0, ctlMaxval = 100, ctlDuration = 0;
+  char *ctlCurve = NULL;
 
-  ASSERT_JOBJECT(ctlJ, "CTL: '%s' needs to be a JSON object!", ctlType);
+  if (!checkType(ctx, ctlJ, json_type_object, ctlType))
+    return;
 
-  wrap_json_unpack(ctlJ, "{s?i,s?i,s?i}",
+  wrap_json_unpack(ctlJ, "{s?i,s?i,s?i,s?s,s?i}",
                    "value", &ctlValue, "minval", &ctlMinval,
-                   "maxval", &ctlMaxval);
+                   "maxval", &ctlMaxval, "curve", &ctlCurve,
+                   "duration", &ctlDuration);
+
+  if (ctlCurve && halRampCurveGet(ctlCurve) == HAL_RAMP_CURVE_END)
+    reportError(ctx, "'%s': 'curve' '%s' is unknown!", ctlType, ctlCurve);
+
+  if (ctlDuration < 0)
+    reportError(ctx, "'%s': 'duration' must be positive! (%d)",
+                ctlType, ctlDuration);
 
   if (ctlValue > ctlMaxval)
-  {
-    AFB_ApiError(NULL, "CTL: '%s': 'value' '%i' is greater than it's maxval! (%d)",
-                 ctlType, ctlValue, ctlMaxval);
-    return HAL_FAIL;
-  }
+    reportError(ctx, "'%s': 'value' '%i' is greater than it's maxval! (%d)",
+                ctlType, ctlValue, ctlMaxval);
 
   if (ctlValue < ctlMinval)
-  {
-    AFB_ApiError(NULL, "CTL: '%s': 'value' '%i' is less than it's minval! (%d)",
-                 ctlType, ctlValue, ctlMinval);
-    return HAL_FAIL;
-  }
-
-  return HAL_OK;
+    reportError(ctx, "'%s': 'value' '%i' is less than it's minval! (%d)",
+                ctlType, ctlValue, ctlMinval);
 }
 
 /*
- * @brief Check that the zone is either a 'sink' or a 'source'
- * @param zoneJ  : The zone json_object
- * @param zoneId : The zone ID for debug
- * @param type   : The matchType to check for
- * @return HAL_OK if zone type matches matchType, HAL_FAIL otherwise
+ * @brief Check a stream sink or source refers to a zone of the same type
+ * @param endpointJ : The stream 'sink' or 'source' object
+ * @param matchType : The zone type to check for
  */
-STATIC HAL_ERRCODE validateZoneIsSinkSource(json_object *zoneJ,
-                                            const char *zoneId,
-                                            SinkSourceT matchType)
+STATIC void validateStreamZone(halValidateCtxT *ctx,
+                               json_object *endpointJ,
+                               SinkSourceT matchType)
 {
-  char *zoneType = NULL;
-  char *zoneTypeMatcher = (matchType == SINK) ? "sink" : "source";
+  const char *zoneTypeMatcher = (matchType == SINK) ? "sink" : "source";
+  char *zoneUid = NULL, *zoneType = NULL;
+  json_object *zoneJ = NULL;
 
-  wrap_json_unpack(zoneJ, "{s?s}",
-                  "type", &zoneType); 
-  
-  // Check that the zone type matches the intended type
-  if (strcmp(zoneType, zoneTypeMatcher) != 0)
+  if (!checkType(ctx, endpointJ, json_type_object, zoneTypeMatcher))
+    return;
+
+  // Check the stream sink/source contains the field 'zone'
+  wrap_json_unpack(endpointJ, "{s?s}", "zone", &zoneUid);
+  if (!zoneUid)
   {
-    AFB_ApiError(NULL, "STREAM: Zone '%s' is not a '%s'!", zoneId, zoneTypeMatcher);
-    return HAL_FAIL;
+    reportError(ctx, "'%s' must have field 'zone'!", zoneTypeMatcher);
+    return;
   }
-  
-  return HAL_OK;
+
+  // Check that the zone exists
+  zoneJ = halIndexGetZone(zoneUid);
+  if (!zoneJ)
+  {
+    reportError(ctx, "Zone '%s' is not defined!", zoneUid);
+    return;
+  }
+
+  // Check that the zone type matches the intended type
+  wrap_json_unpack(zoneJ, "{s?s}", "type", &zoneType);
+  if (!zoneType || strcmp(zoneType, zoneTypeMatcher) != 0)
+    reportError(ctx, "Zone '%s' is not a '%s'!", zoneUid, zoneTypeMatcher);
 }
 
 /*
  * @brief Parse and validate all card channel SINK/SOURCE definitions
  */
-STATIC HAL_ERRCODE validateCardSinkSource(json_object *arrayJ)
+STATIC void validateCardSinkSource(halValidateCtxT *ctx,
+                                   json_object *arrayJ,
+                                   SinkSourceT sinkSourceType)
 {
   int idx = 0, len = 0;
-  
+
+  if (!checkType(ctx, arrayJ, json_type_array, "Channels sink/source"))
+    return;
+
   len = json_object_array_length(arrayJ);
 
   // Loop through the known card channel sinks/sources
@@ -147,27 +229,28 @@ STATIC HAL_ERRCODE validateCardSinkSource(json_object *arrayJ)
 
     if (!type || (port < 0))
     {
-      AFB_ApiError(NULL, "CARD: Channel sink/source must contain 'type' and 'port' properties!");
-      return HAL_FAIL; 
+      reportError(ctx, "Channel sink/source must contain 'type' and 'port' properties!");
+      continue;
     }
 
+    // The first declaration of a channel type is the one zones route to
+    if (getCardSinkSource(type, sinkSourceType) != currJ)
+      reportError(ctx, "Channel '%s' is already declared by card '%s'!",
+                  type, halIndexGetChannelCard(type, sinkSourceType));
+
     // Check 'type' against allowed enum types
     // TODO
   }
-  
-  return HAL_OK;
 }
 
 /*
  * @brief Check that the zone mapping only uses card-declared sinks or sources
  * @params zoneMappingJ   : A json_object containing an array of 'zone' mapping arrays
- *         cardsJ         : A json_object containing an array of 'card' objects
  *         sinkSourceType : An enum indicating the zone type (SINK or SOURCE)
- * @return HAL_OK if zone mapping is valid, HAL_FAIL otherwise
  */
-STATIC HAL_ERRCODE validateZoneMapping(json_object *zoneMappingJ,
-                                       json_object *cardsJ,
-                                       SinkSourceT sinkSourceType)
+STATIC void validateZoneMapping(halValidateCtxT *ctx,
+                                json_object *zoneMappingJ,
+                                SinkSourceT sinkSourceType)
 {
   int zoneMappingIdx = 0;
   int zoneMappingLength = json_object_array_length(zoneMappingJ);
@@ -179,134 +262,150 @@ STATIC HAL_ERRCODE validateZoneMapping(json_object *zoneMappingJ,
 
     // Get inner "input" array
     zoneMappingCurrJ = json_object_array_get_idx(zoneMappingJ, zoneMappingIdx);
-    ASSERT_JARRAY(zoneMappingCurrJ, "ZONE: Zone mapping input must be an array!");
+    if (!checkType(ctx, zoneMappingCurrJ, json_type_array, "Zone mapping input"))
+      continue;
 
     // Loop the input indices
     inputLength = json_object_array_length(zoneMappingCurrJ);
     for (inputIdx = 0; inputIdx < inputLength; inputIdx++)
     {
       json_object *inputCurrJ = NULL;
-      char *map = NULL;
+      const char *map = NULL;
+      double gain = 0.0;
 
       inputCurrJ = json_object_array_get_idx(zoneMappingCurrJ, inputIdx);
-      wrap_json_unpack(inputCurrJ, "s", &map);
-      if (!map)
+      if (!halMatrixCellGet(inputCurrJ, &map, &gain))
       {
-        AFB_ApiError(NULL, "ZONE: Mapping must contain at least one element!");
-        return HAL_FAIL;
+        reportError(ctx, "Mapping must be a channel type, or an object "
+                    "with a 'type' and a positive 'gain'!");
+        continue;
       }
 
-      if (!getCardSinkSource(map, cardsJ, sinkSourceType))
-      {
-        AFB_ApiError(NULL, "ZONE: Map '%s' is not defined in any card!", map);
-        return HAL_FAIL;
-      }
+      if (!getCardSinkSource(map, sinkSourceType))
+        reportError(ctx, "Map '%s' is not defined in any card!", map);
     }
   }
-
-  return HAL_OK;
 }
 
 
 /*****************************************************************************
  * Global Function Definitions
  ****************************************************************************/
+/*
+ * @brief Start a new validation report
+ */
+PUBLIC void validateReportReset(void)
+{
+  if (_reportJ)
+    json_object_put(_reportJ);
+  _reportJ = NULL;
+}
+
+/*
+ * @brief Get the number of errors of the validation report
+ */
+PUBLIC int validateReportCount(void)
+{
+  return _reportJ ? json_object_array_length(_reportJ) : 0;
+}
+
+/*
+ * @brief Get the validation report
+ * @return A new json_object: { "valid": <bool>, "errors": [ { "section",
+ *         "index", "uid", "message" } ] }
+ */
+PUBLIC json_object *validateReportGet(void)
+{
+  json_object *reportJ = NULL;
+
+  wrap_json_pack(&reportJ, "{s:b,s:o}",
+                 "valid", validateReportCount() == 0,
+                 "errors", _reportJ ? json_object_get(_reportJ)
+                                    : json_object_new_array());
+
+  return reportJ;
+}
+
+/*
+ * @brief 'validation' verb, get the validation report of the last load
+ */
+PUBLIC void validateReportVerb(struct afb_req request)
+{
+  afb_req_success(request, validateReportGet(), NULL);
+}
+
 /*
  * @brief Parse and validate all STREAM definitions
+ *        Zones and streams must already be indexed
  */
-HAL_ERRCODE validateStreams(json_object *streamsJ, json_object *zonesJ)
+PUBLIC HAL_ERRCODE validateStreams(json_object *streamsJ)
 {
+  halValidateCtxT ctx = { .section = "streams", .index = -1 };
   int streamsIdx = 0, streamsLength = 0;
-  
+
   // Check that streamsJ is an array
-  ASSERT_JARRAY(streamsJ, "STREAM: Parent object must be an array!");
+  if (!checkType(&ctx, streamsJ, json_type_array, "Parent object"))
+    return HAL_FAIL;
 
   // Loop through the known streams, and make sure all is well
   streamsLength = json_object_array_length(streamsJ);
   for (streamsIdx = 0; streamsIdx < streamsLength; streamsIdx++)
   {
-    char *streamUid = NULL, *streamRole = NULL,
-         *streamSinkZone = NULL, *streamSourceZone = NULL;
+    char *streamUid = NULL, *streamRole = NULL;
+    int streamDuck = 0;
     json_object *streamCurrJ = NULL, *streamSinkJ = NULL,
-                *streamSourceJ = NULL, *resultJ = NULL;
+                *streamSourceJ = NULL;
 
     streamCurrJ = json_object_array_get_idx(streamsJ, streamsIdx);
-    wrap_json_unpack(streamCurrJ, "{s?s,s?s,s?o,s?o,s?o}",
+    wrap_json_unpack(streamCurrJ, "{s?s,s?s,s?o,s?o,s?i}",
                      "uid", &streamUid, "role", &streamRole,
-                     "sink", &streamSinkJ, "source", &streamSourceJ);
+                     "sink", &streamSinkJ, "source", &streamSourceJ,
+                     "duck", &streamDuck);
+    ctx.index = streamsIdx;
+    ctx.uid = streamUid;
 
     // Check that all required fields exist
     if (!streamUid || !streamRole || !streamSinkJ)
     {
-      AFB_ApiError(NULL, "STREAM: Properties must include 'uid', 'role', and 'sink'!");
-      return HAL_FAIL; 
+      reportError(&ctx, "Properties must include 'uid', 'role', and 'sink'!");
+      continue;
     }
 
-    ASSERT_JOBJECT(streamSinkJ, "STREAM: 'sink' must be a JSON object!");
-    if (streamSourceJ)
-      ASSERT_JOBJECT(streamSourceJ, "STREAM: 'source' must be a JSON object!");
-
-    // Check that the streamRole is always valid
-    // TODO check halCtlsTagT type for role
+    // Check that the stream role is only declared once
+    if (halIndexGetStream(streamRole) != streamCurrJ)
+      reportError(&ctx, "Role '%s' is already declared!", streamRole);
 
-    // Check the stream sink contains the field 'zone'
-    wrap_json_unpack(streamSinkJ, "{s?s}",
-                     "zone", &streamSinkZone);
-    if (!streamSinkZone)
-    {
-      AFB_ApiError(NULL, "STREAM: Sink must have field 'zone'!");
-      return HAL_FAIL;
-    }
-    // Check that the zone exists
-    resultJ = json_object_array_find(zonesJ, "uid", streamSinkZone);
-    if (!resultJ)
-    {
-      AFB_ApiError(NULL, "STREAM: Zone '%s' is not defined!", streamSinkZone);
-      return HAL_FAIL;
-    }
-    // Check that the zone is a sink
-    if (validateZoneIsSinkSource(resultJ, streamSinkZone, SINK) == HAL_FAIL)
-      return HAL_FAIL;
+    // Check that the ducking attenuation is a percentage
+    if (streamDuck < 0 || streamDuck > 100)
+      reportError(&ctx, "'duck' must be in [0, 100]! (%d)", streamDuck);
 
-    // If stream source is defined, check it contains the field 'zone'
+    // Check the stream sink and source use a zone of the right type
+    validateStreamZone(&ctx, streamSinkJ, SINK);
     if (streamSourceJ)
-    {
-      wrap_json_unpack(streamSourceJ, "{s?s}",
-                      "zone", &streamSourceZone);
-      if (!streamSourceZone)
-      {
-        AFB_ApiError(NULL, "STREAM: Source must have field 'zone'!");
-        return HAL_FAIL;
-      }
-      // Check that the zone exists
-      resultJ = json_object_array_find(zonesJ, "uid", streamSourceZone);
-      if (!resultJ)
-      {
-        AFB_ApiError(NULL, "STREAM: Zone '%s' is not defined!", streamSourceZone);
-        return HAL_FAIL;
-      }
-      // Check that the zone is a source
-      if (validateZoneIsSinkSource(resultJ, streamSourceZone, SOURCE) == HAL_FAIL)
-        return HAL_FAIL;
-    }
+      validateStreamZone(&ctx, streamSourceJ, SOURCE);
   }
 
+  if (ctx.errors)
+    return HAL_FAIL;
+
   AFB_ApiNotice(NULL, "STREAM: OK!");
   return HAL_OK;
 }
 
 /*
  * @brief Parse and validate all CTL definitions
+ *        Streams must already be indexed
  * @params ctlsJ    : A json_object containing an array of ctls
- *         streamsJ : A json_object containing an array of streams
- * @return HAL_OK if the ctls are valid, HAL_FAIL otherwise 
+ * @return HAL_OK if the ctls are valid, HAL_FAIL otherwise
  */
-HAL_ERRCODE validateCtls(json_object *ctlsJ, json_object *streamsJ)
+PUBLIC HAL_ERRCODE validateCtls(json_object *ctlsJ)
 {
+  halValidateCtxT ctx = { .section = "ctls", .index = -1 };
   int ctlsIdx = 0, ctlsLength = 0;
 
   // Check that ctlsJ is an array
-  ASSERT_JARRAY(ctlsJ, "CTL: Parent object must be an array!");
+  if (!checkType(&ctx, ctlsJ, json_type_array, "Parent object"))
+    return HAL_FAIL;
 
   // Loop through the ctls, and make sure all is well
   ctlsLength = json_object_array_length(ctlsJ);
@@ -323,62 +422,63 @@ HAL_ERRCODE validateCtls(json_object *ctlsJ, json_object *streamsJ)
                      "volume", &ctlVolumeJ, "volramp", &ctlVolrampJ,
                      "bass", &ctlBassJ, "mid", &ctlMidJ, "treble", &ctlTrebleJ,
                      "fade", &ctlFadeJ, "balance", &ctlBalanceJ);
+    ctx.index = ctlsIdx;
+    ctx.uid = ctlUid;
 
     // Check that all required fields exist
     if (!ctlStream || !ctlVolumeJ)
     {
-      AFB_ApiError(NULL, "CTL: Properties must include 'stream' and 'volume'!");
-      return HAL_FAIL; 
+      reportError(&ctx, "Properties must include 'stream' and 'volume'!");
+      continue;
     }
 
     // Check that the ctlStream points to a valid stream
-    if (strcmp(ctlStream, "Master") != 0) // Master does not need to be defined
-    {
-      if (!json_object_array_find(streamsJ, "role", ctlStream))
-      {
-        AFB_ApiError(NULL, "CTL: Stream '%s' is not defined!", ctlStream);
-        return HAL_FAIL;
-      }
-    }
+    if (strcmp(ctlStream, "Master") != 0 && // Master does not need to be defined
+        !halIndexGetStream(ctlStream))
+      reportError(&ctx, "Stream '%s' is not defined!", ctlStream);
+
+    // Check that the stream role is known, or can be registered
+    if (halCtlsRoleGet(ctlStream) == HAL_CTLS_ROLE_NONE &&
+        halCtlsRolesCount() >= HAL_CTLS_ROLES_MAX)
+      reportError(&ctx, "Stream '%s' cannot be registered, too many roles!", ctlStream);
 
     // Check that control 'value', 'minval', 'maxval' values are sane
-    if (validateCtl(ctlVolumeJ, "volume") != HAL_OK)
-      return HAL_FAIL;
+    validateCtl(&ctx, ctlVolumeJ, "volume");
     if (ctlVolrampJ)
-      if (validateCtl(ctlVolrampJ, "volramp") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlVolrampJ, "volramp");
     if (ctlBassJ)
-      if (validateCtl(ctlBassJ, "bass") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlBassJ, "bass");
     if (ctlMidJ)
-      if (validateCtl(ctlMidJ, "mid") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlMidJ, "mid");
     if (ctlTrebleJ)
-      if (validateCtl(ctlTrebleJ, "treble") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlTrebleJ, "treble");
     if (ctlFadeJ)
-      if (validateCtl(ctlFadeJ, "fade") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlFadeJ, "fade");
     if (ctlBalanceJ)
-      if (validateCtl(ctlBalanceJ, "balance") != HAL_OK)
-        return HAL_FAIL;
+      validateCtl(&ctx, ctlBalanceJ, "balance");
   }
 
+  if (ctx.errors)
+    return HAL_FAIL;
+
   AFB_ApiNotice(NULL, "CTL: OK!");
   return HAL_OK;
 }
 
 /*
  * @brief Parse and validate all CARD definitions
+ *        Cards must already be indexed
  * @params cardsJ : A json_object containing an array of cards
- * @return HAL_OK if cards are valid, HAL_FAIL otherwise 
+ * @return HAL_OK if cards are valid, HAL_FAIL otherwise
  */
-HAL_ERRCODE validateCards(json_object *cardsJ)
+PUBLIC HAL_ERRCODE validateCards(json_object *cardsJ)
 {
+  halValidateCtxT ctx = { .section = "cards", .index = -1 };
   int cardsIdx = 0, cardsLength = 0;
 
   // Check that cardsJ is an array
-  ASSERT_JARRAY(cardsJ, "CARD: Parent object must be an array!");
+  if (!checkType(&ctx, cardsJ, json_type_array, "Parent object"))
+    return HAL_FAIL;
 
   // Loop through the known cards, and make sure all is well
   cardsLength = json_object_array_length(cardsJ);
@@ -392,45 +492,55 @@ HAL_ERRCODE validateCards(json_object *cardsJ)
     wrap_json_unpack(cardCurrJ, "{s?s,s?s,s?o}",
                      "name", &cardName, "api", &cardApi,
                      "channels", &cardChannelsJ);
+    ctx.index = cardsIdx;
+    ctx.uid = cardName;
 
     // Check that all required fields exist
     if (!cardName || !cardApi || !cardChannelsJ)
     {
-      AFB_ApiError(NULL, "CARD: Properties must include 'name', 'api', and channels'!");
-      return HAL_FAIL; 
+      reportError(&ctx, "Properties must include 'name', 'api', and channels'!");
+      continue;
     }
 
+    // Check that the card is only declared once
+    if (halIndexGetCard(cardName) != cardCurrJ)
+      reportError(&ctx, "Card '%s' is already declared!", cardName);
+
     // Check the channels object
     wrap_json_unpack(cardChannelsJ, "{s?o,s?o}",
                      "sink", &cardSinksJ, "source", &cardSourcesJ);
     if (!cardSinksJ)
     {
-      AFB_ApiError(NULL, "CARD: Channels must contain 'sink' property!");
-      return HAL_FAIL; 
+      reportError(&ctx, "Channels must contain 'sink' property!");
+      continue;
     }
-    
+
     // Check the channels sink and source objects
-    if (validateCardSinkSource(cardSinksJ) != HAL_OK)
-      return HAL_FAIL;
+    validateCardSinkSource(&ctx, cardSinksJ, SINK);
     if (cardSourcesJ)
-      if (validateCardSinkSource(cardSourcesJ) != HAL_OK)
-        return HAL_FAIL;
+      validateCardSinkSource(&ctx, cardSourcesJ, SOURCE);
   }
 
+  if (ctx.errors)
+    return HAL_FAIL;
+
   AFB_ApiNotice(NULL, "CARD: OK!");
   return HAL_OK;
 }
 
 /*
  * @brief Parse and validate all ZONE definitions
+ *        Cards and zones must already be indexed
  */
-HAL_ERRCODE validateZones(json_object *zonesJ, json_object *cardsJ)
+PUBLIC HAL_ERRCODE validateZones(json_object *zonesJ)
 {
+  halValidateCtxT ctx = { .section = "zones", .index = -1 };
   int zonesIdx = 0, zonesLength = 0;
 
   // Check that zonesJ is an array
-  ASSERT_JARRAY(zonesJ, "ZONE: Parent object must be an array!");
-  
+  if (!checkType(&ctx, zonesJ, json_type_array, "Parent object"))
+    return HAL_FAIL;
+
   // Loop through the known zones, and make sure all is well
   zonesLength = json_object_array_length(zonesJ);
   for (zonesIdx = 0; zonesIdx < zonesLength; zonesIdx++)
@@ -442,14 +552,20 @@ HAL_ERRCODE validateZones(json_object *zonesJ, json_object *cardsJ)
     zoneCurrJ = json_object_array_get_idx(zonesJ, zonesIdx);
     wrap_json_unpack(zoneCurrJ, "{s?s,s?s,s?o}",
                      "uid", &zoneUid, "type", &zoneType, "mapping", &zoneMappingJ);
+    ctx.index = zonesIdx;
+    ctx.uid = zoneUid;
 
     // Check that all required fields exist
     if (!zoneUid || !zoneType || !zoneMappingJ)
     {
-      AFB_ApiError(NULL, "ZONE: Properties must include 'uid', 'type', and 'mapping'!");
-      return HAL_FAIL; 
+      reportError(&ctx, "Properties must include 'uid', 'type', and 'mapping'!");
+      continue;
     }
 
+    // Check that the zone is only declared once
+    if (halIndexGetZone(zoneUid) != zoneCurrJ)
+      reportError(&ctx, "Zone '%s' is already declared!", zoneUid);
+
     // Check that the zoneType is always "sink" or "source"
     if (strcmp(zoneType, "sink") == 0)
       sinkSourceType = SINK;
@@ -457,25 +573,28 @@ HAL_ERRCODE validateZones(json_object *zonesJ, json_object *cardsJ)
       sinkSourceType = SOURCE;
     else
     {
-      AFB_ApiError(NULL, "ZONE: Zone type '%s' is not allowed. Must be 'sink' or 'source'!", zoneType);
-      return HAL_FAIL;
+      reportError(&ctx, "Zone type '%s' is not allowed. Must be 'sink' or 'source'!", zoneType);
+      continue;
     }
 
     // Check that zoneMappingJ is an array
-    ASSERT_JARRAY(zoneMappingJ, "ZONE: Zone mapping object must be an array!");
+    if (!checkType(&ctx, zoneMappingJ, json_type_array, "Zone mapping object"))
+      continue;
 
     // Check that the mapping has at least one element
     if (json_object_array_length(zoneMappingJ) <= 0)
     {
-      AFB_ApiError(NULL, "ZONE: Zone map must have at least one element!");
-      return HAL_FAIL;
+      reportError(&ctx, "Zone map must have at least one element!");
+      continue;
     }
 
     // Check that each mapping entry corresponds to a card
-    if (validateZoneMapping(zoneMappingJ, cardsJ, sinkSourceType) == HAL_FAIL)
-      return HAL_FAIL;
+    validateZoneMapping(&ctx, zoneMappingJ, sinkSourceType);
   }
 
+  if (ctx.errors)
+    return HAL_FAIL;
+
   AFB_ApiNotice(NULL, "ZONE: OK!");
   return HAL_OK;
 }
@@ -28,8 +28,13 @@
  *  Global Function Declarations
  ****************************************************************************/
 PUBLIC HAL_ERRCODE validateCards(json_object *cardsJ);
-PUBLIC HAL_ERRCODE validateZones(json_object *zonesJ, json_object *cardsJ);
-PUBLIC HAL_ERRCODE validateStreams(json_object *streamsJ, json_object *zonesJ);
-PUBLIC HAL_ERRCODE validateCtls(json_object *ctlsJ, json_object *streamsJ);
+PUBLIC HAL_ERRCODE validateZones(json_object *zonesJ);
+PUBLIC HAL_ERRCODE validateStreams(json_object *streamsJ);
+PUBLIC HAL_ERRCODE validateCtls(json_object *ctlsJ);
+
+PUBLIC void validateReportReset(void);
+PUBLIC int validateReportCount(void);
+PUBLIC json_object *validateReportGet(void);
+PUBLIC void validateReportVerb(struct afb_req request);
 
 #endif // HAL_GENERIC_VALIDATE_H
\ No newline at end of file
@@ -19,6 +19,19 @@
 #define _GNU_SOURCE
 #include "hal-generic-utility.h"
 #include "hal-generic-validate.h"
+#include "hal-generic-index.h"
+#include "hal-generic-cache.h"
+#include "hal-generic-card.h"
+#include "hal-generic-startup.h"
+#include "hal-generic-events.h"
+#include "hal-generic-options.h"
+#include "hal-generic-coalesce.h"
+#include "hal-generic-batch.h"
+#include "hal-generic-duck.h"
+#include "hal-generic-reload.h"
+#include "hal-generic-stats.h"
+#include "hal-generic-trace.h"
+#include "hal-generic-static.h"
 #include "ctl-config.h"
 
 
@@ -31,18 +44,34 @@
 #define PCM_Master_Mid 1001
 #define PCM_Master_Treble 1002
 
+#define HAL_GENERIC_VERBS_MAX 64
+#define HAL_GENERIC_SERVICE_VERBS_MAX 16
+
 
 /*****************************************************************************
  * Local Function Declarations
  ****************************************************************************/
 STATIC int hal_generic_preinit();
 STATIC int hal_generic_init();
+STATIC int loadConfig(void);
+STATIC int startCards(void);
 STATIC void hal_generic_event_cb(const char *evtname, json_object *j_event);
+STATIC HAL_ERRCODE resolveCard(const halModelT *model, int cardIdx, halCardT *card);
+STATIC void releaseConfig(bool reloading);
+STATIC void serviceVerbCall(int verbIdx, struct afb_req request);
+STATIC HAL_ERRCODE appendHalServiceVerbs(void);
+STATIC HAL_ERRCODE registerEventHandlers(void);
+STATIC void alsacoreEventCB(void *closure, const char *evtname, json_object *j_event);
+STATIC void halServiceEventCB(void *closure, const char *evtname, json_object *j_event);
+STATIC void cardEventCB(void *closure, const char *evtname, json_object *j_event);
+STATIC void fddspEventCB(void *closure, const char *evtname, json_object *j_event);
+STATIC void unhandledEventCB(void *closure, const char *evtname, json_object *j_event);
 
 STATIC int CardConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *cardsJ);
 STATIC int StreamConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *streamsJ);
 STATIC int ZoneConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *zonesJ);
 STATIC int CtlConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *ctlsJ);
+STATIC int OptionsConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *optionsJ);
 
 
 /*****************************************************************************
@@ -52,15 +81,33 @@ static json_object *_cardsJ = NULL;     // Cards JSON section from conf file
 static json_object *_streamsJ = NULL;   // Streams JSON section from conf file
 static json_object *_zonesJ = NULL;     // Zones JSON section from conf file
 static json_object *_ctlsJ = NULL;      // Ctls JSON section from conf file
+static json_object *_optionsJ = NULL;   // Options JSON section from conf file
+static CtlConfigT *_ctrlConfig = NULL; // Loaded conf file, released after init
+static const char *_configApi = NULL;   // API name set by the conf file
+static const char *_configDir = NULL;   // Directory of the conf files
+
+// Binding verbs, the HAL service verbs are appended in preinit
+static struct afb_verb_v2 halGenericApi[HAL_GENERIC_VERBS_MAX] = {
+  { .verb = "ready", .callback = halStartupReadyVerb, .info = "Get HAL readiness, and subscribe to the 'ready' event" },
+  { .verb = "ctlbatch", .callback = halBatchVerb, .info = "Get and set several HAL ctls in one call" },
+  { .verb = "roleacquire", .callback = halDuckAcquireVerb, .info = "Acquire a role, ducking lower priority roles" },
+  { .verb = "rolerelease", .callback = halDuckReleaseVerb, .info = "Release a role, restoring the roles it ducked" },
+  { .verb = "validation", .callback = validateReportVerb, .info = "Get the validation report of the last config load" },
+  { .verb = "trace", .callback = halTraceVerb, .info = "Get the startup trace, in the Trace Event format" },
+  { .verb = "stats", .callback = halStatsVerb, .info = "Get (and reset) the latency stats of verbs, events and calls" },
+
+  { .verb = NULL }
+};
 
-static alsaHalSndCardT alsaHalSndCard;  // alsaHalSndCard for alsacore
+// HAL service verbs, called through their gate once the cards are ready
+static void (*_serviceCallbacks[HAL_GENERIC_SERVICE_VERBS_MAX])(struct afb_req request);
 
 /* API prefix should be unique for each snd card */
 const struct afb_binding_v2 afbBindingV2 = {
   .api = "4a-hal-generic",
   .preinit = hal_generic_preinit,
   .init = hal_generic_init,
-  .verbs = halServiceApi,
+  .verbs = halGenericApi,
   .onevent = hal_generic_event_cb,
 };
 
@@ -71,22 +118,54 @@ static CtlSectionT ctrlSections[]= {
     {.key="zones"  , .loadCB= ZoneConfig},
     {.key="streams", .loadCB= StreamConfig},
     {.key="ctls"   , .loadCB= CtlConfig},
+    {.key="options", .loadCB= OptionsConfig},
 
     {.key=NULL}
 };
 
 
+/*****************************************************************************
+ * HAL Service Verb Gates
+ ****************************************************************************/
+// One gate per HAL service verb slot, since v2 verbs have no closure
+#define HAL_SERVICE_GATE(a, b) \
+  STATIC void serviceGate##a##b(struct afb_req request) { serviceVerbCall(8 * a + b, request); }
+#define HAL_SERVICE_GATES(a) \
+  HAL_SERVICE_GATE(a, 0) HAL_SERVICE_GATE(a, 1) \
+  HAL_SERVICE_GATE(a, 2) HAL_SERVICE_GATE(a, 3) \
+  HAL_SERVICE_GATE(a, 4) HAL_SERVICE_GATE(a, 5) \
+  HAL_SERVICE_GATE(a, 6) HAL_SERVICE_GATE(a, 7)
+#define HAL_SERVICE_GATE_REFS(a) \
+  serviceGate##a##0, serviceGate##a##1, serviceGate##a##2, \
+  serviceGate##a##3, serviceGate##a##4, serviceGate##a##5, \
+  serviceGate##a##6, serviceGate##a##7
+
+HAL_SERVICE_GATES(0)
+HAL_SERVICE_GATES(1)
+
+static void (*const _serviceGates[HAL_GENERIC_SERVICE_VERBS_MAX])(struct afb_req request) = {
+  HAL_SERVICE_GATE_REFS(0), HAL_SERVICE_GATE_REFS(1)
+};
+
+
 /*****************************************************************************
  * Local Function Definitions (App Controller CB)
  ****************************************************************************/
 /*
  * @brief 'cards' section callback for app controller
+ *         Sections are indexed first, then validated against the indexes
  */
 STATIC int CardConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *cardsJ)
 {
   HAL_ERRCODE err = HAL_OK;
-  
+  halTraceSpanT span = halTraceBegin("config", "halIndexCards", HAL_TRACE_MAIN, NULL);
+
+  halIndexCards(cardsJ);
+  halTraceEnd(span);
+
+  span = halTraceBegin("config", "validateCards", HAL_TRACE_MAIN, NULL);
   err = validateCards(cardsJ); // Cards OK?
+  halTraceEnd(span);
   if (err == HAL_OK)
     _cardsJ = cardsJ;
 
@@ -99,14 +178,20 @@ STATIC int CardConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *car
  */
 STATIC int StreamConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *streamsJ)
 {
-  HAL_ERRCODE err = HAL_FAIL;
+  HAL_ERRCODE err = HAL_OK;
+  halTraceSpanT span = halTraceBegin("config", "halIndexStreams", HAL_TRACE_MAIN, NULL);
 
-  if (_zonesJ) // zones OK?
-  {
-    err = validateStreams(streamsJ, _zonesJ); // streams OK?
-    if (err == HAL_OK)
-      _streamsJ = streamsJ;
-  }
+  // Errors of the zones are already reported, streams are still checked
+  halIndexStreams(streamsJ);
+  halTraceEnd(span);
+
+  span = halTraceBegin("config", "validateStreams", HAL_TRACE_MAIN, NULL);
+  err = validateStreams(streamsJ); // streams OK?
+  halTraceEnd(span);
+  if (err == HAL_OK && _zonesJ)
+    err = halDuckLoad(streamsJ);
+  if (err == HAL_OK && _zonesJ)
+    _streamsJ = streamsJ;
 
   return (int)err;
 }
@@ -116,14 +201,17 @@ STATIC int StreamConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *s
  */
 STATIC int ZoneConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *zonesJ)
 {
-  HAL_ERRCODE err = HAL_FAIL;
+  HAL_ERRCODE err = HAL_OK;
+  halTraceSpanT span = halTraceBegin("config", "halIndexZones", HAL_TRACE_MAIN, NULL);
 
-  if (_cardsJ) // cards OK?
-  {
-    err = validateZones(zonesJ, _cardsJ);
-    if (err == HAL_OK)
-      _zonesJ = zonesJ;
-  }
+  halIndexZones(zonesJ);
+  halTraceEnd(span);
+
+  span = halTraceBegin("config", "validateZones", HAL_TRACE_MAIN, NULL);
+  err = validateZones(zonesJ); // zones OK?
+  halTraceEnd(span);
+  if (err == HAL_OK && _cardsJ)
+    _zonesJ = zonesJ;
 
   return (int)err;
 }
@@ -133,14 +221,27 @@ STATIC int ZoneConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *zon
  */
 STATIC int CtlConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *ctlsJ)
 {
-  HAL_ERRCODE err = HAL_FAIL;
+  HAL_ERRCODE err = HAL_OK;
+  halTraceSpanT span = halTraceBegin("config", "validateCtls", HAL_TRACE_MAIN, NULL);
 
-  if (_streamsJ) // streams OK?
-  {
-    err = validateCtls(ctlsJ, _streamsJ);
-    if (err == HAL_OK)
-      _ctlsJ = ctlsJ;
-  }
+  err = validateCtls(ctlsJ); // ctls OK?
+  halTraceEnd(span);
+  if (err == HAL_OK && _streamsJ)
+    _ctlsJ = ctlsJ;
+
+  return (int)err;
+}
+
+
+/*
+ * @brief 'options' section callback for app controller (optional section)
+ */
+STATIC int OptionsConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *optionsJ)
+{
+  HAL_ERRCODE err = halOptionsLoad(optionsJ);
+
+  if (err == HAL_OK)
+    _optionsJ = optionsJ;
 
   return (int)err;
 }
@@ -149,17 +250,131 @@ STATIC int CtlConfig(AFB_ApiT apiHandle, CtlSectionT *section, json_object *ctls
 /*****************************************************************************
  * Local Function Definitions
  ****************************************************************************/
+/*
+ * @brief Call a HAL service verb, which needs the HAL to be initialized:
+ *        until the HAL card is ready, the verb fails. The other cards hold
+ *        no HAL ctls, one of them failing does not take the verbs down.
+ */
+STATIC void serviceVerbCall(int verbIdx, struct afb_req request)
+{
+  if (!halStartupHalIsReady())
+  {
+    afb_req_fail(request, "not-ready", "HAL card is not ready, see the 'ready' verb");
+    return;
+  }
+
+  _serviceCallbacks[verbIdx](request);
+}
+
+/*
+ * @brief Append the HAL service verbs to the binding verbs, behind their
+ *        gate: the verbs are known at preinit, but the HAL is initialized
+ *        by halServiceInit once the cards are ready
+ */
+STATIC HAL_ERRCODE appendHalServiceVerbs(void)
+{
+  int verbsIdx = 0, serviceIdx = 0;
+
+  while (halGenericApi[verbsIdx].verb)
+    verbsIdx++;
+
+  for (serviceIdx = 0; halServiceApi[serviceIdx].verb; serviceIdx++, verbsIdx++)
+  {
+    if (verbsIdx >= HAL_GENERIC_VERBS_MAX - 1 || serviceIdx >= HAL_GENERIC_SERVICE_VERBS_MAX)
+    {
+      AFB_ApiError(NULL, "Too many verbs, increase HAL_GENERIC_VERBS_MAX "
+                   "or HAL_GENERIC_SERVICE_VERBS_MAX");
+      return HAL_FAIL;
+    }
+    halGenericApi[verbsIdx] = halServiceApi[serviceIdx];
+    _serviceCallbacks[serviceIdx] = halServiceApi[serviceIdx].callback;
+    halGenericApi[verbsIdx].callback = _serviceGates[serviceIdx];
+  }
+  halGenericApi[verbsIdx].verb = NULL;
+
+  return HAL_OK;
+}
+
 /*
  * @brief AFB 'preinit' callback function
  */
 STATIC int hal_generic_preinit()
 {
+  halTraceSpanT span = -1;
+  int err = 0;
+
+  halStartupMark(HAL_STARTUP_MARK_PREINIT);
+  halTraceLaneName(HAL_TRACE_MAIN, afbBindingV2.api);
+  span = halTraceBegin("binding", "preinit", HAL_TRACE_MAIN, NULL);
+
+  // Verbs are timed once the table is complete
+  if (appendHalServiceVerbs() != HAL_OK || halStatsWrapVerbs(halGenericApi) != HAL_OK ||
+      registerEventHandlers() != HAL_OK)
+    err = -1;
+  else
+    err = loadConfig();
+
+  halTraceEnd(span);
+  return err;
+}
+
+/*
+ * @brief Load the config, from the cache if it is up to date, or from the
+ *        config files. A fixed-config image has its config built in.
+ */
+STATIC int loadConfig(void)
+{
+  halTraceSpanT span = -1;
+
+#ifdef HAL_GENERIC_STATIC_CONFIG
+  span = halTraceBegin("config", "halStaticLoad", HAL_TRACE_MAIN, NULL);
+  int staticErr = (int)halStaticLoad();
+  halTraceEnd(span);
+  _configApi = halStaticGetApi();
+
+  return staticErr ? -1 : 0;
+#else
   //const char *dirList= getenv("CONTROL_CONFIG_PATH");
   //if (!dirList) dirList = CONTROL_CONFIG_PATH;
   char *dirList = GetBindingDirPath(NULL);
   strcat(dirList, "/etc");
+  _configDir = dirList;
+
+  // Warm start: the cache holds the validated config, if it is up to date
+  span = halTraceBegin("config", "halCacheLoad", HAL_TRACE_MAIN, NULL);
+  if (halCacheOpen(dirList) == HAL_OK && halCacheLoad() == HAL_OK)
+  {
+    halTraceEnd(span);
+
+    json_object *optionsJ = halCacheGetOptions();
+    json_object *duckingJ = halCacheGetDucking();
+    int err = (int)halOptionsLoad(optionsJ);
+
+    if (!err)
+      err = (int)halDuckLoad(duckingJ);
+    if (optionsJ)
+      json_object_put(optionsJ);
+    if (duckingJ)
+      json_object_put(duckingJ);
+    if (err)
+      goto OnErrorExit;
 
+    _configApi = halCacheGetApi();
+    if (_configApi && afb_daemon_rename_api(_configApi))
+    {
+      AFB_ApiError(apiHandle, "Fail to rename api to:%s", _configApi);
+      goto OnErrorExit;
+    }
+
+    AFB_ApiNotice(apiHandle, "Config loaded from cache, skipping validation");
+    return 0;
+  }
+
+  halTraceEnd(span);
+
+  span = halTraceBegin("config", "CtlConfigSearch", HAL_TRACE_MAIN, NULL);
   const char *configPath = CtlConfigSearch(NULL, dirList, "config");
+  halTraceEnd(span);
   if (!configPath)
   {
     AFB_ApiError(apiHandle, "CtlPreInit: No config-%s-* config found in %s ", GetBinderName(), dirList);
@@ -167,16 +382,25 @@ STATIC int hal_generic_preinit()
   }
 
   // load config file and create API
+  span = halTraceBegin("config", "CtlLoadMetaData", HAL_TRACE_MAIN, configPath);
   CtlConfigT *ctrlConfig = CtlLoadMetaData(NULL, configPath);
+  halTraceEnd(span);
   if (!ctrlConfig)
   {
     AFB_ApiError(apiHandle, "CtrlBindingDyn No valid control config file in:\n-- %s", configPath);
     goto OnErrorExit;
   }
   
+  // The config tree is released after init, the API name is kept
+  _ctrlConfig = ctrlConfig;
   if (ctrlConfig->api)
   {
+    _configApi = strdup(ctrlConfig->api);
+    if (!_configApi)
+      goto OnErrorExit;
+    span = halTraceBegin("config", "afb_daemon_rename_api", HAL_TRACE_MAIN, ctrlConfig->api);
     int err = afb_daemon_rename_api(ctrlConfig->api);
+    halTraceEnd(span);
     if (err)
     {
       AFB_ApiError(apiHandle, "Fail to rename api to:%s", ctrlConfig->api);
@@ -184,11 +408,96 @@ STATIC int hal_generic_preinit()
     }
   }
 
+  // All sections are validated, and all errors reported in one go
+  validateReportReset();
+  span = halTraceBegin("config", "CtlLoadSections", HAL_TRACE_MAIN, NULL);
   int err = CtlLoadSections(NULL, ctrlConfig, ctrlSections);
+  halTraceEnd(span);
+  if (validateReportCount())
+  {
+    json_object *reportJ = validateReportGet();
+
+    AFB_ApiError(apiHandle, "Config is not valid (%d errors): %s",
+                 validateReportCount(),
+                 json_object_to_json_string_ext(reportJ, JSON_C_TO_STRING_PRETTY));
+    json_object_put(reportJ);
+    err = -1;
+  }
+
   return err;
 
 OnErrorExit:
   return -1;
+#endif
+}
+
+/*
+ * @brief Resolve a card from the config model
+ * @param model   : The config model
+ * @param cardIdx : The card index in the model
+ * @param card    : The resolved card
+ * @return HAL_OK on success, HAL_FAIL otherwise
+ */
+STATIC HAL_ERRCODE resolveCard(const halModelT *model, int cardIdx, halCardT *card)
+{
+#ifdef HAL_GENERIC_STATIC_CONFIG
+  // The config is built in, with the halmap of every card pre-resolved
+  return halStaticGetCard(cardIdx, card, afbBindingV2.api);
+#else
+  const halModelCardT *modelCard = &model->cards[cardIdx];
+  size_t halmapSize = 0;
+  int ctlsCount = 0;
+  halTraceSpanT span = -1;
+
+  // Size the card arena with a counting pass over the ctls
+  span = halTraceBegin("card", "sizeAlsaHalMap", HAL_TRACE_MAIN, modelCard->name);
+  halmapSize = sizeAlsaHalMap(model, cardIdx, &ctlsCount);
+  halTraceEnd(span);
+
+  if (halCardInit(card, afbBindingV2.api, modelCard->name, modelCard->api,
+                  modelCard->info, halmapSize) != HAL_OK)
+    return HAL_FAIL;
+
+  // Generate the info to send to the HAL plugin, and the card halmap
+  span = halTraceBegin("card", "generateCardProperties", HAL_TRACE_MAIN, card->name);
+  card->cardpropsJ = generateCardProperties(modelCard);
+  halTraceEnd(span);
+
+  span = halTraceBegin("card", "generateStreamMap", HAL_TRACE_MAIN, card->name);
+  card->streammapJ = generateStreamMap(model, cardIdx);
+  halTraceEnd(span);
+
+  span = halTraceBegin("card", "generateAlsaHalMap", HAL_TRACE_MAIN, card->name);
+  card->halmap = generateAlsaHalMap(card->arena, model, cardIdx, ctlsCount);
+  halTraceEnd(span);
+  if (!card->cardpropsJ || !card->streammapJ || !card->halmap)
+    return HAL_FAIL;
+
+  return HAL_OK;
+#endif
+}
+
+/*
+ * @brief Release the json-c config, once the cards are resolved. A
+ *        running reload keeps its own references to the sections, and
+ *        the index over them.
+ */
+STATIC void releaseConfig(bool reloading)
+{
+  if (!reloading)
+    halIndexClear();
+
+  _cardsJ = NULL;
+  _zonesJ = NULL;
+  _streamsJ = NULL;
+  _ctlsJ = NULL;
+  _optionsJ = NULL;
+
+  if (_ctrlConfig && _ctrlConfig->configJ)
+  {
+    json_object_put(_ctrlConfig->configJ);
+    _ctrlConfig->configJ = NULL;
+  }
 }
 
 /*
@@ -196,112 +505,205 @@ OnErrorExit:
  */
 STATIC int hal_generic_init()
 {
+  halTraceSpanT span = -1;
   int err = 0;
-  int cardInfoIdx = 0, cardInfoLength = 0;
-  json_object *cardInfoArrayJ = NULL, *streammapJ = NULL, *cardpropsJ = NULL,
-              *cardInfoCurrJ = NULL;
 
-  AFB_NOTICE("Initializing 4a-hal-generic");
-  
+  halStartupMark(HAL_STARTUP_MARK_INIT);
+  span = halTraceBegin("binding", "init", HAL_TRACE_MAIN, NULL);
+  err = startCards();
+  halTraceEnd(span);
 
+  return err;
+}
 
-  // If the hal plugin is present, we need to configure our custom sound card to provide all the required interfaces.
-  // This will load the configuration json file, and set up the sound card  
-  if (!_cardsJ || !_streamsJ || !_ctlsJ || !_zonesJ)
-  {
-    AFB_ApiError(NULL, "Cannot initialize HAL plugin: JSON config is not valid!");
-    return err;
-  }
-  
-  cardInfoArrayJ = getCardInfo(_cardsJ);
-  cardInfoLength = json_object_array_length(cardInfoArrayJ);
+/*
+ * @brief Resolve the cards, then start their asynchronous bring-up
+ */
+STATIC int startCards(void)
+{
+  int err = 0;
+  int cardIdx = 0, cardsCount = 0;
+  halModelT *model = NULL;
+  bool fromCache = halCacheIsLoaded(), reloading = false;
+  halTraceSpanT span = -1;
 
-  // Can only support one card at present, due to hal-interface only allowing
-  // one halSndCard instance in it's current implementation.
-  cardInfoLength = 1; // TODO: revise
+  AFB_NOTICE("Initializing 4a-hal-generic");
 
-  for (cardInfoIdx = 0; cardInfoIdx < cardInfoLength; cardInfoIdx++)
-  {
-    char *cardName = NULL, *cardApi = NULL, *cardInfo = NULL;
-    json_object *cardCurrJ = NULL;
+  // alsacore control change events are coalesced before reaching the HAL
+  if (halCoalesceInit(halOptionsGet()->coalesceMs, halServiceEventCB, NULL) != HAL_OK)
+    return (int)HAL_FAIL;
 
-    // Get the card info for this iteration
-    cardInfoCurrJ = json_object_array_get_idx(cardInfoArrayJ, cardInfoIdx);
-    wrap_json_unpack(cardInfoCurrJ, "{s:s,s:s,s?s}",
-                     "name", &cardName, "api", &cardApi, "info", &cardInfo);
+  if (halStatsSetPeriod(halOptionsGet()->statsMs) != HAL_OK)
+    AFB_ApiWarning(NULL, "Cannot start the '%s' event", HAL_STATS_EVENT);
 
-    // Check that HAL plugin AFB API is present.
-    if (afb_daemon_require_api(cardApi, 1))
+  // Resolve the cards, from the cache if it was loaded, or from the
+  // model of the validated JSON config otherwise
+  if (fromCache)
+  {
+    cardsCount = halCacheGetCardCount();
+  }
+#ifdef HAL_GENERIC_STATIC_CONFIG
+  else
+  {
+    cardsCount = halStaticGetCardCount();
+  }
+#else
+  else
+  {
+    if (!_cardsJ || !_streamsJ || !_ctlsJ || !_zonesJ)
     {
-        AFB_ApiError(NULL, "AFB API '%s' is not availble!", cardApi);
-        return (int)HAL_FAIL;
+      AFB_ApiError(NULL, "Cannot initialize HAL plugin: JSON config is not valid!");
+      return err;
     }
 
-    // Fetch the card object from _cardsJ for a given card name
-    cardCurrJ = json_object_array_find(_cardsJ, "name", cardName);
-    if (!cardCurrJ)
-    {
-      AFB_ApiError(NULL, "CARD: Does not exist: '%s'", cardName);
+    span = halTraceBegin("config", "halModelNew", HAL_TRACE_MAIN, NULL);
+    model = halModelNew(_cardsJ, _zonesJ, _streamsJ, _ctlsJ);
+    halTraceEnd(span);
+    if (!model)
       return (int)HAL_FAIL;
-    }
+    cardsCount = model->cardsCount;
+  }
+#endif
 
-    // Generate the info to send to the HAL plugin
-    cardpropsJ = generateCardProperties(cardCurrJ, cardName);
-    streammapJ = generateStreamMap(_streamsJ, _zonesJ, cardName);
+  if (halCardsAlloc(cardsCount) != HAL_OK)
+  {
+    halModelFree(model);
+    return (int)HAL_FAIL;
+  }
 
-    // Attempt to initialize the HAL plugin by it's AFB API
-    AFB_ApiNotice(NULL, "Initialize HAL plugin (name: '%s', api: '%s')",
-                  cardName, cardApi);
-    err = initHalPlugin(cardApi, cardpropsJ, streammapJ);
+  for (cardIdx = 0; !err && cardIdx < cardsCount; cardIdx++)
+  {
+    halCardT *card = halCardGet(cardIdx);
+
+    span = halTraceBegin("card", fromCache ? "halCacheGetCard" : "resolveCard",
+                         HAL_TRACE_MAIN, NULL);
+    if (fromCache)
+      err = halCacheGetCard(cardIdx, card, afbBindingV2.api);
+    else
+      err = resolveCard(model, cardIdx, card);
+    halTraceEnd(span);
+    if (!err)
+      err = halEventsRegister(card->api, cardEventCB, card);
     if (err)
-    {
-      AFB_ApiError(NULL, "Initialize HAL plugin failed! (name: '%s', api: '%s')",
-                   cardName, cardApi);
-      return err;
-    }
+      halCardRelease(card);
+  }
 
-    // HAL sound card mapping info
-    alsaHalSndCard.name = cardName; //  WARNING: name MUST match with 'aplay -l'
-    alsaHalSndCard.info = cardInfo;
-    alsaHalSndCard.ctls = generateAlsaHalMap(_ctlsJ); // Generate halmap controls
-    alsaHalSndCard.volumeCB = NULL; // Use default volume normalization function
+  // The cards own everything they were resolved into
+  halModelFree(model);
+  if (err)
+    return err;
 
-    // Register the HAL with the loaded sound card halmap
-    err = halServiceInit(afbBindingV2.api, &alsaHalSndCard);
-    if (err)
-    {
-      AFB_ApiError(NULL, "Cannot initialize ALSA soundcard: %s", cardName);
-      return err;
-    }
+  // Config is fully resolved, keep it for the next start. A static config
+  // has no cache.
+#ifndef HAL_GENERIC_STATIC_CONFIG
+  if (!fromCache)
+  {
+    json_object *optionsJ = halOptionsGetJ(), *duckingJ = halDuckGetJ();
+
+    span = halTraceBegin("config", "halCacheStore", HAL_TRACE_MAIN, NULL);
+    halCacheStore(_configApi, optionsJ, duckingJ);
+    halTraceEnd(span);
+    json_object_put(optionsJ);
+    json_object_put(duckingJ);
+  }
+#endif
+
+  // If the hal plugin is present, we need to configure our custom sound card to provide all the required interfaces.
+  // Each card has its own plugin; hal-utilities holds the ctls of the first.
+  // The cards come up asynchronously, the 'ready' event signals completion
+  span = halTraceBegin("card", "halStartupRun", HAL_TRACE_MAIN, NULL);
+  err = halStartupRun();
+  halTraceEnd(span);
+
+  // Config changes are applied to the running cards, no section is known
+  // when the config was loaded from the cache
+  if (!err && halOptionsGet()->reload)
+  {
+    halReloadSectionsT sections = {
+      .cardsJ = fromCache ? NULL : _cardsJ,
+      .zonesJ = fromCache ? NULL : _zonesJ,
+      .streamsJ = fromCache ? NULL : _streamsJ,
+      .ctlsJ = fromCache ? NULL : _ctlsJ,
+      .optionsJ = fromCache ? NULL : _optionsJ
+    };
+
+    reloading = (halReloadStart(_configDir, _configApi, &sections) == HAL_OK);
+    if (!reloading)
+      AFB_ApiWarning(NULL, "Config reload is not available");
   }
 
-  AFB_NOTICE(".. Initializing Complete!");
+  span = halTraceBegin("config", "releaseConfig", HAL_TRACE_MAIN, NULL);
+  releaseConfig(reloading);
+  halTraceEnd(span);
+
+  AFB_NOTICE(".. Initializing started (cards: %d)", cardsCount);
   return err;
 }
 
-// This receive all event this binding subscribe to
-STATIC void hal_generic_event_cb(const char *evtname, json_object *j_event)
+/*
+ * @brief 'alsacore' events handler, coalesced then forwarded to the HAL
+ */
+STATIC void alsacoreEventCB(void *closure, const char *evtname, json_object *j_event)
 {
-  AFB_NOTICE("hal_generic_event_cb: Event Received (%s)", evtname);
-  if (strncmp(evtname, "alsacore/", 9) == 0)
-  {
-    halServiceEvent(evtname, j_event);
-    return;
-  }
+  halCoalescePush(evtname, j_event);
+}
 
-  if (strncmp(evtname, "fd-dsp-hifi2/", 13) == 0)
-  {
-    AFB_NOTICE("hal_generic_event_cb: evtname=%s, event=%s", evtname, json_object_get_string(j_event));
+/*
+ * @brief Deliver an event to the HAL
+ */
+STATIC void halServiceEventCB(void *closure, const char *evtname, json_object *j_event)
+{
+  halServiceEvent(evtname, j_event);
+}
 
-    return;
-  }
+/*
+ * @brief Card HAL plugin events handler, events only concern that card
+ */
+STATIC void cardEventCB(void *closure, const char *evtname, json_object *j_event)
+{
+  halCardT *card = (halCardT *)closure;
 
-  if (strncmp(evtname, "hal-fddsp/", 6) == 0)
-  {
-    AFB_NOTICE("hal_generic_event_cb: evtname=%s, event=%s", evtname, json_object_get_string(j_event));
+  AFB_NOTICE("hal_generic_event_cb: card=%s, evtname=%s, event=%s",
+             card->name, evtname, json_object_get_string(j_event));
+}
 
-    return;
-  }
+/*
+ * @brief 'hal-fddsp' events handler
+ */
+STATIC void fddspEventCB(void *closure, const char *evtname, json_object *j_event)
+{
+  AFB_NOTICE("hal_generic_event_cb: evtname=%s, event=%s", evtname, json_object_get_string(j_event));
+}
 
+/*
+ * @brief Handler of events with no registered API
+ */
+STATIC void unhandledEventCB(void *closure, const char *evtname, json_object *j_event)
+{
   AFB_NOTICE("hal_generic_event_cb: UNHANDLED EVENT, evtname=%s, event=%s", evtname, json_object_get_string(j_event));
 }
+
+/*
+ * @brief Register the handlers of the events this binding subscribes to
+ */
+STATIC HAL_ERRCODE registerEventHandlers(void)
+{
+  halEventsSetDefault(unhandledEventCB, NULL);
+
+  if (halEventsRegister("alsacore", alsacoreEventCB, NULL) != HAL_OK ||
+      halEventsRegister("hal-fddsp", fddspEventCB, NULL) != HAL_OK)
+    return HAL_FAIL;
+
+  return HAL_OK;
+}
+
+// This receive all event this binding subscribe to
+STATIC void hal_generic_event_cb(const char *evtname, json_object *j_event)
+{
+  uint64_t startNs = halStatsNow();
+
+  AFB_DEBUG("hal_generic_event_cb: Event Received (%s)", evtname);
+
+  halEventsDispatch(evtname, j_event);
+  halStatsEvent(evtname, startNs);
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ALSA zone mixer plugin, for cards without a DSP.
+ *
+ * An external filter plugin (extplug) which routes a stream to the ports
+ * of its card as the DSP of a HAL plugin would: the mapping of the stream
+ * is read from the payload the HAL sends to its plugin (see the 'shm'
+ * option), through the link the HAL keeps at <runtime dir>/4a-hal/<card>.shm.
+ * Playback streams are mixed from the stream channels into the card ports
+ * with the 'sink' matrix, capture streams from the card ports into the
+ * stream channels with the 'source' matrix.
+ *
+ *   pcm.multimedia {
+ *     type halmix
+ *     slave.pcm "hw:0"                      # Opened with all the card ports
+ *     card "HalMock0"                       # HAL card, for the default shm
+ *     role "Multimedia"                     # Stream of the streammap
+ *     shm "/run/user/1000/4a-hal/HalMock0.shm"  # Optional
+ *   }
+ *
+ * The routing is read when the PCM is opened: a reloaded config applies
+ * from the next open. Samples are S16, S32 or FLOAT, interleaved or not;
+ * the slave gets the same format.
+ */
+
+#include "hal-generic-mix.h"
+#include "hal-generic-shm-reader.h"
+
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MIX_PATH_SZ 256
+
+typedef struct {
+  snd_pcm_extplug_t ext;
+  halMixT mix;
+  halMixFormatT format;
+  unsigned bits;                      // Per sample
+  void *inChunk;                      // Interleaved frames, for other layouts
+  void *outChunk;
+  snd_pcm_channel_area_t inAreas[HAL_MIX_CHANNELS_MAX];
+  snd_pcm_channel_area_t outAreas[HAL_MIX_CHANNELS_MAX];
+} halMixPluginT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static const unsigned int _formats[] = {
+  SND_PCM_FORMAT_S16,
+  SND_PCM_FORMAT_S32,
+  SND_PCM_FORMAT_FLOAT
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+static int shmPath(const char *card, char *path, size_t size);
+static int loadRouting(halMixPluginT *plugin, const char *path, const char *role,
+                       int direction, unsigned *channels, unsigned *ports);
+static void *areasInterleaved(const snd_pcm_channel_area_t *areas,
+                              unsigned channels, unsigned bits,
+                              snd_pcm_uframes_t offset);
+static bool areasPlanar(const snd_pcm_channel_area_t *areas, unsigned channels,
+                        unsigned bits, snd_pcm_uframes_t offset, void **planes);
+static snd_pcm_sframes_t mixTransfer(snd_pcm_extplug_t *ext,
+                                     const snd_pcm_channel_area_t *dstAreas,
+                                     snd_pcm_uframes_t dstOffset,
+                                     const snd_pcm_channel_area_t *srcAreas,
+                                     snd_pcm_uframes_t srcOffset,
+                                     snd_pcm_uframes_t size);
+static int mixInit(snd_pcm_extplug_t *ext);
+static int mixHwFree(snd_pcm_extplug_t *ext);
+static int mixClose(snd_pcm_extplug_t *ext);
+static void mixFree(halMixPluginT *plugin);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Get the path of the link the HAL keeps to the payload of a card
+ * @return 0 on success, -ENAMETOOLONG
+ */
+static int shmPath(const char *card, char *path, size_t size)
+{
+  const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+
+  if (!runtimeDir || !*runtimeDir)
+    runtimeDir = HAL_SHM_LINK_RUNTIME;
+
+  if (snprintf(path, size, "%s/%s/%s%s", runtimeDir, HAL_SHM_LINK_DIR,
+               card, HAL_SHM_LINK_SUFFIX) >= (int)size)
+    return -ENAMETOOLONG;
+
+  return 0;
+}
+
+/*
+ * @brief Set up the mixer with the routing of a stream. Without a matrix,
+ *        each stream channel is routed at unity gain to the ports of the
+ *        card channel types of its 'mapping' row.
+ * @param direction : HAL_SHM_SINK (playback) or HAL_SHM_SOURCE (capture)
+ * @param channels  : Set to the stream channels
+ * @param ports     : Set to the card ports
+ * @return 0 on success, a negative error code otherwise
+ */
+static int loadRouting(halMixPluginT *plugin, const char *path, const char *role,
+                       int direction, unsigned *channels, unsigned *ports)
+{
+  halShmViewT view;
+  const halShmStreamT *streams = NULL;
+  const halShmEndpointT *endpoint = NULL;
+  const float *matrix = NULL;
+  float *gains = NULL;
+  uint32_t streamsCount = 0, idx = 0;
+  unsigned row = 0, col = 0;
+  int err = 0;
+
+  err = halShmMap(path, &view);
+  if (err < 0)
+  {
+    SNDERR("halmix: cannot map %s: %s", path, snd_strerror(err));
+    return err;
+  }
+
+  streams = halShmStreams(&view, &streamsCount);
+  for (idx = 0; idx < streamsCount && !endpoint; idx++)
+  {
+    const char *streamRole = halShmString(&view, streams[idx].role);
+
+    if (streamRole && !strcmp(streamRole, role))
+      endpoint = &streams[idx].endpoints[direction];
+  }
+
+  if (!endpoint || !endpoint->channels || endpoint->channels > HAL_MIX_CHANNELS_MAX)
+  {
+    SNDERR("halmix: no %s stream '%s' in %s",
+           direction == HAL_SHM_SINK ? "sink" : "source", role, path);
+    err = -ENOENT;
+    goto OnErrorExit;
+  }
+
+  *channels = endpoint->channels;
+  *ports = endpoint->cols;
+  matrix = halShmMatrix(&view, endpoint);
+
+  // Without a matrix, the ports are those of the card channels
+  if (!matrix)
+  {
+    const halShmChannelT *cardChannels = NULL;
+    uint32_t cardCount = 0;
+
+    cardChannels = halShmChannels(&view, direction, &cardCount);
+    for (idx = 0; idx < cardCount; idx++)
+      if (cardChannels[idx].port >= 0 && (unsigned)cardChannels[idx].port >= *ports)
+        *ports = (unsigned)cardChannels[idx].port + 1;
+  }
+
+  if (!*ports || *ports > HAL_MIX_CHANNELS_MAX)
+  {
+    SNDERR("halmix: cannot route stream '%s' to %u ports", role, *ports);
+    err = -EINVAL;
+    goto OnErrorExit;
+  }
+
+  // Stream channels x card ports, row major
+  gains = calloc((size_t)*channels * *ports, sizeof(float));
+  if (!gains)
+  {
+    err = -ENOMEM;
+    goto OnErrorExit;
+  }
+
+  if (matrix)
+    memcpy(gains, matrix, sizeof(float) * *channels * *ports);
+  else
+  {
+    const halShmRowT *rows = halShmRows(&view, endpoint);
+    const halShmChannelT *cardChannels = NULL;
+    uint32_t cardCount = 0;
+
+    cardChannels = halShmChannels(&view, direction, &cardCount);
+    for (row = 0; row < *channels; row++)
+    {
+      const uint32_t *cells = halShmCells(&view, &rows[row]);
+      uint32_t cell = 0;
+
+      for (cell = 0; cell < rows[row].cellsCount; cell++)
+      {
+        const char *cellType = halShmString(&view, cells[cell]);
+
+        for (idx = 0; idx < cardCount && cellType; idx++)
+        {
+          const char *type = halShmString(&view, cardChannels[idx].type);
+
+          if (cardChannels[idx].port >= 0 && type && !strcmp(type, cellType))
+            gains[row * *ports + cardChannels[idx].port] = 1.0f;
+        }
+      }
+    }
+  }
+
+  // Capture mixes the card ports into the stream channels
+  if (direction == HAL_SHM_SOURCE)
+  {
+    float *transposed = calloc((size_t)*channels * *ports, sizeof(float));
+
+    if (!transposed)
+    {
+      err = -ENOMEM;
+      goto OnErrorExit;
+    }
+
+    for (row = 0; row < *channels; row++)
+      for (col = 0; col < *ports; col++)
+        transposed[col * *channels + row] = gains[row * *ports + col];
+
+    free(gains);
+    gains = transposed;
+    err = halMixInit(&plugin->mix, *ports, *channels, gains);
+  }
+  else
+    err = halMixInit(&plugin->mix, *channels, *ports, gains);
+
+OnErrorExit:
+  free(gains);
+  halShmUnmap(&view);
+  return err;
+}
+
+/*
+ * @brief Get the first frame of interleaved areas
+ * @return The frame, or NULL if the areas are not interleaved
+ */
+static void *areasInterleaved(const snd_pcm_channel_area_t *areas,
+                              unsigned channels, unsigned bits,
+                              snd_pcm_uframes_t offset)
+{
+  unsigned channel = 0;
+
+  if (areas[0].first % 8)
+    return NULL;
+
+  for (channel = 0; channel < channels; channel++)
+    if (areas[channel].addr != areas[0].addr ||
+        areas[channel].first != areas[0].first + channel * bits ||
+        areas[channel].step != channels * bits)
+      return NULL;
+
+  return (uint8_t *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+}
+
+/*
+ * @brief Get the first sample of each plane of planar areas
+ * @return true on success, false if the areas are not planar
+ */
+static bool areasPlanar(const snd_pcm_channel_area_t *areas, unsigned channels,
+                        unsigned bits, snd_pcm_uframes_t offset, void **planes)
+{
+  unsigned channel = 0;
+
+  for (channel = 0; channel < channels; channel++)
+  {
+    if (areas[channel].step != bits || areas[channel].first % 8)
+      return false;
+
+    planes[channel] = (uint8_t *)areas[channel].addr +
+                      (areas[channel].first + offset * bits) / 8;
+  }
+
+  return true;
+}
+
+/*
+ * @brief extplug 'transfer' callback: mix the frames, with the kernels of
+ *        the layout of the areas, or through interleaved chunks
+ */
+static snd_pcm_sframes_t mixTransfer(snd_pcm_extplug_t *ext,
+                                     const snd_pcm_channel_area_t *dstAreas,
+                                     snd_pcm_uframes_t dstOffset,
+                                     const snd_pcm_channel_area_t *srcAreas,
+                                     snd_pcm_uframes_t srcOffset,
+                                     snd_pcm_uframes_t size)
+{
+  halMixPluginT *plugin = ext->private_data;
+  halMixT *mix = &plugin->mix;
+  void *src = NULL, *dst = NULL;
+  void *srcPlanes[HAL_MIX_CHANNELS_MAX], *dstPlanes[HAL_MIX_CHANNELS_MAX];
+  snd_pcm_uframes_t done = 0;
+
+  src = areasInterleaved(srcAreas, mix->ins, plugin->bits, srcOffset);
+  dst = areasInterleaved(dstAreas, mix->outs, plugin->bits, dstOffset);
+  if (src && dst)
+  {
+    halMixInterleaved(mix, plugin->format, src, dst, (unsigned)size);
+    return (snd_pcm_sframes_t)size;
+  }
+
+  if (areasPlanar(srcAreas, mix->ins, plugin->bits, srcOffset, srcPlanes) &&
+      areasPlanar(dstAreas, mix->outs, plugin->bits, dstOffset, dstPlanes))
+  {
+    halMixPlanar(mix, plugin->format, (const void *const *)srcPlanes,
+                 dstPlanes, (unsigned)size);
+    return (snd_pcm_sframes_t)size;
+  }
+
+  while (done < size)
+  {
+    snd_pcm_uframes_t frames = size - done;
+
+    if (frames > HAL_MIX_FRAMES_MAX)
+      frames = HAL_MIX_FRAMES_MAX;
+
+    snd_pcm_areas_copy(plugin->inAreas, 0, srcAreas, srcOffset + done,
+                       mix->ins, frames, ext->format);
+    halMixInterleaved(mix, plugin->format, plugin->inChunk, plugin->outChunk,
+                      (unsigned)frames);
+    snd_pcm_areas_copy(dstAreas, dstOffset + done, plugin->outAreas, 0,
+                       mix->outs, frames, ext->format);
+    done += frames;
+  }
+
+  return (snd_pcm_sframes_t)size;
+}
+
+/*
+ * @brief extplug 'init' callback, once the hw params are set
+ */
+static int mixInit(snd_pcm_extplug_t *ext)
+{
+  halMixPluginT *plugin = ext->private_data;
+  halMixT *mix = &plugin->mix;
+  unsigned channel = 0, bytes = 0;
+
+  if (ext->slave_format != ext->format)
+  {
+    SNDERR("halmix: slave format %d differs from the client one %d",
+           (int)ext->slave_format, (int)ext->format);
+    return -EINVAL;
+  }
+
+  switch (ext->format)
+  {
+    case SND_PCM_FORMAT_S16:
+      plugin->format = HAL_MIX_S16;
+      break;
+    case SND_PCM_FORMAT_S32:
+      plugin->format = HAL_MIX_S32;
+      break;
+    case SND_PCM_FORMAT_FLOAT:
+      plugin->format = HAL_MIX_FLOAT;
+      break;
+    default:
+      SNDERR("halmix: unsupported format %d", (int)ext->format);
+      return -EINVAL;
+  }
+
+  bytes = halMixSampleBytes(plugin->format);
+  plugin->bits = bytes * 8;
+
+  free(plugin->inChunk);
+  free(plugin->outChunk);
+  plugin->inChunk = malloc((size_t)HAL_MIX_FRAMES_MAX * mix->ins * bytes);
+  plugin->outChunk = malloc((size_t)HAL_MIX_FRAMES_MAX * mix->outs * bytes);
+  if (!plugin->inChunk || !plugin->outChunk)
+    return -ENOMEM;
+
+  for (channel = 0; channel < mix->ins; channel++)
+  {
+    plugin->inAreas[channel].addr = plugin->inChunk;
+    plugin->inAreas[channel].first = channel * plugin->bits;
+    plugin->inAreas[channel].step = mix->ins * plugin->bits;
+  }
+
+  for (channel = 0; channel < mix->outs; channel++)
+  {
+    plugin->outAreas[channel].addr = plugin->outChunk;
+    plugin->outAreas[channel].first = channel * plugin->bits;
+    plugin->outAreas[channel].step = mix->outs * plugin->bits;
+  }
+
+  return 0;
+}
+
+/*
+ * @brief extplug 'hw_free' callback
+ */
+static int mixHwFree(snd_pcm_extplug_t *ext)
+{
+  halMixPluginT *plugin = ext->private_data;
+
+  free(plugin->inChunk);
+  free(plugin->outChunk);
+  plugin->inChunk = NULL;
+  plugin->outChunk = NULL;
+  return 0;
+}
+
+/*
+ * @brief extplug 'close' callback
+ */
+static int mixClose(snd_pcm_extplug_t *ext)
+{
+  mixFree(ext->private_data);
+  return 0;
+}
+
+static void mixFree(halMixPluginT *plugin)
+{
+  halMixRelease(&plugin->mix);
+  free(plugin->inChunk);
+  free(plugin->outChunk);
+  free(plugin);
+}
+
+static const snd_pcm_extplug_callback_t _mixCallbacks = {
+  .transfer = mixTransfer,
+  .init = mixInit,
+  .hw_free = mixHwFree,
+  .close = mixClose,
+};
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Open a 'halmix' PCM
+ */
+SND_PCM_PLUGIN_DEFINE_FUNC(halmix)
+{
+  snd_config_iterator_t i, next;
+  snd_config_t *slaveConf = NULL;
+  halMixPluginT *plugin = NULL;
+  const char *card = NULL, *role = NULL, *shm = NULL;
+  char path[HAL_MIX_PATH_SZ];
+  unsigned channels = 0, ports = 0;
+  int err = 0;
+
+  snd_config_for_each(i, next, conf)
+  {
+    snd_config_t *n = snd_config_iterator_entry(i);
+    const char *id = NULL;
+
+    if (snd_config_get_id(n, &id) < 0)
+      continue;
+    if (!strcmp(id, "comment") || !strcmp(id, "type") || !strcmp(id, "hint"))
+      continue;
+
+    if (!strcmp(id, "slave"))
+      slaveConf = n;
+    else if (!strcmp(id, "card"))
+      err = snd_config_get_string(n, &card);
+    else if (!strcmp(id, "role"))
+      err = snd_config_get_string(n, &role);
+    else if (!strcmp(id, "shm"))
+      err = snd_config_get_string(n, &shm);
+    else
+    {
+      SNDERR("halmix: unknown field %s", id);
+      return -EINVAL;
+    }
+
+    if (err < 0)
+    {
+      SNDERR("halmix: invalid value for %s", id);
+      return -EINVAL;
+    }
+  }
+
+  if (!slaveConf || !role || (!card && !shm))
+  {
+    SNDERR("halmix: slave, role, and card or shm are required");
+    return -EINVAL;
+  }
+
+  if (!shm)
+  {
+    err = shmPath(card, path, sizeof(path));
+    if (err < 0)
+      return err;
+    shm = path;
+  }
+
+  plugin = calloc(1, sizeof(halMixPluginT));
+  if (!plugin)
+    return -ENOMEM;
+
+  err = loadRouting(plugin, shm, role,
+                    stream == SND_PCM_STREAM_PLAYBACK ? HAL_SHM_SINK : HAL_SHM_SOURCE,
+                    &channels, &ports);
+  if (err < 0)
+    goto OnErrorExit;
+
+  plugin->ext.version = SND_PCM_EXTPLUG_VERSION;
+  plugin->ext.name = "HAL zone mixer";
+  plugin->ext.callback = &_mixCallbacks;
+  plugin->ext.private_data = plugin;
+
+  err = snd_pcm_extplug_create(&plugin->ext, name, root, slaveConf, stream, mode);
+  if (err < 0)
+    goto OnErrorExit;
+
+  // The client has the stream channels, the slave the card ports. The
+  // samples are mixed in place of the slave ones, so the format is kept
+  // linked: setting a client param alone would unlink it from the slave.
+  snd_pcm_extplug_set_param_list(&plugin->ext, SND_PCM_EXTPLUG_HW_FORMAT,
+                                 sizeof(_formats) / sizeof(_formats[0]), _formats);
+  snd_pcm_extplug_set_param_link(&plugin->ext, SND_PCM_EXTPLUG_HW_FORMAT, 1);
+  snd_pcm_extplug_set_param(&plugin->ext, SND_PCM_EXTPLUG_HW_CHANNELS, channels);
+  snd_pcm_extplug_set_slave_param(&plugin->ext, SND_PCM_EXTPLUG_HW_CHANNELS, ports);
+
+  *pcmp = plugin->ext.pcm;
+  return 0;
+
+OnErrorExit:
+  mixFree(plugin);
+  return err;
+}
+
+SND_PCM_PLUGIN_SYMBOL(halmix);
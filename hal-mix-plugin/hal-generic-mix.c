@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Zone mixer engine, for cards without a DSP.
+ *
+ * Realizes the routing of a streammap endpoint in software: the stream
+ * channels are mixed into the card ports (or the other way round) through
+ * the gain matrix of the endpoint, so that one channel may feed several
+ * ports, and one port several channels, as with the 'FiveOne' mappings.
+ *
+ * Interleaved frames: each SIMD lane computes one output, and every input
+ * of the frame is broadcast and accumulated against its row of gains. The
+ * matrix rows are padded with zeros to a whole number of vectors, and the
+ * padding outputs are stored over the start of the next frame, which
+ * overwrites them next. The last frame spills into the slack at the end of
+ * the output block. Planar buffers: each SIMD lane computes one frame, and
+ * every non-zero gain accumulates an input plane into an output plane, a
+ * block padded to a whole number of vectors at a time.
+ *
+ * The mix kernels are picked once, at runtime: AVX2 with FMA (8 lanes) or
+ * SSE (4 lanes) on x86, NEON (4 lanes) on ARM, and scalar otherwise. The
+ * sample conversions are memory bound, and use SSE2 when it is the
+ * baseline, the scalar loops otherwise. Integer samples are converted back
+ * with rounding to nearest and saturation.
+ */
+
+#include "hal-generic-mix.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAL_MIX_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAL_MIX_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MIX_ALIGN 32
+#define HAL_MIX_S16_SCALE 32768.0f
+#define HAL_MIX_S32_SCALE 2147483648.0f
+#define HAL_MIX_S32_MAX 2147483520.0f // Largest float below 2^31
+
+typedef void (*halMixFramesT)(const halMixT *mix, const float *in, float *out,
+                              unsigned count);
+typedef void (*halMixPlanesT)(const halMixT *mix, unsigned count);
+typedef void (*halMixToFloatT)(const void *src, float *dst, unsigned count);
+typedef void (*halMixFromFloatT)(const float *src, void *dst, unsigned count);
+
+typedef struct {
+  const char *name;
+  halMixFramesT frames;
+  halMixPlanesT planes;
+} halMixKernelsT;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+static void framesScalar(const halMixT *mix, const float *in, float *out,
+                         unsigned count);
+static void planesScalar(const halMixT *mix, unsigned count);
+#ifdef HAL_MIX_X86
+static void framesSse(const halMixT *mix, const float *in, float *out,
+                      unsigned count);
+static void planesSse(const halMixT *mix, unsigned count);
+static void framesAvx2(const halMixT *mix, const float *in, float *out,
+                       unsigned count);
+static void planesAvx2(const halMixT *mix, unsigned count);
+#endif
+#ifdef HAL_MIX_NEON
+static void framesNeon(const halMixT *mix, const float *in, float *out,
+                       unsigned count);
+static void planesNeon(const halMixT *mix, unsigned count);
+#endif
+static void s16ToFloat(const void *src, float *dst, unsigned count);
+static void s32ToFloat(const void *src, float *dst, unsigned count);
+static void floatToFloat(const void *src, float *dst, unsigned count);
+static void floatToS16(const float *src, void *dst, unsigned count);
+static void floatToS32(const float *src, void *dst, unsigned count);
+static void floatFromFloat(const float *src, void *dst, unsigned count);
+static void selectKernels(void);
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static const halMixKernelsT *_kernels = NULL;
+
+static const halMixKernelsT _kernelsScalar = { "scalar", framesScalar, planesScalar };
+#ifdef HAL_MIX_X86
+static const halMixKernelsT _kernelsSse = { "sse", framesSse, planesSse };
+static const halMixKernelsT _kernelsAvx2 = { "avx2", framesAvx2, planesAvx2 };
+#endif
+#ifdef HAL_MIX_NEON
+static const halMixKernelsT _kernelsNeon = { "neon", framesNeon, planesNeon };
+#endif
+
+static const halMixToFloatT _toFloat[HAL_MIX_FORMATS] = {
+  [HAL_MIX_S16] = s16ToFloat,
+  [HAL_MIX_S32] = s32ToFloat,
+  [HAL_MIX_FLOAT] = floatToFloat
+};
+
+static const halMixFromFloatT _fromFloat[HAL_MIX_FORMATS] = {
+  [HAL_MIX_S16] = floatToS16,
+  [HAL_MIX_S32] = floatToS32,
+  [HAL_MIX_FLOAT] = floatFromFloat
+};
+
+static const unsigned _sampleBytes[HAL_MIX_FORMATS] = {
+  [HAL_MIX_S16] = sizeof(int16_t),
+  [HAL_MIX_S32] = sizeof(int32_t),
+  [HAL_MIX_FLOAT] = sizeof(float)
+};
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Mix interleaved frames, one output at a time
+ */
+static void framesScalar(const halMixT *mix, const float *in, float *out,
+                         unsigned count)
+{
+  unsigned frame = 0, outIdx = 0, inIdx = 0;
+
+  for (frame = 0; frame < count; frame++, in += mix->ins, out += mix->outs)
+    for (outIdx = 0; outIdx < mix->outsPadded; outIdx++)
+    {
+      const float *gains = mix->gains + outIdx;
+      float acc = 0.0f;
+
+      for (inIdx = 0; inIdx < mix->ins; inIdx++, gains += mix->outsPadded)
+        acc += in[inIdx] * *gains;
+
+      out[outIdx] = acc;
+    }
+}
+
+/*
+ * @brief Mix the planes of the block, one frame at a time
+ */
+static void planesScalar(const halMixT *mix, unsigned count)
+{
+  unsigned termIdx = 0, frame = 0;
+
+  memset(mix->outBuf, 0, sizeof(float) * mix->outs * HAL_MIX_FRAMES_MAX);
+
+  for (termIdx = 0; termIdx < mix->termsCount; termIdx++)
+  {
+    const halMixTermT *term = &mix->terms[termIdx];
+    const float *in = mix->inBuf + term->in * HAL_MIX_FRAMES_MAX;
+    float *out = mix->outBuf + term->out * HAL_MIX_FRAMES_MAX;
+
+    for (frame = 0; frame < count; frame++)
+      out[frame] += term->gain * in[frame];
+  }
+}
+
+#ifdef HAL_MIX_X86
+/*
+ * @brief Mix interleaved frames, 4 outputs at a time
+ */
+__attribute__((target("sse2")))
+static void framesSse(const halMixT *mix, const float *in, float *out,
+                      unsigned count)
+{
+  unsigned frame = 0, outIdx = 0, inIdx = 0;
+
+  for (frame = 0; frame < count; frame++, in += mix->ins, out += mix->outs)
+    for (outIdx = 0; outIdx < mix->outsPadded; outIdx += 4)
+    {
+      const float *gains = mix->gains + outIdx;
+      __m128 acc = _mm_setzero_ps();
+
+      for (inIdx = 0; inIdx < mix->ins; inIdx++, gains += mix->outsPadded)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(in[inIdx]), _mm_load_ps(gains)));
+
+      _mm_storeu_ps(out + outIdx, acc);
+    }
+}
+
+/*
+ * @brief Mix the planes of the block, 4 frames at a time
+ */
+__attribute__((target("sse2")))
+static void planesSse(const halMixT *mix, unsigned count)
+{
+  unsigned termIdx = 0, frame = 0;
+
+  memset(mix->outBuf, 0, sizeof(float) * mix->outs * HAL_MIX_FRAMES_MAX);
+
+  for (termIdx = 0; termIdx < mix->termsCount; termIdx++)
+  {
+    const halMixTermT *term = &mix->terms[termIdx];
+    const float *in = mix->inBuf + term->in * HAL_MIX_FRAMES_MAX;
+    float *out = mix->outBuf + term->out * HAL_MIX_FRAMES_MAX;
+    __m128 gain = _mm_set1_ps(term->gain);
+
+    for (frame = 0; frame < count; frame += 4)
+      _mm_store_ps(out + frame, _mm_add_ps(_mm_load_ps(out + frame),
+                                           _mm_mul_ps(gain, _mm_load_ps(in + frame))));
+  }
+}
+
+/*
+ * @brief Mix interleaved frames, 8 outputs at a time
+ */
+__attribute__((target("avx2,fma")))
+static void framesAvx2(const halMixT *mix, const float *in, float *out,
+                       unsigned count)
+{
+  unsigned frame = 0, outIdx = 0, inIdx = 0;
+
+  for (frame = 0; frame < count; frame++, in += mix->ins, out += mix->outs)
+    for (outIdx = 0; outIdx < mix->outsPadded; outIdx += 8)
+    {
+      const float *gains = mix->gains + outIdx;
+      __m256 acc = _mm256_setzero_ps();
+
+      for (inIdx = 0; inIdx < mix->ins; inIdx++, gains += mix->outsPadded)
+        acc = _mm256_fmadd_ps(_mm256_broadcast_ss(&in[inIdx]), _mm256_load_ps(gains), acc);
+
+      _mm256_storeu_ps(out + outIdx, acc);
+    }
+}
+
+/*
+ * @brief Mix the planes of the block, 8 frames at a time
+ */
+__attribute__((target("avx2,fma")))
+static void planesAvx2(const halMixT *mix, unsigned count)
+{
+  unsigned termIdx = 0, frame = 0;
+
+  memset(mix->outBuf, 0, sizeof(float) * mix->outs * HAL_MIX_FRAMES_MAX);
+
+  for (termIdx = 0; termIdx < mix->termsCount; termIdx++)
+  {
+    const halMixTermT *term = &mix->terms[termIdx];
+    const float *in = mix->inBuf + term->in * HAL_MIX_FRAMES_MAX;
+    float *out = mix->outBuf + term->out * HAL_MIX_FRAMES_MAX;
+    __m256 gain = _mm256_set1_ps(term->gain);
+
+    for (frame = 0; frame < count; frame += 8)
+      _mm256_store_ps(out + frame, _mm256_fmadd_ps(gain, _mm256_load_ps(in + frame),
+                                                   _mm256_load_ps(out + frame)));
+  }
+}
+#endif /* HAL_MIX_X86 */
+
+#ifdef HAL_MIX_NEON
+/*
+ * @brief Mix interleaved frames, 4 outputs at a time
+ */
+static void framesNeon(const halMixT *mix, const float *in, float *out,
+                       unsigned count)
+{
+  unsigned frame = 0, outIdx = 0, inIdx = 0;
+
+  for (frame = 0; frame < count; frame++, in += mix->ins, out += mix->outs)
+    for (outIdx = 0; outIdx < mix->outsPadded; outIdx += 4)
+    {
+      const float *gains = mix->gains + outIdx;
+      float32x4_t acc = vdupq_n_f32(0.0f);
+
+      for (inIdx = 0; inIdx < mix->ins; inIdx++, gains += mix->outsPadded)
+        acc = vmlaq_n_f32(acc, vld1q_f32(gains), in[inIdx]);
+
+      vst1q_f32(out + outIdx, acc);
+    }
+}
+
+/*
+ * @brief Mix the planes of the block, 4 frames at a time
+ */
+static void planesNeon(const halMixT *mix, unsigned count)
+{
+  unsigned termIdx = 0, frame = 0;
+
+  memset(mix->outBuf, 0, sizeof(float) * mix->outs * HAL_MIX_FRAMES_MAX);
+
+  for (termIdx = 0; termIdx < mix->termsCount; termIdx++)
+  {
+    const halMixTermT *term = &mix->terms[termIdx];
+    const float *in = mix->inBuf + term->in * HAL_MIX_FRAMES_MAX;
+    float *out = mix->outBuf + term->out * HAL_MIX_FRAMES_MAX;
+
+    for (frame = 0; frame < count; frame += 4)
+      vst1q_f32(out + frame, vmlaq_n_f32(vld1q_f32(out + frame),
+                                         vld1q_f32(in + frame), term->gain));
+  }
+}
+#endif /* HAL_MIX_NEON */
+
+static void s16ToFloat(const void *src, float *dst, unsigned count)
+{
+  const int16_t *samples = src;
+  unsigned idx = 0;
+
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(1.0f / HAL_MIX_S16_SCALE);
+
+  for (; idx + 8 <= count; idx += 8)
+  {
+    __m128i vec = _mm_loadu_si128((const __m128i *)(samples + idx));
+
+    // Sign extend, by shifting the samples down from the high halves
+    _mm_storeu_ps(dst + idx, _mm_mul_ps(scale, _mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpacklo_epi16(vec, vec), 16))));
+    _mm_storeu_ps(dst + idx + 4, _mm_mul_ps(scale, _mm_cvtepi32_ps(
+                    _mm_srai_epi32(_mm_unpackhi_epi16(vec, vec), 16))));
+  }
+#endif
+
+  for (; idx < count; idx++)
+    dst[idx] = (1.0f / HAL_MIX_S16_SCALE) * (float)samples[idx];
+}
+
+static void s32ToFloat(const void *src, float *dst, unsigned count)
+{
+  const int32_t *samples = src;
+  unsigned idx = 0;
+
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(1.0f / HAL_MIX_S32_SCALE);
+
+  for (; idx + 4 <= count; idx += 4)
+    _mm_storeu_ps(dst + idx, _mm_mul_ps(scale, _mm_cvtepi32_ps(
+                    _mm_loadu_si128((const __m128i *)(samples + idx)))));
+#endif
+
+  for (; idx < count; idx++)
+    dst[idx] = (1.0f / HAL_MIX_S32_SCALE) * (float)samples[idx];
+}
+
+static void floatToFloat(const void *src, float *dst, unsigned count)
+{
+  memcpy(dst, src, sizeof(float) * count);
+}
+
+static void floatToS16(const float *src, void *dst, unsigned count)
+{
+  int16_t *samples = dst;
+  unsigned idx = 0;
+
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(HAL_MIX_S16_SCALE);
+  const __m128 low = _mm_set1_ps(-HAL_MIX_S16_SCALE);
+  const __m128 high = _mm_set1_ps(HAL_MIX_S16_SCALE - 1.0f);
+
+  // Rounds to nearest, as lrintf
+  for (; idx + 8 <= count; idx += 8)
+  {
+    __m128i first = _mm_cvtps_epi32(_mm_max_ps(low, _mm_min_ps(high,
+                      _mm_mul_ps(scale, _mm_loadu_ps(src + idx)))));
+    __m128i second = _mm_cvtps_epi32(_mm_max_ps(low, _mm_min_ps(high,
+                       _mm_mul_ps(scale, _mm_loadu_ps(src + idx + 4)))));
+
+    _mm_storeu_si128((__m128i *)(samples + idx), _mm_packs_epi32(first, second));
+  }
+#endif
+
+  for (; idx < count; idx++)
+  {
+    float sample = fmaxf(-HAL_MIX_S16_SCALE,
+                         fminf(HAL_MIX_S16_SCALE - 1.0f, HAL_MIX_S16_SCALE * src[idx]));
+
+    samples[idx] = (int16_t)lrintf(sample);
+  }
+}
+
+static void floatToS32(const float *src, void *dst, unsigned count)
+{
+  int32_t *samples = dst;
+  unsigned idx = 0;
+
+#ifdef __SSE2__
+  const __m128 scale = _mm_set1_ps(HAL_MIX_S32_SCALE);
+  const __m128 low = _mm_set1_ps(-HAL_MIX_S32_SCALE);
+  const __m128 high = _mm_set1_ps(HAL_MIX_S32_MAX);
+
+  for (; idx + 4 <= count; idx += 4)
+  {
+    __m128 sample = _mm_mul_ps(scale, _mm_loadu_ps(src + idx));
+
+    sample = _mm_max_ps(low, _mm_min_ps(high, sample));
+    _mm_storeu_si128((__m128i *)(samples + idx), _mm_cvtps_epi32(sample));
+  }
+#endif
+
+  for (; idx < count; idx++)
+  {
+    float sample = fmaxf(-HAL_MIX_S32_SCALE,
+                         fminf(HAL_MIX_S32_MAX, HAL_MIX_S32_SCALE * src[idx]));
+
+    samples[idx] = (int32_t)lrintf(sample);
+  }
+}
+
+static void floatFromFloat(const float *src, void *dst, unsigned count)
+{
+  memcpy(dst, src, sizeof(float) * count);
+}
+
+/*
+ * @brief Pick the widest kernels the CPU supports (once, idempotent)
+ */
+static void selectKernels(void)
+{
+  if (_kernels)
+    return;
+
+#if defined(HAL_MIX_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    _kernels = &_kernelsAvx2;
+  else if (__builtin_cpu_supports("sse2"))
+    _kernels = &_kernelsSse;
+#elif defined(HAL_MIX_NEON)
+  _kernels = &_kernelsNeon;
+#endif
+
+  if (!_kernels)
+    _kernels = &_kernelsScalar;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Set up a mixer
+ * @param ins   : Input channels
+ * @param outs  : Output channels
+ * @param gains : ins x outs gains, row major
+ * @return 0 on success, -EINVAL if the channels are not supported, or
+ *         -ENOMEM
+ */
+int halMixInit(halMixT *mix, unsigned ins, unsigned outs, const float *gains)
+{
+  unsigned inIdx = 0, outIdx = 0;
+
+  memset(mix, 0, sizeof(halMixT));
+  if (!ins || ins > HAL_MIX_CHANNELS_MAX || !outs || outs > HAL_MIX_CHANNELS_MAX || !gains)
+    return -EINVAL;
+
+  mix->ins = ins;
+  mix->outs = outs;
+  mix->outsPadded = (outs + HAL_MIX_LANES - 1) & ~(HAL_MIX_LANES - 1);
+
+  // Sizes are whole vectors, as aligned_alloc requires
+  mix->gains = aligned_alloc(HAL_MIX_ALIGN, sizeof(float) * ins * mix->outsPadded);
+  mix->terms = malloc(sizeof(halMixTermT) * ins * outs);
+  mix->inBuf = aligned_alloc(HAL_MIX_ALIGN, sizeof(float) * ins * HAL_MIX_FRAMES_MAX);
+  mix->outBuf = aligned_alloc(HAL_MIX_ALIGN,
+                              sizeof(float) * (outs * HAL_MIX_FRAMES_MAX + HAL_MIX_LANES));
+  if (!mix->gains || !mix->terms || !mix->inBuf || !mix->outBuf)
+  {
+    halMixRelease(mix);
+    return -ENOMEM;
+  }
+
+  memset(mix->gains, 0, sizeof(float) * ins * mix->outsPadded);
+  memset(mix->inBuf, 0, sizeof(float) * ins * HAL_MIX_FRAMES_MAX);
+
+  for (inIdx = 0; inIdx < ins; inIdx++)
+    for (outIdx = 0; outIdx < outs; outIdx++)
+    {
+      float gain = gains[inIdx * outs + outIdx];
+
+      mix->gains[inIdx * mix->outsPadded + outIdx] = gain;
+      if (gain == 0.0f)
+        continue;
+
+      mix->terms[mix->termsCount].in = (uint16_t)inIdx;
+      mix->terms[mix->termsCount].out = (uint16_t)outIdx;
+      mix->terms[mix->termsCount].gain = gain;
+      mix->termsCount++;
+    }
+
+  selectKernels();
+  return 0;
+}
+
+/*
+ * @brief Release the buffers of a mixer
+ */
+void halMixRelease(halMixT *mix)
+{
+  free(mix->gains);
+  free(mix->terms);
+  free(mix->inBuf);
+  free(mix->outBuf);
+  memset(mix, 0, sizeof(halMixT));
+}
+
+/*
+ * @brief Mix interleaved frames
+ * @param src   : count x ins samples
+ * @param dst   : count x outs samples, not overlapping src
+ */
+void halMixInterleaved(halMixT *mix, halMixFormatT format,
+                       const void *src, void *dst, unsigned count)
+{
+  unsigned bytes = _sampleBytes[format];
+
+  while (count)
+  {
+    unsigned frames = count < HAL_MIX_FRAMES_MAX ? count : HAL_MIX_FRAMES_MAX;
+    const float *in = src;
+
+    if (format != HAL_MIX_FLOAT)
+    {
+      _toFloat[format](src, mix->inBuf, frames * mix->ins);
+      in = mix->inBuf;
+    }
+
+    _kernels->frames(mix, in, mix->outBuf, frames);
+    _fromFloat[format](mix->outBuf, dst, frames * mix->outs);
+
+    src = (const uint8_t *)src + (size_t)frames * mix->ins * bytes;
+    dst = (uint8_t *)dst + (size_t)frames * mix->outs * bytes;
+    count -= frames;
+  }
+}
+
+/*
+ * @brief Mix planar buffers
+ * @param src   : ins planes of count samples
+ * @param dst   : outs planes of count samples
+ */
+void halMixPlanar(halMixT *mix, halMixFormatT format,
+                  const void *const *src, void *const *dst, unsigned count)
+{
+  unsigned bytes = _sampleBytes[format];
+  size_t offset = 0;
+
+  while (count)
+  {
+    unsigned frames = count < HAL_MIX_FRAMES_MAX ? count : HAL_MIX_FRAMES_MAX;
+    unsigned idx = 0;
+
+    for (idx = 0; idx < mix->ins; idx++)
+      _toFloat[format]((const uint8_t *)src[idx] + offset,
+                       mix->inBuf + idx * HAL_MIX_FRAMES_MAX, frames);
+
+    // The padding frames of the last vector are mixed, but not converted
+    _kernels->planes(mix, (frames + HAL_MIX_LANES - 1) & ~(HAL_MIX_LANES - 1));
+
+    for (idx = 0; idx < mix->outs; idx++)
+      _fromFloat[format](mix->outBuf + idx * HAL_MIX_FRAMES_MAX,
+                         (uint8_t *)dst[idx] + offset, frames);
+
+    offset += (size_t)frames * bytes;
+    count -= frames;
+  }
+}
+
+/*
+ * @brief Get the size of a sample, in bytes
+ */
+unsigned halMixSampleBytes(halMixFormatT format)
+{
+  return _sampleBytes[format];
+}
+
+/*
+ * @brief Get the name of the mix kernels in use: avx2, sse, neon or scalar
+ */
+const char *halMixEngine(void)
+{
+  selectKernels();
+  return _kernels->name;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_MIX_H
+#define HAL_GENERIC_MIX_H
+
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MIX_CHANNELS_MAX 64       // As HAL_MATRIX_PORTS_MAX
+#define HAL_MIX_FRAMES_MAX 256        // Frames mixed at a time
+#define HAL_MIX_LANES 8               // Widest vector, in floats
+
+typedef enum {
+  HAL_MIX_S16,
+  HAL_MIX_S32,
+  HAL_MIX_FLOAT,
+
+  HAL_MIX_FORMATS
+} halMixFormatT;
+
+// A non-zero gain of the matrix, for the planar kernel
+typedef struct {
+  uint16_t in;
+  uint16_t out;
+  float gain;
+} halMixTermT;
+
+/*
+ * Routing of 'ins' channels to 'outs' channels through a gain matrix, as
+ * the 'matrix' of a streammap endpoint: every output is the sum of the
+ * inputs weighted by their gains. Samples are converted to float, mixed
+ * a block at a time, and converted back.
+ *
+ * Interleaved frames are mixed a vector of outputs at a time, from the
+ * matrix padded to a whole number of vectors. Planar buffers are mixed a
+ * vector of frames at a time, from the list of the non-zero gains. Any
+ * channel count thus runs the same kernel, with no branch on samples.
+ */
+typedef struct {
+  unsigned ins;
+  unsigned outs;
+  unsigned outsPadded;                // outs, rounded up to HAL_MIX_LANES
+  float *gains;                       // ins x outsPadded, row major
+  halMixTermT *terms;
+  unsigned termsCount;
+  float *inBuf;                       // A block of inputs, as float
+  float *outBuf;                      // A block of outputs, as float
+} halMixT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+int halMixInit(halMixT *mix, unsigned ins, unsigned outs, const float *gains);
+void halMixRelease(halMixT *mix);
+void halMixInterleaved(halMixT *mix, halMixFormatT format,
+                       const void *src, void *dst, unsigned count);
+void halMixPlanar(halMixT *mix, halMixFormatT format,
+                  const void *const *src, void *const *dst, unsigned count);
+unsigned halMixSampleBytes(halMixFormatT format);
+const char *halMixEngine(void);
+
+#endif /* HAL_GENERIC_MIX_H */
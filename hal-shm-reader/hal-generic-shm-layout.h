@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_SHM_LAYOUT_H
+#define HAL_GENERIC_SHM_LAYOUT_H
+
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+/*
+ * Layout of the 'initialize_sndcard' payload of a card, when handed to the
+ * HAL plugin in a sealed memfd (see the 'shm' option). It holds the same
+ * data as the 'cardprops' and 'streammap' objects, in flat sections:
+ *
+ *   header | channels | streams | rows | cells | gains | strings
+ *
+ * Section offsets are from the start of the segment, and aligned on
+ * HAL_SHM_ALIGN. References between sections are indexes into the target
+ * section, and strings are offsets into the string pool, where 0 stands
+ * for NULL. Integers and gains are in host order, as the segment does not
+ * leave the host.
+ *
+ * The version is bumped on any change of the layout.
+ */
+#define HAL_SHM_MAGIC 0x534c4148      // 'HALS'
+#define HAL_SHM_VERSION 1
+#define HAL_SHM_ALIGN 8
+
+#define HAL_SHM_SINK 0                // Directions, as SinkSourceT
+#define HAL_SHM_SOURCE 1
+
+/*
+ * The segment of each card is also linked at <runtime dir>/4a-hal/<card>.shm,
+ * for the readers which are not sent its path, as the ALSA plugins. The
+ * runtime dir is $XDG_RUNTIME_DIR, or /tmp. The link is replaced along with
+ * the segment, and dangles once the HAL has exited.
+ */
+#define HAL_SHM_LINK_DIR "4a-hal"
+#define HAL_SHM_LINK_SUFFIX ".shm"
+#define HAL_SHM_LINK_RUNTIME "/tmp"   // Without XDG_RUNTIME_DIR
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;                      // Segment size
+  uint32_t channelsCount[2];          // By direction
+  uint32_t streamsCount;
+  uint32_t rowsCount;
+  uint32_t cellsCount;
+  uint32_t gainsCount;
+  uint32_t stringsSize;
+  uint32_t channelsOffset;            // halShmChannelT, sinks then sources
+  uint32_t streamsOffset;             // halShmStreamT
+  uint32_t rowsOffset;                // halShmRowT
+  uint32_t cellsOffset;               // uint32_t, string offsets of the channel types
+  uint32_t gainsOffset;               // float
+  uint32_t stringsOffset;             // NUL terminated strings
+} halShmHeaderT;
+
+// A card channel, i.e. an entry of 'cardprops' 'sink' or 'source'
+typedef struct {
+  uint32_t type;                      // String offset
+  int32_t port;
+} halShmChannelT;
+
+// The 'sink' or 'source' of a stream
+typedef struct {
+  uint32_t channels;                  // Stream channels, 0 if the stream has none
+  uint32_t rowsIdx;                   // First 'mapping' row, one per channel
+  uint32_t cols;                      // Card ports, 0 if there is no matrix
+  uint32_t gainsIdx;                  // First gain of the channels x cols matrix, row major
+} halShmEndpointT;
+
+// A 'streammap' entry
+typedef struct {
+  uint32_t role;                      // String offset
+  halShmEndpointT endpoints[2];       // By direction
+} halShmStreamT;
+
+// A 'mapping' row: the card channel types a stream channel is routed to
+typedef struct {
+  uint32_t cellsIdx;
+  uint32_t cellsCount;
+} halShmRowT;
+
+#endif /* HAL_GENERIC_SHM_LAYOUT_H */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reader of the payload segments of hal-generic, for HAL plugins.
+ *
+ * With the 'shm' option, 'initialize_sndcard' is sent
+ * { "shm": { "path", "size", "version" } } instead of 'cardprops' and
+ * 'streammap': 'path' opens a sealed memfd of the HAL, laid out as in
+ * hal-generic-shm-layout.h. halShmMap maps it read-only, and checks the
+ * seals and every offset and index once, so that the accessors need no
+ * further check.
+ *
+ * The library only depends on libc, and may be linked into any plugin.
+ */
+
+#define _GNU_SOURCE
+#include "hal-generic-shm-reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+// The segment can neither change nor shrink under the mapping
+#define HAL_SHM_SEALS (F_SEAL_WRITE | F_SEAL_SHRINK)
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+static bool sectionValid(const halShmViewT *view, uint32_t offset,
+                         uint32_t count, size_t itemSize);
+static bool stringValid(const halShmViewT *view, uint32_t offset);
+static bool endpointValid(const halShmViewT *view,
+                          const halShmEndpointT *endpoint);
+static bool layoutValid(const halShmViewT *view);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Check that a section is aligned, and within the segment
+ */
+static bool sectionValid(const halShmViewT *view, uint32_t offset,
+                         uint32_t count, size_t itemSize)
+{
+  return offset >= sizeof(halShmHeaderT) &&
+         (offset % HAL_SHM_ALIGN) == 0 &&
+         offset <= view->size &&
+         (uint64_t)count * itemSize <= view->size - offset;
+}
+
+/*
+ * @brief Check that a string offset is within the string pool
+ */
+static bool stringValid(const halShmViewT *view, uint32_t offset)
+{
+  return offset < view->header->stringsSize;
+}
+
+/*
+ * @brief Check the rows, cells and gains of a stream endpoint
+ */
+static bool endpointValid(const halShmViewT *view,
+                          const halShmEndpointT *endpoint)
+{
+  const halShmHeaderT *header = view->header;
+  const halShmRowT *rows = NULL;
+  const uint32_t *cells = NULL;
+  uint32_t rowIdx = 0, cellIdx = 0;
+
+  if (!endpoint->channels)
+    return true;
+
+  if ((uint64_t)endpoint->rowsIdx + endpoint->channels > header->rowsCount)
+    return false;
+  if (endpoint->cols &&
+      (uint64_t)endpoint->gainsIdx + (uint64_t)endpoint->channels * endpoint->cols >
+        header->gainsCount)
+    return false;
+
+  rows = (const halShmRowT *)(view->base + header->rowsOffset) + endpoint->rowsIdx;
+  cells = (const uint32_t *)(view->base + header->cellsOffset);
+  for (rowIdx = 0; rowIdx < endpoint->channels; rowIdx++)
+  {
+    if ((uint64_t)rows[rowIdx].cellsIdx + rows[rowIdx].cellsCount > header->cellsCount)
+      return false;
+
+    for (cellIdx = 0; cellIdx < rows[rowIdx].cellsCount; cellIdx++)
+      if (!stringValid(view, cells[rows[rowIdx].cellsIdx + cellIdx]))
+        return false;
+  }
+
+  return true;
+}
+
+/*
+ * @brief Check the header, the sections, and every reference of a segment
+ */
+static bool layoutValid(const halShmViewT *view)
+{
+  const halShmHeaderT *header = view->header;
+  const halShmChannelT *channels = NULL;
+  const halShmStreamT *streams = NULL;
+  uint32_t idx = 0, channelsCount = 0;
+
+  if (view->size < sizeof(halShmHeaderT) ||
+      header->magic != HAL_SHM_MAGIC ||
+      header->version != HAL_SHM_VERSION ||
+      header->size != view->size)
+    return false;
+
+  channelsCount = header->channelsCount[HAL_SHM_SINK] + header->channelsCount[HAL_SHM_SOURCE];
+  if (channelsCount < header->channelsCount[HAL_SHM_SINK] ||
+      !sectionValid(view, header->channelsOffset, channelsCount, sizeof(halShmChannelT)) ||
+      !sectionValid(view, header->streamsOffset, header->streamsCount, sizeof(halShmStreamT)) ||
+      !sectionValid(view, header->rowsOffset, header->rowsCount, sizeof(halShmRowT)) ||
+      !sectionValid(view, header->cellsOffset, header->cellsCount, sizeof(uint32_t)) ||
+      !sectionValid(view, header->gainsOffset, header->gainsCount, sizeof(float)) ||
+      !sectionValid(view, header->stringsOffset, header->stringsSize, 1))
+    return false;
+
+  // Every string ends within the pool
+  if (!header->stringsSize ||
+      view->base[header->stringsOffset + header->stringsSize - 1] != '\0')
+    return false;
+
+  channels = (const halShmChannelT *)(view->base + header->channelsOffset);
+  for (idx = 0; idx < channelsCount; idx++)
+    if (!stringValid(view, channels[idx].type))
+      return false;
+
+  streams = (const halShmStreamT *)(view->base + header->streamsOffset);
+  for (idx = 0; idx < header->streamsCount; idx++)
+    if (!stringValid(view, streams[idx].role) ||
+        !endpointValid(view, &streams[idx].endpoints[HAL_SHM_SINK]) ||
+        !endpointValid(view, &streams[idx].endpoints[HAL_SHM_SOURCE]))
+      return false;
+
+  return true;
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Map a payload segment read-only, and check it
+ * @param path : The 'path' of the 'shm' payload
+ * @param view : Set to the mapping, to release with halShmUnmap
+ * @return 0 on success, -errno otherwise: -EPERM if the segment is not
+ *         sealed, -EPROTO if it is not a valid payload of this version
+ */
+int halShmMap(const char *path, halShmViewT *view)
+{
+  struct stat st;
+  void *base = NULL;
+  int fd = -1, seals = 0, err = 0;
+
+  memset(view, 0, sizeof(halShmViewT));
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || (seals & HAL_SHM_SEALS) != HAL_SHM_SEALS)
+  {
+    close(fd);
+    return -EPERM;
+  }
+
+  if (fstat(fd, &st) < 0)
+  {
+    err = -errno;
+    close(fd);
+    return err;
+  }
+  if ((size_t)st.st_size < sizeof(halShmHeaderT))
+  {
+    close(fd);
+    return -EPROTO;
+  }
+
+  // The mapping outlives the fd
+  base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  err = (base == MAP_FAILED) ? -errno : 0;
+  close(fd);
+  if (err)
+    return err;
+
+  view->base = base;
+  view->size = (size_t)st.st_size;
+  view->header = (const halShmHeaderT *)base;
+
+  if (!layoutValid(view))
+  {
+    halShmUnmap(view);
+    return -EPROTO;
+  }
+
+  return 0;
+}
+
+/*
+ * @brief Release a mapping. Pointers into the segment are no longer valid.
+ */
+void halShmUnmap(halShmViewT *view)
+{
+  if (view->base)
+    munmap((void *)view->base, view->size);
+
+  memset(view, 0, sizeof(halShmViewT));
+}
+
+/*
+ * @brief Get a string of the segment
+ * @return The string, or NULL for offset 0
+ */
+const char *halShmString(const halShmViewT *view, uint32_t offset)
+{
+  if (!offset)
+    return NULL;
+
+  return (const char *)view->base + view->header->stringsOffset + offset;
+}
+
+/*
+ * @brief Get the card channels of a direction, i.e. 'cardprops'
+ * @param direction : HAL_SHM_SINK or HAL_SHM_SOURCE
+ * @param count     : Set to the number of channels
+ */
+const halShmChannelT *halShmChannels(const halShmViewT *view, int direction,
+                                     uint32_t *count)
+{
+  const halShmChannelT *channels =
+    (const halShmChannelT *)(view->base + view->header->channelsOffset);
+
+  *count = view->header->channelsCount[direction];
+  return direction == HAL_SHM_SINK ? channels :
+         channels + view->header->channelsCount[HAL_SHM_SINK];
+}
+
+/*
+ * @brief Get the streams, i.e. 'streammap'
+ * @param count : Set to the number of streams
+ */
+const halShmStreamT *halShmStreams(const halShmViewT *view, uint32_t *count)
+{
+  *count = view->header->streamsCount;
+  return (const halShmStreamT *)(view->base + view->header->streamsOffset);
+}
+
+/*
+ * @brief Get the 'mapping' rows of a stream endpoint, one per channel
+ * @return The rows, or NULL if the stream has no such endpoint
+ */
+const halShmRowT *halShmRows(const halShmViewT *view,
+                             const halShmEndpointT *endpoint)
+{
+  if (!endpoint->channels)
+    return NULL;
+
+  return (const halShmRowT *)(view->base + view->header->rowsOffset) + endpoint->rowsIdx;
+}
+
+/*
+ * @brief Get the cells of a 'mapping' row, as string offsets of the card
+ *        channel types
+ */
+const uint32_t *halShmCells(const halShmViewT *view, const halShmRowT *row)
+{
+  return (const uint32_t *)(view->base + view->header->cellsOffset) + row->cellsIdx;
+}
+
+/*
+ * @brief Get the routing matrix of a stream endpoint, channels x cols
+ *        gains, row major
+ * @return The gains, or NULL if there is no matrix
+ */
+const float *halShmMatrix(const halShmViewT *view,
+                          const halShmEndpointT *endpoint)
+{
+  if (!endpoint->channels || !endpoint->cols)
+    return NULL;
+
+  return (const float *)(view->base + view->header->gainsOffset) + endpoint->gainsIdx;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_SHM_READER_H
+#define HAL_GENERIC_SHM_READER_H
+
+#include "hal-generic-shm-layout.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+// A read-only mapping of a payload segment, checked by halShmMap
+typedef struct {
+  const uint8_t *base;
+  size_t size;
+  const halShmHeaderT *header;
+} halShmViewT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+int halShmMap(const char *path, halShmViewT *view);
+void halShmUnmap(halShmViewT *view);
+
+const char *halShmString(const halShmViewT *view, uint32_t offset);
+const halShmChannelT *halShmChannels(const halShmViewT *view, int direction,
+                                     uint32_t *count);
+const halShmStreamT *halShmStreams(const halShmViewT *view, uint32_t *count);
+const halShmRowT *halShmRows(const halShmViewT *view,
+                             const halShmEndpointT *endpoint);
+const uint32_t *halShmCells(const halShmViewT *view, const halShmRowT *row);
+const float *halShmMatrix(const halShmViewT *view,
+                          const halShmEndpointT *endpoint);
+
+#endif /* HAL_GENERIC_SHM_READER_H */
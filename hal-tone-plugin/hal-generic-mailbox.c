@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hal-generic-mailbox.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MAILBOX_SLOTS 3
+#define HAL_MAILBOX_SLOT_MASK 0x3u
+#define HAL_MAILBOX_FRESH 0x4u        // The middle block was not fetched yet
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Set up a mailbox, with every block a copy of initial
+ * @param size    : The size of a block
+ * @param initial : The first block the reader fetches
+ * @return 0 on success, -EINVAL or -ENOMEM
+ */
+int halMailboxInit(halMailboxT *mailbox, size_t size, const void *initial)
+{
+  unsigned slot = 0;
+
+  memset(mailbox, 0, sizeof(halMailboxT));
+  if (!size || !initial)
+    return -EINVAL;
+
+  // Blocks on their own cache lines, as each side writes its own
+  mailbox->size = (size + HAL_MAILBOX_CACHELINE - 1) & ~(size_t)(HAL_MAILBOX_CACHELINE - 1);
+  mailbox->blocks = aligned_alloc(HAL_MAILBOX_CACHELINE, HAL_MAILBOX_SLOTS * mailbox->size);
+  if (!mailbox->blocks)
+    return -ENOMEM;
+
+  for (slot = 0; slot < HAL_MAILBOX_SLOTS; slot++)
+    memcpy(mailbox->blocks + slot * mailbox->size, initial, size);
+
+  mailbox->front = 0;
+  mailbox->middle = 1;
+  mailbox->back = 2;
+  return 0;
+}
+
+/*
+ * @brief Release the blocks of a mailbox, once neither side uses it
+ */
+void halMailboxRelease(halMailboxT *mailbox)
+{
+  free(mailbox->blocks);
+  mailbox->blocks = NULL;
+}
+
+/*
+ * @brief Writer side: get the block to fill, before publishing it. It
+ *        holds an older block, to be filled whole.
+ */
+void *halMailboxBack(halMailboxT *mailbox)
+{
+  return mailbox->blocks + mailbox->back * mailbox->size;
+}
+
+/*
+ * @brief Writer side: publish the back block, as the latest one
+ */
+void halMailboxPublish(halMailboxT *mailbox)
+{
+  unsigned middle = __atomic_exchange_n(&mailbox->middle,
+                                        mailbox->back | HAL_MAILBOX_FRESH,
+                                        __ATOMIC_ACQ_REL);
+
+  mailbox->back = middle & HAL_MAILBOX_SLOT_MASK;
+}
+
+/*
+ * @brief Reader side: get the latest published block. Wait free, for the
+ *        real-time thread.
+ * @param fresh : Set to true if it was published since the last fetch
+ * @return The block, valid until the next fetch
+ */
+const void *halMailboxFetch(halMailboxT *mailbox, bool *fresh)
+{
+  *fresh = false;
+
+  if (__atomic_load_n(&mailbox->middle, __ATOMIC_RELAXED) & HAL_MAILBOX_FRESH)
+  {
+    unsigned middle = __atomic_exchange_n(&mailbox->middle, mailbox->front,
+                                          __ATOMIC_ACQ_REL);
+
+    mailbox->front = middle & HAL_MAILBOX_SLOT_MASK;
+    *fresh = true;
+  }
+
+  return mailbox->blocks + mailbox->front * mailbox->size;
+}
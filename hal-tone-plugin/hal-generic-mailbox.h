@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_MAILBOX_H
+#define HAL_GENERIC_MAILBOX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_MAILBOX_CACHELINE 64
+
+/*
+ * Lock-free mailbox of parameter blocks, from one writer thread to one
+ * reader thread (a triple buffer). The writer fills its back block and
+ * publishes it by swapping it with the middle one; the reader takes the
+ * latest published block by swapping the middle one with its front block.
+ * Neither side ever waits for the other: the reader always gets a whole
+ * block, the latest one, and blocks published in between are dropped.
+ */
+typedef struct {
+  unsigned middle __attribute__((aligned(HAL_MAILBOX_CACHELINE)));  // Slot | fresh bit, shared
+  unsigned back __attribute__((aligned(HAL_MAILBOX_CACHELINE)));    // Writer slot
+  unsigned front __attribute__((aligned(HAL_MAILBOX_CACHELINE)));   // Reader slot
+  unsigned char *blocks;              // 3 blocks
+  size_t size;                        // Of a block, rounded up to a cache line
+} halMailboxT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+int halMailboxInit(halMailboxT *mailbox, size_t size, const void *initial);
+void halMailboxRelease(halMailboxT *mailbox);
+void *halMailboxBack(halMailboxT *mailbox);
+void halMailboxPublish(halMailboxT *mailbox);
+const void *halMailboxFetch(halMailboxT *mailbox, bool *fresh);
+
+#endif /* HAL_GENERIC_MAILBOX_H */
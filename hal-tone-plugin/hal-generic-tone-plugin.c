@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ALSA tone control plugin, for cards without a DSP.
+ *
+ * An external filter plugin (extplug) which runs the tone control engine
+ * of hal-generic-tone.c on the stream. The band gains, fade and balance
+ * follow the HAL controls of the card (the 'bass', 'mid', 'treble',
+ * 'fade' and 'balance' ctls of the config), created by alsacore from the
+ * halmap. The same config thus works with or without a DSP in the HAL
+ * plugin.
+ *
+ * The audio thread never waits on the controls: a control thread of the
+ * plugin waits for their events, and publishes their values to a lock-free
+ * mailbox (hal-generic-mailbox.c). The audio thread fetches the latest
+ * values on period boundaries, and the engine glides the band gains and
+ * ramps the channel gains to them, so that fast control changes do not
+ * click.
+ *
+ *   pcm.tone {
+ *     type haltone
+ *     slave.pcm "plughw:0"                  # Converts from FLOAT
+ *     ctl "hw:0"                            # Card of the HAL controls
+ *     bass "Master Bass Playback Volume"    # Any control may be left out
+ *     mid "Master Mid Playback Volume"
+ *     treble "Master Treble Playback Volume"
+ *     fade "Master Playback Fade"
+ *     balance "Master Playback Balance"
+ *     range 12                              # Band gain at full scale, in dB
+ *     bass_freq 100                         # Band frequencies, in Hz
+ *     mid_freq 1000
+ *     treble_freq 10000
+ *   }
+ *
+ * A control is read as a position between its min and max: the middle is
+ * flat, and the ends are -range and +range dB, or fully faded.
+ */
+
+#include "hal-generic-tone.h"
+#include "hal-generic-mailbox.h"
+
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_TONE_CHUNK_FRAMES 256       // Frames filtered at a time
+#define HAL_TONE_CTL_DEFAULT "default"
+#define HAL_TONE_POLLFDS_MAX 8
+
+typedef enum {
+  CTL_BASS,
+  CTL_MID,
+  CTL_TREBLE,
+  CTL_FADE,
+  CTL_BALANCE,
+
+  CTLS_COUNT
+} halToneCtlT;
+
+// The control values, as published to the audio thread
+typedef struct {
+  float gainDb[HAL_TONE_BANDS];
+  float balance;
+  float fade;
+} halToneParamsT;
+
+typedef struct {
+  snd_pcm_extplug_t ext;
+  halToneT tone;
+  float rangeDb;
+  float freq[HAL_TONE_BANDS];
+  char *ctlNames[CTLS_COUNT];           // NULL if not followed
+  halMailboxT mailbox;
+  halToneParamsT applied;               // Audio thread only
+  float *chunk;                         // Interleaved frames being filtered
+  snd_pcm_channel_area_t areas[HAL_TONE_CHANNELS_MAX];
+  // Control thread only, once started
+  snd_hctl_t *hctl;                     // NULL if no control is followed
+  snd_hctl_elem_t *elems[CTLS_COUNT];
+  bool dirty;                           // A control changed
+  pthread_t thread;
+  bool threadStarted;
+  int wakeFd;                           // Stops the control thread
+} halTonePluginT;
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static const char *_ctlKeys[CTLS_COUNT] = {
+  [CTL_BASS] = "bass",
+  [CTL_MID] = "mid",
+  [CTL_TREBLE] = "treble",
+  [CTL_FADE] = "fade",
+  [CTL_BALANCE] = "balance"
+};
+
+static const char *_freqKeys[HAL_TONE_BANDS] = {
+  [HAL_TONE_BASS] = "bass_freq",
+  [HAL_TONE_MID] = "mid_freq",
+  [HAL_TONE_TREBLE] = "treble_freq"
+};
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+static int elemCB(snd_hctl_elem_t *elem, unsigned int mask);
+static int openCtls(halTonePluginT *plugin, const char *ctl);
+static float ctlPosition(snd_hctl_elem_t *elem);
+static void readCtls(halTonePluginT *plugin, halToneParamsT *params);
+static void *ctlThread(void *data);
+static int startCtlThread(halTonePluginT *plugin);
+static void applyParams(halTonePluginT *plugin, const halToneParamsT *params);
+static snd_pcm_sframes_t toneTransfer(snd_pcm_extplug_t *ext,
+                                      const snd_pcm_channel_area_t *dstAreas,
+                                      snd_pcm_uframes_t dstOffset,
+                                      const snd_pcm_channel_area_t *srcAreas,
+                                      snd_pcm_uframes_t srcOffset,
+                                      snd_pcm_uframes_t size);
+static int toneInit(snd_pcm_extplug_t *ext);
+static int toneHwFree(snd_pcm_extplug_t *ext);
+static int toneClose(snd_pcm_extplug_t *ext);
+static void toneFree(halTonePluginT *plugin);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief hctl element callback: flag value changes
+ */
+static int elemCB(snd_hctl_elem_t *elem, unsigned int mask)
+{
+  halTonePluginT *plugin = snd_hctl_elem_get_callback_private(elem);
+
+  if (mask == SND_CTL_EVENT_MASK_REMOVE)
+  {
+    int idx = 0;
+
+    for (idx = 0; idx < CTLS_COUNT; idx++)
+      if (plugin->elems[idx] == elem)
+        plugin->elems[idx] = NULL;
+    return 0;
+  }
+
+  if (mask & SND_CTL_EVENT_MASK_VALUE)
+    plugin->dirty = true;
+
+  return 0;
+}
+
+/*
+ * @brief Open the card of the HAL controls, and find the followed ones.
+ *        Controls missing from the card are logged, and left flat.
+ * @return 0 on success, a negative error code otherwise
+ */
+static int openCtls(halTonePluginT *plugin, const char *ctl)
+{
+  int idx = 0, err = 0, followed = 0;
+
+  for (idx = 0; idx < CTLS_COUNT; idx++)
+    if (plugin->ctlNames[idx])
+      followed++;
+  if (!followed)
+    return 0;
+
+  err = snd_hctl_open(&plugin->hctl, ctl, SND_CTL_NONBLOCK);
+  if (err < 0)
+  {
+    SNDERR("haltone: cannot open ctl %s: %s", ctl, snd_strerror(err));
+    return err;
+  }
+
+  err = snd_hctl_load(plugin->hctl);
+  if (err < 0)
+  {
+    SNDERR("haltone: cannot load ctl %s: %s", ctl, snd_strerror(err));
+    return err;
+  }
+
+  for (idx = 0; idx < CTLS_COUNT; idx++)
+  {
+    snd_ctl_elem_id_t *id = NULL;
+
+    if (!plugin->ctlNames[idx])
+      continue;
+
+    snd_ctl_elem_id_alloca(&id);
+    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+    snd_ctl_elem_id_set_name(id, plugin->ctlNames[idx]);
+
+    plugin->elems[idx] = snd_hctl_find_elem(plugin->hctl, id);
+    if (!plugin->elems[idx])
+    {
+      SNDERR("haltone: no control '%s' on %s, %s is flat",
+             plugin->ctlNames[idx], ctl, _ctlKeys[idx]);
+      continue;
+    }
+
+    snd_hctl_elem_set_callback(plugin->elems[idx], elemCB);
+    snd_hctl_elem_set_callback_private(plugin->elems[idx], plugin);
+  }
+
+  return 0;
+}
+
+/*
+ * @brief Read a control as a position between its min and max
+ * @return -1 at min, 1 at max, 0 in the middle, or if it cannot be read
+ */
+static float ctlPosition(snd_hctl_elem_t *elem)
+{
+  snd_ctl_elem_info_t *info = NULL;
+  snd_ctl_elem_value_t *value = NULL;
+  long min = 0, max = 0, val = 0;
+
+  if (!elem)
+    return 0.0f;
+
+  snd_ctl_elem_info_alloca(&info);
+  snd_ctl_elem_value_alloca(&value);
+  if (snd_hctl_elem_info(elem, info) < 0 ||
+      snd_ctl_elem_info_get_type(info) != SND_CTL_ELEM_TYPE_INTEGER ||
+      snd_hctl_elem_read(elem, value) < 0)
+    return 0.0f;
+
+  min = snd_ctl_elem_info_get_min(info);
+  max = snd_ctl_elem_info_get_max(info);
+  val = snd_ctl_elem_value_get_integer(value, 0);
+  if (max <= min)
+    return 0.0f;
+
+  return (2.0f * (float)(val - min) / (float)(max - min)) - 1.0f;
+}
+
+/*
+ * @brief Read the followed controls, as control values
+ */
+static void readCtls(halTonePluginT *plugin, halToneParamsT *params)
+{
+  static const halToneCtlT bands[HAL_TONE_BANDS] = { CTL_BASS, CTL_MID, CTL_TREBLE };
+  int band = 0;
+
+  for (band = 0; band < HAL_TONE_BANDS; band++)
+    params->gainDb[band] = ctlPosition(plugin->elems[bands[band]]) * plugin->rangeDb;
+
+  params->balance = ctlPosition(plugin->elems[CTL_BALANCE]);
+  params->fade = ctlPosition(plugin->elems[CTL_FADE]);
+}
+
+/*
+ * @brief Control thread: wait for control events, and publish the values
+ *        once they changed
+ */
+static void *ctlThread(void *data)
+{
+  halTonePluginT *plugin = data;
+  struct pollfd pfds[HAL_TONE_POLLFDS_MAX + 1];
+  int count = snd_hctl_poll_descriptors(plugin->hctl, pfds, HAL_TONE_POLLFDS_MAX);
+
+  if (count < 0)
+    return NULL;
+
+  pfds[count].fd = plugin->wakeFd;
+  pfds[count].events = POLLIN;
+
+  for (;;)
+  {
+    if (poll(pfds, count + 1, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (pfds[count].revents)
+      break;
+
+    snd_hctl_handle_events(plugin->hctl);
+    if (!plugin->dirty)
+      continue;
+
+    plugin->dirty = false;
+    readCtls(plugin, halMailboxBack(&plugin->mailbox));
+    halMailboxPublish(&plugin->mailbox);
+  }
+
+  return NULL;
+}
+
+/*
+ * @brief Start the control thread, if a control is followed
+ * @return 0 on success, a negative error code otherwise
+ */
+static int startCtlThread(halTonePluginT *plugin)
+{
+  int err = 0;
+
+  if (!plugin->hctl)
+    return 0;
+
+  plugin->wakeFd = eventfd(0, EFD_CLOEXEC);
+  if (plugin->wakeFd < 0)
+    return -errno;
+
+  err = pthread_create(&plugin->thread, NULL, ctlThread, plugin);
+  if (err)
+    return -err;
+
+  plugin->threadStarted = true;
+  return 0;
+}
+
+/*
+ * @brief Audio thread: apply control values to the engine, which smooths
+ *        them. A ramp is only started when the channel gains change.
+ */
+static void applyParams(halTonePluginT *plugin, const halToneParamsT *params)
+{
+  int band = 0;
+
+  for (band = 0; band < HAL_TONE_BANDS; band++)
+    halToneSetBand(&plugin->tone, (halToneBandT)band, params->gainDb[band]);
+
+  if (params->balance != plugin->applied.balance || params->fade != plugin->applied.fade)
+    halToneSetBalance(&plugin->tone, params->balance, params->fade);
+
+  plugin->applied = *params;
+}
+
+/*
+ * @brief extplug 'transfer' callback: filter the frames, in chunks
+ */
+static snd_pcm_sframes_t toneTransfer(snd_pcm_extplug_t *ext,
+                                      const snd_pcm_channel_area_t *dstAreas,
+                                      snd_pcm_uframes_t dstOffset,
+                                      const snd_pcm_channel_area_t *srcAreas,
+                                      snd_pcm_uframes_t srcOffset,
+                                      snd_pcm_uframes_t size)
+{
+  halTonePluginT *plugin = ext->private_data;
+  const halToneParamsT *params = NULL;
+  snd_pcm_uframes_t done = 0;
+  bool fresh = false;
+
+  // The latest control values, wait free
+  params = halMailboxFetch(&plugin->mailbox, &fresh);
+  if (fresh)
+    applyParams(plugin, params);
+
+  while (done < size)
+  {
+    snd_pcm_uframes_t frames = size - done;
+
+    if (frames > HAL_TONE_CHUNK_FRAMES)
+      frames = HAL_TONE_CHUNK_FRAMES;
+
+    snd_pcm_areas_copy(plugin->areas, 0, srcAreas, srcOffset + done,
+                       ext->channels, frames, SND_PCM_FORMAT_FLOAT);
+    halToneProcess(&plugin->tone, plugin->chunk, (unsigned)frames);
+    snd_pcm_areas_copy(dstAreas, dstOffset + done, plugin->areas, 0,
+                       ext->channels, frames, SND_PCM_FORMAT_FLOAT);
+    done += frames;
+  }
+
+  return (snd_pcm_sframes_t)size;
+}
+
+/*
+ * @brief extplug 'init' callback, once the hw params are set
+ */
+static int toneInit(snd_pcm_extplug_t *ext)
+{
+  halTonePluginT *plugin = ext->private_data;
+  unsigned channel = 0;
+  int band = 0, err = 0;
+  bool fresh = false;
+
+  err = halToneInit(&plugin->tone, ext->rate, ext->channels);
+  if (err < 0)
+  {
+    SNDERR("haltone: %u channels at %u Hz are not supported", ext->channels, ext->rate);
+    return err;
+  }
+
+  for (band = 0; band < HAL_TONE_BANDS; band++)
+    halToneSetFreq(&plugin->tone, (halToneBandT)band, plugin->freq[band]);
+
+  free(plugin->chunk);
+  plugin->chunk = aligned_alloc(32, sizeof(float) * HAL_TONE_CHUNK_FRAMES * ext->channels);
+  if (!plugin->chunk)
+    return -ENOMEM;
+
+  for (channel = 0; channel < ext->channels; channel++)
+  {
+    plugin->areas[channel].addr = plugin->chunk;
+    plugin->areas[channel].first = channel * 32;
+    plugin->areas[channel].step = ext->channels * 32;
+  }
+
+  // The stream starts with the current values, with no smoothing
+  applyParams(plugin, halMailboxFetch(&plugin->mailbox, &fresh));
+  halToneSetBalance(&plugin->tone, plugin->applied.balance, plugin->applied.fade);
+  halToneSettle(&plugin->tone);
+  return 0;
+}
+
+/*
+ * @brief extplug 'hw_free' callback
+ */
+static int toneHwFree(snd_pcm_extplug_t *ext)
+{
+  halTonePluginT *plugin = ext->private_data;
+
+  free(plugin->chunk);
+  plugin->chunk = NULL;
+  return 0;
+}
+
+/*
+ * @brief extplug 'close' callback
+ */
+static int toneClose(snd_pcm_extplug_t *ext)
+{
+  toneFree(ext->private_data);
+  return 0;
+}
+
+static void toneFree(halTonePluginT *plugin)
+{
+  int idx = 0;
+
+  if (plugin->threadStarted)
+  {
+    uint64_t wake = 1;
+
+    if (write(plugin->wakeFd, &wake, sizeof(wake)) == sizeof(wake))
+      pthread_join(plugin->thread, NULL);
+  }
+  if (plugin->wakeFd >= 0)
+    close(plugin->wakeFd);
+  if (plugin->hctl)
+    snd_hctl_close(plugin->hctl);
+  halMailboxRelease(&plugin->mailbox);
+  for (idx = 0; idx < CTLS_COUNT; idx++)
+    free(plugin->ctlNames[idx]);
+  free(plugin->chunk);
+  free(plugin);
+}
+
+static const snd_pcm_extplug_callback_t _toneCallbacks = {
+  .transfer = toneTransfer,
+  .init = toneInit,
+  .hw_free = toneHwFree,
+  .close = toneClose,
+};
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Open a 'haltone' PCM
+ */
+SND_PCM_PLUGIN_DEFINE_FUNC(haltone)
+{
+  snd_config_iterator_t i, next;
+  snd_config_t *slaveConf = NULL;
+  halTonePluginT *plugin = NULL;
+  const char *ctl = HAL_TONE_CTL_DEFAULT;
+  halToneParamsT params;
+  int err = 0, idx = 0;
+
+  // The engine state is read with aligned vector loads
+  plugin = aligned_alloc(_Alignof(halTonePluginT), sizeof(halTonePluginT));
+  if (!plugin)
+    return -ENOMEM;
+  memset(plugin, 0, sizeof(halTonePluginT));
+  plugin->wakeFd = -1;
+
+  plugin->rangeDb = HAL_TONE_RANGE_DB;
+  plugin->freq[HAL_TONE_BASS] = HAL_TONE_BASS_HZ;
+  plugin->freq[HAL_TONE_MID] = HAL_TONE_MID_HZ;
+  plugin->freq[HAL_TONE_TREBLE] = HAL_TONE_TREBLE_HZ;
+
+  snd_config_for_each(i, next, conf)
+  {
+    snd_config_t *n = snd_config_iterator_entry(i);
+    const char *id = NULL, *str = NULL;
+    double real = 0.0;
+    bool known = false;
+
+    if (snd_config_get_id(n, &id) < 0)
+      continue;
+    if (!strcmp(id, "comment") || !strcmp(id, "type") || !strcmp(id, "hint"))
+      continue;
+
+    if (!strcmp(id, "slave"))
+    {
+      slaveConf = n;
+      continue;
+    }
+
+    if (!strcmp(id, "ctl"))
+    {
+      if (snd_config_get_string(n, &ctl) < 0)
+        goto OnInvalid;
+      continue;
+    }
+
+    if (!strcmp(id, "range"))
+    {
+      if (snd_config_get_ireal(n, &real) < 0 || real <= 0.0)
+        goto OnInvalid;
+      plugin->rangeDb = (float)real;
+      continue;
+    }
+
+    for (idx = 0; idx < CTLS_COUNT && !known; idx++)
+      if (!strcmp(id, _ctlKeys[idx]))
+      {
+        if (snd_config_get_string(n, &str) < 0)
+          goto OnInvalid;
+        free(plugin->ctlNames[idx]);
+        plugin->ctlNames[idx] = strdup(str);
+        known = true;
+      }
+
+    for (idx = 0; idx < HAL_TONE_BANDS && !known; idx++)
+      if (!strcmp(id, _freqKeys[idx]))
+      {
+        if (snd_config_get_ireal(n, &real) < 0 || real <= 0.0)
+          goto OnInvalid;
+        plugin->freq[idx] = (float)real;
+        known = true;
+      }
+
+    if (known)
+      continue;
+
+    SNDERR("haltone: unknown field %s", id);
+    err = -EINVAL;
+    goto OnErrorExit;
+
+OnInvalid:
+    SNDERR("haltone: invalid value for %s", id);
+    err = -EINVAL;
+    goto OnErrorExit;
+  }
+
+  if (!slaveConf)
+  {
+    SNDERR("haltone: no slave defined");
+    err = -EINVAL;
+    goto OnErrorExit;
+  }
+
+  err = openCtls(plugin, ctl);
+  if (err < 0)
+    goto OnErrorExit;
+
+  readCtls(plugin, &params);
+  err = halMailboxInit(&plugin->mailbox, sizeof(halToneParamsT), &params);
+  if (err < 0)
+    goto OnErrorExit;
+
+  err = startCtlThread(plugin);
+  if (err < 0)
+    goto OnErrorExit;
+
+  plugin->ext.version = SND_PCM_EXTPLUG_VERSION;
+  plugin->ext.name = "HAL tone control";
+  plugin->ext.callback = &_toneCallbacks;
+  plugin->ext.private_data = plugin;
+
+  err = snd_pcm_extplug_create(&plugin->ext, name, root, slaveConf, stream, mode);
+  if (err < 0)
+    goto OnErrorExit;
+
+  // The engine filters floats, and the slave converts
+  snd_pcm_extplug_set_param_minmax(&plugin->ext, SND_PCM_EXTPLUG_HW_CHANNELS,
+                                   1, HAL_TONE_CHANNELS_MAX);
+  snd_pcm_extplug_set_param(&plugin->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
+  snd_pcm_extplug_set_slave_param(&plugin->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_FLOAT);
+
+  *pcmp = plugin->ext.pcm;
+  return 0;
+
+OnErrorExit:
+  toneFree(plugin);
+  return err;
+}
+
+SND_PCM_PLUGIN_SYMBOL(haltone);
@@ -0,0 +1,690 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tone control DSP engine, for cards without a DSP.
+ *
+ * Bass, mid and treble are a low shelf, a peaking and a high shelf biquad
+ * (RBJ cookbook), run as a cascade in transposed direct form II. Frames
+ * are interleaved, so the channels of a frame are contiguous: each SIMD
+ * lane filters one channel, and the state of a group of channels stays in
+ * registers for the whole block. Channels left over by the vector width
+ * are filtered by the scalar kernel.
+ *
+ * Changes are smoothed, so that controls do not click: band gains glide
+ * to their target by small steps, with the coefficients designed again
+ * for every short block, and channel gains ramp linearly, sample by
+ * sample, as the kernels add a per channel step to the gain of every
+ * frame. The step is 0 outside of ramps.
+ *
+ * The kernel is picked once, at runtime: AVX2 (8 channels) or SSE (4
+ * channels) on x86, NEON (4 channels) on ARM, and scalar otherwise.
+ * Nothing else is built with the wider instruction sets, so the library
+ * runs on any CPU of its architecture.
+ */
+
+#include "hal-generic-tone.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAL_TONE_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAL_TONE_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_TONE_Q 0.7071             // Slope of the shelves, and Q of the peak
+#define HAL_TONE_FLAT_DB 0.01f        // Bands within this gain are skipped
+#define HAL_TONE_FREQ_MAX 0.45        // Of the sample rate
+#define HAL_TONE_GLIDE_FRAMES 32      // Band gains move once per block of
+#define HAL_TONE_GLIDE_DB 0.25f       // at most
+#define HAL_TONE_RAMP_MS 20           // Channel gain ramps
+
+typedef void (*halToneKernelT)(halToneT *tone, float *frames, unsigned count,
+                               const int *bands, int bandsCount);
+
+// ALSA default channel order: FL, FR, RL, RR, FC, LFE, SL, SR
+static const signed char _channelSide[] = { -1, 1, -1, 1, 0, 0, -1, 1 };
+static const signed char _channelDepth[] = { 1, 1, -1, -1, 1, 0, 0, 0 };
+
+
+/*****************************************************************************
+ * Local Variable Declarations
+ ****************************************************************************/
+static halToneKernelT _kernel = NULL;
+static const char *_engine = NULL;
+
+
+/*****************************************************************************
+ * Local Function Declarations
+ ****************************************************************************/
+static void designBand(halToneT *tone, halToneBandT band);
+static bool glideBands(halToneT *tone);
+static void processScalar(halToneT *tone, float *frames, unsigned count,
+                          unsigned firstChannel, const int *bands, int bandsCount);
+static void kernelScalar(halToneT *tone, float *frames, unsigned count,
+                         const int *bands, int bandsCount);
+#ifdef HAL_TONE_X86
+static void processSse(halToneT *tone, float *frames, unsigned count,
+                       unsigned firstChannel, const int *bands, int bandsCount);
+static void kernelSse(halToneT *tone, float *frames, unsigned count,
+                      const int *bands, int bandsCount);
+static void kernelAvx2(halToneT *tone, float *frames, unsigned count,
+                       const int *bands, int bandsCount);
+static unsigned flushDenormals(void);
+static void restoreCsr(unsigned csr);
+#endif
+#ifdef HAL_TONE_NEON
+static void kernelNeon(halToneT *tone, float *frames, unsigned count,
+                       const int *bands, int bandsCount);
+#endif
+static void selectKernel(void);
+
+
+/*****************************************************************************
+ * Local Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Compute the coefficients of a band, from its frequency and gain
+ */
+static void designBand(halToneT *tone, halToneBandT band)
+{
+  double freq = tone->freq[band], A = 0.0, w0 = 0.0, cosw = 0.0, alpha = 0.0,
+         b0 = 1.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0, sqrtA = 0.0;
+  halToneBiquadT *biquad = &tone->biquads[band];
+
+  tone->flat[band] = fabsf(tone->gainDb[band]) < HAL_TONE_FLAT_DB;
+  if (tone->flat[band])
+  {
+    // The state of a skipped band restarts from rest
+    memset(tone->z1[band], 0, sizeof(tone->z1[band]));
+    memset(tone->z2[band], 0, sizeof(tone->z2[band]));
+    return;
+  }
+
+  if (freq > HAL_TONE_FREQ_MAX * tone->rate)
+    freq = HAL_TONE_FREQ_MAX * tone->rate;
+
+  A = pow(10.0, tone->gainDb[band] / 40.0);
+  sqrtA = sqrt(A);
+  w0 = 2.0 * M_PI * freq / tone->rate;
+  cosw = cos(w0);
+  alpha = sin(w0) / (2.0 * HAL_TONE_Q);
+
+  switch (band)
+  {
+    case HAL_TONE_BASS:
+      b0 = A * ((A + 1) - (A - 1) * cosw + 2 * sqrtA * alpha);
+      b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+      b2 = A * ((A + 1) - (A - 1) * cosw - 2 * sqrtA * alpha);
+      a0 = (A + 1) + (A - 1) * cosw + 2 * sqrtA * alpha;
+      a1 = -2 * ((A - 1) + (A + 1) * cosw);
+      a2 = (A + 1) + (A - 1) * cosw - 2 * sqrtA * alpha;
+      break;
+
+    case HAL_TONE_MID:
+      b0 = 1 + alpha * A;
+      b1 = -2 * cosw;
+      b2 = 1 - alpha * A;
+      a0 = 1 + alpha / A;
+      a1 = -2 * cosw;
+      a2 = 1 - alpha / A;
+      break;
+
+    case HAL_TONE_TREBLE:
+      b0 = A * ((A + 1) + (A - 1) * cosw + 2 * sqrtA * alpha);
+      b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+      b2 = A * ((A + 1) + (A - 1) * cosw - 2 * sqrtA * alpha);
+      a0 = (A + 1) - (A - 1) * cosw + 2 * sqrtA * alpha;
+      a1 = 2 * ((A - 1) - (A + 1) * cosw);
+      a2 = (A + 1) - (A - 1) * cosw - 2 * sqrtA * alpha;
+      break;
+
+    default:
+      return;
+  }
+
+  biquad->b0 = (float)(b0 / a0);
+  biquad->b1 = (float)(b1 / a0);
+  biquad->b2 = (float)(b2 / a0);
+  biquad->a1 = (float)(a1 / a0);
+  biquad->a2 = (float)(a2 / a0);
+}
+
+/*
+ * @brief Move the band gains one step towards their target
+ * @return true if a band is still gliding after this step
+ */
+static bool glideBands(halToneT *tone)
+{
+  bool gliding = false;
+  int band = 0;
+
+  for (band = 0; band < HAL_TONE_BANDS; band++)
+  {
+    float delta = tone->targetDb[band] - tone->gainDb[band];
+
+    if (delta == 0.0f)
+      continue;
+
+    if (fabsf(delta) > HAL_TONE_GLIDE_DB)
+    {
+      tone->gainDb[band] += copysignf(HAL_TONE_GLIDE_DB, delta);
+      gliding = true;
+    }
+    else
+      tone->gainDb[band] = tone->targetDb[band];
+
+    designBand(tone, (halToneBandT)band);
+  }
+
+  return gliding;
+}
+
+/*
+ * @brief Filter the channels from firstChannel on, one at a time
+ */
+static void processScalar(halToneT *tone, float *frames, unsigned count,
+                          unsigned firstChannel, const int *bands, int bandsCount)
+{
+  unsigned channel = 0, idx = 0;
+  int bandIdx = 0;
+
+  for (channel = firstChannel; channel < tone->channels; channel++)
+  {
+    float z1[HAL_TONE_BANDS], z2[HAL_TONE_BANDS], gain = tone->gains[channel],
+          step = tone->steps[channel];
+    float *frame = frames + channel;
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      z1[bandIdx] = tone->z1[bands[bandIdx]][channel];
+      z2[bandIdx] = tone->z2[bands[bandIdx]][channel];
+    }
+
+    for (idx = 0; idx < count; idx++, frame += tone->channels)
+    {
+      float x = *frame;
+
+      for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+      {
+        const halToneBiquadT *bq = &tone->biquads[bands[bandIdx]];
+        float y = bq->b0 * x + z1[bandIdx];
+
+        z1[bandIdx] = bq->b1 * x - bq->a1 * y + z2[bandIdx];
+        z2[bandIdx] = bq->b2 * x - bq->a2 * y;
+        x = y;
+      }
+
+      *frame = x * gain;
+      gain += step;
+    }
+
+    tone->gains[channel] = gain;
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      tone->z1[bands[bandIdx]][channel] = z1[bandIdx];
+      tone->z2[bands[bandIdx]][channel] = z2[bandIdx];
+    }
+  }
+}
+
+static void kernelScalar(halToneT *tone, float *frames, unsigned count,
+                         const int *bands, int bandsCount)
+{
+  processScalar(tone, frames, count, 0, bands, bandsCount);
+}
+
+#ifdef HAL_TONE_X86
+/*
+ * @brief Filter the channels from firstChannel on, 4 at a time with SSE
+ */
+__attribute__((target("sse2")))
+static void processSse(halToneT *tone, float *frames, unsigned count,
+                       unsigned firstChannel, const int *bands, int bandsCount)
+{
+  unsigned channel = 0, idx = 0, stride = tone->channels;
+  int bandIdx = 0;
+
+  for (channel = firstChannel; channel + 4 <= tone->channels; channel += 4)
+  {
+    __m128 b0[HAL_TONE_BANDS], b1[HAL_TONE_BANDS], b2[HAL_TONE_BANDS],
+           a1[HAL_TONE_BANDS], a2[HAL_TONE_BANDS],
+           z1[HAL_TONE_BANDS], z2[HAL_TONE_BANDS];
+    __m128 gain = _mm_load_ps(&tone->gains[channel]);
+    __m128 step = _mm_load_ps(&tone->steps[channel]);
+    float *frame = frames + channel;
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      const halToneBiquadT *bq = &tone->biquads[bands[bandIdx]];
+
+      b0[bandIdx] = _mm_set1_ps(bq->b0);
+      b1[bandIdx] = _mm_set1_ps(bq->b1);
+      b2[bandIdx] = _mm_set1_ps(bq->b2);
+      a1[bandIdx] = _mm_set1_ps(bq->a1);
+      a2[bandIdx] = _mm_set1_ps(bq->a2);
+      z1[bandIdx] = _mm_load_ps(&tone->z1[bands[bandIdx]][channel]);
+      z2[bandIdx] = _mm_load_ps(&tone->z2[bands[bandIdx]][channel]);
+    }
+
+    for (idx = 0; idx < count; idx++, frame += stride)
+    {
+      __m128 x = _mm_loadu_ps(frame);
+
+      for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+      {
+        __m128 y = _mm_add_ps(_mm_mul_ps(b0[bandIdx], x), z1[bandIdx]);
+
+        z1[bandIdx] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[bandIdx], x),
+                                            _mm_mul_ps(a1[bandIdx], y)), z2[bandIdx]);
+        z2[bandIdx] = _mm_sub_ps(_mm_mul_ps(b2[bandIdx], x), _mm_mul_ps(a2[bandIdx], y));
+        x = y;
+      }
+
+      _mm_storeu_ps(frame, _mm_mul_ps(x, gain));
+      gain = _mm_add_ps(gain, step);
+    }
+
+    _mm_store_ps(&tone->gains[channel], gain);
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      _mm_store_ps(&tone->z1[bands[bandIdx]][channel], z1[bandIdx]);
+      _mm_store_ps(&tone->z2[bands[bandIdx]][channel], z2[bandIdx]);
+    }
+  }
+
+  processScalar(tone, frames, count, channel, bands, bandsCount);
+}
+
+__attribute__((target("sse2")))
+static void kernelSse(halToneT *tone, float *frames, unsigned count,
+                      const int *bands, int bandsCount)
+{
+  processSse(tone, frames, count, 0, bands, bandsCount);
+}
+
+/*
+ * @brief Filter 8 channels at a time, with AVX2, then 4 with SSE
+ */
+__attribute__((target("avx2")))
+static void kernelAvx2(halToneT *tone, float *frames, unsigned count,
+                       const int *bands, int bandsCount)
+{
+  unsigned channel = 0, idx = 0, stride = tone->channels;
+  int bandIdx = 0;
+
+  for (channel = 0; channel + 8 <= tone->channels; channel += 8)
+  {
+    __m256 b0[HAL_TONE_BANDS], b1[HAL_TONE_BANDS], b2[HAL_TONE_BANDS],
+           a1[HAL_TONE_BANDS], a2[HAL_TONE_BANDS],
+           z1[HAL_TONE_BANDS], z2[HAL_TONE_BANDS];
+    __m256 gain = _mm256_load_ps(&tone->gains[channel]);
+    __m256 step = _mm256_load_ps(&tone->steps[channel]);
+    float *frame = frames + channel;
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      const halToneBiquadT *bq = &tone->biquads[bands[bandIdx]];
+
+      b0[bandIdx] = _mm256_set1_ps(bq->b0);
+      b1[bandIdx] = _mm256_set1_ps(bq->b1);
+      b2[bandIdx] = _mm256_set1_ps(bq->b2);
+      a1[bandIdx] = _mm256_set1_ps(bq->a1);
+      a2[bandIdx] = _mm256_set1_ps(bq->a2);
+      z1[bandIdx] = _mm256_load_ps(&tone->z1[bands[bandIdx]][channel]);
+      z2[bandIdx] = _mm256_load_ps(&tone->z2[bands[bandIdx]][channel]);
+    }
+
+    for (idx = 0; idx < count; idx++, frame += stride)
+    {
+      __m256 x = _mm256_loadu_ps(frame);
+
+      for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+      {
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(b0[bandIdx], x), z1[bandIdx]);
+
+        z1[bandIdx] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1[bandIdx], x),
+                                                  _mm256_mul_ps(a1[bandIdx], y)), z2[bandIdx]);
+        z2[bandIdx] = _mm256_sub_ps(_mm256_mul_ps(b2[bandIdx], x),
+                                    _mm256_mul_ps(a2[bandIdx], y));
+        x = y;
+      }
+
+      _mm256_storeu_ps(frame, _mm256_mul_ps(x, gain));
+      gain = _mm256_add_ps(gain, step);
+    }
+
+    _mm256_store_ps(&tone->gains[channel], gain);
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      _mm256_store_ps(&tone->z1[bands[bandIdx]][channel], z1[bandIdx]);
+      _mm256_store_ps(&tone->z2[bands[bandIdx]][channel], z2[bandIdx]);
+    }
+  }
+
+  // The channels left, e.g. 4 of 12
+  processSse(tone, frames, count, channel, bands, bandsCount);
+}
+
+/*
+ * @brief Flush denormals, as the filter state decays in silence
+ * @return The MXCSR to restore
+ */
+__attribute__((target("sse2")))
+static unsigned flushDenormals(void)
+{
+  unsigned csr = _mm_getcsr();
+
+  _mm_setcsr(csr | 0x8040);
+  return csr;
+}
+
+__attribute__((target("sse2")))
+static void restoreCsr(unsigned csr)
+{
+  _mm_setcsr(csr);
+}
+#endif /* HAL_TONE_X86 */
+
+#ifdef HAL_TONE_NEON
+/*
+ * @brief Filter 4 channels at a time, with NEON
+ */
+static void kernelNeon(halToneT *tone, float *frames, unsigned count,
+                       const int *bands, int bandsCount)
+{
+  unsigned channel = 0, idx = 0, stride = tone->channels;
+  int bandIdx = 0;
+
+  for (channel = 0; channel + 4 <= tone->channels; channel += 4)
+  {
+    float32x4_t b0[HAL_TONE_BANDS], b1[HAL_TONE_BANDS], b2[HAL_TONE_BANDS],
+                a1[HAL_TONE_BANDS], a2[HAL_TONE_BANDS],
+                z1[HAL_TONE_BANDS], z2[HAL_TONE_BANDS];
+    float32x4_t gain = vld1q_f32(&tone->gains[channel]);
+    float32x4_t step = vld1q_f32(&tone->steps[channel]);
+    float *frame = frames + channel;
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      const halToneBiquadT *bq = &tone->biquads[bands[bandIdx]];
+
+      b0[bandIdx] = vdupq_n_f32(bq->b0);
+      b1[bandIdx] = vdupq_n_f32(bq->b1);
+      b2[bandIdx] = vdupq_n_f32(bq->b2);
+      a1[bandIdx] = vdupq_n_f32(bq->a1);
+      a2[bandIdx] = vdupq_n_f32(bq->a2);
+      z1[bandIdx] = vld1q_f32(&tone->z1[bands[bandIdx]][channel]);
+      z2[bandIdx] = vld1q_f32(&tone->z2[bands[bandIdx]][channel]);
+    }
+
+    for (idx = 0; idx < count; idx++, frame += stride)
+    {
+      float32x4_t x = vld1q_f32(frame);
+
+      for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+      {
+        float32x4_t y = vmlaq_f32(z1[bandIdx], b0[bandIdx], x);
+
+        z1[bandIdx] = vmlsq_f32(vmlaq_f32(z2[bandIdx], b1[bandIdx], x), a1[bandIdx], y);
+        z2[bandIdx] = vmlsq_f32(vmulq_f32(b2[bandIdx], x), a2[bandIdx], y);
+        x = y;
+      }
+
+      vst1q_f32(frame, vmulq_f32(x, gain));
+      gain = vaddq_f32(gain, step);
+    }
+
+    vst1q_f32(&tone->gains[channel], gain);
+
+    for (bandIdx = 0; bandIdx < bandsCount; bandIdx++)
+    {
+      vst1q_f32(&tone->z1[bands[bandIdx]][channel], z1[bandIdx]);
+      vst1q_f32(&tone->z2[bands[bandIdx]][channel], z2[bandIdx]);
+    }
+  }
+
+  processScalar(tone, frames, count, channel, bands, bandsCount);
+}
+#endif /* HAL_TONE_NEON */
+
+/*
+ * @brief Pick the widest kernel the CPU supports (once, idempotent)
+ */
+static void selectKernel(void)
+{
+  if (_kernel)
+    return;
+
+#if defined(HAL_TONE_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    _engine = "avx2";
+    _kernel = kernelAvx2;
+  }
+  else if (__builtin_cpu_supports("sse2"))
+  {
+    _engine = "sse";
+    _kernel = kernelSse;
+  }
+#elif defined(HAL_TONE_NEON)
+  _engine = "neon";
+  _kernel = kernelNeon;
+#endif
+
+  if (!_kernel)
+  {
+    _engine = "scalar";
+    _kernel = kernelScalar;
+  }
+}
+
+
+/*****************************************************************************
+ * Global Function Definitions
+ ****************************************************************************/
+/*
+ * @brief Set up a flat tone control, with the default band frequencies
+ * @return 0 on success, -EINVAL if the rate or channels are not supported
+ */
+int halToneInit(halToneT *tone, unsigned rate, unsigned channels)
+{
+  unsigned idx = 0;
+
+  if (!rate || !channels || channels > HAL_TONE_CHANNELS_MAX)
+    return -EINVAL;
+
+  memset(tone, 0, sizeof(halToneT));
+  tone->rate = rate;
+  tone->channels = channels;
+  tone->freq[HAL_TONE_BASS] = HAL_TONE_BASS_HZ;
+  tone->freq[HAL_TONE_MID] = HAL_TONE_MID_HZ;
+  tone->freq[HAL_TONE_TREBLE] = HAL_TONE_TREBLE_HZ;
+
+  for (idx = 0; idx < HAL_TONE_BANDS; idx++)
+    tone->flat[idx] = true;
+  for (idx = 0; idx < HAL_TONE_CHANNELS_MAX; idx++)
+  {
+    tone->gains[idx] = 1.0f;
+    tone->targets[idx] = 1.0f;
+  }
+
+  tone->rampFrames = rate * HAL_TONE_RAMP_MS / 1000;
+  if (!tone->rampFrames)
+    tone->rampFrames = 1;
+
+  selectKernel();
+  return 0;
+}
+
+/*
+ * @brief Clear the filter state, e.g. on a stream restart
+ */
+void halToneReset(halToneT *tone)
+{
+  memset(tone->z1, 0, sizeof(tone->z1));
+  memset(tone->z2, 0, sizeof(tone->z2));
+}
+
+/*
+ * @brief Set the frequency of a band, in Hz
+ */
+void halToneSetFreq(halToneT *tone, halToneBandT band, float freq)
+{
+  if (band >= HAL_TONE_BANDS || freq <= 0.0f)
+    return;
+
+  tone->freq[band] = freq;
+  designBand(tone, band);
+}
+
+/*
+ * @brief Set the gain of a band, in dB. The band glides to it while
+ *        frames are processed.
+ */
+void halToneSetBand(halToneT *tone, halToneBandT band, float gainDb)
+{
+  if (band >= HAL_TONE_BANDS)
+    return;
+
+  tone->targetDb[band] = gainDb;
+}
+
+/*
+ * @brief Set the balance and fade, as channel gains. The gains ramp to
+ *        them over HAL_TONE_RAMP_MS.
+ * @param balance : -1 (left only) to 1 (right only), 0 for centered
+ * @param fade    : -1 (rear only) to 1 (front only), 0 for centered
+ */
+void halToneSetBalance(halToneT *tone, float balance, float fade)
+{
+  unsigned channel = 0;
+
+  balance = fmaxf(-1.0f, fminf(1.0f, balance));
+  fade = fmaxf(-1.0f, fminf(1.0f, fade));
+
+  for (channel = 0; channel < tone->channels; channel++)
+  {
+    float gain = 1.0f;
+
+    // Channels past the default order are left as is
+    if (channel < sizeof(_channelSide))
+    {
+      if (_channelSide[channel] * balance < 0.0f)
+        gain *= 1.0f - fabsf(balance);
+      if (_channelDepth[channel] * fade < 0.0f)
+        gain *= 1.0f - fabsf(fade);
+    }
+
+    tone->targets[channel] = gain;
+    tone->steps[channel] = (gain - tone->gains[channel]) / (float)tone->rampFrames;
+  }
+
+  tone->rampLeft = tone->rampFrames;
+}
+
+/*
+ * @brief Apply the band and channel gains at once, with no smoothing, e.g.
+ *        before the first frames
+ */
+void halToneSettle(halToneT *tone)
+{
+  int band = 0;
+
+  for (band = 0; band < HAL_TONE_BANDS; band++)
+  {
+    tone->gainDb[band] = tone->targetDb[band];
+    designBand(tone, (halToneBandT)band);
+  }
+
+  memcpy(tone->gains, tone->targets, sizeof(tone->gains));
+  memset(tone->steps, 0, sizeof(tone->steps));
+  tone->rampLeft = 0;
+}
+
+/*
+ * @brief Filter interleaved float frames, in place
+ */
+void halToneProcess(halToneT *tone, float *frames, unsigned count)
+{
+  int bands[HAL_TONE_BANDS], bandsCount = 0, band = 0;
+#ifdef HAL_TONE_X86
+  // An i686 CPU may have no SSE, the scalar kernel leaves MXCSR alone
+  bool simd = _kernel != kernelScalar;
+  unsigned csr = simd ? flushDenormals() : 0;
+#endif
+
+  while (count)
+  {
+    unsigned blockCount = count;
+
+    // Gliding bands and ramps end on block boundaries
+    if (glideBands(tone) && blockCount > HAL_TONE_GLIDE_FRAMES)
+      blockCount = HAL_TONE_GLIDE_FRAMES;
+    if (tone->rampLeft && blockCount > tone->rampLeft)
+      blockCount = tone->rampLeft;
+
+    bandsCount = 0;
+    for (band = 0; band < HAL_TONE_BANDS; band++)
+      if (!tone->flat[band])
+        bands[bandsCount++] = band;
+
+    _kernel(tone, frames, blockCount, bands, bandsCount);
+
+    // The ramp lands exactly on its target
+    if (tone->rampLeft)
+    {
+      tone->rampLeft -= blockCount;
+      if (!tone->rampLeft)
+      {
+        memcpy(tone->gains, tone->targets, sizeof(tone->gains));
+        memset(tone->steps, 0, sizeof(tone->steps));
+      }
+    }
+
+    frames += (size_t)blockCount * tone->channels;
+    count -= blockCount;
+  }
+
+#ifdef HAL_TONE_X86
+  if (simd)
+    restoreCsr(csr);
+#endif
+}
+
+/*
+ * @brief Get the name of the kernel in use: avx2, sse, neon or scalar
+ */
+const char *halToneEngine(void)
+{
+  selectKernel();
+  return _engine;
+}
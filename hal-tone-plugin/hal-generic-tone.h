@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018 Fiberdyne Systems
+ *
+ * Author: James O'Shannessy <james.oshannessy@fiberdyne.com.au>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_GENERIC_TONE_H
+#define HAL_GENERIC_TONE_H
+
+#include <stdbool.h>
+
+
+/*****************************************************************************
+ * Definitions
+ ****************************************************************************/
+#define HAL_TONE_CHANNELS_MAX 32
+#define HAL_TONE_RANGE_DB 12.0f         // Band gain at full scale
+#define HAL_TONE_BASS_HZ 100.0f         // Low shelf
+#define HAL_TONE_MID_HZ 1000.0f         // Peaking
+#define HAL_TONE_TREBLE_HZ 10000.0f     // High shelf
+
+typedef enum {
+  HAL_TONE_BASS,
+  HAL_TONE_MID,
+  HAL_TONE_TREBLE,
+
+  HAL_TONE_BANDS
+} halToneBandT;
+
+// Biquad coefficients, normalized by a0
+typedef struct {
+  float b0, b1, b2, a1, a2;
+} halToneBiquadT;
+
+/*
+ * Tone control of interleaved float frames: a cascade of one biquad per
+ * band, then a gain per channel for the fade and balance. Flat bands are
+ * skipped. The state is laid out by channel, so that the channels of a
+ * frame are filtered together, one SIMD lane each.
+ */
+typedef struct {
+  unsigned rate;
+  unsigned channels;
+  float freq[HAL_TONE_BANDS];
+  float gainDb[HAL_TONE_BANDS];       // Gliding to targetDb
+  float targetDb[HAL_TONE_BANDS];
+  halToneBiquadT biquads[HAL_TONE_BANDS];
+  bool flat[HAL_TONE_BANDS];
+  float gains[HAL_TONE_CHANNELS_MAX] __attribute__((aligned(32)));
+  float targets[HAL_TONE_CHANNELS_MAX] __attribute__((aligned(32)));
+  float steps[HAL_TONE_CHANNELS_MAX] __attribute__((aligned(32)));  // Per frame
+  unsigned rampFrames;
+  unsigned rampLeft;                  // Frames to the end of the gains ramp
+  float z1[HAL_TONE_BANDS][HAL_TONE_CHANNELS_MAX] __attribute__((aligned(32)));
+  float z2[HAL_TONE_BANDS][HAL_TONE_CHANNELS_MAX] __attribute__((aligned(32)));
+} halToneT;
+
+
+/*****************************************************************************
+ * Global Function Declarations
+ ****************************************************************************/
+int halToneInit(halToneT *tone, unsigned rate, unsigned channels);
+void halToneReset(halToneT *tone);
+void halToneSetFreq(halToneT *tone, halToneBandT band, float freq);
+void halToneSetBand(halToneT *tone, halToneBandT band, float gainDb);
+void halToneSetBalance(halToneT *tone, float balance, float fade);
+void halToneSettle(halToneT *tone);
+void halToneProcess(halToneT *tone, float *frames, unsigned count);
+const char *halToneEngine(void);
+
+#endif /* HAL_GENERIC_TONE_H */